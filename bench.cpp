@@ -0,0 +1,1164 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <ospray/ospray.h>
+#include <ospray/ospray_cpp.h>
+#include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <tbb/global_control.h>
+#include <tbb/task_arena.h>
+#include "cpu_raycaster.h"
+#include "dataset_cache.h"
+#include "gradient_volume.h"
+#include "loader.h"
+#include "render_quality.h"
+#include "render_session.h"
+#include "scene_volumes.h"
+#include "slice_renderer.h"
+#include "synthetic_volume.h"
+#include "util/json.hpp"
+#include "util/memory_stats.h"
+#include "util/transfer_function_widget.h"
+#include "util/util.h"
+#include "vector_field.h"
+#include "volume_histogram.h"
+
+using namespace ospray;
+using namespace rkcommon;
+using json = nlohmann::json;
+
+const std::string USAGE =
+    "./mini_scivis_bench [options]\n"
+    "Options:\n"
+    "  -json <volume.json>      Also benchmark loading, statistics and rendering of the\n"
+    "                           provided dataset\n"
+    "\n"
+    "  -off <mesh.off>          Also benchmark loading and rendering the provided OFF mesh\n"
+    "\n"
+    "  -dims <n>                Size of the synthetic n^3 volumes (default 128)\n"
+    "\n"
+    "  -field (noise|marschner-lobb|blobs)\n"
+    "                           Field of the synthetic volumes (default marschner-lobb)\n"
+    "\n"
+    "  -sparsity <x>            Fraction of empty bricks in the synthetic volumes\n"
+    "\n"
+    "  -off-dims <n>            Vertex grid size of the synthetic n^3 tet mesh (default 32)\n"
+    "\n"
+    "  -iters <n>               Timed iterations per benchmark (default 5)\n"
+    "\n"
+    "  -img <w> <h>             Image size for the render benchmarks (default 1280 720)\n"
+    "\n"
+    "  -frames <n>              Accumulation passes per render benchmark (default 16)\n"
+    "\n"
+    "  -r (scivis|pathtracer)   Select the OSPRay renderer to use\n"
+    "\n"
+    "  -data-dir <dir>          Directory to write the synthetic volumes to (default .)\n"
+    "\n"
+    "  -scaling                 Run the render scaling benchmark instead, sweeping the\n"
+    "                           thread counts, renderers, image sizes, sampling rates and\n"
+    "                           synthetic volume sizes below, plus the -json dataset\n"
+    "\n"
+    "  -threads <n,...>         Thread counts to sweep (default powers of two up to the\n"
+    "                           number of hardware threads)\n"
+    "\n"
+    "  -resolutions <WxH,...>   Image sizes to sweep (default 640x360,1280x720)\n"
+    "\n"
+    "  -sampling-rates <x,...>  Volume sampling rates to sweep (default 0.5,1,2)\n"
+    "\n"
+    "  -renderers <name,...>    Renderers to sweep (default scivis,pathtracer)\n"
+    "\n"
+    "  -volume-dims <n,...>     Synthetic n^3 volume sizes to sweep (default 64,128,256)\n"
+    "\n"
+    "  -sessions <n>            Run the multi-session benchmark instead, rendering n\n"
+    "                           independent sessions of the -json dataset (or a synthetic\n"
+    "                           -dims volume) through the shared dataset cache. Exits\n"
+    "                           non-zero if the sessions don't share one copy of the\n"
+    "                           voxel data, or it isn't released once they're closed\n"
+    "\n"
+    "  -o <results.json>        Write the results as JSON to the file\n"
+    "\n"
+    "  -h                       Print this help.";
+
+struct BenchmarkResult {
+    std::string name;
+    std::string dataset;
+    // Time taken by each timed iteration in milliseconds
+    std::vector<double> iteration_ms;
+    // Additional benchmark specific metrics, e.g. throughput
+    json metrics = json::object();
+
+    double min_ms() const
+    {
+        return *std::min_element(iteration_ms.begin(), iteration_ms.end());
+    }
+
+    double mean_ms() const
+    {
+        return std::accumulate(iteration_ms.begin(), iteration_ms.end(), 0.0) /
+               iteration_ms.size();
+    }
+
+    double median_ms() const
+    {
+        std::vector<double> sorted = iteration_ms;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+
+    json to_json() const
+    {
+        json j;
+        j["name"] = name;
+        j["dataset"] = dataset;
+        j["iterations"] = iteration_ms.size();
+        j["min_ms"] = min_ms();
+        j["mean_ms"] = mean_ms();
+        j["median_ms"] = median_ms();
+        j["iteration_ms"] = iteration_ms;
+        j["metrics"] = metrics;
+        return j;
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(const Clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Run the function once untimed to warm up caches, then time each of the iterations
+template <typename F>
+BenchmarkResult run_benchmark(const std::string &name,
+                              const std::string &dataset,
+                              const size_t iters,
+                              const F &fn)
+{
+    BenchmarkResult result;
+    result.name = name;
+    result.dataset = dataset;
+    fn();
+    for (size_t i = 0; i < iters; ++i) {
+        auto start = Clock::now();
+        fn();
+        result.iteration_ms.push_back(elapsed_ms(start));
+    }
+    std::cout << "  " << name << " [" << dataset << "]: median " << result.median_ms()
+              << "ms, min " << result.min_ms() << "ms\n";
+    return result;
+}
+
+struct RenderParams {
+    std::string renderer_type = "scivis";
+    math::vec2i img_size = math::vec2i(1280, 720);
+    size_t frames = 16;
+    float sampling_rate = 1.f;
+    // The quality preset to render with, or empty for the renderer's defaults
+    std::string quality;
+};
+
+// Render the brick with the camera framing the view bounds, or the brick's bounds if not
+// given, timing each accumulation pass. The suffix is appended to the result name to tell
+// variants of a dataset apart
+BenchmarkResult benchmark_render(const std::string &dataset,
+                                 VolumeBrick &brick,
+                                 const RenderParams &params,
+                                 const size_t iters,
+                                 const std::string &name_suffix = "",
+                                 const math::box3f *view_bounds = nullptr)
+{
+    TransferFunctionWidget tfn_widget;
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+
+    cpp::TransferFunction tfn("piecewiseLinear");
+    tfn.setParam("color",
+                 cpp::SharedData(reinterpret_cast<math::vec3f *>(tfn_colors.data()),
+                                 tfn_colors.size() / 3));
+    tfn.setParam("opacity", cpp::SharedData(tfn_opacities.data(), tfn_opacities.size()));
+    tfn.setParam("valueRange", brick.value_range);
+    tfn.commit();
+
+    brick.model.setParam("transferFunction", tfn);
+    brick.model.commit();
+
+    cpp::Group group;
+    group.setParam("volume", cpp::CopiedData(brick.model));
+    group.commit();
+
+    cpp::Instance instance(group);
+    instance.commit();
+
+    cpp::Light light("ambient");
+    light.setParam("intensity", 1.f);
+    light.commit();
+
+    cpp::World world;
+    world.setParam("instance", cpp::CopiedData(instance));
+    world.setParam("light", cpp::CopiedData(light));
+    world.commit();
+
+    cpp::Renderer renderer(params.renderer_type);
+    renderer.setParam("volumeSamplingRate", params.sampling_rate);
+    renderer.setParam("backgroundColor", math::vec3f(1.f));
+    if (!params.quality.empty()) {
+        apply_quality_preset(renderer,
+                             params.renderer_type,
+                             quality_presets()[find_quality_preset(params.quality)]);
+    }
+    renderer.commit();
+
+    const math::box3f &bounds = view_bounds ? *view_bounds : brick.bounds;
+    const math::vec3f world_center = bounds.center();
+    const float world_diagonal = math::length(bounds.size());
+    cpp::Camera camera("perspective");
+    camera.setParam("aspect", static_cast<float>(params.img_size.x) / params.img_size.y);
+    camera.setParam("position", world_center - math::vec3f(0.f, 0.f, world_diagonal * 1.5f));
+    camera.setParam("direction", math::vec3f(0.f, 0.f, 1.f));
+    camera.setParam("up", math::vec3f(0.f, 1.f, 0.f));
+    camera.setParam("fovy", 40.f);
+    camera.commit();
+
+    cpp::FrameBuffer fb(
+        params.img_size.x, params.img_size.y, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
+
+    // Each iteration renders a converging sequence of accumulation passes from a cleared
+    // framebuffer, as the app does after each interaction
+    std::vector<double> pass_ms;
+    const std::string name = "render_" + params.renderer_type + "_" +
+                             std::to_string(params.img_size.x) + "x" +
+                             std::to_string(params.img_size.y) + name_suffix;
+    BenchmarkResult result = run_benchmark(name, dataset, iters, [&]() {
+        fb.clear();
+        for (size_t i = 0; i < params.frames; ++i) {
+            auto start = Clock::now();
+            fb.renderFrame(renderer, camera, world).wait();
+            pass_ms.push_back(elapsed_ms(start));
+        }
+    });
+
+    // Drop the warm up iteration's passes
+    pass_ms.erase(pass_ms.begin(), pass_ms.begin() + params.frames);
+    const double mean_pass_ms =
+        std::accumulate(pass_ms.begin(), pass_ms.end(), 0.0) / pass_ms.size();
+    const double mpixels = double(params.img_size.x) * params.img_size.y * 1e-6;
+    result.metrics["width"] = params.img_size.x;
+    result.metrics["height"] = params.img_size.y;
+    result.metrics["accumulation_passes"] = params.frames;
+    result.metrics["sampling_rate"] = params.sampling_rate;
+    if (!params.quality.empty()) {
+        result.metrics["quality"] = params.quality;
+    }
+    result.metrics["ms_per_pass"] = mean_pass_ms;
+    result.metrics["frames_per_second"] = 1000.0 / mean_pass_ms;
+    result.metrics["mpixels_per_second"] = mpixels * 1000.0 / mean_pass_ms;
+    std::cout << "    " << mean_pass_ms << "ms/pass, "
+              << result.metrics["frames_per_second"].get<double>() << " frames/s, "
+              << result.metrics["mpixels_per_second"].get<double>() << " Mpixels/s\n";
+    return result;
+}
+
+// Benchmark the loading, statistics, isosurface extraction and rendering of a raw volume
+void benchmark_raw_volume(const std::string &dataset,
+                          const json &config,
+                          const RenderParams &render_params,
+                          const size_t iters,
+                          std::vector<BenchmarkResult> &results)
+{
+    VolumeBrick brick;
+    BenchmarkResult load = run_benchmark(
+        "load_raw_volume", dataset, iters, [&]() { brick = load_raw_volume(config); });
+    const double mbytes = brick.voxel_data->size() * 1e-6;
+    load.metrics["mbytes"] = mbytes;
+    load.metrics["mbytes_per_second"] = mbytes * 1000.0 / load.median_ms();
+    results.push_back(load);
+
+    BenchmarkResult value_range =
+        run_benchmark("compute_value_range_" + brick.voxel_type, dataset, iters, [&]() {
+            brick.value_range = compute_volume_value_range(brick);
+        });
+    value_range.metrics["mbytes"] = mbytes;
+    value_range.metrics["mbytes_per_second"] = mbytes * 1000.0 / value_range.median_ms();
+    results.push_back(value_range);
+
+    BenchmarkResult histogram = run_benchmark(
+        "histogram_" + brick.voxel_type, dataset, iters, [&]() {
+            compute_histogram(brick, brick.value_range, 1024);
+        });
+    histogram.metrics["mbytes"] = mbytes;
+    histogram.metrics["mbytes_per_second"] = mbytes * 1000.0 / histogram.median_ms();
+    results.push_back(histogram);
+
+    for (const bool quantize : {false, true}) {
+        GradientVolume gradient;
+        BenchmarkResult result = run_benchmark(
+            std::string("gradient_magnitude_") + (quantize ? "u8" : "float32"),
+            dataset,
+            iters,
+            [&]() { gradient = compute_gradient_magnitude(brick, quantize); });
+        result.metrics["mbytes"] = mbytes;
+        result.metrics["mbytes_per_second"] = mbytes * 1000.0 / result.median_ms();
+        result.metrics["gradient_mbytes"] = gradient.data->size() * 1e-6;
+        results.push_back(result);
+        if (quantize) {
+            const math::vec2i bins(256, 128);
+            BenchmarkResult histogram =
+                run_benchmark("histogram_2d", dataset, iters, [&]() {
+                    compute_histogram_2d(brick, gradient, brick.value_range, bins);
+                });
+            histogram.metrics["mbytes_per_second"] = mbytes * 1000.0 / histogram.median_ms();
+            results.push_back(histogram);
+        }
+    }
+
+    const std::vector<float> isovalues = {
+        (brick.value_range.x + brick.value_range.y) * 0.5f};
+    results.push_back(run_benchmark("extract_isosurfaces", dataset, iters, [&]() {
+        extract_isosurfaces(config, brick, isovalues);
+    }));
+
+    results.push_back(benchmark_render(dataset, brick, render_params, iters));
+
+    // The cost of each quality preset on the same view
+    for (const auto &preset : quality_presets()) {
+        RenderParams preset_params = render_params;
+        preset_params.quality = preset.name;
+        results.push_back(
+            benchmark_render(dataset, brick, preset_params, iters, "_" + preset.name));
+    }
+
+    // Crop to the center eighth of the volume and render it from the same view, the time
+    // per pass should drop with the fraction of the volume sampled
+    const math::vec3i crop_size = math::max(brick.dims / 2, math::vec3i(1));
+    const math::box3i center_region(brick.dims / 4, brick.dims / 4 + crop_size);
+    VolumeBrick cropped;
+    BenchmarkResult crop = run_benchmark("crop_volume", dataset, iters, [&]() {
+        cropped = crop_volume(brick, center_region);
+    });
+    crop.metrics["mbytes"] = cropped.voxel_data->size() * 1e-6;
+    crop.metrics["fraction"] = double(cropped.voxel_data->size()) / brick.voxel_data->size();
+    results.push_back(crop);
+    results.push_back(
+        benchmark_render(dataset, cropped, render_params, iters, "_crop", &brick.bounds));
+
+    // Center slices along each axis, x slices gather a voxel per row while y and z slices
+    // read whole rows, and an oblique slice through all three axes
+    TransferFunctionWidget tfn_widget;
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+    SliceRenderer slice_renderer;
+    slice_renderer.set_transfer_function(tfn_colors, tfn_opacities);
+    SliceParams slice_params;
+    slice_params.value_range = brick.value_range;
+    const char *axis_names[3] = {"x", "y", "z"};
+    for (int axis = 0; axis < 4; ++axis) {
+        slice_params.oblique = axis == 3;
+        if (slice_params.oblique) {
+            slice_params.center = brick.bounds.center();
+            slice_params.normal = math::vec3f(1.f);
+        } else {
+            slice_params.axis = axis;
+            slice_params.index = brick.dims[axis] / 2;
+        }
+        const std::string name = slice_params.oblique
+                                     ? std::string("slice_oblique")
+                                     : std::string("slice_") + axis_names[axis];
+        BenchmarkResult slice = run_benchmark(
+            name, dataset, iters, [&]() { slice_renderer.render(brick, slice_params); });
+        const math::vec2i size = slice_renderer.image_size();
+        const double mpixels = double(size.x) * size.y * 1e-6;
+        slice.metrics["width"] = size.x;
+        slice.metrics["height"] = size.y;
+        slice.metrics["mpixels_per_second"] = mpixels * 1000.0 / slice.median_ms();
+        results.push_back(slice);
+    }
+}
+
+void benchmark_transfer_function(const size_t iters, std::vector<BenchmarkResult> &results)
+{
+    // The conversions are cheap, so run a batch of them per iteration to get a
+    // measurable time
+    const size_t batch_size = 1000;
+    TransferFunctionWidget tfn_widget;
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+
+    BenchmarkResult split = run_benchmark("tfn_get_colormapf_split", "colormap", iters, [&]() {
+        for (size_t i = 0; i < batch_size; ++i) {
+            tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+        }
+    });
+    split.metrics["calls_per_iteration"] = batch_size;
+    split.metrics["us_per_call"] = split.median_ms() * 1000.0 / batch_size;
+    split.metrics["entries"] = tfn_opacities.size();
+    results.push_back(split);
+
+    BenchmarkResult rgba = run_benchmark("tfn_get_colormapf_rgba", "colormap", iters, [&]() {
+        for (size_t i = 0; i < batch_size; ++i) {
+            tfn_colors = tfn_widget.get_colormapf();
+        }
+    });
+    rgba.metrics["calls_per_iteration"] = batch_size;
+    rgba.metrics["us_per_call"] = rgba.median_ms() * 1000.0 / batch_size;
+    rgba.metrics["entries"] = tfn_colors.size() / 4;
+    results.push_back(rgba);
+
+    // Dragging a control point of a high resolution table only recomputes and copies the
+    // span between its neighbors
+    TransferFunctionWidget hires_widget;
+    hires_widget.set_resolution(4096);
+    std::vector<std::array<float, 2>> points = {
+        {0.f, 0.f}, {0.3f, 0.2f}, {0.4f, 0.5f}, {0.5f, 0.2f}, {1.f, 1.f}};
+    hires_widget.set_opacity_points(points);
+    hires_widget.get_colormapf(tfn_colors, tfn_opacities);
+    size_t span_entries = 0;
+    BenchmarkResult drag = run_benchmark("tfn_drag_update", "colormap", iters, [&]() {
+        for (size_t i = 0; i < batch_size; ++i) {
+            points[2][1] = i % 2 == 0 ? 0.8f : 0.5f;
+            hires_widget.set_opacity_points(points);
+            size_t begin = 0;
+            size_t end = 0;
+            hires_widget.get_colormapf_changes(tfn_colors, tfn_opacities, begin, end);
+            span_entries = end - begin;
+        }
+    });
+    drag.metrics["calls_per_iteration"] = batch_size;
+    drag.metrics["us_per_call"] = drag.median_ms() * 1000.0 / batch_size;
+    drag.metrics["entries"] = hires_widget.get_resolution();
+    drag.metrics["span_entries"] = span_entries;
+    results.push_back(drag);
+
+    // The embedded colormaps are decoded on first selection, so constructing the widget
+    // only decodes the default colormap and each first selection pays for one decode
+    const size_t construct_batch = 100;
+    auto construct_widgets = [&]() {
+        for (size_t i = 0; i < construct_batch; ++i) {
+            TransferFunctionWidget widget;
+        }
+    };
+    BenchmarkResult construct =
+        run_benchmark("tfn_widget_construct", "colormap", iters, construct_widgets);
+    construct.metrics["calls_per_iteration"] = construct_batch;
+    construct.metrics["us_per_call"] = construct.median_ms() * 1000.0 / construct_batch;
+    results.push_back(construct);
+
+    size_t num_colormaps = 0;
+    auto select_colormaps = [&]() {
+        TransferFunctionWidget widget;
+        const std::vector<std::string> names = widget.colormap_names();
+        for (const auto &name : names) {
+            widget.select_colormap(name);
+        }
+        num_colormaps = names.size();
+    };
+    BenchmarkResult select =
+        run_benchmark("tfn_first_select_colormaps", "colormap", iters, select_colormaps);
+    select.metrics["colormaps"] = num_colormaps;
+    select.metrics["us_per_colormap"] = select.median_ms() * 1000.0 / num_colormaps;
+    results.push_back(select);
+}
+
+// Compare the pre-integrated CPU raycaster at one sample per voxel against point sampling
+// at one and four samples per voxel, measuring the time per pass and the RMSE of each
+// against a point sampled reference at eight samples per voxel. A narrow opacity peak is
+// used since thin transfer function features are what low sampling rates miss. Also times
+// the incremental table update after dragging a control point
+void benchmark_preintegration(const std::string &dataset,
+                              const std::shared_ptr<VolumeBrick> &brick,
+                              const RenderParams &render_params,
+                              const size_t iters,
+                              std::vector<BenchmarkResult> &results)
+{
+    // The CPU raycaster is much slower than OSPRay, so render a quarter size image
+    const math::vec2i img_size = math::max(render_params.img_size / 4, math::vec2i(1));
+    TransferFunctionWidget tfn_widget;
+    std::vector<std::array<float, 2>> points = {
+        {0.f, 0.f}, {0.45f, 0.f}, {0.5f, 1.f}, {0.55f, 0.f}, {1.f, 0.f}};
+    tfn_widget.set_opacity_points(points);
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+
+    RaycastCamera camera;
+    const float world_diagonal = math::length(brick->bounds.size());
+    camera.eye = brick->bounds.center() - math::vec3f(0.f, 0.f, world_diagonal * 1.5f);
+    camera.aspect = float(img_size.x) / img_size.y;
+
+    auto render = [&](const bool preintegrated,
+                      const float sampling_rate,
+                      const bool shade,
+                      size_t run_iters) {
+        CpuRaycaster raycaster(brick, img_size);
+        RaycastParams params;
+        params.preintegrated = preintegrated;
+        params.shade = shade;
+        params.sampling_rate = sampling_rate;
+        params.value_range = brick->value_range;
+        raycaster.set_params(params);
+        raycaster.set_transfer_function(tfn_colors, tfn_opacities, 0, tfn_opacities.size());
+
+        const std::string name = std::string(preintegrated ? "raycast_preintegrated_"
+                                                           : "raycast_point_") +
+                                 "rate" + std::to_string(sampling_rate).substr(0, 3) +
+                                 (shade ? "_shaded" : "");
+        BenchmarkResult result = run_benchmark(name, dataset, run_iters, [&]() {
+            raycaster.reset_accumulation();
+            for (size_t i = 0; i < render_params.frames; ++i) {
+                raycaster.render_frame(camera);
+            }
+        });
+        result.metrics["width"] = img_size.x;
+        result.metrics["height"] = img_size.y;
+        result.metrics["sampling_rate"] = sampling_rate;
+        result.metrics["ms_per_pass"] = result.median_ms() / render_params.frames;
+        return std::make_pair(result, raycaster.linear_image());
+    };
+
+    std::cout << "  Rendering the point sampled reference\n";
+    const std::vector<float> reference = render(false, 8.f, false, 1).second;
+    const std::vector<std::pair<bool, float>> configs = {
+        {true, 1.f}, {false, 1.f}, {false, 4.f}};
+    double preintegrated_ms = 0.0;
+    for (const auto &c : configs) {
+        auto rendered = render(c.first, c.second, false, iters);
+        double sum_sq = 0.0;
+        for (size_t i = 0; i < reference.size(); ++i) {
+            const double diff = rendered.second[i] - reference[i];
+            sum_sq += diff * diff;
+        }
+        rendered.first.metrics["rmse_vs_rate8"] = std::sqrt(sum_sq / reference.size());
+        std::cout << "    " << rendered.first.metrics["ms_per_pass"].get<double>()
+                  << "ms/pass, RMSE "
+                  << rendered.first.metrics["rmse_vs_rate8"].get<double>() << "\n";
+        if (c.first) {
+            preintegrated_ms = rendered.first.metrics["ms_per_pass"].get<double>();
+        }
+        results.push_back(rendered.first);
+    }
+
+    // Shading with precomputed normals trades 2 bytes per voxel for not computing gradients
+    // per sample, compare the time per pass against the unshaded pre-integrated render
+    BenchmarkResult normals = run_benchmark("normal_volume", dataset, iters, [&]() {
+        brick->normals = std::make_shared<NormalVolume>(compute_normal_volume(*brick));
+    });
+    normals.metrics["normal_mbytes"] = brick->normals->data->size() * 1e-6;
+    results.push_back(normals);
+    BenchmarkResult shaded = render(true, 1.f, true, iters).first;
+    shaded.metrics["ms_per_pass_unshaded"] = preintegrated_ms;
+    std::cout << "    Shaded " << shaded.metrics["ms_per_pass"].get<double>()
+              << "ms/pass\n";
+    results.push_back(shaded);
+    brick->normals.reset();
+
+    CpuRaycaster raycaster(brick, img_size);
+    raycaster.set_transfer_function(tfn_colors, tfn_opacities, 0, tfn_opacities.size());
+    size_t update_entries = 0;
+    size_t update_index = 0;
+    BenchmarkResult update = run_benchmark("preintegration_update", dataset, iters, [&]() {
+        points[2][1] = update_index++ % 2 == 0 ? 0.5f : 1.f;
+        tfn_widget.set_opacity_points(points);
+        size_t begin = 0;
+        size_t end = 0;
+        tfn_widget.get_colormapf_changes(tfn_colors, tfn_opacities, begin, end);
+        raycaster.set_transfer_function(tfn_colors, tfn_opacities, begin, end);
+        update_entries = raycaster.get_table().last_update_entries;
+    });
+    const size_t table_size = raycaster.get_table().get_resolution();
+    update.metrics["table_entries"] = table_size * table_size;
+    update.metrics["updated_entries"] = update_entries;
+    std::cout << "    Updated " << update_entries << " of " << table_size * table_size
+              << " table entries\n";
+    results.push_back(update);
+}
+
+// Benchmark computing the magnitude volume and tracing streamlines through a synthetic
+// vortex, which swirls around the z axis while rising through the volume
+void benchmark_streamlines(const int dim,
+                           const size_t iters,
+                           std::vector<BenchmarkResult> &results)
+{
+    VectorField field;
+    field.dims = math::vec3i(dim);
+    field.bounds = math::box3f(math::vec3f(0.f), math::vec3f(dim));
+    const size_t n_voxels = field.dims.long_product();
+    field.data = make_tracked_buffer(MemoryCategory::VOLUME_HOST,
+                                     n_voxels * sizeof(math::vec3f));
+    math::vec3f *vectors = reinterpret_cast<math::vec3f *>(field.data->data());
+    const math::vec3f center = field.bounds.center();
+    for (int z = 0; z < dim; ++z) {
+        for (int y = 0; y < dim; ++y) {
+            for (int x = 0; x < dim; ++x) {
+                const math::vec3f p = math::vec3f(x, y, z) - center;
+                vectors[(size_t(z) * dim + y) * dim + x] =
+                    math::vec3f(-p.y, p.x, 0.1f * dim);
+            }
+        }
+    }
+    const std::string dataset = "synthetic_vortex_" + std::to_string(dim);
+    const double mbytes = field.data->size() * 1e-6;
+
+    BenchmarkResult magnitude =
+        run_benchmark("compute_magnitude_volume", dataset, iters, [&]() {
+            compute_magnitude_volume(field);
+        });
+    magnitude.metrics["mbytes"] = mbytes;
+    magnitude.metrics["mbytes_per_second"] = mbytes * 1000.0 / magnitude.median_ms();
+    results.push_back(magnitude);
+
+    StreamlineParams params;
+    params.seed_box = field.bounds;
+    params.seed_res = math::vec3i(16);
+    Streamlines lines;
+    BenchmarkResult trace = run_benchmark("trace_streamlines", dataset, iters, [&]() {
+        lines = trace_streamlines(field, params);
+    });
+    trace.metrics["seeds"] = params.seed_res.long_product();
+    trace.metrics["lines"] = lines.num_lines;
+    trace.metrics["vertices"] = lines.positions.size();
+    trace.metrics["vertices_per_second"] = lines.positions.size() * 1000.0 / trace.median_ms();
+    results.push_back(trace);
+}
+
+// Setup error reporting and logging on the device and commit it
+void configure_device(OSPDevice device)
+{
+    ospDeviceSetErrorCallback(
+        device,
+        [](void *, OSPError, const char *errorDetails) {
+            std::cerr << "OSPRay error: " << errorDetails << std::endl;
+            throw std::runtime_error(errorDetails);
+        },
+        nullptr);
+    ospDeviceSetStatusCallback(
+        device, [](void *, const char *msg) { std::cout << msg; }, nullptr);
+
+    bool warnAsErrors = true;
+    auto logLevel = OSP_LOG_WARNING;
+
+    ospDeviceSetParam(device, "warnAsError", OSP_BOOL, &warnAsErrors);
+    ospDeviceSetParam(device, "logLevel", OSP_INT, &logLevel);
+
+    ospDeviceCommit(device);
+}
+
+struct ScalingParams {
+    std::vector<int> thread_counts;
+    std::vector<math::vec2i> img_sizes = {math::vec2i(640, 360), math::vec2i(1280, 720)};
+    std::vector<float> sampling_rates = {0.5f, 1.f, 2.f};
+    std::vector<std::string> renderers = {"scivis", "pathtracer"};
+    std::vector<int> volume_dims = {64, 128, 256};
+};
+
+// Estimate the memory traffic of volume sampling for a frame: each pixel's ray takes
+// about sampling_rate samples per voxel it crosses, each reading the 8 voxels needed for
+// trilinear interpolation. This ignores caching and empty space skipping, so is an upper
+// bound useful for comparing against the machine's bandwidth
+double estimate_sample_bytes(const VolumeBrick &brick,
+                             const math::vec2i &img_size,
+                             const float sampling_rate)
+{
+    const double voxels_per_ray = std::cbrt(double(brick.dims.long_product()));
+    const double voxel_size = brick.voxel_data ? voxel_type_size(brick.voxel_type) : 4;
+    return double(img_size.x) * img_size.y * voxels_per_ray * sampling_rate * 8.0 *
+           voxel_size;
+}
+
+// Sweep the thread counts, renderers, volumes, image sizes and sampling rates, rendering
+// each combination with a fresh OSPRay device limited to the thread count
+json run_scaling_benchmark(std::vector<std::pair<std::string, VolumeBrick>> &volumes,
+                           const ScalingParams &scaling,
+                           const RenderParams &base_render_params,
+                           const size_t iters,
+                           std::vector<BenchmarkResult> &results)
+{
+    // The volumes are re-created on each device, so release the OSPRay objects created on
+    // the initial device before switching away from it
+    for (auto &v : volumes) {
+        v.second.brick = cpp::Volume();
+        v.second.model = cpp::VolumetricModel();
+    }
+
+    json table = json::array();
+    // Times at the first thread count for each configuration of renderer, volume, image
+    // width and height and sampling rate, used to compute the speedup and parallel efficiency
+    using ScalingConfig = std::tuple<std::string, std::string, int, int, float>;
+    std::map<ScalingConfig, std::pair<int, double>> baseline_ms;
+    for (const int threads : scaling.thread_counts) {
+        std::cout << "Benchmarking with " << threads << " threads\n";
+        tbb::global_control tbb_threads(tbb::global_control::max_allowed_parallelism,
+                                        threads);
+        OSPDevice device = ospNewDevice("cpu");
+        ospDeviceSetParam(device, "numThreads", OSP_INT, &threads);
+        configure_device(device);
+        ospSetCurrentDevice(device);
+        ospDeviceRelease(device);
+
+        for (auto &v : volumes) {
+            VolumeBrick &brick = v.second;
+            make_structured_volume(brick, brick.bounds.size() / math::vec3f(brick.dims));
+            for (const auto &renderer : scaling.renderers) {
+                for (const auto &img_size : scaling.img_sizes) {
+                    for (const float sampling_rate : scaling.sampling_rates) {
+                        RenderParams params = base_render_params;
+                        params.renderer_type = renderer;
+                        params.img_size = img_size;
+                        params.sampling_rate = sampling_rate;
+                        BenchmarkResult r = benchmark_render(v.first, brick, params, iters);
+
+                        const double ms_per_frame = r.metrics["ms_per_pass"].get<double>();
+                        const ScalingConfig key(
+                            renderer, v.first, img_size.x, img_size.y, sampling_rate);
+                        if (baseline_ms.find(key) == baseline_ms.end()) {
+                            baseline_ms[key] = std::make_pair(threads, ms_per_frame);
+                        }
+                        const auto &baseline = baseline_ms[key];
+                        const double speedup = baseline.second / ms_per_frame;
+                        const double efficiency = speedup * baseline.first / threads;
+                        const double bandwidth_gbps =
+                            estimate_sample_bytes(brick, img_size, sampling_rate) /
+                            (ms_per_frame * 1e6);
+
+                        r.metrics["threads"] = threads;
+                        r.metrics["speedup"] = speedup;
+                        r.metrics["parallel_efficiency"] = efficiency;
+                        r.metrics["estimated_sample_bandwidth_gbps"] = bandwidth_gbps;
+                        table.push_back({{"threads", threads},
+                                         {"renderer", renderer},
+                                         {"dataset", v.first},
+                                         {"width", img_size.x},
+                                         {"height", img_size.y},
+                                         {"sampling_rate", sampling_rate},
+                                         {"ms_per_frame", ms_per_frame},
+                                         {"speedup", speedup},
+                                         {"parallel_efficiency", efficiency},
+                                         {"estimated_sample_bandwidth_gbps", bandwidth_gbps}});
+                        results.push_back(r);
+                    }
+                }
+            }
+            brick.brick = cpp::Volume();
+            brick.model = cpp::VolumetricModel();
+        }
+    }
+
+    std::printf("\n%8s %-10s %-28s %10s %5s %10s %8s %6s %8s\n",
+                "threads",
+                "renderer",
+                "dataset",
+                "image",
+                "rate",
+                "ms/frame",
+                "speedup",
+                "eff.",
+                "GB/s");
+    for (const auto &row : table) {
+        const std::string img = std::to_string(row["width"].get<int>()) + "x" +
+                                std::to_string(row["height"].get<int>());
+        std::printf("%8d %-10s %-28s %10s %5.2f %10.2f %8.2f %6.2f %8.2f\n",
+                    row["threads"].get<int>(),
+                    row["renderer"].get<std::string>().c_str(),
+                    row["dataset"].get<std::string>().c_str(),
+                    img.c_str(),
+                    row["sampling_rate"].get<float>(),
+                    row["ms_per_frame"].get<double>(),
+                    row["speedup"].get<double>(),
+                    row["parallel_efficiency"].get<double>(),
+                    row["estimated_sample_bandwidth_gbps"].get<double>());
+    }
+    return table;
+}
+
+// Open the sessions on the same volume file through the dataset cache, each with its own
+// camera, and render them concurrently. Reports the memory used by the dataset and per
+// session to check that the voxel data is only held once
+json run_session_benchmark(const std::string &volume_file,
+                           const size_t num_sessions,
+                           const RenderParams &render_params,
+                           const size_t iters,
+                           std::vector<BenchmarkResult> &results)
+{
+    const std::string dataset_name = get_file_basename(volume_file);
+    const size_t volume_before = tracked_memory(MemoryCategory::VOLUME_HOST);
+
+    RenderSessionParams session_params;
+    session_params.renderer_type = render_params.renderer_type;
+    session_params.img_size = render_params.img_size;
+
+    std::vector<std::unique_ptr<RenderSession>> sessions;
+    // The bytes of one copy of the dataset, which all the sessions should share
+    size_t dataset_bytes = 0;
+    BenchmarkResult open_sessions;
+    open_sessions.name = "open_sessions";
+    open_sessions.dataset = dataset_name;
+    for (size_t i = 0; i < num_sessions; ++i) {
+        auto start = Clock::now();
+        auto dataset = dataset_cache().acquire(volume_file);
+        sessions.emplace_back(new RenderSession(dataset, session_params));
+        open_sessions.iteration_ms.push_back(elapsed_ms(start));
+
+        // Orbit each session's camera around the volume so they render different views
+        const math::vec3f center = dataset->bounds.center();
+        const float radius = 1.5f * math::length(dataset->bounds.size());
+        const float angle = 2.f * 3.14159265f * i / num_sessions;
+        json update;
+        update["camera"]["eye"] = {center.x + radius * std::sin(angle),
+                                   center.y,
+                                   center.z - radius * std::cos(angle)};
+        update["camera"]["at"] = {center.x, center.y, center.z};
+        update["sampling_rate"] = render_params.sampling_rate;
+        sessions.back()->apply_update(update);
+
+        if (i == 0) {
+            dataset_bytes = volume_brick_bytes(*dataset);
+            record_memory_stage("First session");
+        }
+    }
+    record_memory_stage(std::to_string(num_sessions) + " sessions");
+    std::cout << "  open_sessions [" << dataset_name << "]: first "
+              << open_sessions.iteration_ms.front() << "ms, median "
+              << open_sessions.median_ms() << "ms\n";
+    results.push_back(open_sessions);
+
+    // Render all sessions' frames concurrently, as a server would for its clients
+    BenchmarkResult render = run_benchmark(
+        "render_sessions_" + std::to_string(num_sessions), dataset_name, iters, [&]() {
+            for (auto &s : sessions) {
+                s->reset_accumulation();
+            }
+            for (size_t f = 0; f < render_params.frames; ++f) {
+                std::vector<cpp::Future> futures;
+                for (auto &s : sessions) {
+                    // The raycaster renders in parallel itself, so its sessions are
+                    // rendered one at a time
+                    if (s->raycaster) {
+                        s->render_pass();
+                    } else {
+                        futures.push_back(s->fb.renderFrame(s->renderer, s->camera, s->world));
+                    }
+                }
+                for (auto &future : futures) {
+                    future.wait();
+                }
+            }
+        });
+    const double ms_per_pass = render.median_ms() / render_params.frames;
+    render.metrics["sessions"] = num_sessions;
+    render.metrics["ms_per_pass"] = ms_per_pass;
+    render.metrics["session_frames_per_second"] = num_sessions * 1000.0 / ms_per_pass;
+    results.push_back(render);
+
+    const size_t volume_bytes = tracked_memory(MemoryCategory::VOLUME_HOST) - volume_before;
+    const size_t session_bytes = tracked_memory(MemoryCategory::FRAMEBUFFER) +
+                                 tracked_memory(MemoryCategory::TRANSFER_FUNCTION);
+    json report;
+    report["dataset"] = dataset_name;
+    report["sessions"] = num_sessions;
+    report["datasets_loaded"] = dataset_cache().loaded_datasets().size();
+    report["shared_volume_bytes"] = volume_bytes;
+    report["unshared_volume_bytes"] = volume_bytes * num_sessions;
+    report["per_session_bytes"] = session_bytes / num_sessions;
+    std::cout << "  " << num_sessions << " sessions share "
+              << report["datasets_loaded"].get<size_t>() << " dataset(s) using "
+              << format_bytes(volume_bytes) << " of voxel data (vs. "
+              << format_bytes(volume_bytes * num_sessions) << " unshared), "
+              << format_bytes(session_bytes / num_sessions) << " per session\n";
+
+    sessions.clear();
+    report["datasets_loaded_after_close"] = dataset_cache().loaded_datasets().size();
+    report["volume_bytes_after_close"] =
+        tracked_memory(MemoryCategory::VOLUME_HOST) - volume_before;
+
+    // Check the sessions shared a single copy of the voxel data, which was released once
+    // they were closed
+    std::vector<std::string> failures;
+    if (report["datasets_loaded"].get<size_t>() != 1) {
+        failures.push_back("expected 1 dataset loaded");
+    }
+    if (volume_bytes != dataset_bytes) {
+        failures.push_back("expected the sessions' voxel data to be " +
+                           format_bytes(dataset_bytes) + ", one copy of the dataset");
+    }
+    if (report["datasets_loaded_after_close"].get<size_t>() != 0) {
+        failures.push_back("expected no datasets loaded after closing the sessions");
+    }
+    if (report["volume_bytes_after_close"].get<size_t>() != 0) {
+        failures.push_back("expected the voxel data to be released after closing");
+    }
+    for (const auto &f : failures) {
+        std::cout << "  [FAILED]: " << f << "\n";
+    }
+    if (failures.empty()) {
+        std::cout << "  Sessions shared one copy of the dataset\n";
+    }
+    report["passed"] = failures.empty();
+    report["failures"] = failures;
+    return report;
+}
+
+// Returns the exit code, non-zero if a benchmark's checks failed
+int run_benchmarks(const std::vector<std::string> &args);
+
+int main(int argc, const char **argv)
+{
+    OSPError init_err = ospInit(&argc, argv);
+    if (init_err != OSP_NO_ERROR) {
+        throw std::runtime_error("Failed to initialize OSPRay");
+    }
+
+    OSPDevice device = ospGetCurrentDevice();
+    if (!device) {
+        throw std::runtime_error("OSPRay device could not be fetched!");
+    }
+    configure_device(device);
+    ospDeviceRelease(device);
+
+    const int status = run_benchmarks(std::vector<std::string>(argv, argv + argc));
+
+    ospShutdown();
+
+    return status;
+}
+
+int run_benchmarks(const std::vector<std::string> &args)
+{
+    std::string volume_file;
+    std::string off_file;
+    std::string data_dir = ".";
+    std::string output_file;
+    int synthetic_dim = 128;
+    int synthetic_off_dim = 32;
+    SyntheticVolumeParams synthetic_params;
+    size_t iters = 5;
+    RenderParams render_params;
+    bool scaling_mode = false;
+    ScalingParams scaling_params;
+    size_t num_sessions = 0;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-json") {
+            volume_file = args[++i];
+        } else if (args[i] == "-off") {
+            off_file = args[++i];
+        } else if (args[i] == "-dims") {
+            synthetic_dim = std::stoi(args[++i]);
+        } else if (args[i] == "-field") {
+            synthetic_params.field = parse_synthetic_field(args[++i]);
+        } else if (args[i] == "-sparsity") {
+            synthetic_params.sparsity = std::stof(args[++i]);
+        } else if (args[i] == "-off-dims") {
+            synthetic_off_dim = std::stoi(args[++i]);
+        } else if (args[i] == "-iters") {
+            iters = std::stoi(args[++i]);
+        } else if (args[i] == "-img") {
+            render_params.img_size.x = std::stoi(args[++i]);
+            render_params.img_size.y = std::stoi(args[++i]);
+        } else if (args[i] == "-frames") {
+            render_params.frames = std::stoi(args[++i]);
+        } else if (args[i] == "-r") {
+            render_params.renderer_type = args[++i];
+        } else if (args[i] == "-data-dir") {
+            data_dir = args[++i];
+        } else if (args[i] == "-scaling") {
+            scaling_mode = true;
+        } else if (args[i] == "-threads") {
+            scaling_params.thread_counts.clear();
+            for (const auto &t : split_string(args[++i], ',')) {
+                scaling_params.thread_counts.push_back(std::stoi(t));
+            }
+        } else if (args[i] == "-resolutions") {
+            scaling_params.img_sizes.clear();
+            for (const auto &r : split_string(args[++i], ',')) {
+                const auto wh = split_string(r, 'x');
+                scaling_params.img_sizes.emplace_back(std::stoi(wh.at(0)),
+                                                      std::stoi(wh.at(1)));
+            }
+        } else if (args[i] == "-sampling-rates") {
+            scaling_params.sampling_rates.clear();
+            for (const auto &r : split_string(args[++i], ',')) {
+                scaling_params.sampling_rates.push_back(std::stof(r));
+            }
+        } else if (args[i] == "-renderers") {
+            scaling_params.renderers = split_string(args[++i], ',');
+        } else if (args[i] == "-volume-dims") {
+            scaling_params.volume_dims.clear();
+            for (const auto &d : split_string(args[++i], ',')) {
+                scaling_params.volume_dims.push_back(std::stoi(d));
+            }
+        } else if (args[i] == "-sessions") {
+            num_sessions = std::stoi(args[++i]);
+        } else if (args[i] == "-o") {
+            output_file = args[++i];
+        } else if (args[i] == "-h") {
+            std::cout << USAGE << "\n";
+            return 0;
+        }
+    }
+    if (iters == 0 || render_params.frames == 0) {
+        throw std::runtime_error("At least one iteration and frame are required");
+    }
+
+    std::vector<BenchmarkResult> results;
+    json report;
+    report["benchmark"] = "mini_scivis_bench";
+    report["threads"] = tbb::this_task_arena::max_concurrency();
+    report["synthetic_field"] = synthetic_field_name(synthetic_params.field);
+    report["synthetic_sparsity"] = synthetic_params.sparsity;
+
+    if (num_sessions > 0) {
+        std::string session_file = volume_file;
+        std::string raw_file;
+        if (session_file.empty()) {
+            synthetic_params.dims = math::vec3i(synthetic_dim);
+            synthetic_params.voxel_type = "uint8";
+            const std::string dataset = "synthetic_" +
+                                        synthetic_field_name(synthetic_params.field) + "_" +
+                                        std::to_string(synthetic_dim);
+            raw_file = data_dir + "/bench_" + dataset + ".raw";
+            session_file = data_dir + "/bench_" + dataset + ".json";
+            const json config = write_synthetic_volume(synthetic_params, raw_file);
+            std::ofstream fout(session_file.c_str());
+            fout << config.dump(4) << "\n";
+        }
+        std::cout << "Benchmarking " << num_sessions << " sessions of " << session_file
+                  << "\n";
+        report["sessions"] = run_session_benchmark(
+            session_file, num_sessions, render_params, iters, results);
+        if (!raw_file.empty()) {
+            std::remove(raw_file.c_str());
+            std::remove(session_file.c_str());
+        }
+    } else if (scaling_mode) {
+        if (scaling_params.thread_counts.empty()) {
+            const int max_threads = tbb::this_task_arena::max_concurrency();
+            for (int t = 1; t < max_threads; t *= 2) {
+                scaling_params.thread_counts.push_back(t);
+            }
+            scaling_params.thread_counts.push_back(max_threads);
+        }
+
+        std::vector<std::pair<std::string, VolumeBrick>> volumes;
+        for (const int dim : scaling_params.volume_dims) {
+            synthetic_params.dims = math::vec3i(dim);
+            synthetic_params.voxel_type = "uint8";
+            const std::string dataset = "synthetic_" +
+                                        synthetic_field_name(synthetic_params.field) + "_" +
+                                        std::to_string(dim);
+            volumes.emplace_back(dataset, generate_synthetic_volume(synthetic_params));
+        }
+        if (!volume_file.empty()) {
+            const json config = load_volume_config(volume_file);
+            VolumeBrick brick = load_raw_volume(config);
+            brick.value_range = compute_volume_value_range(brick);
+            volumes.emplace_back(get_file_basename(volume_file), brick);
+        }
+
+        report["scaling"] =
+            run_scaling_benchmark(volumes, scaling_params, render_params, iters, results);
+    } else {
+        report["synthetic_dims"] = synthetic_dim;
+        report["renderer"] = render_params.renderer_type;
+
+        std::cout << "Benchmarking transfer function conversion\n";
+        benchmark_transfer_function(iters, results);
+
+        const std::vector<std::string> voxel_types = {"uint8", "uint16", "float32", "float64"};
+        synthetic_params.dims = math::vec3i(synthetic_dim);
+        for (const auto &voxel_type : voxel_types) {
+            synthetic_params.voxel_type = voxel_type;
+            const std::string dataset = "synthetic_" +
+                                        synthetic_field_name(synthetic_params.field) + "_" +
+                                        voxel_type + "_" + std::to_string(synthetic_dim);
+            std::cout << "Benchmarking " << dataset << "\n";
+
+            BenchmarkResult generate =
+                run_benchmark("generate_synthetic_volume", dataset, iters, [&]() {
+                    generate_synthetic_volume(synthetic_params);
+                });
+            generate.metrics["sparsity"] = synthetic_params.sparsity;
+            results.push_back(generate);
+
+            const std::string raw_file = data_dir + "/bench_" + dataset + ".raw";
+            const json config = write_synthetic_volume(synthetic_params, raw_file);
+            benchmark_raw_volume(dataset, config, render_params, iters, results);
+            std::remove(raw_file.c_str());
+        }
+
+        {
+            synthetic_params.voxel_type = "uint8";
+            const std::string dataset = "synthetic_" +
+                                        synthetic_field_name(synthetic_params.field) + "_" +
+                                        std::to_string(synthetic_dim);
+            std::cout << "Benchmarking pre-integration on " << dataset << "\n";
+            benchmark_preintegration(
+                dataset,
+                std::make_shared<VolumeBrick>(generate_synthetic_volume(synthetic_params)),
+                render_params,
+                iters,
+                results);
+        }
+
+        std::cout << "Benchmarking streamline tracing\n";
+        benchmark_streamlines(synthetic_dim, iters, results);
+
+        {
+            SyntheticVolumeParams off_params = synthetic_params;
+            off_params.dims = math::vec3i(synthetic_off_dim);
+            const std::string dataset = "synthetic_" + synthetic_field_name(off_params.field) +
+                                        "_tets_" + std::to_string(synthetic_off_dim);
+            std::cout << "Benchmarking " << dataset << "\n";
+            const std::string synthetic_off_file = data_dir + "/bench_" + dataset + ".off";
+            write_synthetic_tet_mesh(off_params, synthetic_off_file);
+            VolumeBrick brick;
+            results.push_back(run_benchmark("load_off", dataset, iters, [&]() {
+                brick = load_off(synthetic_off_file);
+            }));
+            results.push_back(benchmark_render(dataset, brick, render_params, iters));
+            std::remove(synthetic_off_file.c_str());
+        }
+
+        if (!volume_file.empty()) {
+            std::cout << "Benchmarking " << volume_file << "\n";
+            const json config = load_volume_config(volume_file);
+            benchmark_raw_volume(
+                get_file_basename(volume_file), config, render_params, iters, results);
+        }
+
+        if (!off_file.empty()) {
+            std::cout << "Benchmarking " << off_file << "\n";
+            const std::string dataset = get_file_basename(off_file);
+            VolumeBrick brick;
+            results.push_back(run_benchmark(
+                "load_off", dataset, iters, [&]() { brick = load_off(off_file); }));
+            results.push_back(benchmark_render(dataset, brick, render_params, iters));
+        }
+    }
+
+    report["memory"] = memory_report_json();
+    report["results"] = json::array();
+    for (const auto &r : results) {
+        report["results"].push_back(r.to_json());
+    }
+    if (!output_file.empty()) {
+        std::ofstream fout(output_file.c_str());
+        fout << report.dump(4) << "\n";
+        std::cout << "Benchmark results saved to '" << output_file << "'\n";
+    } else {
+        std::cout << report.dump(4) << "\n";
+    }
+    if (report.find("sessions") != report.end() && !report["sessions"]["passed"].get<bool>()) {
+        std::cout << "The multi-session checks failed\n";
+        return 1;
+    }
+    return 0;
+}
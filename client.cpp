@@ -0,0 +1,246 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stb_image_write.h"
+#include "util/frame_transport.h"
+#include "util/json.hpp"
+#include "util/memory_stats.h"
+#include "util/socket_util.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+const std::string USAGE =
+    "./mini_scivis_client <address> [options]\n"
+    "Connects to a mini_scivis render server at the address, either unix:<path> or "
+    "[host:]port\n"
+    "Options:\n"
+    "  -listen                  Listen on the address for a mini_scivis app streaming with\n"
+    "                           -stream instead of connecting to a server\n"
+    "\n"
+    "  -v                       Print the size and type of each frame received\n"
+    "\n"
+    "  -update <json>           Send a JSON update after connecting, e.g.\n"
+    "                           '{\"colormap\": \"Jet\", \"density_scale\": 2}'. Can be "
+    "repeated\n"
+    "\n"
+    "  -orbit <n>               Orbit the camera around the volume in n steps, moving on\n"
+    "                           once each view has converged (default 0)\n"
+    "\n"
+    "  -orbit-interactive       Move the camera after every frame received instead of\n"
+    "                           waiting for each view to converge\n"
+    "\n"
+    "  -delay <ms>              Sleep after each frame to simulate a slow client\n"
+    "\n"
+    "  -o <name.jpg>            Save the final image reconstructed from the frames\n"
+    "\n"
+    "  -shutdown                Ask the server to shut down when done\n"
+    "\n"
+    "  -h                       Print this help.";
+
+struct FrameStats {
+    size_t count = 0;
+    size_t bytes = 0;
+};
+
+json orbit_camera(const json &scene, const int step, const int steps)
+{
+    const json &bounds = scene["world_bounds"];
+    float center[3];
+    float radius = 0.f;
+    for (size_t i = 0; i < 3; ++i) {
+        const float lo = bounds[0][i].get<float>();
+        const float hi = bounds[1][i].get<float>();
+        center[i] = (lo + hi) * 0.5f;
+        radius += (hi - lo) * (hi - lo);
+    }
+    radius = 1.5f * std::sqrt(radius);
+    const float angle = 2.f * 3.14159265f * step / steps;
+    json camera;
+    camera["eye"] = {center[0] + radius * std::sin(angle),
+                     center[1],
+                     center[2] - radius * std::cos(angle)};
+    camera["at"] = {center[0], center[1], center[2]};
+    camera["up"] = {0.f, 1.f, 0.f};
+    return camera;
+}
+
+int main(int argc, const char **argv)
+{
+    const std::vector<std::string> args(argv, argv + argc);
+    std::string address;
+    std::vector<std::string> updates;
+    int orbit_steps = 0;
+    bool orbit_interactive = false;
+    int delay_ms = 0;
+    std::string output_image_file;
+    bool shutdown = false;
+    bool listen_mode = false;
+    bool verbose = false;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-listen") {
+            listen_mode = true;
+        } else if (args[i] == "-v") {
+            verbose = true;
+        } else if (args[i] == "-update") {
+            updates.push_back(args[++i]);
+        } else if (args[i] == "-orbit") {
+            orbit_steps = std::stoi(args[++i]);
+        } else if (args[i] == "-orbit-interactive") {
+            orbit_interactive = true;
+        } else if (args[i] == "-delay") {
+            delay_ms = std::stoi(args[++i]);
+        } else if (args[i] == "-o") {
+            output_image_file = args[++i];
+        } else if (args[i] == "-shutdown") {
+            shutdown = true;
+        } else if (args[i] == "-h") {
+            std::cout << USAGE << "\n";
+            return 0;
+        } else if (args[i][0] != '-') {
+            address = args[i];
+        }
+    }
+    if (address.empty()) {
+        std::cout << "[error]: A server address is required\n" << USAGE << "\n";
+        return 1;
+    }
+
+    int fd = -1;
+    json scene;
+    Message msg;
+    if (listen_mode) {
+        const int listen_fd = listen_on(address);
+        std::cout << "Waiting for a stream on " << address << "\n";
+        fd = accept_client(listen_fd);
+        close_socket(listen_fd);
+    } else {
+        fd = connect_to(address);
+        if (!recv_message(fd, msg) || msg.type != MESSAGE_JSON) {
+            std::cerr << "[error]: Server did not send the scene description\n";
+            return 1;
+        }
+        scene = json::parse(msg.payload.begin(), msg.payload.end());
+        std::cout << "Connected to " << address << ", image size " << scene["image_size"]
+                  << ", colormap '" << scene["colormap"].get<std::string>() << "'\n";
+
+        for (const auto &u : updates) {
+            send_message(fd, MESSAGE_JSON, json::parse(u).dump());
+        }
+    }
+
+    int orbit_step = 0;
+    size_t frames = 0;
+    size_t converged_frames = 0;
+    size_t total_bytes = 0;
+    bool invalid_frame = false;
+    json last_header;
+    std::map<std::string, FrameStats> stats;
+    FrameDecoder decoder;
+    const auto start = Clock::now();
+    auto view_start = start;
+    while (recv_message(fd, msg)) {
+        if (msg.type == MESSAGE_JSON) {
+            const json reply = json::parse(msg.payload.begin(), msg.payload.end());
+            if (reply["type"] == "error") {
+                std::cerr << "[error]: Server: " << reply["message"].get<std::string>()
+                          << "\n";
+            }
+            continue;
+        }
+
+        // A malformed frame means the stream can't be trusted, so stop receiving
+        json header;
+        try {
+            std::string header_str;
+            const uint8_t *data = nullptr;
+            size_t data_size = 0;
+            unpack_frame_message(msg, header_str, data, data_size);
+            header = json::parse(header_str);
+            decoder.decode(header, data, data_size);
+        } catch (const std::exception &e) {
+            std::cerr << "[error]: Invalid frame from the server: " << e.what() << "\n";
+            invalid_frame = true;
+            break;
+        }
+        last_header = header;
+
+        const std::string kind = header["kind"].get<std::string>();
+        ++frames;
+        total_bytes += msg.payload.size();
+        stats[kind].count++;
+        stats[kind].bytes += msg.payload.size();
+        if (verbose) {
+            std::cout << "Frame " << frames << ": " << kind << ", " << msg.payload.size()
+                      << "b";
+            if (kind == "tiles") {
+                std::cout << " (" << header["tiles"].size() << "/" << header["total_tiles"]
+                          << " tiles)";
+            }
+            std::cout << "\n";
+        }
+
+        if (delay_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        }
+
+        const bool converged = header.value("converged", false);
+        if (converged) {
+            ++converged_frames;
+            const std::chrono::duration<double, std::milli> view_time =
+                Clock::now() - view_start;
+            std::cout << "View " << orbit_step << " converged after "
+                      << header["accumulation"] << " passes in " << view_time.count()
+                      << "ms\n";
+        }
+        if (listen_mode) {
+            continue;
+        }
+        if ((converged || orbit_interactive) && orbit_step < orbit_steps) {
+            ++orbit_step;
+            view_start = Clock::now();
+            json update;
+            update["camera"] = orbit_camera(scene, orbit_step, orbit_steps);
+            send_message(fd, MESSAGE_JSON, update.dump());
+        } else if (converged) {
+            break;
+        }
+    }
+
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    std::cout << "Received " << frames << " frames (" << converged_frames << " converged) in "
+              << elapsed.count() << "s, " << frames / elapsed.count() << " frames/s, "
+              << format_bytes(total_bytes) << " total\n";
+    for (const auto &s : stats) {
+        std::cout << "  " << s.first << ": " << s.second.count << " frames, "
+                  << format_bytes(s.second.bytes / s.second.count) << " per frame\n";
+    }
+    if (!last_header.is_null()) {
+        std::cout << "Frames skipped by the sender: " << last_header.value("skipped_frames", 0)
+                  << ", dropped: " << last_header.value("dropped_frames", 0) << "\n";
+    }
+
+    if (!output_image_file.empty() && !decoder.image.empty()) {
+        stbi_write_jpg(output_image_file.c_str(),
+                       decoder.width,
+                       decoder.height,
+                       4,
+                       decoder.image.data(),
+                       90);
+        std::cout << "Image saved to '" << output_image_file << "'\n";
+    }
+
+    if (listen_mode) {
+        close_socket(fd);
+        return invalid_frame ? 1 : 0;
+    }
+    const json close_msg = {{shutdown ? "shutdown" : "close", true}};
+    send_message(fd, MESSAGE_JSON, close_msg.dump());
+    shutdown_socket(fd);
+    close_socket(fd);
+    return invalid_frame ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#include "clipping.h"
+#include <algorithm>
+
+ClippingGroup::ClippingGroup() : plane_geom("plane"), box_geom("box")
+{
+    plane_model = cpp::GeometricModel(plane_geom);
+    box_model = cpp::GeometricModel(box_geom);
+    // Box geometry clips the volume inside the box, inverting it keeps the inside instead.
+    // The models are committed once their geometry has primitives
+    box_model.setParam("invertNormals", true);
+
+    group.commit();
+    instance = cpp::Instance(group);
+    instance.commit();
+}
+
+bool ClippingGroup::update(std::vector<OSPObject> &pending_commits)
+{
+    std::vector<math::vec4f> coefficients;
+    for (const auto &p : planes) {
+        const float len = length(p.normal);
+        if (!p.enabled || len == 0.f) {
+            continue;
+        }
+        const math::vec3f n = p.normal / len;
+        const math::vec4f c(n, -p.position);
+        coefficients.push_back(p.flip ? -c : c);
+    }
+    std::vector<math::box3f> bounds;
+    for (const auto &b : boxes) {
+        if (b.enabled) {
+            bounds.push_back(b.bounds);
+        }
+    }
+
+    // The arrays are rewritten in place when the number of planes or boxes is unchanged,
+    // otherwise they're shared again from their new storage
+    const bool planes_resized = coefficients.size() != plane_coefficients.size();
+    const bool boxes_resized = bounds.size() != box_bounds.size();
+    const bool planes_changed =
+        planes_resized ||
+        !std::equal(coefficients.begin(), coefficients.end(), plane_coefficients.begin());
+    const bool boxes_changed =
+        boxes_resized ||
+        !std::equal(bounds.begin(),
+                    bounds.end(),
+                    box_bounds.begin(),
+                    [](const math::box3f &a, const math::box3f &b) {
+                        return a.lower == b.lower && a.upper == b.upper;
+                    });
+    if (!planes_changed && !boxes_changed) {
+        return false;
+    }
+
+    const bool had_planes = !plane_coefficients.empty();
+    const bool had_boxes = !box_bounds.empty();
+    if (planes_resized) {
+        plane_coefficients = coefficients;
+        if (!plane_coefficients.empty()) {
+            plane_geom.setParam("plane.coefficients", cpp::SharedData(plane_coefficients));
+        }
+    } else {
+        std::copy(coefficients.begin(), coefficients.end(), plane_coefficients.begin());
+    }
+    if (boxes_resized) {
+        box_bounds = bounds;
+        if (!box_bounds.empty()) {
+            box_geom.setParam("box", cpp::SharedData(box_bounds));
+        }
+    } else {
+        std::copy(bounds.begin(), bounds.end(), box_bounds.begin());
+    }
+    if (planes_changed && !plane_coefficients.empty()) {
+        pending_commits.push_back(plane_geom.handle());
+        pending_commits.push_back(plane_model.handle());
+    }
+    if (boxes_changed && !box_bounds.empty()) {
+        pending_commits.push_back(box_geom.handle());
+        pending_commits.push_back(box_model.handle());
+    }
+
+    // The group's geometry list only changes when the first plane or box is added or the
+    // last one is removed
+    if (had_planes != !plane_coefficients.empty() || had_boxes != !box_bounds.empty()) {
+        std::vector<cpp::GeometricModel> models;
+        if (!plane_coefficients.empty()) {
+            models.push_back(plane_model);
+        }
+        if (!box_bounds.empty()) {
+            models.push_back(box_model);
+        }
+        if (models.empty()) {
+            group.removeParam("clippingGeometry");
+        } else {
+            group.setParam("clippingGeometry", cpp::CopiedData(models));
+        }
+    }
+    pending_commits.push_back(group.handle());
+    pending_commits.push_back(instance.handle());
+
+    const bool was_active = is_active;
+    is_active = !plane_coefficients.empty() || !box_bounds.empty();
+    return is_active != was_active;
+}
+
+bool ClippingGroup::active() const
+{
+    return is_active;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <ospray/ospray.h>
+#include <ospray/ospray_cpp.h>
+#include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <rkcommon/math/box.h>
+#include <rkcommon/math/vec.h>
+#include "session_state.h"
+
+using namespace ospray;
+using namespace rkcommon;
+
+// All the clipping planes and boxes of the scene, held in a single clipping group and
+// instance. The enabled planes are the primitives of one plane geometry and the boxes of
+// one box geometry, with their arrays shared with OSPRay and rewritten in place, so editing
+// a plane or box only recommits the clipping geometry chain. The world's instance list
+// only changes when clipping is turned on or off entirely
+struct ClippingGroup {
+    std::vector<ClippingPlaneState> planes;
+    std::vector<ClippingBoxState> boxes;
+
+    cpp::Instance instance;
+
+    ClippingGroup();
+
+    // Update the clipping geometry from the planes and boxes, adding the objects that must
+    // be committed to pending_commits. Returns true if clipping was turned on or off, in
+    // which case the instance must be added to or removed from the world
+    bool update(std::vector<OSPObject> &pending_commits);
+
+    // Whether any plane or box is enabled, i.e. the instance should be in the world
+    bool active() const;
+
+private:
+    // The coefficients of the enabled planes and the bounds of the enabled boxes, which
+    // OSPRay reads in place
+    std::vector<math::vec4f> plane_coefficients;
+    std::vector<math::box3f> box_bounds;
+
+    cpp::Geometry plane_geom;
+    cpp::Geometry box_geom;
+    cpp::GeometricModel plane_model;
+    cpp::GeometricModel box_model;
+    cpp::Group group;
+    bool is_active = false;
+};
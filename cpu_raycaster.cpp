@@ -0,0 +1,400 @@
+#include "cpu_raycaster.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+#include "voxel_sampler.h"
+
+namespace {
+
+// Stop compositing a ray once it's this opaque
+const float EARLY_TERMINATION_OPACITY = 0.99f;
+const int TILE_SIZE = 16;
+
+uint32_t hash_u32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+float to_unit_float(const uint32_t x)
+{
+    return (x >> 8) * (1.f / 16777216.f);
+}
+
+// Intersect the ray with the box, returning false if it misses
+bool intersect_box(const math::vec3f &origin,
+                   const math::vec3f &dir,
+                   const math::box3f &box,
+                   float &t_near,
+                   float &t_far)
+{
+    t_near = 0.f;
+    t_far = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 3; ++i) {
+        const float inv_dir = 1.f / dir[i];
+        float t0 = (box.lower[i] - origin[i]) * inv_dir;
+        float t1 = (box.upper[i] - origin[i]) * inv_dir;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        t_near = std::max(t_near, t0);
+        t_far = std::min(t_far, t1);
+    }
+    return t_near <= t_far;
+}
+
+struct RaycastFrame {
+    const VolumeBrick *brick = nullptr;
+    math::vec3f spacing;
+    const RaycastParams *params = nullptr;
+    const PreintegrationTable *table = nullptr;
+    const std::vector<float> *tfn_colors = nullptr;
+    const std::vector<float> *tfn_opacities = nullptr;
+    const std::vector<float> *tfn_2d_opacities = nullptr;
+    math::vec2i tfn_2d_size;
+    RaycastCamera camera;
+    math::vec2i img_size;
+    int frame = 0;
+    std::vector<float> *accum = nullptr;
+    std::vector<uint32_t> *image = nullptr;
+};
+
+// Look up the color and opacity of the normalized value in the 1D transfer function
+void lookup_tfn(const RaycastFrame &f, const float value, float *color, float &opacity)
+{
+    const std::vector<float> &colors = *f.tfn_colors;
+    const std::vector<float> &opacities = *f.tfn_opacities;
+    const size_t size = opacities.size();
+    const float pos = value * (size - 1);
+    const size_t lo = std::min(size_t(pos), size - 1);
+    const size_t hi = std::min(lo + 1, size - 1);
+    const float t = pos - lo;
+    for (size_t c = 0; c < 3; ++c) {
+        color[c] = (1.f - t) * colors[lo * 3 + c] + t * colors[hi * 3 + c];
+    }
+    opacity = (1.f - t) * opacities[lo] + t * opacities[hi];
+}
+
+// Look up the opacity of the normalized value and gradient magnitude in the 2D table
+float lookup_tfn_2d(const RaycastFrame &f, const float value, const float gradient)
+{
+    const std::vector<float> &table = *f.tfn_2d_opacities;
+    const int width = f.tfn_2d_size.x;
+    const float x = value * (width - 1);
+    const float y = gradient * (f.tfn_2d_size.y - 1);
+    const int x0 = std::min(int(x), width - 1);
+    const int y0 = std::min(int(y), f.tfn_2d_size.y - 1);
+    const int x1 = std::min(x0 + 1, width - 1);
+    const int y1 = std::min(y0 + 1, f.tfn_2d_size.y - 1);
+    const float tx = x - x0;
+    const float ty = y - y0;
+    return (1.f - ty) * ((1.f - tx) * table[y0 * width + x0] + tx * table[y0 * width + x1]) +
+           ty * ((1.f - tx) * table[y1 * width + x0] + tx * table[y1 * width + x1]);
+}
+
+// Get the premultiplied RGBA of a segment of the step length with the color and opacity
+// throughout
+void segment_rgba(const RaycastFrame &f,
+                  const float *color,
+                  const float opacity,
+                  const float step,
+                  float *rgba)
+{
+    const float alpha = 1.f - std::exp(-step * opacity * f.params->density_scale);
+    for (size_t c = 0; c < 3; ++c) {
+        rgba[c] = color[c] * alpha;
+    }
+    rgba[3] = alpha;
+}
+
+template <typename T, typename G>
+void raycast_frame(const RaycastFrame &f)
+{
+    const VolumeBrick &brick = *f.brick;
+    const RaycastParams &params = *f.params;
+    VoxelSampler<T> sampler;
+    sampler.voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    sampler.dims = brick.dims;
+    sampler.value_lo = params.value_range.x;
+    sampler.value_scale = params.value_range.y > params.value_range.x
+                              ? 1.f / (params.value_range.y - params.value_range.x)
+                              : 1.f;
+
+    // Gradient magnitudes are sampled for 2D classification, normalized by the max
+    const bool classify_2d = f.tfn_2d_opacities != nullptr;
+    VoxelSampler<G> gradient_sampler;
+    if (classify_2d) {
+        const GradientVolume &gradient = *brick.gradient;
+        gradient_sampler.voxels = reinterpret_cast<const G *>(gradient.data->data());
+        gradient_sampler.dims = gradient.dims;
+        gradient_sampler.value_scale =
+            gradient.quantized
+                ? 1.f / 255.f
+                : (gradient.max_magnitude > 0.f ? 1.f / gradient.max_magnitude : 0.f);
+    }
+
+    // Shading reads the normal of the nearest voxel, so the gradients aren't computed
+    // per sample
+    const uint16_t *normals =
+        params.shade ? reinterpret_cast<const uint16_t *>(brick.normals->data->data())
+                     : nullptr;
+
+    // Steps are measured in voxels of the finest spacing, so a sampling rate of 1 takes
+    // one sample per voxel
+    const float step = 1.f / params.sampling_rate;
+    const float dt = reduce_min(f.spacing) * step;
+
+    const math::vec3f dir = math::normalize(f.camera.dir);
+    const math::vec3f right = math::normalize(math::cross(dir, f.camera.up));
+    const math::vec3f up = math::cross(right, dir);
+    // M_PI isn't defined by MSVC without _USE_MATH_DEFINES
+    constexpr float pi = 3.14159265f;
+    const float screen_height = 2.f * std::tan(f.camera.fovy * 0.5f * pi / 180.f);
+    const float screen_width = screen_height * f.camera.aspect;
+    const math::vec2f region = f.camera.image_end - f.camera.image_start;
+
+    const tbb::blocked_range2d<int> pixels(
+        0, f.img_size.y, TILE_SIZE, 0, f.img_size.x, TILE_SIZE);
+    tbb::parallel_for(pixels, [&](const tbb::blocked_range2d<int> &tile) {
+        for (int y = tile.rows().begin(); y != tile.rows().end(); ++y) {
+            for (int x = tile.cols().begin(); x != tile.cols().end(); ++x) {
+                const uint32_t seed = hash_u32(
+                    hash_u32(hash_u32(uint32_t(x)) ^ uint32_t(y)) ^ uint32_t(f.frame));
+                const uint32_t seed2 = hash_u32(seed);
+                const uint32_t seed3 = hash_u32(seed2);
+
+                const float u = f.camera.image_start.x +
+                                (x + to_unit_float(seed)) / f.img_size.x * region.x;
+                const float v = f.camera.image_start.y +
+                                (y + to_unit_float(seed2)) / f.img_size.y * region.y;
+                const math::vec3f ray_dir = math::normalize(
+                    dir + (u - 0.5f) * screen_width * right + (v - 0.5f) * screen_height * up);
+
+                float color[3] = {0.f, 0.f, 0.f};
+                float alpha = 0.f;
+                float t_near = 0.f;
+                float t_far = 0.f;
+                if (intersect_box(f.camera.eye, ray_dir, brick.bounds, t_near, t_far)) {
+                    auto voxel_pos = [&](const float t) {
+                        return (f.camera.eye + t * ray_dir - brick.bounds.lower) / f.spacing;
+                    };
+                    float t = t_near + to_unit_float(seed3) * dt;
+                    float front = sampler(voxel_pos(t));
+                    float rgba[4];
+                    float sample_color[3];
+                    float sample_opacity = 0.f;
+                    for (t += dt; t <= t_far && alpha < EARLY_TERMINATION_OPACITY;
+                         t += dt) {
+                        const math::vec3f p = voxel_pos(t);
+                        const float back = sampler(p);
+                        if (classify_2d) {
+                            lookup_tfn(f, back, sample_color, sample_opacity);
+                            sample_opacity = lookup_tfn_2d(f, back, gradient_sampler(p));
+                            segment_rgba(f, sample_color, sample_opacity, step, rgba);
+                        } else if (params.preintegrated) {
+                            const float *entry = f.table->lookup(front, back);
+                            std::copy(entry, entry + 4, rgba);
+                        } else {
+                            lookup_tfn(f, back, sample_color, sample_opacity);
+                            segment_rgba(f, sample_color, sample_opacity, step, rgba);
+                        }
+                        if (normals) {
+                            size_t voxel = 0;
+                            for (int i = 2; i >= 0; --i) {
+                                const int v = std::min(std::max(int(p[i] + 0.5f), 0),
+                                                       brick.dims[i] - 1);
+                                voxel = voxel * brick.dims[i] + v;
+                            }
+                            const math::vec3f n = decode_octahedral(normals[voxel]);
+                            const float shading =
+                                params.ambient +
+                                (1.f - params.ambient) * std::abs(math::dot(n, ray_dir));
+                            for (int c = 0; c < 3; ++c) {
+                                rgba[c] *= shading;
+                            }
+                        }
+                        const float transmittance = 1.f - alpha;
+                        for (int c = 0; c < 3; ++c) {
+                            color[c] += transmittance * rgba[c];
+                        }
+                        alpha += transmittance * rgba[3];
+                        front = back;
+                    }
+                }
+
+                const size_t pixel = size_t(y) * f.img_size.x + x;
+                float *accum = &(*f.accum)[pixel * 3];
+                uint32_t packed = 0xff000000;
+                for (int c = 0; c < 3; ++c) {
+                    const float composited =
+                        color[c] + (1.f - alpha) * params.background_color[c];
+                    accum[c] += (composited - accum[c]) / (f.frame + 1);
+                    packed |= uint32_t(srgb_encode(accum[c])) << (8 * c);
+                }
+                (*f.image)[pixel] = packed;
+            }
+        }
+    });
+}
+
+// Dispatch on the gradient volume's storage type, which is only sampled for 2D
+// classification
+template <typename T>
+void raycast_frame_dispatch(const RaycastFrame &f)
+{
+    if (f.tfn_2d_opacities && !f.brick->gradient->quantized) {
+        raycast_frame<T, float>(f);
+    } else {
+        raycast_frame<T, uint8_t>(f);
+    }
+}
+
+}
+
+CpuRaycaster::CpuRaycaster(const std::shared_ptr<VolumeBrick> &dataset,
+                           const math::vec2i &img_size,
+                           const size_t table_resolution)
+    : dataset(dataset), table(table_resolution)
+{
+    if (!dataset->voxel_data) {
+        throw std::runtime_error(
+            "The CPU raycaster only supports structured volumes with voxel data");
+    }
+    spacing = dataset->bounds.size() / math::vec3f(dataset->dims);
+    params.value_range = dataset->value_range;
+    table.set_segment(1.f / params.sampling_rate, params.density_scale);
+    resize(img_size);
+}
+
+void CpuRaycaster::set_params(const RaycastParams &p)
+{
+    if (p.sampling_rate <= 0.f) {
+        throw std::runtime_error("The sampling rate must be positive");
+    }
+    params = p;
+    table.set_segment(1.f / params.sampling_rate, params.density_scale);
+}
+
+const RaycastParams &CpuRaycaster::get_params() const
+{
+    return params;
+}
+
+void CpuRaycaster::set_transfer_function(const std::vector<float> &colors,
+                                         const std::vector<float> &opacities,
+                                         const size_t begin,
+                                         const size_t end)
+{
+    if (colors.size() != tfn_colors.size() || opacities.size() != tfn_opacities.size()) {
+        tfn_colors = colors;
+        tfn_opacities = opacities;
+        table.update(tfn_colors, tfn_opacities, 0, tfn_opacities.size());
+        return;
+    }
+    std::copy(
+        colors.begin() + begin * 3, colors.begin() + end * 3, tfn_colors.begin() + begin * 3);
+    std::copy(
+        opacities.begin() + begin, opacities.begin() + end, tfn_opacities.begin() + begin);
+    table.update(tfn_colors, tfn_opacities, begin, end);
+}
+
+void CpuRaycaster::set_transfer_function_2d(const std::vector<float> &opacities,
+                                            const math::vec2i &size)
+{
+    if (opacities.empty()) {
+        tfn_2d_opacities.clear();
+        tfn_2d_size = math::vec2i(0);
+        return;
+    }
+    if (!dataset->gradient) {
+        throw std::runtime_error(
+            "2D transfer functions require the volume's gradient magnitudes");
+    }
+    if (size.x < 1 || size.y < 1 || opacities.size() != size_t(size.x) * size.y) {
+        throw std::runtime_error("Invalid 2D transfer function size");
+    }
+    tfn_2d_opacities = opacities;
+    tfn_2d_size = size;
+}
+
+const PreintegrationTable &CpuRaycaster::get_table() const
+{
+    return table;
+}
+
+void CpuRaycaster::resize(const math::vec2i &size)
+{
+    img_size = size;
+    accum.resize(size_t(img_size.x) * img_size.y * 3);
+    image.resize(size_t(img_size.x) * img_size.y);
+    reset_accumulation();
+}
+
+void CpuRaycaster::reset_accumulation()
+{
+    std::fill(accum.begin(), accum.end(), 0.f);
+    frames = 0;
+}
+
+void CpuRaycaster::render_frame(const RaycastCamera &camera)
+{
+    if (tfn_opacities.empty()) {
+        throw std::runtime_error("The CPU raycaster's transfer function must be set");
+    }
+    if (params.shade && !dataset->normals) {
+        throw std::runtime_error("Shading requires the volume's precomputed normals");
+    }
+    RaycastFrame f;
+    f.brick = dataset.get();
+    f.spacing = spacing;
+    f.params = &params;
+    f.table = &table;
+    f.tfn_colors = &tfn_colors;
+    f.tfn_opacities = &tfn_opacities;
+    if (!tfn_2d_opacities.empty()) {
+        f.tfn_2d_opacities = &tfn_2d_opacities;
+        f.tfn_2d_size = tfn_2d_size;
+    }
+    f.camera = camera;
+    f.img_size = img_size;
+    f.frame = frames;
+    f.accum = &accum;
+    f.image = &image;
+
+    const std::string &voxel_type = dataset->voxel_type;
+    if (voxel_type == "uint8") {
+        raycast_frame_dispatch<uint8_t>(f);
+    } else if (voxel_type == "uint16") {
+        raycast_frame_dispatch<uint16_t>(f);
+    } else if (voxel_type == "float32") {
+        raycast_frame_dispatch<float>(f);
+    } else if (voxel_type == "float64") {
+        raycast_frame_dispatch<double>(f);
+    } else {
+        throw std::runtime_error("Unrecognized voxel type " + voxel_type);
+    }
+    ++frames;
+}
+
+const uint32_t *CpuRaycaster::image_data() const
+{
+    return image.data();
+}
+
+const std::vector<float> &CpuRaycaster::linear_image() const
+{
+    return accum;
+}
+
+int CpuRaycaster::accumulated_frames() const
+{
+    return frames;
+}
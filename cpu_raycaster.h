@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <rkcommon/math/vec.h>
+#include "gradient_volume.h"
+#include "preintegration.h"
+#include "volume_data.h"
+
+using namespace rkcommon;
+
+struct RaycastCamera {
+    math::vec3f eye = math::vec3f(0.f);
+    math::vec3f dir = math::vec3f(0.f, 0.f, 1.f);
+    math::vec3f up = math::vec3f(0.f, 1.f, 0.f);
+    float fovy = 40.f;
+    // Aspect ratio of the full image, the region rendered is [image_start, image_end)
+    float aspect = 1.f;
+    math::vec2f image_start = math::vec2f(0.f);
+    math::vec2f image_end = math::vec2f(1.f);
+};
+
+struct RaycastParams {
+    // Use the pre-integrated table for each segment between samples, otherwise each
+    // sample is classified on its own through the transfer function
+    bool preintegrated = true;
+    // Samples per voxel along the ray
+    float sampling_rate = 1.f;
+    float density_scale = 1.f;
+    math::vec3f background_color = math::vec3f(1.f);
+    math::vec2f value_range = math::vec2f(0.f, 1.f);
+    // Shade samples by the dataset's precomputed normals with a headlight, scaling their
+    // color by ambient + (1 - ambient) * |dot(normal, ray dir)|. Requires the normal volume
+    bool shade = false;
+    float ambient = 0.3f;
+};
+
+// A CPU volume raycaster for the brick's structured voxel data, rendering emission and
+// absorption with either a pre-integrated table lookup per ray segment or point sampled
+// classification. Rays start at a jittered offset each frame and frames are accumulated,
+// so the image converges like OSPRay's accumulation buffer. OSPRay's volume integrator
+// can't take a custom classification table, which is why this path exists alongside it
+class CpuRaycaster {
+    std::shared_ptr<VolumeBrick> dataset;
+    math::vec3f spacing;
+
+    RaycastParams params;
+    PreintegrationTable table;
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    // Opacities over value x normalized gradient magnitude, empty when classifying by
+    // value alone
+    std::vector<float> tfn_2d_opacities;
+    math::vec2i tfn_2d_size = math::vec2i(0);
+
+    math::vec2i img_size;
+    // Running average of the linear RGB frames, and the sRGBA8 image of it
+    std::vector<float> accum;
+    std::vector<uint32_t> image;
+    int frames = 0;
+
+public:
+    CpuRaycaster(const std::shared_ptr<VolumeBrick> &dataset,
+                 const math::vec2i &img_size,
+                 const size_t table_resolution = 256);
+
+    CpuRaycaster(const CpuRaycaster &) = delete;
+    CpuRaycaster &operator=(const CpuRaycaster &) = delete;
+
+    // Set the render parameters, this doesn't reset the accumulated image
+    void set_params(const RaycastParams &params);
+
+    const RaycastParams &get_params() const;
+
+    // Update the RGB color and opacity transfer function, where the entries [begin, end)
+    // changed since the last update
+    void set_transfer_function(const std::vector<float> &colors,
+                               const std::vector<float> &opacities,
+                               const size_t begin,
+                               const size_t end);
+
+    // Classify samples by value and gradient magnitude with the opacity table, indexed by
+    // [gradient * size.x + value], coloring them by value with the 1D transfer function.
+    // Requires the dataset's gradient volume. Segments can't be pre-integrated in 2D, so
+    // samples are point classified. An empty table returns to 1D classification
+    void set_transfer_function_2d(const std::vector<float> &opacities, const math::vec2i &size);
+
+    const PreintegrationTable &get_table() const;
+
+    void resize(const math::vec2i &size);
+
+    void reset_accumulation();
+
+    // Render another frame in parallel tiles and accumulate it
+    void render_frame(const RaycastCamera &camera);
+
+    // The accumulated image as sRGBA8 pixels, stored bottom row first like OSPRay's
+    // framebuffer
+    const uint32_t *image_data() const;
+
+    // The accumulated image in linear RGB, for comparing images
+    const std::vector<float> &linear_image() const;
+
+    int accumulated_frames() const;
+};
@@ -0,0 +1,54 @@
+#include "dataset_cache.h"
+#include <iostream>
+#include "json.hpp"
+#include "loader.h"
+
+std::shared_ptr<VolumeBrick> DatasetCache::acquire(const std::string &volume_file,
+                                                   const math::vec2f &value_range)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Drop entries for datasets which have been released
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second->dataset.expired() && it->first != volume_file) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        auto &e = entries[volume_file];
+        if (!e) {
+            e = std::make_shared<Entry>();
+        }
+        entry = e;
+    }
+
+    std::lock_guard<std::mutex> lock(entry->load_mutex);
+    std::shared_ptr<VolumeBrick> dataset = entry->dataset.lock();
+    if (!dataset) {
+        std::cout << "Loading dataset " << volume_file << "\n";
+        json config;
+        dataset = std::make_shared<VolumeBrick>(load_volume(volume_file, config, value_range));
+        entry->dataset = dataset;
+    }
+    return dataset;
+}
+
+std::vector<std::string> DatasetCache::loaded_datasets()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> loaded;
+    for (const auto &e : entries) {
+        if (!e.second->dataset.expired()) {
+            loaded.push_back(e.first);
+        }
+    }
+    return loaded;
+}
+
+DatasetCache &dataset_cache()
+{
+    static DatasetCache cache;
+    return cache;
+}
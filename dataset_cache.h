@@ -0,0 +1,40 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <rkcommon/math/vec.h>
+#include "volume_data.h"
+
+using namespace rkcommon;
+
+// Process-wide cache of loaded volumes keyed by their file path. Render sessions viewing
+// the same file share one copy of the voxel data and its OSPRay volume, which is released
+// once the last reference to it is dropped
+class DatasetCache {
+    struct Entry {
+        // Held while loading so concurrent requests for the same file wait on a single
+        // load instead of reading the data twice
+        std::mutex load_mutex;
+        std::weak_ptr<VolumeBrick> dataset;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+
+public:
+    // Get the dataset for the volume file, loading it if it's not already in memory. The
+    // value range is computed if not finite and is only used when the data is loaded
+    std::shared_ptr<VolumeBrick> acquire(
+        const std::string &volume_file,
+        const math::vec2f &value_range =
+            math::vec2f(std::numeric_limits<float>::infinity()));
+
+    // Get the files of the datasets currently held in memory
+    std::vector<std::string> loaded_datasets();
+};
+
+DatasetCache &dataset_cache();
@@ -0,0 +1,192 @@
+#include "distributed_render.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "loader.h"
+#include "memory_stats.h"
+#include "util.h"
+
+#ifdef MPI_FOUND
+#include <mpi.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+void split_partition(const math::box3i &box,
+                     const int num_parts,
+                     std::vector<math::box3i> &partitions)
+{
+    if (num_parts == 1) {
+        partitions.push_back(box);
+        return;
+    }
+    const math::vec3i size = box.size();
+    int axis = 0;
+    if (size.y > size[axis]) {
+        axis = 1;
+    }
+    if (size.z > size[axis]) {
+        axis = 2;
+    }
+    // Split proportionally so odd part counts give evenly sized bricks
+    const int lo_parts = num_parts / 2;
+    const int split = box.lower[axis] + int(int64_t(size[axis]) * lo_parts / num_parts);
+    if (split <= box.lower[axis] || split >= box.upper[axis]) {
+        throw std::runtime_error("Volume is too small to partition into " +
+                                 std::to_string(num_parts) + " bricks");
+    }
+
+    math::box3i lo = box;
+    lo.upper[axis] = split;
+    math::box3i hi = box;
+    hi.lower[axis] = split;
+    split_partition(lo, lo_parts, partitions);
+    split_partition(hi, num_parts - lo_parts, partitions);
+}
+
+}
+
+std::vector<math::box3i> partition_volume(const math::vec3i &dims, const int num_parts)
+{
+    if (num_parts < 1) {
+        throw std::runtime_error("Invalid number of volume partitions");
+    }
+    std::vector<math::box3i> partitions;
+    split_partition(math::box3i(math::vec3i(0), dims), num_parts, partitions);
+    return partitions;
+}
+
+std::shared_ptr<VolumeBrick> load_volume_partition(const json &config,
+                                                   const math::box3i &partition,
+                                                   const int ghost_voxels)
+{
+    const math::vec3i dims = get_vec<int, 3>(config["size"]);
+    const math::vec3f grid_spacing = get_vec<float, 3>(config["spacing"]);
+    const math::vec3i ghost(ghost_voxels);
+    const math::box3i region(max(partition.lower - ghost, math::vec3i(0)),
+                             min(partition.upper + ghost, dims));
+
+    auto brick = std::make_shared<VolumeBrick>(load_raw_volume(config, region));
+    brick->bounds =
+        math::box3f(partition.lower * grid_spacing, partition.upper * grid_spacing);
+    return brick;
+}
+
+#ifdef MPI_FOUND
+
+void init_distributed_device(int &argc, const char **argv)
+{
+    int provided = 0;
+    MPI_Init_thread(&argc, const_cast<char ***>(&argv), MPI_THREAD_MULTIPLE, &provided);
+    if (provided != MPI_THREAD_MULTIPLE) {
+        throw std::runtime_error("MPI does not support MPI_THREAD_MULTIPLE");
+    }
+
+    if (ospLoadModule("mpi") != OSP_NO_ERROR) {
+        throw std::runtime_error("Failed to load the OSPRay MPI module");
+    }
+    OSPDevice device = ospNewDevice("mpiDistributed");
+    if (!device) {
+        throw std::runtime_error("Failed to create the OSPRay MPI distributed device");
+    }
+    ospDeviceCommit(device);
+    ospSetCurrentDevice(device);
+    ospDeviceRelease(device);
+}
+
+void shutdown_distributed_device()
+{
+    ospShutdown();
+    MPI_Finalize();
+}
+
+void run_distributed_render(const std::string &volume_file,
+                            const DistributedRenderParams &params)
+{
+    int rank = 0;
+    int world_size = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    if (get_file_extension(volume_file) != "json") {
+        throw std::runtime_error("Distributed rendering requires a raw volume JSON config");
+    }
+    const json config = load_volume_config(volume_file);
+    const math::vec3i dims = get_vec<int, 3>(config["size"]);
+    const math::vec3f grid_spacing = get_vec<float, 3>(config["spacing"]);
+    const std::vector<math::box3i> partitions = partition_volume(dims, world_size);
+    const math::box3i &partition = partitions[rank];
+
+    const auto load_start = Clock::now();
+    std::shared_ptr<VolumeBrick> dataset =
+        load_volume_partition(config, partition, params.ghost_voxels);
+    const double load_ms =
+        std::chrono::duration<double, std::milli>(Clock::now() - load_start).count();
+
+    // Each rank only sees its own partition, so the value range is reduced across them
+    math::vec2f value_range = params.render.value_range;
+    if (!std::isfinite(value_range.x) || !std::isfinite(value_range.y)) {
+        const math::vec2f local_range = compute_volume_value_range(*dataset);
+        MPI_Allreduce(&local_range.x, &value_range.x, 1, MPI_FLOAT, MPI_MIN, MPI_COMM_WORLD);
+        MPI_Allreduce(&local_range.y, &value_range.y, 1, MPI_FLOAT, MPI_MAX, MPI_COMM_WORLD);
+    }
+    dataset->value_range = value_range;
+    record_memory_stage("Volume loaded");
+
+    RenderSessionParams session_params = params.render.session;
+    session_params.distributed = true;
+    session_params.global_bounds = math::box3f(math::vec3f(0.f), dims * grid_spacing);
+    RenderSession session(dataset, session_params);
+    if (!params.render.camera.empty()) {
+        session.apply_update({{"camera", params.render.camera}});
+    }
+
+    std::vector<double> frame_ms;
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int i = 0; i < params.render.frames; ++i) {
+        const auto start = Clock::now();
+        session.render_pass();
+        frame_ms.push_back(
+            std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    const double loaded_bytes = dataset->voxel_data->size();
+    const double rank_stats[2] = {load_ms, loaded_bytes};
+    std::vector<double> all_stats(2 * world_size);
+    MPI_Gather(rank_stats, 2, MPI_DOUBLE, all_stats.data(), 2, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        std::cout << "Distributed render of " << volume_file << " on " << world_size
+                  << " ranks\n";
+        for (int i = 0; i < world_size; ++i) {
+            std::cout << "Rank " << i << ": voxels " << partitions[i].lower << " - "
+                      << partitions[i].upper << ", loaded "
+                      << format_bytes(size_t(all_stats[2 * i + 1])) << " in "
+                      << all_stats[2 * i] << "ms\n";
+        }
+        if (!frame_ms.empty()) {
+            double total_ms = 0.0;
+            for (const auto &t : frame_ms) {
+                total_ms += t;
+            }
+            std::cout << "Rendered " << frame_ms.size() << " frames, avg "
+                      << total_ms / frame_ms.size() << "ms, min "
+                      << *std::min_element(frame_ms.begin(), frame_ms.end()) << "ms, max "
+                      << *std::max_element(frame_ms.begin(), frame_ms.end()) << "ms\n";
+        }
+
+        // Only rank 0 holds the composited image
+        const std::vector<uint8_t> jpeg = session.encode_jpeg(95);
+        std::ofstream fout(params.render.output_image_file.c_str(), std::ios::binary);
+        fout.write(reinterpret_cast<const char *>(jpeg.data()), jpeg.size());
+        std::cout << "Image saved to '" << params.render.output_image_file << "'\n";
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
+
+#endif
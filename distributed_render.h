@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <rkcommon/math/box.h>
+#include <rkcommon/math/vec.h>
+#include "json.hpp"
+#include "render_session.h"
+#include "volume_data.h"
+
+using namespace rkcommon;
+using json = nlohmann::json;
+
+// Split a volume of the given dimensions into num_parts bricks of voxels [lower, upper) by
+// recursively bisecting the longest axis. The bricks don't overlap, the cells between
+// neighboring bricks are filled by loading them with ghost voxels
+std::vector<math::box3i> partition_volume(const math::vec3i &dims, const int num_parts);
+
+// Load a partition of the raw volume, reading ghost_voxels extra voxels around it (clamped
+// to the volume) so samples at the partition's faces interpolate the same as they would in
+// the full volume. The brick's bounds are the region covered by the partition itself,
+// excluding the ghost voxels
+std::shared_ptr<VolumeBrick> load_volume_partition(const json &config,
+                                                   const math::box3i &partition,
+                                                   const int ghost_voxels);
+
+struct DistributedRenderParams {
+    // The camera and render parameters are applied on all ranks
+    BatchRenderParams render;
+    int ghost_voxels = 1;
+};
+
+#ifdef MPI_FOUND
+// Initialize MPI and make OSPRay's MPI distributed device current, in place of ospInit
+void init_distributed_device(int &argc, const char **argv);
+
+// Shutdown OSPRay and finalize MPI
+void shutdown_distributed_device();
+
+// Render the volume data-parallel across the MPI ranks. Each rank loads its partition of
+// the volume and the image is composited by OSPRay, rank 0 saves the image and reports
+// the load and render timings. Must be called by all ranks
+void run_distributed_render(const std::string &volume_file,
+                            const DistributedRenderParams &params);
+#endif
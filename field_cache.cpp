@@ -0,0 +1,128 @@
+#include "field_cache.h"
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include "loader.h"
+#include "util.h"
+
+FieldCache::FieldCache(const json &config,
+                       const size_t selected,
+                       const std::shared_ptr<VolumeBrick> &brick,
+                       const size_t budget_bytes)
+    : config(config), budget_bytes(budget_bytes)
+{
+    for (const auto &name : volume_field_names(config)) {
+        Field f;
+        f.name = name;
+        const json &field_config = config["fields"][fields.size()];
+        if (field_config.find("range") != field_config.end()) {
+            f.value_range = get_vec<float, 2>(field_config["range"]);
+        }
+        fields.push_back(f);
+    }
+    if (selected >= fields.size()) {
+        throw std::runtime_error("Invalid selected volume field");
+    }
+    transfer_functions.resize(fields.size());
+    fields[selected].brick = brick;
+    fields[selected].value_range = brick->value_range;
+    fields[selected].last_used = ++use_count;
+}
+
+size_t FieldCache::size() const
+{
+    return fields.size();
+}
+
+const std::string &FieldCache::name(const size_t i) const
+{
+    return fields.at(i).name;
+}
+
+size_t FieldCache::find(const std::string &name) const
+{
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i].name == name) {
+            return i;
+        }
+    }
+    throw std::runtime_error("The volume has no field " + name);
+}
+
+bool FieldCache::resident(const size_t i) const
+{
+    return fields.at(i).brick != nullptr;
+}
+
+std::shared_ptr<VolumeBrick> FieldCache::acquire(const size_t i)
+{
+    Field &f = fields.at(i);
+    f.last_used = ++use_count;
+    if (!f.brick) {
+        // Release the other fields first so the new field's voxels aren't loaded on top of
+        // cached fields that no longer fit. The field being displayed is still referenced
+        // by the app until the new one replaces it, so switching fields briefly holds both
+        evict(i);
+
+        std::cout << "Loading field " << f.name << "\n";
+        using namespace std::chrono;
+        auto start = steady_clock::now();
+        f.brick =
+            std::make_shared<VolumeBrick>(load_raw_volume(volume_field_config(config, i)));
+        if (!std::isfinite(f.value_range.x) || !std::isfinite(f.value_range.y)) {
+            f.value_range = compute_volume_value_range(*f.brick);
+        }
+        f.brick->value_range = f.value_range;
+        auto end = steady_clock::now();
+        std::cout << "Loaded field " << f.name << " in "
+                  << duration_cast<milliseconds>(end - start).count() << "ms, value range "
+                  << f.value_range << "\n";
+    }
+    return f.brick;
+}
+
+void FieldCache::release(const size_t i)
+{
+    fields.at(i).brick = nullptr;
+}
+
+size_t FieldCache::resident_bytes() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i].brick) {
+            bytes += field_bytes(i);
+        }
+    }
+    return bytes;
+}
+
+size_t FieldCache::field_bytes(const size_t i) const
+{
+    const math::vec3i dims = get_vec<int, 3>(config["size"]);
+    return dims.long_product() *
+           voxel_type_size(config["fields"][i]["type"].get<std::string>());
+}
+
+void FieldCache::evict(const size_t keep)
+{
+    while (true) {
+        size_t lru = fields.size();
+        size_t bytes = field_bytes(keep);
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (i == keep || !fields[i].brick) {
+                continue;
+            }
+            bytes += field_bytes(i);
+            if (lru == fields.size() || fields[i].last_used < fields[lru].last_used) {
+                lru = i;
+            }
+        }
+        if (lru == fields.size() || bytes <= budget_bytes) {
+            return;
+        }
+        std::cout << "Releasing field " << fields[lru].name << "\n";
+        fields[lru].brick = nullptr;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <rkcommon/math/vec.h>
+#include "json.hpp"
+#include "volume_data.h"
+
+using namespace rkcommon;
+using json = nlohmann::json;
+
+// The transfer function last applied to a field, restored when the field is selected again
+struct FieldTransferFunction {
+    bool saved = false;
+    std::string colormap;
+    std::vector<std::array<float, 2>> opacity_points;
+    math::vec2f value_range;
+};
+
+// The fields of a multi-field volume, loaded when they're first selected. Fields stay
+// resident while the voxels of the loaded fields fit in the budget, beyond it the least
+// recently selected fields are released. The selected field is always kept, so the default
+// budget of 0 holds only the selected field. Each field's value range is kept when it's
+// released, so reloading it doesn't recompute the range
+class FieldCache {
+    struct Field {
+        std::string name;
+        math::vec2f value_range = math::vec2f(std::numeric_limits<float>::infinity());
+        std::shared_ptr<VolumeBrick> brick;
+        uint64_t last_used = 0;
+    };
+
+    json config;
+    std::vector<Field> fields;
+    size_t budget_bytes = 0;
+    uint64_t use_count = 0;
+
+public:
+    // Indexed by field, kept for the whole session whether the field is resident or not
+    std::vector<FieldTransferFunction> transfer_functions;
+
+    FieldCache() = default;
+
+    // Setup the fields of the multi-field volume config from load_volume_config, with the
+    // loaded brick of the initially selected field
+    FieldCache(const json &config,
+               const size_t selected,
+               const std::shared_ptr<VolumeBrick> &brick,
+               const size_t budget_bytes);
+
+    size_t size() const;
+
+    const std::string &name(const size_t i) const;
+
+    // Find the index of the named field, throws if there's no such field
+    size_t find(const std::string &name) const;
+
+    bool resident(const size_t i) const;
+
+    // Get field i's brick and mark it as the most recently used, loading it if it's not
+    // resident and releasing the least recently used fields that don't fit in the budget
+    std::shared_ptr<VolumeBrick> acquire(const size_t i);
+
+    // Drop the cache's reference to field i's brick, so its voxels are released once the
+    // app drops its copies, e.g. when the field is cropped with the uncropped data released
+    void release(const size_t i);
+
+    // The bytes of voxel data of the resident fields
+    size_t resident_bytes() const;
+
+private:
+    // The bytes of field i's voxels on the volume's grid
+    size_t field_bytes(const size_t i) const;
+
+    // Release the least recently used fields other than keep until the resident fields and
+    // keep fit in the budget
+    void evict(const size_t keep);
+};
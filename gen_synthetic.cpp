@@ -0,0 +1,97 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "synthetic_volume.h"
+#include "util/json.hpp"
+
+using json = nlohmann::json;
+
+const std::string USAGE =
+    "./mini_scivis_gen <output name> [options]\n"
+    "Writes <output name>.raw and <output name>.json, or <output name>.off with -off\n"
+    "Options:\n"
+    "  -field (noise|marschner-lobb|blobs)\n"
+    "                           Select the field to generate (default marschner-lobb)\n"
+    "\n"
+    "  -dims <x> <y> <z>        Set the volume dimensions (default 128 128 128)\n"
+    "\n"
+    "  -type (uint8|uint16|float32|float64)\n"
+    "                           Set the voxel type (default uint8)\n"
+    "\n"
+    "  -sparsity <x>            Fraction of bricks to leave empty, in [0, 1] (default 0)\n"
+    "\n"
+    "  -brick-size <n>          Size of the bricks used for sparsity (default 16)\n"
+    "\n"
+    "  -blobs <n>               Number of blobs for the blobs field (default 64)\n"
+    "\n"
+    "  -octaves <n>             Number of noise octaves for the noise field (default 4)\n"
+    "\n"
+    "  -seed <n>                Set the random seed (default 0)\n"
+    "\n"
+    "  -off                     Write a tetrahedral mesh with dims vertices instead\n"
+    "\n"
+    "  -h                       Print this help.";
+
+int main(int argc, const char **argv)
+{
+    const std::vector<std::string> args(argv, argv + argc);
+    std::string output_name;
+    bool write_off = false;
+    SyntheticVolumeParams params;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-field") {
+            params.field = parse_synthetic_field(args[++i]);
+        } else if (args[i] == "-dims") {
+            params.dims.x = std::stoi(args[++i]);
+            params.dims.y = std::stoi(args[++i]);
+            params.dims.z = std::stoi(args[++i]);
+        } else if (args[i] == "-type") {
+            params.voxel_type = args[++i];
+        } else if (args[i] == "-sparsity") {
+            params.sparsity = std::stof(args[++i]);
+        } else if (args[i] == "-brick-size") {
+            params.sparsity_brick_size = std::stoi(args[++i]);
+        } else if (args[i] == "-blobs") {
+            params.blob_count = std::stoi(args[++i]);
+        } else if (args[i] == "-octaves") {
+            params.noise_octaves = std::stoi(args[++i]);
+        } else if (args[i] == "-seed") {
+            params.seed = std::stoul(args[++i]);
+        } else if (args[i] == "-off") {
+            write_off = true;
+        } else if (args[i] == "-h") {
+            std::cout << USAGE << "\n";
+            return 0;
+        } else if (args[i][0] != '-') {
+            output_name = args[i];
+        }
+    }
+    if (output_name.empty()) {
+        std::cout << "[error]: An output name is required\n" << USAGE << "\n";
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (write_off) {
+        const std::string off_file = output_name + ".off";
+        write_synthetic_tet_mesh(params, off_file);
+        std::cout << "Tet mesh written to '" << off_file << "'\n";
+    } else {
+        const std::string raw_file = output_name + ".raw";
+        json config = write_synthetic_volume(params, raw_file);
+        // The volume path is resolved relative to the JSON file when loading
+        config.erase("volume");
+        const std::string config_file = output_name + ".json";
+        std::ofstream fout(config_file.c_str());
+        fout << config.dump(4) << "\n";
+        std::cout << config.dump(4) << "\nVolume written to '" << raw_file << "', config to '"
+                  << config_file << "'\n";
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::cout << "Generation took "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count()
+              << "ms\n";
+    return 0;
+}
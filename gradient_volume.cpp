@@ -0,0 +1,323 @@
+#include "gradient_volume.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <tbb/blocked_range.h>
+#include <tbb/combinable.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include "memory_stats.h"
+
+namespace {
+
+// Compute the gradient magnitudes of the row of voxels at (y, z) into out. Each pass is a
+// branch free loop over contiguous rows so the compiler can vectorize it
+template <typename T>
+void gradient_row(const T *voxels,
+                  const math::vec3i &dims,
+                  const math::vec3f &spacing,
+                  const int y,
+                  const int z,
+                  float *out)
+{
+    const size_t nx = dims.x;
+    const size_t slice = nx * dims.y;
+    const int y0 = std::max(y - 1, 0);
+    const int y1 = std::min(y + 1, dims.y - 1);
+    const int z0 = std::max(z - 1, 0);
+    const int z1 = std::min(z + 1, dims.z - 1);
+    const T *row = voxels + z * slice + y * nx;
+    const T *row_y0 = voxels + z * slice + y0 * nx;
+    const T *row_y1 = voxels + z * slice + y1 * nx;
+    const T *row_z0 = voxels + z0 * slice + y * nx;
+    const T *row_z1 = voxels + z1 * slice + y * nx;
+    const float fy = y1 > y0 ? 1.f / ((y1 - y0) * spacing.y) : 0.f;
+    const float fz = z1 > z0 ? 1.f / ((z1 - z0) * spacing.z) : 0.f;
+
+    for (size_t x = 0; x < nx; ++x) {
+        const float gy = (float(row_y1[x]) - float(row_y0[x])) * fy;
+        const float gz = (float(row_z1[x]) - float(row_z0[x])) * fz;
+        out[x] = gy * gy + gz * gz;
+    }
+    if (nx > 1) {
+        const float fx = 1.f / (2.f * spacing.x);
+        for (size_t x = 1; x + 1 < nx; ++x) {
+            const float gx = (float(row[x + 1]) - float(row[x - 1])) * fx;
+            out[x] += gx * gx;
+        }
+        const float gx_first = (float(row[1]) - float(row[0])) / spacing.x;
+        const float gx_last = (float(row[nx - 1]) - float(row[nx - 2])) / spacing.x;
+        out[0] += gx_first * gx_first;
+        out[nx - 1] += gx_last * gx_last;
+    }
+    for (size_t x = 0; x < nx; ++x) {
+        out[x] = std::sqrt(out[x]);
+    }
+}
+
+// Compute the gradient vectors of the row of voxels at (y, z) into gx, gy and gz, with the
+// same differences as gradient_row
+template <typename T>
+void gradient_vector_row(const T *voxels,
+                         const math::vec3i &dims,
+                         const math::vec3f &spacing,
+                         const int y,
+                         const int z,
+                         float *gx,
+                         float *gy,
+                         float *gz)
+{
+    const size_t nx = dims.x;
+    const size_t slice = nx * dims.y;
+    const int y0 = std::max(y - 1, 0);
+    const int y1 = std::min(y + 1, dims.y - 1);
+    const int z0 = std::max(z - 1, 0);
+    const int z1 = std::min(z + 1, dims.z - 1);
+    const T *row = voxels + z * slice + y * nx;
+    const T *row_y0 = voxels + z * slice + y0 * nx;
+    const T *row_y1 = voxels + z * slice + y1 * nx;
+    const T *row_z0 = voxels + z0 * slice + y * nx;
+    const T *row_z1 = voxels + z1 * slice + y * nx;
+    const float fy = y1 > y0 ? 1.f / ((y1 - y0) * spacing.y) : 0.f;
+    const float fz = z1 > z0 ? 1.f / ((z1 - z0) * spacing.z) : 0.f;
+
+    for (size_t x = 0; x < nx; ++x) {
+        gy[x] = (float(row_y1[x]) - float(row_y0[x])) * fy;
+        gz[x] = (float(row_z1[x]) - float(row_z0[x])) * fz;
+    }
+    gx[0] = 0.f;
+    if (nx > 1) {
+        const float fx = 1.f / (2.f * spacing.x);
+        for (size_t x = 1; x + 1 < nx; ++x) {
+            gx[x] = (float(row[x + 1]) - float(row[x - 1])) * fx;
+        }
+        gx[0] = (float(row[1]) - float(row[0])) / spacing.x;
+        gx[nx - 1] = (float(row[nx - 1]) - float(row[nx - 2])) / spacing.x;
+    }
+}
+
+template <typename T>
+GradientVolume compute_gradient(const VolumeBrick &brick, const bool quantize)
+{
+    const T *voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    const math::vec3i dims = brick.dims;
+    const math::vec3f spacing = brick.bounds.size() / math::vec3f(dims);
+    const size_t nx = dims.x;
+    const size_t num_voxels = nx * dims.y * dims.z;
+
+    GradientVolume gradient;
+    gradient.dims = dims;
+    gradient.quantized = quantize;
+    gradient.data = make_tracked_buffer(MemoryCategory::VOLUME_DERIVED,
+                                        num_voxels * (quantize ? 1 : sizeof(float)));
+
+    // The float magnitudes are written directly to the output while finding the max. When
+    // quantizing the max is found first, so the magnitudes are never all stored as floats
+    float *magnitudes =
+        quantize ? nullptr : reinterpret_cast<float *>(gradient.data->data());
+    gradient.max_magnitude = tbb::parallel_reduce(
+        tbb::blocked_range<int>(0, dims.z),
+        0.f,
+        [&](const tbb::blocked_range<int> &r, float max_magnitude) {
+            std::vector<float> row_buf(nx);
+            for (int z = r.begin(); z != r.end(); ++z) {
+                for (int y = 0; y < dims.y; ++y) {
+                    float *out = magnitudes ? magnitudes + (size_t(z) * dims.y + y) * nx
+                                            : row_buf.data();
+                    gradient_row(voxels, dims, spacing, y, z, out);
+                    max_magnitude =
+                        std::max(max_magnitude, *std::max_element(out, out + nx));
+                }
+            }
+            return max_magnitude;
+        },
+        [](const float a, const float b) { return std::max(a, b); });
+
+    if (quantize) {
+        const float scale =
+            gradient.max_magnitude > 0.f ? 255.f / gradient.max_magnitude : 0.f;
+        uint8_t *quantized = gradient.data->data();
+        auto quantize_slices = [&](const tbb::blocked_range<int> &r) {
+            std::vector<float> row_buf(nx);
+            for (int z = r.begin(); z != r.end(); ++z) {
+                for (int y = 0; y < dims.y; ++y) {
+                    gradient_row(voxels, dims, spacing, y, z, row_buf.data());
+                    uint8_t *out = quantized + (size_t(z) * dims.y + y) * nx;
+                    for (size_t x = 0; x < nx; ++x) {
+                        out[x] = uint8_t(row_buf[x] * scale + 0.5f);
+                    }
+                }
+            }
+        };
+        tbb::parallel_for(tbb::blocked_range<int>(0, dims.z), quantize_slices);
+    }
+    return gradient;
+}
+
+template <typename T>
+NormalVolume compute_normals(const VolumeBrick &brick)
+{
+    const T *voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    const math::vec3i dims = brick.dims;
+    const math::vec3f spacing = brick.bounds.size() / math::vec3f(dims);
+    const size_t nx = dims.x;
+    const size_t num_voxels = nx * dims.y * dims.z;
+
+    NormalVolume normals;
+    normals.dims = dims;
+    normals.data =
+        make_tracked_buffer(MemoryCategory::VOLUME_DERIVED, num_voxels * sizeof(uint16_t));
+    uint16_t *codes = reinterpret_cast<uint16_t *>(normals.data->data());
+    auto encode_slices = [&](const tbb::blocked_range<int> &r) {
+        std::vector<float> gx(nx);
+        std::vector<float> gy(nx);
+        std::vector<float> gz(nx);
+        for (int z = r.begin(); z != r.end(); ++z) {
+            for (int y = 0; y < dims.y; ++y) {
+                gradient_vector_row(
+                    voxels, dims, spacing, y, z, gx.data(), gy.data(), gz.data());
+                uint16_t *out = codes + (size_t(z) * dims.y + y) * nx;
+                for (size_t x = 0; x < nx; ++x) {
+                    out[x] = encode_octahedral(math::vec3f(gx[x], gy[x], gz[x]));
+                }
+            }
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<int>(0, dims.z), encode_slices);
+    return normals;
+}
+
+template <typename T>
+std::vector<uint32_t> histogram_2d(const VolumeBrick &brick,
+                                   const GradientVolume &gradient,
+                                   const math::vec2f &value_range,
+                                   const math::vec2i &bins)
+{
+    const T *voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    const size_t num_voxels = size_t(brick.dims.x) * brick.dims.y * brick.dims.z;
+    const float value_scale =
+        value_range.y > value_range.x ? bins.x / (value_range.y - value_range.x) : 0.f;
+
+    tbb::combinable<std::vector<uint32_t>> local_counts(
+        [&]() { return std::vector<uint32_t>(size_t(bins.x) * bins.y, 0); });
+    auto count_voxels = [&](const tbb::blocked_range<size_t> &r) {
+        std::vector<uint32_t> &counts = local_counts.local();
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+            const int v = std::min(
+                std::max(int((voxels[i] - value_range.x) * value_scale), 0), bins.x - 1);
+            const int g = std::min(int(gradient.normalized(i) * bins.y), bins.y - 1);
+            ++counts[size_t(g) * bins.x + v];
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_voxels), count_voxels);
+
+    std::vector<uint32_t> counts(size_t(bins.x) * bins.y, 0);
+    local_counts.combine_each([&](const std::vector<uint32_t> &local) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += local[i];
+        }
+    });
+    return counts;
+}
+
+}
+
+float GradientVolume::normalized(const size_t i) const
+{
+    if (quantized) {
+        return (*data)[i] * (1.f / 255.f);
+    }
+    const float *magnitudes = reinterpret_cast<const float *>(data->data());
+    return max_magnitude > 0.f ? magnitudes[i] / max_magnitude : 0.f;
+}
+
+math::vec3f NormalVolume::normal(const size_t i) const
+{
+    return decode_octahedral(reinterpret_cast<const uint16_t *>(data->data())[i]);
+}
+
+uint16_t encode_octahedral(const math::vec3f &n)
+{
+    const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    float px = 0.f;
+    float py = 0.f;
+    if (l1 > 0.f) {
+        px = n.x / l1;
+        py = n.y / l1;
+        if (n.z < 0.f) {
+            const float fx = (1.f - std::abs(py)) * (px >= 0.f ? 1.f : -1.f);
+            const float fy = (1.f - std::abs(px)) * (py >= 0.f ? 1.f : -1.f);
+            px = fx;
+            py = fy;
+        }
+    }
+    const uint16_t qx = uint16_t((px * 0.5f + 0.5f) * 255.f + 0.5f);
+    const uint16_t qy = uint16_t((py * 0.5f + 0.5f) * 255.f + 0.5f);
+    return qx | (qy << 8);
+}
+
+math::vec3f decode_octahedral(const uint16_t code)
+{
+    const float px = (code & 0xff) * (2.f / 255.f) - 1.f;
+    const float py = (code >> 8) * (2.f / 255.f) - 1.f;
+    math::vec3f n(px, py, 1.f - std::abs(px) - std::abs(py));
+    if (n.z < 0.f) {
+        n.x = (1.f - std::abs(py)) * (px >= 0.f ? 1.f : -1.f);
+        n.y = (1.f - std::abs(px)) * (py >= 0.f ? 1.f : -1.f);
+    }
+    return normalize(n);
+}
+
+GradientVolume compute_gradient_magnitude(const VolumeBrick &brick, const bool quantize)
+{
+    if (!brick.voxel_data) {
+        throw std::runtime_error("Gradients can only be computed for structured volumes");
+    }
+    if (brick.voxel_type == "uint8") {
+        return compute_gradient<uint8_t>(brick, quantize);
+    } else if (brick.voxel_type == "uint16") {
+        return compute_gradient<uint16_t>(brick, quantize);
+    } else if (brick.voxel_type == "float32") {
+        return compute_gradient<float>(brick, quantize);
+    } else if (brick.voxel_type == "float64") {
+        return compute_gradient<double>(brick, quantize);
+    }
+    throw std::runtime_error("Unrecognized voxel type " + brick.voxel_type);
+}
+
+NormalVolume compute_normal_volume(const VolumeBrick &brick)
+{
+    if (!brick.voxel_data) {
+        throw std::runtime_error("Normals can only be computed for structured volumes");
+    }
+    if (brick.voxel_type == "uint8") {
+        return compute_normals<uint8_t>(brick);
+    } else if (brick.voxel_type == "uint16") {
+        return compute_normals<uint16_t>(brick);
+    } else if (brick.voxel_type == "float32") {
+        return compute_normals<float>(brick);
+    } else if (brick.voxel_type == "float64") {
+        return compute_normals<double>(brick);
+    }
+    throw std::runtime_error("Unrecognized voxel type " + brick.voxel_type);
+}
+
+std::vector<uint32_t> compute_histogram_2d(const VolumeBrick &brick,
+                                           const GradientVolume &gradient,
+                                           const math::vec2f &value_range,
+                                           const math::vec2i &bins)
+{
+    if (bins.x <= 0 || bins.y <= 0) {
+        throw std::runtime_error("Invalid number of histogram bins");
+    }
+    if (brick.voxel_type == "uint8") {
+        return histogram_2d<uint8_t>(brick, gradient, value_range, bins);
+    } else if (brick.voxel_type == "uint16") {
+        return histogram_2d<uint16_t>(brick, gradient, value_range, bins);
+    } else if (brick.voxel_type == "float32") {
+        return histogram_2d<float>(brick, gradient, value_range, bins);
+    } else if (brick.voxel_type == "float64") {
+        return histogram_2d<double>(brick, gradient, value_range, bins);
+    }
+    throw std::runtime_error("Unrecognized voxel type " + brick.voxel_type);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <rkcommon/math/vec.h>
+#include "volume_data.h"
+
+using namespace rkcommon;
+
+// The gradient magnitude of each voxel of a brick, in value units per unit of world space
+struct GradientVolume {
+    math::vec3i dims;
+    // The magnitudes as float32, or uint8 quantized over [0, max_magnitude]
+    std::shared_ptr<std::vector<uint8_t>> data;
+    bool quantized = false;
+    float max_magnitude = 0.f;
+
+    // Get the magnitude of the voxel normalized to [0, 1] by the max magnitude
+    float normalized(const size_t i) const;
+};
+
+// The unit gradient direction of each voxel of a brick, octahedral encoded in 16 bits with
+// 8 bits per coordinate, for shading without computing gradients while rendering. Voxels
+// with a zero gradient store +z
+struct NormalVolume {
+    math::vec3i dims;
+    // The uint16 encoded normals
+    std::shared_ptr<std::vector<uint8_t>> data;
+
+    math::vec3f normal(const size_t i) const;
+};
+
+// Encode the unit vector by projecting it onto the octahedron and unfolding the lower half
+// over the upper, quantizing the resulting 2D point to 8 bits per coordinate
+uint16_t encode_octahedral(const math::vec3f &n);
+
+math::vec3f decode_octahedral(const uint16_t code);
+
+// Compute the gradient magnitudes of the brick's voxels with central differences, or
+// one-sided differences on the faces, in parallel over slices. If quantized the
+// magnitudes are stored in 8 bits, taking a quarter of the memory
+GradientVolume compute_gradient_magnitude(const VolumeBrick &brick, const bool quantize);
+
+// Compute a 2D histogram of the voxels' values over the value range and their normalized
+// gradient magnitudes, stored as [gradient_bin * bins.x + value_bin]
+std::vector<uint32_t> compute_histogram_2d(const VolumeBrick &brick,
+                                           const GradientVolume &gradient,
+                                           const math::vec2f &value_range,
+                                           const math::vec2i &bins);
+
+// Compute the brick's unit gradient directions with the same differences as the gradient
+// magnitudes, in parallel over slices, taking 2 bytes per voxel
+NormalVolume compute_normal_volume(const VolumeBrick &brick);
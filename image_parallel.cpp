@@ -0,0 +1,250 @@
+#include "image_parallel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include "frame_transport.h"
+#include "loader.h"
+#include "numa_util.h"
+#include "socket_util.h"
+
+#ifdef _WIN32
+
+void run_image_parallel(const std::string &, const ImageParallelParams &)
+{
+    throw std::runtime_error("Image parallel rendering forks its workers, which isn't "
+                             "supported on Windows");
+}
+
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// A strip of image rows [y, y + height), counted from the bottom of the image
+struct ImageStrip {
+    int index = 0;
+    int y = 0;
+    int height = 0;
+};
+
+std::vector<ImageStrip> image_strips(const int height, const int num_strips)
+{
+    std::vector<ImageStrip> strips;
+    for (int i = 0; i < num_strips; ++i) {
+        ImageStrip s;
+        s.index = i;
+        s.y = int(int64_t(height) * i / num_strips);
+        s.height = int(int64_t(height) * (i + 1) / num_strips) - s.y;
+        strips.push_back(s);
+    }
+    return strips;
+}
+
+double elapsed_ms(const Clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Render the worker's strips and send them back to the parent over fd, followed by a JSON
+// report of the worker's placement and timings
+void run_worker(const int worker,
+                const int fd,
+                const std::string &volume_file,
+                const std::vector<ImageStrip> &strips,
+                const ImageParallelParams &params)
+{
+    json report;
+    report["worker"] = worker;
+    report["numa_node"] = -1;
+    if (params.pin_numa) {
+        // Pin before initializing OSPRay and loading the volume, so OSPRay's threads start
+        // on the node and the voxel data is first touched there
+        const std::vector<NumaNode> nodes = numa_nodes();
+        const NumaNode &node = nodes[worker % nodes.size()];
+        if (pin_to_numa_node(node)) {
+            report["numa_node"] = node.id;
+        }
+    }
+
+    int argc = 1;
+    const char *argv[] = {"mini_scivis"};
+    if (ospInit(&argc, argv) != OSP_NO_ERROR) {
+        throw std::runtime_error("Failed to initialize OSPRay");
+    }
+
+    const auto load_start = Clock::now();
+    json config;
+    auto dataset = std::make_shared<VolumeBrick>(
+        load_volume(volume_file, config, params.render.value_range));
+    report["load_ms"] = elapsed_ms(load_start);
+
+    const math::vec2i img_size = params.render.session.img_size;
+    std::vector<ImageStrip> worker_strips;
+    std::vector<std::unique_ptr<RenderSession>> sessions;
+    for (const auto &s : strips) {
+        if (s.index % params.processes != worker) {
+            continue;
+        }
+        RenderSessionParams session_params = params.render.session;
+        session_params.img_size = math::vec2i(img_size.x, s.height);
+        session_params.image_start = math::vec2f(0.f, float(s.y) / img_size.y);
+        session_params.image_end = math::vec2f(1.f, float(s.y + s.height) / img_size.y);
+        sessions.emplace_back(new RenderSession(dataset, session_params));
+        if (!params.render.camera.empty()) {
+            sessions.back()->apply_update({{"camera", params.render.camera}});
+        }
+        worker_strips.push_back(s);
+    }
+    report["strips"] = sessions.size();
+
+    const auto render_start = Clock::now();
+    for (int i = 0; i < params.render.frames; ++i) {
+        for (auto &s : sessions) {
+            s->render_pass();
+        }
+    }
+    report["render_ms"] = elapsed_ms(render_start);
+
+    for (size_t i = 0; i < sessions.size(); ++i) {
+        const json header = {{"strip", worker_strips[i].index},
+                             {"y", worker_strips[i].y},
+                             {"width", img_size.x},
+                             {"height", worker_strips[i].height}};
+        const uint32_t *img = sessions[i]->map_image();
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(img);
+        const std::vector<uint8_t> pixels(
+            bytes, bytes + size_t(img_size.x) * worker_strips[i].height * 4);
+        sessions[i]->unmap_image(img);
+
+        const std::vector<uint8_t> msg = pack_frame_message(header.dump(), pixels);
+        if (!send_message(fd, MESSAGE_FRAME, msg.data(), msg.size())) {
+            throw std::runtime_error("Failed to send strip to the parent process");
+        }
+    }
+    send_message(fd, MESSAGE_JSON, report.dump());
+
+    sessions.clear();
+    dataset.reset();
+    ospShutdown();
+}
+
+}
+
+void run_image_parallel(const std::string &volume_file, const ImageParallelParams &params)
+{
+    if (params.processes < 1 || params.strips_per_process < 1 || params.render.frames < 1) {
+        throw std::runtime_error(
+            "Invalid number of image parallel processes, strips or frames");
+    }
+    const math::vec2i img_size = params.render.session.img_size;
+    const std::vector<ImageStrip> strips = image_strips(
+        img_size.y, std::min(params.processes * params.strips_per_process, img_size.y));
+
+    // Flush before forking so buffered output isn't repeated by the workers
+    std::cout.flush();
+    const auto start = Clock::now();
+    std::vector<pid_t> workers;
+    std::vector<int> worker_fds;
+    for (int i = 0; i < params.processes; ++i) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            throw std::runtime_error("Failed to create socket pair for worker");
+        }
+        const pid_t pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("Failed to fork image parallel worker");
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            for (const int fd : worker_fds) {
+                close(fd);
+            }
+            int status = 0;
+            try {
+                run_worker(i, fds[1], volume_file, strips, params);
+            } catch (const std::exception &e) {
+                std::cerr << "[error]: Image parallel worker " << i << " failed: " << e.what()
+                          << "\n";
+                status = 1;
+            }
+            close(fds[1]);
+            std::cout.flush();
+            _exit(status);
+        }
+        close(fds[1]);
+        workers.push_back(pid);
+        worker_fds.push_back(fds[0]);
+    }
+
+    // Gather the strips into the final image, which is stored bottom row first like the
+    // strips rendered by OSPRay
+    std::vector<uint8_t> image(size_t(img_size.x) * img_size.y * 4, 0);
+    std::vector<json> reports;
+    size_t received_strips = 0;
+    for (const int fd : worker_fds) {
+        Message msg;
+        while (recv_message(fd, msg)) {
+            if (msg.type == MESSAGE_JSON) {
+                reports.push_back(json::parse(msg.payload.begin(), msg.payload.end()));
+                continue;
+            }
+            std::string header_str;
+            const uint8_t *pixels = nullptr;
+            size_t size = 0;
+            unpack_frame_message(msg, header_str, pixels, size);
+            const json header = json::parse(header_str);
+            const int y = header["y"].get<int>();
+            const int height = header["height"].get<int>();
+            const size_t row_bytes = size_t(img_size.x) * 4;
+            if (y < 0 || y + height > img_size.y || size != row_bytes * height) {
+                throw std::runtime_error("Received invalid strip from worker");
+            }
+            std::memcpy(image.data() + y * row_bytes, pixels, size);
+            ++received_strips;
+        }
+        close_socket(fd);
+    }
+    const double total_ms = elapsed_ms(start);
+
+    bool failed = false;
+    for (const pid_t pid : workers) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    if (failed || received_strips != strips.size()) {
+        throw std::runtime_error("Image parallel rendering failed");
+    }
+
+    std::cout << "Image parallel render of " << img_size.x << "x" << img_size.y << " in "
+              << strips.size() << " strips on " << params.processes << " processes\n";
+    double max_render_ms = 0.0;
+    for (const auto &r : reports) {
+        const double render_ms = r["render_ms"].get<double>();
+        max_render_ms = std::max(max_render_ms, render_ms);
+        std::cout << "Worker " << r["worker"].get<int>() << " (NUMA node "
+                  << r["numa_node"].get<int>() << "): " << r["strips"].get<int>()
+                  << " strips, loaded in " << r["load_ms"].get<double>() << "ms, "
+                  << render_ms / params.render.frames << "ms/frame\n";
+    }
+    std::cout << "Rendered " << params.render.frames << " frames in " << max_render_ms
+              << "ms (" << params.render.frames / (max_render_ms / 1000.0)
+              << " FPS), total " << total_ms << "ms including startup\n";
+
+    const std::vector<uint8_t> jpeg =
+        encode_jpeg(image.data(), img_size.x, img_size.y, 95, true);
+    std::ofstream fout(params.render.output_image_file.c_str(), std::ios::binary);
+    fout.write(reinterpret_cast<const char *>(jpeg.data()), jpeg.size());
+    std::cout << "Image saved to '" << params.render.output_image_file << "'\n";
+}
+
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include "render_session.h"
+
+struct ImageParallelParams {
+    BatchRenderParams render;
+    int processes = 2;
+    // The image is split into processes * strips_per_process horizontal strips which are
+    // assigned to the processes round-robin, so the empty and busy parts of the image are
+    // spread across them
+    int strips_per_process = 4;
+    // Pin each process to a NUMA node, assigned round-robin. The process loads its copy of
+    // the volume after being pinned so the data is first touched on its own node
+    bool pin_numa = true;
+};
+
+// Render the volume image-parallel across local worker processes which each load their
+// own copy of the volume and render a subset of the image's strips. The strips are
+// gathered into the final image, which is saved along with a report of each worker's
+// NUMA node, load time and render time. This forks the workers, so it must be called
+// before OSPRay is initialized in this process
+void run_image_parallel(const std::string &volume_file, const ImageParallelParams &params);
@@ -0,0 +1,104 @@
+#include "lights.h"
+#include <iostream>
+#include <stdexcept>
+#include "stb_image.h"
+#include "util.h"
+
+const std::vector<std::string> &light_types()
+{
+    static const std::vector<std::string> types = {
+        "ambient", "distant", "sphere", "hdri", "sunSky"};
+    return types;
+}
+
+std::vector<LightParams> default_lights()
+{
+    return {LightParams(0.3f),
+            LightParams(1.f, math::vec3f(0.5f, -1.f, 0.25f)),
+            LightParams(1.f, math::vec3f(-0.5f, -0.5f, 0.5f))};
+}
+
+cpp::CopiedData SceneLights::light_list()
+{
+    lights.clear();
+    types.clear();
+    for (const auto &p : params) {
+        cpp::Light light(p.type);
+        set_params(light, p);
+        light.commit();
+        lights.push_back(light);
+        types.push_back(p.type);
+    }
+    return cpp::CopiedData(lights);
+}
+
+bool SceneLights::update(size_t i, std::vector<OSPObject> &pending_commits)
+{
+    if (i >= lights.size() || types[i] != params[i].type) {
+        return true;
+    }
+    set_params(lights[i], params[i]);
+    pending_commits.push_back(lights[i].handle());
+    return false;
+}
+
+bool SceneLights::update_all(std::vector<OSPObject> &pending_commits)
+{
+    if (params.size() != lights.size()) {
+        return true;
+    }
+    bool list_changed = false;
+    for (size_t i = 0; i < params.size(); ++i) {
+        list_changed |= update(i, pending_commits);
+    }
+    return list_changed;
+}
+
+void SceneLights::set_params(cpp::Light &light, const LightParams &p)
+{
+    light.setParam("intensity", p.intensity);
+    light.setParam("color", p.color);
+    if (p.type == "distant" || p.type == "hdri" || p.type == "sunSky") {
+        light.setParam("direction", p.direction);
+    }
+    if (p.type == "hdri" || p.type == "sunSky") {
+        light.setParam("up", p.up);
+    }
+    if (p.type == "sphere") {
+        light.setParam("position", p.position);
+        light.setParam("radius", p.radius);
+    }
+    if (p.type == "hdri") {
+        light.setParam("map", load_hdri_map(p.map));
+    }
+    if (p.type == "sunSky") {
+        light.setParam("turbidity", p.turbidity);
+        light.setParam("albedo", p.albedo);
+    }
+}
+
+cpp::Texture SceneLights::load_hdri_map(const std::string &file)
+{
+    auto fnd = hdri_maps.find(file);
+    if (fnd != hdri_maps.end()) {
+        return fnd->second;
+    }
+
+    int x, y, n;
+    float *data = stbi_loadf(file.c_str(), &x, &y, &n, 3);
+    if (!data) {
+        throw std::runtime_error("Failed to load HDRI environment map " + file);
+    }
+    cpp::Texture tex("texture2d");
+    tex.setParam("format", OSP_TEXTURE_RGB32F);
+    tex.setParam("data",
+                 cpp::CopiedData(reinterpret_cast<const math::vec3f *>(data),
+                                 math::vec2ul(x, y)));
+    tex.commit();
+    stbi_image_free(data);
+
+    std::cout << "Loaded HDRI environment map " << get_file_basename(file) << " (" << x
+              << "x" << y << ")\n";
+    hdri_maps[file] = tex;
+    return tex;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ospray/ospray.h>
+#include <ospray/ospray_cpp.h>
+#include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <rkcommon/math/vec.h>
+#include "session_state.h"
+
+using namespace ospray;
+using namespace rkcommon;
+
+// The light types which can be added to the scene, in the order shown in the UI
+const std::vector<std::string> &light_types();
+
+// An ambient light and two distant lights
+std::vector<LightParams> default_lights();
+
+// The lights of the scene and their OSPRay objects. Editing a light sets and commits only
+// that light, which the world reads from in place, while the world's light list is only
+// replaced when lights are added, removed or change type
+struct SceneLights {
+    std::vector<LightParams> params;
+
+    // Create the OSPRay lights for all the params and return the world's light list, used
+    // when the scene is created and whenever update or update_all return true
+    cpp::CopiedData light_list();
+
+    // Set light i's parameters from params[i] and add it to pending_commits. Returns true
+    // if the light had to be re-created for a new type, in which case the world's light
+    // list must be replaced with light_list()
+    bool update(size_t i, std::vector<OSPObject> &pending_commits);
+
+    // Update every light after params was reassigned, returns true if the world's light list
+    // must be replaced
+    bool update_all(std::vector<OSPObject> &pending_commits);
+
+private:
+    std::vector<cpp::Light> lights;
+    std::vector<std::string> types;
+    // The environment map textures of hdri lights by image file, loaded once
+    std::map<std::string, cpp::Texture> hdri_maps;
+
+    void set_params(cpp::Light &light, const LightParams &p);
+
+    cpp::Texture load_hdri_map(const std::string &file);
+};
@@ -82,6 +82,11 @@ VolumeBrick load_off(const std::string &file_name)
     volume_data.brick.setParam("vertex.data", cpp::CopiedData(vertex_scalars));
     volume_data.brick.commit();
     volume_data.model = cpp::VolumetricModel(volume_data.brick);
+    volume_data.ospray_memory = std::make_shared<TrackedMemory>(
+        MemoryCategory::VOLUME_OSPRAY,
+        vertex_positions.size() * sizeof(math::vec3f) +
+            vertex_indices.size() * sizeof(uint64_t) + cell_offsets.size() * sizeof(uint64_t) +
+            cell_types.size() * sizeof(uint8_t) + vertex_scalars.size() * sizeof(float));
 
     return volume_data;
 }
@@ -1,13 +1,17 @@
 #include "loader.h"
 #include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <ospray/ospray.h>
 #include <ospray/ospray_cpp.h>
+#include <tbb/parallel_for.h>
 #include "json.hpp"
 #include "stb_image.h"
 #include "util.h"
+#include "vector_field.h"
 
 #ifdef USE_EXPLICIT_ISOSURFACE
 #include <vtkDoubleArray.h>
@@ -26,65 +30,223 @@
 #include <Visus/IdxDataset.h>
 #endif
 
-VolumeBrick load_raw_volume(const json &config)
+json load_volume_config(const std::string &config_file)
 {
-    VolumeBrick brick;
+    json config;
+    std::ifstream cfg_file(config_file.c_str());
+    cfg_file >> config;
 
-    const std::string volume_file = config["volume"].get<std::string>();
-    const math::vec3f grid_spacing = get_vec<float, 3>(config["spacing"]);
-    brick.dims = get_vec<int, 3>(config["size"]);
-    brick.bounds = math::box3f(math::vec3f(0), brick.dims * grid_spacing);
-
-    brick.brick = cpp::Volume("structuredRegular");
-    brick.brick.setParam("dimensions", brick.dims);
-    brick.brick.setParam("gridSpacing", grid_spacing);
+    std::string base_path = get_file_basepath(config_file);
+    if (base_path == config_file) {
+        base_path = ".";
+    }
+    // Multi-field volumes list a raw file and voxel type for each field on the shared grid,
+    // the first field is loaded when no field is picked
+    if (config.find("fields") != config.end()) {
+        if (config["fields"].empty()) {
+            throw std::runtime_error("Volume config " + config_file + " has no fields");
+        }
+        for (auto &field : config["fields"]) {
+            field["volume"] = base_path + "/" + get_file_basename(field["url"]);
+            if (field.find("type") == field.end()) {
+                field["type"] = config["type"];
+            }
+        }
+        if (config.find("url") == config.end()) {
+            config["url"] = config["fields"][0]["url"];
+            config["type"] = config["fields"][0]["type"];
+        }
+    }
+    const std::string base_name = get_file_basename(config["url"]);
+    config["volume"] = base_path + "/" + base_name;
+    return config;
+}
 
-    size_t voxel_size = 0;
-    const std::string voxel_type_string = config["type"].get<std::string>();
-    if (voxel_type_string == "uint8") {
-        voxel_size = 1;
-        brick.brick.setParam("voxelType", int(OSP_UCHAR));
-    } else if (voxel_type_string == "uint16") {
-        voxel_size = 2;
-        brick.brick.setParam("voxelType", int(OSP_USHORT));
-    } else if (voxel_type_string == "float32") {
-        voxel_size = 4;
-        brick.brick.setParam("voxelType", int(OSP_FLOAT));
-    } else if (voxel_type_string == "float64") {
-        voxel_size = 8;
-        brick.brick.setParam("voxelType", int(OSP_DOUBLE));
-    } else {
-        throw std::runtime_error("Unrecognized voxel type " + voxel_type_string);
+std::vector<std::string> volume_field_names(const json &config)
+{
+    std::vector<std::string> names;
+    if (config.find("fields") != config.end()) {
+        for (const auto &field : config["fields"]) {
+            names.push_back(field["name"].get<std::string>());
+        }
     }
+    return names;
+}
 
-    const size_t n_voxels = brick.dims.long_product();
-    brick.voxel_data = std::make_shared<std::vector<uint8_t>>(n_voxels * voxel_size, 0);
+json volume_field_config(const json &config, const size_t field)
+{
+    if (config.find("fields") == config.end() || field >= config["fields"].size()) {
+        throw std::runtime_error("Invalid volume field index " + std::to_string(field));
+    }
+    const json &f = config["fields"][field];
+    json field_config = config;
+    field_config.erase("fields");
+    field_config["name"] = f["name"];
+    field_config["url"] = f["url"];
+    field_config["volume"] = f["volume"];
+    field_config["type"] = f["type"];
+    if (f.find("range") != f.end()) {
+        field_config["range"] = f["range"];
+    }
+    return field_config;
+}
 
-    std::ifstream fin(volume_file.c_str(), std::ios::binary);
-    if (!fin.read(reinterpret_cast<char *>(brick.voxel_data->data()),
-                  brick.voxel_data->size())) {
-        throw std::runtime_error("Failed to read volume " + volume_file);
+size_t voxel_type_size(const std::string &voxel_type)
+{
+    if (voxel_type == "uint8") {
+        return 1;
+    } else if (voxel_type == "uint16") {
+        return 2;
+    } else if (voxel_type == "float32") {
+        return 4;
+    } else if (voxel_type == "float64") {
+        return 8;
+    } else if (voxel_type == "vec3f") {
+        return 12;
     }
+    throw std::runtime_error("Unrecognized voxel type " + voxel_type);
+}
+
+void make_structured_volume(VolumeBrick &brick,
+                            const math::vec3f &grid_spacing,
+                            const math::vec3f &grid_origin)
+{
+    brick.brick = cpp::Volume("structuredRegular");
+    brick.brick.setParam("dimensions", brick.dims);
+    brick.brick.setParam("gridOrigin", grid_origin);
+    brick.brick.setParam("gridSpacing", grid_spacing);
 
     cpp::SharedData osp_data;
-    if (voxel_type_string == "uint8") {
+    if (brick.voxel_type == "uint8") {
+        brick.brick.setParam("voxelType", int(OSP_UCHAR));
         osp_data = cpp::SharedData(brick.voxel_data->data(), math::vec3ul(brick.dims));
-    } else if (voxel_type_string == "uint16") {
+    } else if (brick.voxel_type == "uint16") {
+        brick.brick.setParam("voxelType", int(OSP_USHORT));
         osp_data = cpp::SharedData(reinterpret_cast<uint16_t *>(brick.voxel_data->data()),
                                    math::vec3ul(brick.dims));
-    } else if (voxel_type_string == "float32") {
+    } else if (brick.voxel_type == "float32") {
+        brick.brick.setParam("voxelType", int(OSP_FLOAT));
         osp_data = cpp::SharedData(reinterpret_cast<float *>(brick.voxel_data->data()),
                                    math::vec3ul(brick.dims));
-    } else if (voxel_type_string == "float64") {
+    } else if (brick.voxel_type == "float64") {
+        brick.brick.setParam("voxelType", int(OSP_DOUBLE));
         osp_data = cpp::SharedData(reinterpret_cast<double *>(brick.voxel_data->data()),
                                    math::vec3ul(brick.dims));
+    } else {
+        throw std::runtime_error("Unrecognized voxel type " + brick.voxel_type);
     }
     brick.brick.setParam("data", osp_data);
     brick.brick.commit();
     brick.model = cpp::VolumetricModel(brick.brick);
+}
+
+VolumeBrick load_raw_volume(const json &config)
+{
+    const math::vec3i dims = get_vec<int, 3>(config["size"]);
+    return load_raw_volume(config, math::box3i(math::vec3i(0), dims));
+}
+
+VolumeBrick load_raw_volume(const json &config, const math::box3i &region)
+{
+    VolumeBrick brick;
+
+    const std::string volume_file = config["volume"].get<std::string>();
+    const math::vec3f grid_spacing = get_vec<float, 3>(config["spacing"]);
+    const math::vec3i volume_dims = get_vec<int, 3>(config["size"]);
+    if (region.lower.x < 0 || region.lower.y < 0 || region.lower.z < 0 ||
+        region.upper.x > volume_dims.x || region.upper.y > volume_dims.y ||
+        region.upper.z > volume_dims.z || reduce_min(region.size()) <= 0) {
+        throw std::runtime_error("Invalid region to read from volume " + volume_file);
+    }
+    brick.dims = region.size();
+    brick.bounds = math::box3f(region.lower * grid_spacing, region.upper * grid_spacing);
+    brick.voxel_type = config["type"].get<std::string>();
+
+    const size_t voxel_size = voxel_type_size(brick.voxel_type);
+    const size_t n_voxels = brick.dims.long_product();
+    brick.voxel_data =
+        make_tracked_buffer(MemoryCategory::VOLUME_HOST, n_voxels * voxel_size);
+
+    std::ifstream fin(volume_file.c_str(), std::ios::binary);
+    if (brick.dims == volume_dims) {
+        if (!fin.read(reinterpret_cast<char *>(brick.voxel_data->data()),
+                      brick.voxel_data->size())) {
+            throw std::runtime_error("Failed to read volume " + volume_file);
+        }
+    } else {
+        // Read the region a row at a time, seeking to the start of each row in the file
+        const size_t row_bytes = brick.dims.x * voxel_size;
+        uint8_t *out = brick.voxel_data->data();
+        for (int z = region.lower.z; z < region.upper.z; ++z) {
+            for (int y = region.lower.y; y < region.upper.y; ++y) {
+                const size_t offset =
+                    ((size_t(z) * volume_dims.y + y) * volume_dims.x + region.lower.x) *
+                    voxel_size;
+                fin.seekg(offset);
+                if (!fin.read(reinterpret_cast<char *>(out), row_bytes)) {
+                    throw std::runtime_error("Failed to read volume " + volume_file);
+                }
+                out += row_bytes;
+            }
+        }
+    }
+
+    // Vector fields are rendered as their magnitudes, with the vectors kept for tracing
+    if (brick.voxel_type == "vec3f") {
+        auto field = std::make_shared<VectorField>();
+        field->dims = brick.dims;
+        field->bounds = brick.bounds;
+        field->data = brick.voxel_data;
+        VolumeBrick magnitude = compute_magnitude_volume(*field);
+        magnitude.vectors = field;
+        return magnitude;
+    }
+
+    make_structured_volume(brick, grid_spacing, region.lower * grid_spacing);
     return brick;
 }
 
+VolumeBrick crop_volume(const VolumeBrick &brick, const math::box3i &region)
+{
+    if (!brick.voxel_data) {
+        throw std::runtime_error("Only structured volumes can be cropped");
+    }
+    if (region.lower.x < 0 || region.lower.y < 0 || region.lower.z < 0 ||
+        region.upper.x > brick.dims.x || region.upper.y > brick.dims.y ||
+        region.upper.z > brick.dims.z || reduce_min(region.size()) <= 0) {
+        throw std::runtime_error("Invalid crop region");
+    }
+    const math::vec3f grid_spacing = brick.bounds.size() / math::vec3f(brick.dims);
+
+    VolumeBrick cropped;
+    cropped.dims = region.size();
+    cropped.bounds = math::box3f(brick.bounds.lower + region.lower * grid_spacing,
+                                 brick.bounds.lower + region.upper * grid_spacing);
+    cropped.voxel_type = brick.voxel_type;
+    cropped.value_range = brick.value_range;
+    // Streamlines are still traced through the whole vector field
+    cropped.vectors = brick.vectors;
+
+    const size_t voxel_size = voxel_type_size(brick.voxel_type);
+    const size_t row_bytes = cropped.dims.x * voxel_size;
+    cropped.voxel_data = make_tracked_buffer(MemoryCategory::VOLUME_HOST,
+                                             cropped.dims.long_product() * voxel_size);
+    const uint8_t *in = brick.voxel_data->data();
+    uint8_t *out = cropped.voxel_data->data();
+    tbb::parallel_for(0, cropped.dims.z, [&](const int z) {
+        for (int y = 0; y < cropped.dims.y; ++y) {
+            const size_t in_row =
+                size_t(z + region.lower.z) * brick.dims.y + y + region.lower.y;
+            const size_t in_offset = (in_row * brick.dims.x + region.lower.x) * voxel_size;
+            const size_t out_offset = (size_t(z) * cropped.dims.y + y) * row_bytes;
+            std::memcpy(out + out_offset, in + in_offset, row_bytes);
+        }
+    });
+
+    make_structured_volume(cropped, grid_spacing, cropped.bounds.lower);
+    return cropped;
+}
+
 VolumeBrick load_idx_volume(const std::string &idx_file, json &config)
 {
     VolumeBrick brick;
@@ -138,9 +300,11 @@ VolumeBrick load_idx_volume(const std::string &idx_file, json &config)
         brick.brick.setParam("voxelType", int(OSP_DOUBLE));
     }
     config["type"] = voxel_type;
+    brick.voxel_type = voxel_type;
 
     const size_t n_voxels = size_t(brick.dims.x) * size_t(brick.dims.y) * size_t(brick.dims.z);
-    brick.voxel_data = std::make_shared<std::vector<uint8_t>>(n_voxels * voxel_size, 0);
+    brick.voxel_data =
+        make_tracked_buffer(MemoryCategory::VOLUME_HOST, n_voxels * voxel_size);
     std::memcpy(brick.voxel_data->data(), query->buffer.c_ptr(), brick.voxel_data->size());
 
     cpp::SharedData osp_data;
@@ -167,9 +331,65 @@ VolumeBrick load_idx_volume(const std::string &idx_file, json &config)
     return brick;
 }
 
+math::vec2f compute_volume_value_range(const VolumeBrick &brick)
+{
+    if (brick.voxel_type == "uint8") {
+        return compute_value_range(brick.voxel_data->data(), brick.voxel_data->size());
+    } else if (brick.voxel_type == "uint16") {
+        return compute_value_range(reinterpret_cast<uint16_t *>(brick.voxel_data->data()),
+                                   brick.voxel_data->size() / sizeof(uint16_t));
+    } else if (brick.voxel_type == "float32") {
+        return compute_value_range(reinterpret_cast<float *>(brick.voxel_data->data()),
+                                   brick.voxel_data->size() / sizeof(float));
+    } else if (brick.voxel_type == "float64") {
+        return compute_value_range(reinterpret_cast<double *>(brick.voxel_data->data()),
+                                   brick.voxel_data->size() / sizeof(double));
+    }
+    throw std::runtime_error("Unrecognized voxel type " + brick.voxel_type);
+}
+
+VolumeBrick load_volume(const std::string &volume_file,
+                        json &config,
+                        math::vec2f value_range,
+                        const std::string &field)
+{
+    VolumeBrick brick;
+    const std::string ext = get_file_extension(volume_file);
+    if (ext == "json") {
+        config = load_volume_config(volume_file);
+        if (field.empty()) {
+            brick = load_raw_volume(config);
+        } else {
+            const std::vector<std::string> names = volume_field_names(config);
+            auto fnd = std::find(names.begin(), names.end(), field);
+            if (fnd == names.end()) {
+                throw std::runtime_error("Volume " + volume_file + " has no field " + field);
+            }
+            brick = load_raw_volume(volume_field_config(config, fnd - names.begin()));
+        }
+    } else if (ext == "off") {
+        return load_off(volume_file);
+    } else if (ext == "idx") {
+        config = json();
+        brick = load_idx_volume(volume_file, config);
+    } else {
+        std::cout << "Unsupported file type " << volume_file << "\n";
+        throw std::runtime_error("Unsupported file type " + volume_file);
+    }
+
+    if (!std::isfinite(value_range.x) || !std::isfinite(value_range.y)) {
+        std::cout << "Computing value range\n";
+        value_range = compute_volume_value_range(brick);
+        std::cout << "Computed value range: " << value_range << "\n";
+    }
+    brick.value_range = value_range;
+    return brick;
+}
+
 std::vector<cpp::Geometry> extract_isosurfaces(const json &config,
                                                const VolumeBrick &brick,
-                                               const std::vector<float> &isovalues)
+                                               const std::vector<float> &isovalues,
+                                               std::vector<TrackedMemory> *mesh_memory)
 {
     std::vector<cpp::Geometry> isosurfaces;
 #ifdef USE_EXPLICIT_ISOSURFACE
@@ -242,6 +462,11 @@ std::vector<cpp::Geometry> extract_isosurfaces(const json &config,
             isosurface.setParam("index", cpp::CopiedData(indices));
             isosurface.commit();
             isosurfaces.push_back(isosurface);
+            if (mesh_memory) {
+                mesh_memory->emplace_back(MemoryCategory::ISOSURFACE,
+                                          vertices.size() * sizeof(math::vec3f) +
+                                              indices.size() * sizeof(math::vec3ui));
+            }
         } else {
             std::cout << "Isosurface at " << v << " is empty\n";
         }
@@ -19,10 +19,60 @@ using namespace ospray;
 using namespace rkcommon;
 using json = nlohmann::json;
 
+// Read the JSON config for a raw volume and set its "volume" entry to the path of the raw
+// file, which is expected to be next to the JSON file
+json load_volume_config(const std::string &config_file);
+
+// Get the names of the fields of a multi-field volume config, empty if the volume has a
+// single field
+std::vector<std::string> volume_field_names(const json &config);
+
+// Get the config to load field i of a multi-field volume config, which is a single field
+// config with the field's raw file, voxel type and name on the volume's grid
+json volume_field_config(const json &config, const size_t field);
+
+// Get the size in bytes of a voxel of the named type (uint8, uint16, float32, float64 or
+// vec3f, three float32 components)
+size_t voxel_type_size(const std::string &voxel_type);
+
+// Setup the brick's structuredRegular OSPRay volume and volumetric model sharing the
+// brick's voxel_data. The dims, voxel_type and voxel_data of the brick must be set
+void make_structured_volume(VolumeBrick &brick,
+                            const math::vec3f &grid_spacing,
+                            const math::vec3f &grid_origin = math::vec3f(0.f));
+
 VolumeBrick load_raw_volume(const json &config);
 
+// Load the region of voxels [region.lower, region.upper) of a raw volume, reading only the
+// rows of the file within the region. The brick is placed at the region's position in the
+// full volume
+VolumeBrick load_raw_volume(const json &config, const math::box3i &region);
+
+// Copy the region of voxels [region.lower, region.upper) of the brick into a new brick with
+// its own structuredRegular volume, placed at the region's position in the brick. Only the
+// region is held and sampled by the new brick, so dropping the original brick releases the
+// rest of the voxels. The value range is kept from the brick, the gradient isn't copied and
+// the vector field is shared
+VolumeBrick crop_volume(const VolumeBrick &brick, const math::box3i &region);
+
 VolumeBrick load_idx_volume(const std::string &idx_file, json &config);
 
-std::vector<cpp::Geometry> extract_isosurfaces(const json &config,
-                                               const VolumeBrick &brick,
-                                               const std::vector<float> &isovalues);
+// Compute the value range of the brick's voxel data, dispatching on its voxel type
+math::vec2f compute_volume_value_range(const VolumeBrick &brick);
+
+// Load a volume from a JSON config, OFF tet mesh or IDX file, picking the loader based on
+// the file extension. If the value range is not finite it's computed from the data.
+// The config is filled out with the JSON config when loading raw volumes. For multi-field
+// volumes the named field is loaded, or the first field if field is empty
+VolumeBrick load_volume(const std::string &volume_file,
+                        json &config,
+                        math::vec2f value_range,
+                        const std::string &field = "");
+
+// Extract the isosurfaces from the brick. If mesh_memory is provided the size of the meshes
+// copied into OSPRay is tracked in it
+std::vector<cpp::Geometry> extract_isosurfaces(
+    const json &config,
+    const VolumeBrick &brick,
+    const std::vector<float> &isovalues,
+    std::vector<TrackedMemory> *mesh_memory = nullptr);
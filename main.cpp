@@ -1,26 +1,50 @@
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <future>
 #include <iostream>
 #include <limits>
+#include <map>
 #include <thread>
 #include <SDL.h>
 #include <ospray/ospray.h>
 #include <ospray/ospray_cpp.h>
 #include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <tbb/task_group.h>
 #include "arcball_camera.h"
 #include "glad/glad.h"
 #include "imgui/imgui.h"
 #include "imgui_impl_opengl3.h"
 #include "imgui_impl_sdl.h"
+#include "clipping.h"
+#include "cpu_raycaster.h"
+#include "dataset_cache.h"
+#include "distributed_render.h"
+#include "field_cache.h"
+#include "gradient_volume.h"
+#include "image_parallel.h"
+#include "lights.h"
 #include "loader.h"
+#include "render_quality.h"
+#include "render_server.h"
+#include "scene_volumes.h"
+#include "session_state.h"
+#include "slice_renderer.h"
 #include "stb_image.h"
 #include "stb_image_write.h"
 #include "util/arcball_camera.h"
+#include "util/frame_transport.h"
 #include "util/json.hpp"
+#include "util/memory_stats.h"
+#include "util/numa_util.h"
 #include "util/shader.h"
+#include "util/socket_util.h"
+#include "util/transfer_function_2d_widget.h"
 #include "util/transfer_function_widget.h"
 #include "util/util.h"
+#include "vector_field.h"
+#include "volume_histogram.h"
 
 using namespace ospray;
 using namespace rkcommon;
@@ -64,17 +88,77 @@ const std::string USAGE =
     "\n"
     "  -vr <lo> <hi>            Provide the value range for the volume to skip computing it\n"
     "\n"
-    "  -r (scivis|pathtracer)   Select the OSPRay renderer to use\n"
+    "  -r (scivis|pathtracer)   Select the OSPRay renderer to use. The -server and\n"
+    "                           -image-parallel modes also support -r preintegrated, a\n"
+    "                           CPU raycaster using a pre-integrated transfer function\n"
+    "                           table for fewer samples per ray. The interactive app\n"
+    "                           rejects it, since the raycaster can't draw the\n"
+    "                           isosurfaces, streamlines and other geometry it mixes with\n"
+    "                           the volume. It switches to the raycaster by itself while\n"
+    "                           a 2D transfer function or normal shading is enabled\n"
     "\n"
     "  -camera <eye_x> <eye_y> <eye_z> <at_x> <at_y> <at_z> <up_x> <up_y> <up_z>\n"
     "                           Specify the camera position, orbit center and up vector\n"
     "\n"
+    "  -crop <x0> <y0> <z0> <x1> <y1> <z1>\n"
+    "                           Render only the voxels [x0, x1) x [y0, y1) x [z0, z1) of the\n"
+    "                           volume, copied into a smaller volume. The crop box can also\n"
+    "                           be changed in the UI\n"
+    "\n"
+    "  -crop-release            Release the uncropped volume's memory when cropping, it's\n"
+    "                           reloaded if the crop is reset or moved\n"
+    "\n"
+    "  -field <name>            Select the field of a multi-field volume to show first,\n"
+    "                           other fields are loaded when they're selected in the UI\n"
+    "\n"
+    "  -field-budget <MB>       Keep previously selected fields loaded while all the loaded\n"
+    "                           fields fit in the budget. The default of 0 keeps only the\n"
+    "                           selected field\n"
+    "\n"
+    "  -add-volume <file> <x> <y> <z>\n"
+    "                           Show another volume translated by (x, y, z), e.g. to compare\n"
+    "                           datasets side by side or overlaid. Each volume has its own\n"
+    "                           transfer function window, and all are loaded in parallel\n"
+    "\n"
+    "  -volume-budget <MB>      Refuse to load volumes totalling more than the budget\n"
+    "\n"
+    "  -streamlines <n>         Trace streamlines through a \"vec3f\" vector field volume\n"
+    "                           from an n^3 grid of seeds. The volume shows the vectors'\n"
+    "                           magnitudes, and the seeds can be moved in the UI\n"
+    "\n"
+    "  -hide-magnitude          Hide the vector field's magnitude volume, e.g. to show only\n"
+    "                           its streamlines\n"
+    "\n"
+    "  -session <session.json>  Restore the dataset, value range, transfer function, camera,\n"
+    "                           lights, clipping planes, isosurfaces and renderer settings\n"
+    "                           saved with the \"Save Session\" button, which saves back to\n"
+    "                           this file (default session.json). Arguments after -session\n"
+    "                           override the session's settings\n"
+    "\n"
     "  -tfn [ignore_opacity] <tfcn.png/jpg>\n"
     "                           Load the saved RGBA transfer function from the provided "
     "image\n"
     "                           file. If you optionally set ignore_opacity as the first arg\n"
     "                           the opacity in the file will not be used\n"
     "\n"
+    "  -colormap-dir [ignore_opacity] <dir>\n"
+    "                           Load the PNG and JPG colormaps in the directory in the\n"
+    "                           background, adding them to the colormap list as they're\n"
+    "                           loaded. The images are treated like -tfn images\n"
+    "\n"
+    "  -tfn-res <n>             Number of entries in the transfer function table\n"
+    "                           (default 1024)\n"
+    "\n"
+    "  -gradient [u8]           Compute the volume's gradient magnitudes after loading for\n"
+    "                           2D value x gradient magnitude transfer functions, optionally\n"
+    "                           quantized to 8 bits. 2D transfer functions are rendered with\n"
+    "                           the CPU raycaster, which doesn't render isosurfaces,\n"
+    "                           clipping planes or lights. Also applies to -server\n"
+    "\n"
+    "  -normals                 Precompute the volume's gradient directions as 16-bit\n"
+    "                           octahedral normals after loading, for shading the volume\n"
+    "                           with a headlight in the CPU raycaster\n"
+    "\n"
     "  -bg <r> <g> <b>          Set the desired background color (default white)\n"
     "\n"
     "  -iso-color <r> <g> <b>   Set the desired isosurface color (default light gray)\n"
@@ -89,87 +173,124 @@ const std::string USAGE =
     "  -dir2 <intensity> <x> <y> <z>\n"
     "                           Set the second directional light intensity and direction\n"
     "\n"
+    "  -hdri <file> <intensity> Add an HDRI environment light with the image file as its map\n"
+    "                           (e.g. a .hdr file). Any number of lights of each type can\n"
+    "                           be set in a -session file\n"
+    "\n"
     "  -density-scale <x>       Set the volume density scaling\n"
     "\n"
+    "  -quality (interactive|balanced|final|auto)\n"
+    "                           Set the renderer's pixel samples, AO samples, shadows and\n"
+    "                           max path length from a quality preset. auto (the default)\n"
+    "                           renders with the interactive preset while the camera moves\n"
+    "                           and the final preset once it stops. The frame times of each\n"
+    "                           preset are printed on exit\n"
+    "\n"
     "  -nf <n>                  Set the number of frames to render before saving the image "
     "and exiting\n"
     "\n"
     "  -o <name.jpg>            Set the output image filename\n"
     "\n"
+    "  -stream <address>        Stream frames to a receiver listening on the address, e.g.\n"
+    "                           mini_scivis_client <address> -listen. Previews are sent\n"
+    "                           while the camera moves and changed tiles as the image\n"
+    "                           accumulates\n"
+    "\n"
+    "  -stream-accum <n>        Number of frames to accumulate before sending the converged\n"
+    "                           full quality frame (default 64)\n"
+    "\n"
+    "  -server <address>        Run headless as a render server listening on the address,\n"
+    "                           either unix:<path> or [host:]port. Clients send JSON\n"
+    "                           updates and receive JPEG frames, see mini_scivis_client.\n"
+    "                           The -vr, -r, -bg and -density-scale options also apply\n"
+    "\n"
+    "  -server-fps <fps>        Max rate to send progressive frames to clients (default 30)\n"
+    "\n"
+    "  -server-accum <n>        Number of frames to accumulate before the image is converged\n"
+    "                           and the server idles (default 64)\n"
+    "\n"
+    "  -mpi                     Render data-parallel across MPI ranks, run with mpirun. Each\n"
+    "                           rank loads a partition of the raw volume and rank 0 saves\n"
+    "                           the composited image after -nf frames (default 32) to -o.\n"
+    "                           The -vr, -r, -camera, -bg and -density-scale options also\n"
+    "                           apply\n"
+    "\n"
+    "  -ghost <n>               Number of ghost voxels loaded around each MPI rank's\n"
+    "                           partition (default 1)\n"
+    "\n"
+    "  -image-parallel <n>      Render image-parallel on n local processes which each load\n"
+    "                           a copy of the volume and render a subset of the image's\n"
+    "                           strips, then save the image after -nf frames to -o. Each\n"
+    "                           process is pinned to a NUMA node, assigned round-robin.\n"
+    "                           The -vr, -r, -camera, -bg and -density-scale options also\n"
+    "                           apply\n"
+    "\n"
+    "  -strips <n>              Number of image strips per image parallel process\n"
+    "                           (default 4)\n"
+    "\n"
+    "  -no-numa-pin             Don't pin image parallel processes to NUMA nodes\n"
+    "\n"
+    "  -size <w> <h>            Image size for -mpi and -image-parallel (default 1280 720)\n"
+    "\n"
+    "  -numa-threads <node>     Pin the app's threads, including OSPRay's worker threads, to\n"
+    "                           the NUMA node\n"
+    "\n"
+    "  -numa-loader <node>      Run the volume loader's threads on the NUMA node\n"
+    "\n"
+    "  -numa-memory <node|interleave>\n"
+    "                           Allocate the volume memory on the NUMA node, or interleave\n"
+    "                           its pages across all nodes\n"
+    "\n"
+    "  -numa-report             Report the NUMA placement of the threads and volume memory\n"
+    "                           after loading, this is done whenever a -numa option is set\n"
+    "\n"
     "  -h                       Print this help.";
 
 int win_width = 1280;
 int win_height = 720;
-
-struct ClippingPlane {
-    int axis = 0;
-    bool flip_plane = false;
-    bool enabled = false;
-    math::vec3f position;
-
-    cpp::Geometry geom;
-    cpp::GeometricModel model;
-    cpp::Group group;
-    cpp::Instance instance;
-
-    ClippingPlane(int axis = 0, const math::vec3f &pos = math::vec3f(0.f))
-        : axis(axis), position(pos), geom("plane")
-    {
-        math::vec4f normal(0.f);
-        normal[axis] = 1.f;
-        geom.setParam("plane.coefficients", cpp::CopiedData(normal));
-        geom.commit();
-
-        model = cpp::GeometricModel(geom);
-        model.commit();
-
-        group.setParam("clippingGeometry", cpp::CopiedData(model));
-        group.commit();
-
-        instance = cpp::Instance(group);
-        const math::affine3f xfm =
-            math::affine3f::translate(math::vec3f(position.x, position.y, position.z));
-        instance.setParam("xfm", xfm);
-        instance.commit();
-    }
-
-    void flip_direction(bool flip_dir, std::vector<OSPObject> &pending_commits)
-    {
-        flip_plane = flip_dir;
-        model.setParam("invertNormals", flip_plane);
-        pending_commits.push_back(model.handle());
-        pending_commits.push_back(group.handle());
-        pending_commits.push_back(instance.handle());
-    }
-
-    void set_position(const float &pos, std::vector<OSPObject> &pending_commits)
-    {
-        position[axis] = pos;
-        const math::affine3f xfm =
-            math::affine3f::translate(math::vec3f(position.x, position.y, position.z));
-        instance.setParam("xfm", xfm);
-        pending_commits.push_back(instance.handle());
-    }
-};
-
-struct LightParams {
-    float intensity = 0.5f;
-    math::vec3f direction = math::vec3f(0.f);
-
-    LightParams() = default;
-    LightParams(float intensity) : intensity(intensity) {}
-    LightParams(float intensity, const math::vec3f &dir) : intensity(intensity), direction(dir)
-    {
-    }
-};
+// NUMA placement of the threads and volume memory, and whether to report it after loading
+NumaPlacement numa_placement;
+bool numa_report = false;
 
 glm::vec2 transform_mouse(glm::vec2 in)
 {
     return glm::vec2(in.x * 2.f / win_width - 1.f, 1.f - 2.f * in.y / win_height);
 }
 
+// Compute the brick's gradient magnitude volume for 2D transfer functions
+void compute_brick_gradient(VolumeBrick &brick, const bool quantize)
+{
+    const auto start = std::chrono::steady_clock::now();
+    brick.gradient =
+        std::make_shared<GradientVolume>(compute_gradient_magnitude(brick, quantize));
+    const double elapsed_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+    std::cout << "Computed " << (quantize ? "8-bit" : "float") << " gradient magnitudes ("
+              << format_bytes(brick.gradient->data->size()) << ") in " << elapsed_ms
+              << "ms\n";
+}
+
+// Compute the brick's quantized normals for shading in the CPU raycaster
+void compute_brick_normals(VolumeBrick &brick)
+{
+    const auto start = std::chrono::steady_clock::now();
+    brick.normals = std::make_shared<NormalVolume>(compute_normal_volume(brick));
+    const double elapsed_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+            .count();
+    std::cout << "Computed 16-bit normals (" << format_bytes(brick.normals->data->size())
+              << ") in " << elapsed_ms << "ms\n";
+}
+
 void run_app(const std::vector<std::string> &args, SDL_Window *window);
 
+void run_server(const std::vector<std::string> &args);
+
+void run_distributed(const std::vector<std::string> &args);
+
+void run_image_parallel_render(const std::vector<std::string> &args);
+
 int main(int argc, const char **argv)
 {
     if (argc < 2) {
@@ -179,9 +300,57 @@ int main(int argc, const char **argv)
         return 1;
     }
 
-    OSPError init_err = ospInit(&argc, argv);
-    if (init_err != OSP_NO_ERROR) {
-        throw std::runtime_error("Failed to initialize OSPRay");
+    // The image parallel workers are forked before OSPRay is initialized, and each
+    // initialize it themselves
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-image-parallel") {
+            run_image_parallel_render(std::vector<std::string>(argv, argv + argc));
+            return 0;
+        }
+    }
+
+    bool distributed = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        distributed = distributed || arg == "-mpi";
+        if (arg == "-numa-threads") {
+            numa_placement.thread_node = std::stoi(argv[++i]);
+        } else if (arg == "-numa-loader") {
+            numa_placement.loader_node = std::stoi(argv[++i]);
+        } else if (arg == "-numa-memory") {
+            const std::string node = argv[++i];
+            if (node == "interleave") {
+                numa_placement.interleave_memory = true;
+            } else {
+                numa_placement.memory_node = std::stoi(node);
+            }
+        } else if (arg == "-numa-report") {
+            numa_report = true;
+        }
+    }
+    numa_report = numa_report || numa_placement.thread_node >= 0 ||
+                  numa_placement.loader_node >= 0 || numa_placement.memory_node >= 0 ||
+                  numa_placement.interleave_memory;
+    // Pin before initializing OSPRay so its worker threads are created on the node
+    if (!apply_thread_placement(numa_placement)) {
+        std::cerr << "[warning]: Failed to pin threads to NUMA node "
+                  << numa_placement.thread_node << "\n";
+    }
+#ifdef MPI_FOUND
+    if (distributed) {
+        init_distributed_device(argc, argv);
+    }
+#else
+    if (distributed) {
+        std::cerr << "[error]: Compile with MPI to enable distributed rendering\n";
+        return 1;
+    }
+#endif
+    if (!distributed) {
+        OSPError init_err = ospInit(&argc, argv);
+        if (init_err != OSP_NO_ERROR) {
+            throw std::runtime_error("Failed to initialize OSPRay");
+        }
     }
 
     OSPDevice device = ospGetCurrentDevice();
@@ -203,10 +372,29 @@ int main(int argc, const char **argv)
 
     ospDeviceSetParam(device, "warnAsError", OSP_BOOL, &warnAsErrors);
     ospDeviceSetParam(device, "logLevel", OSP_INT, &logLevel);
+    if (numa_placement.thread_node >= 0) {
+        // Match OSPRay's thread count to the node it's pinned to
+        int num_threads = find_numa_node(numa_placement.thread_node).cpus.size();
+        ospDeviceSetParam(device, "numThreads", OSP_INT, &num_threads);
+    }
 
     ospDeviceCommit(device);
     ospDeviceRelease(device);
 
+    const std::vector<std::string> args(argv, argv + argc);
+#ifdef MPI_FOUND
+    if (distributed) {
+        run_distributed(args);
+        shutdown_distributed_device();
+        return 0;
+    }
+#endif
+    if (std::find(args.begin(), args.end(), "-server") != args.end()) {
+        run_server(args);
+        ospShutdown();
+        return 0;
+    }
+
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
         std::cerr << "Failed to init SDL: " << SDL_GetError() << "\n";
         return -1;
@@ -250,7 +438,7 @@ int main(int argc, const char **argv)
     ImGui_ImplSDL2_InitForOpenGL(window, gl_context);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
-    run_app(std::vector<std::string>(argv, argv + argc), window);
+    run_app(args, window);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL2_Shutdown();
@@ -265,6 +453,154 @@ int main(int argc, const char **argv)
     return 0;
 }
 
+void run_server(const std::vector<std::string> &args)
+{
+    RenderServerParams params;
+    params.session.img_size = math::vec2i(win_width, win_height);
+    math::vec2f value_range(std::numeric_limits<float>::infinity());
+    std::string volume_file;
+    bool compute_gradient = false;
+    bool quantize_gradient = false;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "-server") {
+            params.address = args[++i];
+        } else if (args[i] == "-server-fps") {
+            params.transport.max_fps = std::stof(args[++i]);
+        } else if (args[i] == "-server-accum") {
+            params.max_accumulation = std::stoi(args[++i]);
+        } else if (args[i] == "-vr") {
+            value_range.x = std::stof(args[++i]);
+            value_range.y = std::stof(args[++i]);
+        } else if (args[i] == "-r") {
+            params.session.renderer_type = args[++i];
+        } else if (args[i] == "-bg") {
+            params.session.background_color.x = std::stof(args[++i]);
+            params.session.background_color.y = std::stof(args[++i]);
+            params.session.background_color.z = std::stof(args[++i]);
+        } else if (args[i] == "-density-scale") {
+            params.session.density_scale = std::stof(args[++i]);
+        } else if (args[i] == "-gradient") {
+            compute_gradient = true;
+            if (i + 1 < args.size() && args[i + 1] == "u8") {
+                quantize_gradient = true;
+                ++i;
+            }
+        } else if (args[i][0] != '-') {
+            volume_file = args[i];
+        }
+    }
+    if (volume_file.empty()) {
+        std::cout << "No volume file provided!\n";
+        throw std::runtime_error("No volume file provided");
+    }
+
+    std::shared_ptr<VolumeBrick> dataset;
+    run_with_numa_placement(numa_placement, [&]() {
+        dataset = dataset_cache().acquire(volume_file, value_range);
+    });
+    if (numa_report) {
+        std::cout << numa_placement_report(dataset->voxel_data ? dataset->voxel_data->data()
+                                                               : nullptr,
+                                           dataset->voxel_data ? dataset->voxel_data->size()
+                                                               : 0);
+    }
+    record_memory_stage("Volume loaded");
+    if (compute_gradient && !dataset->gradient) {
+        compute_brick_gradient(*dataset, quantize_gradient);
+        record_memory_stage("Gradients computed");
+    }
+
+    run_render_server(dataset, params);
+    record_memory_stage("Exit");
+    std::cout << memory_report();
+}
+
+// Parse the option at args[i] if it's one shared by the batch render modes, advancing i
+// past its values. Returns false if it's not one of these options
+bool parse_batch_render_arg(const std::vector<std::string> &args,
+                            size_t &i,
+                            BatchRenderParams &params)
+{
+    if (args[i] == "-vr") {
+        params.value_range.x = std::stof(args[++i]);
+        params.value_range.y = std::stof(args[++i]);
+    } else if (args[i] == "-r") {
+        params.session.renderer_type = args[++i];
+    } else if (args[i] == "-camera") {
+        json eye, at, up;
+        for (json *v : {&eye, &at, &up}) {
+            for (int j = 0; j < 3; ++j) {
+                v->push_back(std::stof(args[++i]));
+            }
+        }
+        params.camera = {{"eye", eye}, {"at", at}, {"up", up}};
+    } else if (args[i] == "-bg") {
+        params.session.background_color.x = std::stof(args[++i]);
+        params.session.background_color.y = std::stof(args[++i]);
+        params.session.background_color.z = std::stof(args[++i]);
+    } else if (args[i] == "-density-scale") {
+        params.session.density_scale = std::stof(args[++i]);
+    } else if (args[i] == "-size") {
+        params.session.img_size.x = std::stoi(args[++i]);
+        params.session.img_size.y = std::stoi(args[++i]);
+    } else if (args[i] == "-nf") {
+        params.frames = std::stoi(args[++i]);
+    } else if (args[i] == "-o") {
+        params.output_image_file = args[++i];
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void run_distributed(const std::vector<std::string> &args)
+{
+    DistributedRenderParams params;
+    params.render.session.img_size = math::vec2i(win_width, win_height);
+    std::string volume_file;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (parse_batch_render_arg(args, i, params.render)) {
+            continue;
+        } else if (args[i] == "-ghost") {
+            params.ghost_voxels = std::stoi(args[++i]);
+        } else if (args[i][0] != '-') {
+            volume_file = args[i];
+        }
+    }
+    if (volume_file.empty()) {
+        std::cout << "No volume file provided!\n";
+        throw std::runtime_error("No volume file provided");
+    }
+#ifdef MPI_FOUND
+    run_distributed_render(volume_file, params);
+#endif
+}
+
+void run_image_parallel_render(const std::vector<std::string> &args)
+{
+    ImageParallelParams params;
+    params.render.session.img_size = math::vec2i(win_width, win_height);
+    std::string volume_file;
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (parse_batch_render_arg(args, i, params.render)) {
+            continue;
+        } else if (args[i] == "-image-parallel") {
+            params.processes = std::stoi(args[++i]);
+        } else if (args[i] == "-strips") {
+            params.strips_per_process = std::stoi(args[++i]);
+        } else if (args[i] == "-no-numa-pin") {
+            params.pin_numa = false;
+        } else if (args[i][0] != '-') {
+            volume_file = args[i];
+        }
+    }
+    if (volume_file.empty()) {
+        std::cout << "No volume file provided!\n";
+        throw std::runtime_error("No volume file provided");
+    }
+    run_image_parallel(volume_file, params);
+}
+
 void run_app(const std::vector<std::string> &args, SDL_Window *window)
 {
     json config;
@@ -281,19 +617,42 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
     std::vector<math::vec4f> isosurface_colors;
     float isosurface_opacity = 1.f;
     std::vector<Colormap> cmdline_colormaps;
-    std::array<LightParams, 3> light_params = {
-        LightParams(0.3f),
-        LightParams(1.f, math::vec3f(0.5f, -1.f, 0.25f)),
-        LightParams(1.f, math::vec3f(-0.5f, -0.5f, 0.5f))};
+    // Colormap directories to load in the background, and whether to use their opacity
+    std::vector<std::pair<std::string, bool>> colormap_dirs;
+    size_t tfn_resolution = 1024;
+    bool compute_gradient = false;
+    bool quantize_gradient = false;
+    bool compute_normals = false;
+    bool cmdline_crop = false;
+    bool crop_release = false;
+    math::box3i crop_region(math::vec3i(0), math::vec3i(0));
+    std::vector<LightParams> light_params = default_lights();
+    std::string field_name;
+    size_t field_budget = 0;
+    std::vector<SceneVolumeState> volume_states;
+    size_t volume_budget = 0;
+    int streamline_res = 0;
+    bool show_magnitude = true;
 
     std::string volume_file;
+    // The session restored with -session, and the file the UI saves the session to
+    SessionState session;
+    bool restore_session = false;
+    // Whether the value range and field are the session's, which only apply to its volume
+    bool session_value_range = false;
+    bool session_field = false;
+    std::string session_file = "session.json";
     int render_frame_count = -1;
+    std::string stream_address;
+    int stream_accumulation = 64;
     std::string output_image_file = "mini_scivis.jpg";
     float density_scale = 1.f;
+    std::string quality = "auto";
     for (size_t i = 1; i < args.size(); ++i) {
         if (args[i] == "-vr") {
             value_range.x = std::stof(args[++i]);
             value_range.y = std::stof(args[++i]);
+            session_value_range = false;
         } else if (args[i] == "-iso") {
             isovalues.push_back(std::stof(args[++i]));
         } else if (args[i] == "-r") {
@@ -311,6 +670,84 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
             cam_up.x = std::stof(args[++i]);
             cam_up.y = std::stof(args[++i]);
             cam_up.z = std::stof(args[++i]);
+        } else if (args[i] == "-crop") {
+            cmdline_crop = true;
+            for (int j = 0; j < 3; ++j) {
+                crop_region.lower[j] = std::stoi(args[++i]);
+            }
+            for (int j = 0; j < 3; ++j) {
+                crop_region.upper[j] = std::stoi(args[++i]);
+            }
+        } else if (args[i] == "-crop-release") {
+            crop_release = true;
+        } else if (args[i] == "-field") {
+            field_name = args[++i];
+            session_field = false;
+        } else if (args[i] == "-field-budget") {
+            field_budget = std::stoul(args[++i]) * 1024 * 1024;
+        } else if (args[i] == "-add-volume") {
+            SceneVolumeState v;
+            v.volume_file = args[++i];
+            v.translation.x = std::stof(args[++i]);
+            v.translation.y = std::stof(args[++i]);
+            v.translation.z = std::stof(args[++i]);
+            volume_states.push_back(v);
+        } else if (args[i] == "-volume-budget") {
+            volume_budget = std::stoul(args[++i]) * 1024 * 1024;
+        } else if (args[i] == "-streamlines") {
+            streamline_res = std::stoi(args[++i]);
+        } else if (args[i] == "-hide-magnitude") {
+            show_magnitude = false;
+        } else if (args[i] == "-session") {
+            session_file = args[++i];
+            session = load_session(session_file);
+            restore_session = true;
+            // Only the settings in the session replace those given before it
+            if (!session.volume_file.empty()) {
+                volume_file = session.volume_file;
+            }
+            if (!session.field.empty()) {
+                field_name = session.field;
+                session_field = true;
+            }
+            if (!session.volumes.empty()) {
+                volume_states = session.volumes;
+            }
+            // Reusing the stored value range skips computing it while loading
+            if (std::isfinite(session.value_range.x) && std::isfinite(session.value_range.y)) {
+                value_range = session.value_range;
+                session_value_range = true;
+            }
+            if (!session.isovalues.empty()) {
+                isovalues = session.isovalues;
+            }
+            if (!session.isosurface_colors.empty()) {
+                isosurface_colors = session.isosurface_colors;
+            }
+            if (session.has_isosurface_opacity) {
+                isosurface_opacity = session.isosurface_opacity;
+            }
+            if (session.has_renderer_type) {
+                renderer_type = session.renderer_type;
+            }
+            if (session.has_quality) {
+                quality = session.quality;
+            }
+            if (session.has_background_color) {
+                background_color = session.background_color;
+            }
+            if (session.has_density_scale) {
+                density_scale = session.density_scale;
+            }
+            if (session.has_camera) {
+                cmdline_camera = true;
+                cam_eye = glm::vec3(session.cam_eye.x, session.cam_eye.y, session.cam_eye.z);
+                cam_at = glm::vec3(session.cam_at.x, session.cam_at.y, session.cam_at.z);
+                cam_up = glm::vec3(session.cam_up.x, session.cam_up.y, session.cam_up.z);
+            }
+            if (!session.lights.empty()) {
+                light_params = session.lights;
+            }
         } else if (args[i] == "-tfn") {
             bool use_opacity = true;
             if (args[i + 1] == "ignore_opacity") {
@@ -324,6 +761,15 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
             std::vector<uint8_t> img_data(data, data + x * 4);
             stbi_image_free(data);
             cmdline_colormaps.emplace_back(tfn_name, img_data, LINEAR, use_opacity);
+        } else if (args[i] == "-colormap-dir") {
+            bool use_opacity = true;
+            if (args[i + 1] == "ignore_opacity") {
+                use_opacity = false;
+                ++i;
+            }
+            colormap_dirs.emplace_back(args[++i], use_opacity);
+        } else if (args[i] == "-tfn-res") {
+            tfn_resolution = std::stoul(args[++i]);
         } else if (args[i] == "-bg") {
             background_color.x = std::stof(args[++i]);
             background_color.y = std::stof(args[++i]);
@@ -336,22 +782,44 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
             isosurface_colors.push_back(c);
         } else if (args[i] == "-iso-opacity") {
             isosurface_opacity = std::stof(args[++i]);
-        } else if (args[i] == "-ambient") {
-            light_params[0].intensity = std::stof(args[++i]);
-        } else if (args[i] == "-dir1") {
-            light_params[1].intensity = std::stof(args[++i]);
-            light_params[1].direction.x = std::stof(args[++i]);
-            light_params[1].direction.y = std::stof(args[++i]);
-            light_params[1].direction.z = std::stof(args[++i]);
-        } else if (args[i] == "-dir2") {
-            light_params[2].intensity = std::stof(args[++i]);
-            light_params[2].direction.x = std::stof(args[++i]);
-            light_params[2].direction.y = std::stof(args[++i]);
-            light_params[2].direction.z = std::stof(args[++i]);
+        } else if (args[i] == "-ambient" || args[i] == "-dir1" || args[i] == "-dir2") {
+            // These set the lights at their position in the default setup, a session
+            // with fewer lights gets the default ones added back
+            const size_t l = args[i] == "-ambient" ? 0 : args[i] == "-dir1" ? 1 : 2;
+            const std::vector<LightParams> defaults = default_lights();
+            while (light_params.size() <= l) {
+                light_params.push_back(defaults[light_params.size()]);
+            }
+            light_params[l].intensity = std::stof(args[++i]);
+            if (l != 0) {
+                light_params[l].direction.x = std::stof(args[++i]);
+                light_params[l].direction.y = std::stof(args[++i]);
+                light_params[l].direction.z = std::stof(args[++i]);
+            }
+        } else if (args[i] == "-hdri") {
+            LightParams hdri;
+            hdri.type = "hdri";
+            hdri.map = args[++i];
+            hdri.intensity = std::stof(args[++i]);
+            light_params.push_back(hdri);
         } else if (args[i] == "-density-scale") {
             density_scale = std::stof(args[++i]);
         } else if (args[i] == "-nf") {
             render_frame_count = std::stoi(args[++i]);
+        } else if (args[i] == "-quality") {
+            quality = args[++i];
+        } else if (args[i] == "-gradient") {
+            compute_gradient = true;
+            if (i + 1 < args.size() && args[i + 1] == "u8") {
+                quantize_gradient = true;
+                ++i;
+            }
+        } else if (args[i] == "-normals") {
+            compute_normals = true;
+        } else if (args[i] == "-stream") {
+            stream_address = args[++i];
+        } else if (args[i] == "-stream-accum") {
+            stream_accumulation = std::stoi(args[++i]);
         } else if (args[i] == "-o") {
             output_image_file = args[++i];
         } else if (args[i] == "-h") {
@@ -365,64 +833,161 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
         std::cout << "No volume file provided!\n";
         throw std::runtime_error("No volume file provided");
     }
+    // The session's value ranges and field are those of its volume, a different volume
+    // given on the command line computes its own
+    if (restore_session && volume_file != session.volume_file) {
+        if (session_value_range) {
+            value_range = math::vec2f(std::numeric_limits<float>::infinity());
+        }
+        if (session_field) {
+            field_name.clear();
+        }
+        session.tfn_value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    }
+    if (renderer_type == "preintegrated") {
+        std::cout << "The preintegrated renderer is only supported in the -server and "
+                  << "-image-parallel modes, the interactive app uses the CPU raycaster "
+                  << "when a 2D transfer function or normal shading is enabled\n";
+        throw std::runtime_error("Unsupported renderer for the interactive app");
+    }
 
-    if (get_file_extension(volume_file) == "json") {
-        std::ifstream cfg_file(volume_file.c_str());
-        cfg_file >> config;
-
-        std::string base_path = get_file_basepath(volume_file);
-        if (base_path == volume_file) {
-            base_path = ".";
-        }
-        const std::string base_name = get_file_basename(config["url"]);
-        config["volume"] = base_path + "/" + base_name;
-        brick = load_raw_volume(config);
-
-        if (!std::isfinite(value_range.x) || !std::isfinite(value_range.y)) {
-            std::cout << "Computing value range\n";
-            const std::string voxel_type = config["type"].get<std::string>();
-            if (voxel_type == "uint8") {
-                value_range =
-                    compute_value_range(brick.voxel_data->data(), brick.voxel_data->size());
-            } else if (voxel_type == "uint16") {
-                value_range =
-                    compute_value_range(reinterpret_cast<uint16_t *>(brick.voxel_data->data()),
-                                        brick.voxel_data->size() / sizeof(uint16_t));
-            } else if (voxel_type == "float32") {
-                value_range =
-                    compute_value_range(reinterpret_cast<float *>(brick.voxel_data->data()),
-                                        brick.voxel_data->size() / sizeof(float));
-            } else if (voxel_type == "float64") {
-                value_range =
-                    compute_value_range(reinterpret_cast<double *>(brick.voxel_data->data()),
-                                        brick.voxel_data->size() / sizeof(double));
-            }
-            std::cout << "Computed value range: " << value_range << "\n";
-        }
-        brick.value_range = value_range;
-        std::cout << config.dump(4) << "\n";
-    } else if (get_file_extension(volume_file) == "off") {
-        brick = load_off(volume_file);
-        value_range = brick.value_range;
-    } else if (get_file_extension(volume_file) == "idx") {
-#ifdef OPENVISUS_FOUND
-        config = json();
-        brick = load_idx_volume(volume_file, config);
-#else
+#ifndef OPENVISUS_FOUND
+    if (get_file_extension(volume_file) == "idx") {
         std::cerr << "[error]: Requested to load non-JSON file data " << volume_file
                   << ", but OpenVisus was not found\n";
         std::exit(1);
+    }
 #endif
+    // The volumes added to the scene are loaded in parallel with the main volume, once their
+    // sizes are known to fit in the budget shared by all of them
+    std::vector<std::unique_ptr<SceneVolume>> scene_volumes;
+    std::vector<std::string> scene_volume_files = {volume_file};
+    std::vector<size_t> scene_volume_bytes = {estimate_volume_bytes(volume_file, field_name)};
+    for (const auto &v : volume_states) {
+        scene_volumes.emplace_back(new SceneVolume(v.volume_file, v.translation));
+        scene_volumes.back()->value_range = v.value_range;
+        scene_volume_files.push_back(v.volume_file);
+        scene_volume_bytes.push_back(estimate_volume_bytes(v.volume_file));
+    }
+    check_volume_budget(scene_volume_files, scene_volume_bytes, volume_budget);
+
+    tbb::task_group load_tasks;
+    load_tasks.run([&]() {
+        run_with_numa_placement(numa_placement, [&]() {
+            brick = load_volume(volume_file, config, value_range, field_name);
+        });
+    });
+    for (auto &v : scene_volumes) {
+        SceneVolume *scene_volume = v.get();
+        load_tasks.run([scene_volume]() {
+            scene_volume->brick = load_volume(
+                scene_volume->volume_file, scene_volume->config, scene_volume->value_range);
+        });
+    }
+    load_tasks.wait();
+    value_range = brick.value_range;
+    // IDX and OFF volumes are only checked against the budget once they're loaded
+    // The main volume's gradients and normals are computed after loading, and are counted
+    // at the size of the uncropped volume
+    const size_t derived_voxel_bytes =
+        (compute_gradient ? (quantize_gradient ? 1 : sizeof(float)) : 0) +
+        (compute_normals ? sizeof(uint16_t) : 0);
+    scene_volume_bytes[0] =
+        volume_brick_bytes(brick) + brick.dims.long_product() * derived_voxel_bytes;
+    for (size_t i = 0; i < scene_volumes.size(); ++i) {
+        scene_volume_bytes[i + 1] = volume_brick_bytes(scene_volumes[i]->brick);
+    }
+    check_volume_budget(scene_volume_files, scene_volume_bytes, volume_budget);
+    if (numa_report) {
+        std::cout << numa_placement_report(
+            brick.voxel_data ? brick.voxel_data->data() : nullptr,
+            brick.voxel_data ? brick.voxel_data->size() : 0);
+    }
+    if (!config.is_null()) {
+        std::cout << config.dump(4) << "\n";
+    }
+    record_memory_stage("Volume loaded");
+
+    // The fields of a multi-field volume are loaded when they're selected, the loaded brick
+    // is the selected field
+    FieldCache fields;
+    size_t active_field = 0;
+    const std::vector<std::string> field_names = volume_field_names(config);
+    if (!field_names.empty()) {
+        if (!field_name.empty()) {
+            active_field =
+                std::find(field_names.begin(), field_names.end(), field_name) -
+                field_names.begin();
+        }
+        fields = FieldCache(
+            config, active_field, std::make_shared<VolumeBrick>(brick), field_budget);
+    }
+    // The data file of the volume or its selected field, which the histogram is cached next to
+    auto field_data_file = [&]() -> std::string {
+        if (fields.size() != 0) {
+            return volume_field_config(config, active_field)["volume"].get<std::string>();
+        }
+        return config.find("volume") != config.end() ? config["volume"].get<std::string>()
+                                                     : volume_file;
+    };
+
+    // The value histogram shown behind the opacity curve is cached next to the volume data
+    // so it's only computed the first time the volume is opened
+    VolumeHistogram histogram;
+    if (brick.voxel_data) {
+        histogram = load_cached_histogram(brick, field_data_file(), 1024);
+    }
+
+    // While cropped the brick holds only the crop box's voxels, and the full volume is kept
+    // to change the crop unless it's released
+    const math::vec3i volume_dims = brick.dims;
+    VolumeBrick full_brick;
+    bool cropped = false;
+    if (cmdline_crop) {
+        VolumeBrick crop = crop_volume(brick, crop_region);
+        if (!crop_release) {
+            full_brick = brick;
+        } else if (fields.size() != 0) {
+            fields.release(active_field);
+        }
+        brick = crop;
+        cropped = true;
+        record_memory_stage("Volume cropped");
     } else {
-        std::cout << "Unsupported file type " << volume_file << "\n";
-        throw std::runtime_error("Unsupported file type " + volume_file);
+        crop_region = math::box3i(math::vec3i(0), volume_dims);
+    }
+
+    // The 2D transfer function's editor shows a histogram of the values and gradient
+    // magnitudes as a guide to placing regions over material boundaries
+    TransferFunction2DWidget tfn_2d_widget;
+    if (compute_gradient) {
+        compute_brick_gradient(brick, quantize_gradient);
+        const math::vec2i histogram_bins(256, 128);
+        tfn_2d_widget.set_histogram(
+            compute_histogram_2d(brick, *brick.gradient, value_range, histogram_bins),
+            histogram_bins.x,
+            histogram_bins.y);
+        record_memory_stage("Gradients computed");
+    }
+    if (compute_normals) {
+        compute_brick_normals(brick);
+        record_memory_stage("Normals computed");
     }
 
     math::vec2f ui_value_range = value_range;
+    if (restore_session && std::isfinite(session.tfn_value_range.x) &&
+        std::isfinite(session.tfn_value_range.y)) {
+        ui_value_range.x = std::max(session.tfn_value_range.x, value_range.x);
+        ui_value_range.y = std::min(session.tfn_value_range.y, value_range.y);
+    }
 
-    const math::vec3f world_center = brick.bounds.center();
-    const math::box3f world_bounds = brick.bounds;
-    const float world_diagonal = math::length(brick.bounds.size());
+    // The camera frames all the volumes in the scene
+    math::box3f world_bounds = brick.bounds;
+    for (const auto &v : scene_volumes) {
+        world_bounds.extend(v->world_bounds());
+    }
+    const math::vec3f world_center = world_bounds.center();
+    const float world_diagonal = math::length(world_bounds.size());
     if (!cmdline_camera) {
         cam_eye =
             glm::vec3(world_center.x, world_center.y, world_center.z - world_diagonal * 1.5);
@@ -432,12 +997,33 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
     ArcballCamera arcball(cam_eye, cam_at, cam_up);
 
     TransferFunctionWidget tfn_widget;
+    tfn_widget.set_resolution(tfn_resolution);
     for (const auto &cmap : cmdline_colormaps) {
         tfn_widget.add_colormap(cmap);
     }
+    for (const auto &dir : colormap_dirs) {
+        tfn_widget.load_colormap_directory(dir.first, dir.second);
+    }
+    if (!histogram.counts.empty()) {
+        tfn_widget.set_histogram(
+            histogram.counts, histogram.value_range.x, histogram.value_range.y);
+    }
+    tfn_widget.set_value_range(ui_value_range.x, ui_value_range.y);
+    if (restore_session) {
+        if (!session.colormap.empty() && !tfn_widget.select_colormap(session.colormap)) {
+            std::cout << "The session's colormap '" << session.colormap
+                      << "' isn't loaded, using the default colormap\n";
+        }
+        if (session.opacity_points.size() >= 2) {
+            tfn_widget.set_opacity_points(session.opacity_points);
+        }
+        tfn_2d_widget.set_regions(session.tfn_2d_regions);
+    }
     std::vector<float> tfn_colors;
     std::vector<float> tfn_opacities;
     tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+    TrackedMemory tfn_memory(MemoryCategory::TRANSFER_FUNCTION,
+                             (tfn_colors.size() + tfn_opacities.size()) * sizeof(float));
 
     cpp::TransferFunction tfn("piecewiseLinear");
     tfn.setParam("color",
@@ -448,25 +1034,60 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
     tfn.commit();
 
     cpp::Renderer renderer(renderer_type);
-    float sampling_rate = 1.f;
+    float sampling_rate = session.has_sampling_rate ? session.sampling_rate : 1.f;
     renderer.setParam("volumeSamplingRate", sampling_rate);
     renderer.setParam("backgroundColor", background_color);
+    // With auto quality the interactive preset is used while the camera moves and the
+    // final preset once it stops
+    bool quality_auto = quality == "auto";
+    int quality_index = quality_auto ? 0 : int(find_quality_preset(quality));
+    size_t active_quality = quality_index;
+    apply_quality_preset(renderer, renderer_type, quality_presets()[active_quality]);
     renderer.commit();
+    // OSPRay's time to render each frame with each preset
+    std::map<std::string, QualityFrameTimes> quality_frame_times;
 
     brick.model.setParam("densityScale", density_scale);
     brick.model.setParam("transferFunction", tfn);
     brick.model.commit();
 
+    for (size_t i = 0; i < scene_volumes.size(); ++i) {
+        SceneVolume &v = *scene_volumes[i];
+        for (const auto &cmap : cmdline_colormaps) {
+            v.tfn_widget.add_colormap(cmap);
+        }
+        for (const auto &dir : colormap_dirs) {
+            v.tfn_widget.load_colormap_directory(dir.first, dir.second);
+        }
+        const SceneVolumeState &state = volume_states[i];
+        if (std::isfinite(state.tfn_value_range.x) && std::isfinite(state.tfn_value_range.y)) {
+            v.ui_value_range = state.tfn_value_range;
+        }
+        if (!state.colormap.empty()) {
+            v.tfn_widget.select_colormap(state.colormap);
+        }
+        if (state.opacity_points.size() >= 2) {
+            v.tfn_widget.set_opacity_points(state.opacity_points);
+        }
+        v.setup(density_scale);
+    }
+
     cpp::Group group;
     group.setParam("volume", cpp::CopiedData(brick.model));
 
-    if (!isovalues.empty()) {
-        cpp::Material material(renderer_type, "obj");
-        material.setParam("kd", math::vec3f(1.f));
-        material.setParam("d", isosurface_opacity);
-        material.commit();
-
-        auto geom = extract_isosurfaces(config, brick, isovalues);
+    // The isosurfaces are extracted again whenever the rendered brick is replaced, the
+    // implicit isosurfaces reference the brick's volume and its voxels
+    std::vector<TrackedMemory> isosurface_memory;
+    cpp::Material isosurface_material(renderer_type, "obj");
+    isosurface_material.setParam("kd", math::vec3f(1.f));
+    isosurface_material.setParam("d", isosurface_opacity);
+    isosurface_material.commit();
+    auto extract_brick_isosurfaces = [&]() {
+        isosurface_memory.clear();
+        // Explicit isosurfaces read the voxel type and spacing of the selected field
+        const json iso_config =
+            fields.size() != 0 ? volume_field_config(config, active_field) : config;
+        auto geom = extract_isosurfaces(iso_config, brick, isovalues, &isosurface_memory);
         std::vector<cpp::GeometricModel> geom_models;
         // If using VTK for multiple isosurfaces we'll get a bunch of triangle meshes, one
         // per-isovalue
@@ -474,7 +1095,7 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
             const auto &g = geom[i];
             cpp::GeometricModel geom_model;
             geom_model = cpp::GeometricModel(g);
-            geom_model.setParam("material", material);
+            geom_model.setParam("material", isosurface_material);
             if (!isosurface_colors.empty()) {
                 if (geom.size() > 1) {
                     geom_model.setParam("color", cpp::CopiedData(isosurface_colors[i]));
@@ -487,43 +1108,77 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
         }
         if (!geom_models.empty()) {
             group.setParam("geometry", cpp::CopiedData(geom_models));
+        } else {
+            group.removeParam("geometry");
         }
+    };
+    if (!isovalues.empty()) {
+        extract_brick_isosurfaces();
+        record_memory_stage("Isosurfaces extracted");
     }
     group.commit();
 
     cpp::Instance instance(group);
     instance.commit();
 
-    std::vector<cpp::Light> lights;
-    // create and setup an ambient light
-    {
-        cpp::Light light("ambient");
-        light.setParam("intensity", light_params[0].intensity);
-        light.commit();
-        lights.push_back(light);
-    }
-    {
-        cpp::Light light("distant");
-        light.setParam("intensity", light_params[1].intensity);
-        light.setParam("direction", light_params[1].direction);
-        light.commit();
-        lights.push_back(light);
-    }
-    {
-        cpp::Light light("distant");
-        light.setParam("intensity", light_params[2].intensity);
-        light.setParam("direction", light_params[2].direction);
-        light.commit();
-        lights.push_back(light);
-    }
-
-    std::array<ClippingPlane, 3> clipping_planes = {ClippingPlane(0, world_center),
-                                                    ClippingPlane(1, world_center),
-                                                    ClippingPlane(2, world_center)};
+    // Streamlines traced through a vector field volume, colored by speed through the
+    // transfer function of its magnitude volume. They're traced in the background when the
+    // seeds change and swapped in once the current frame is done
+    const std::shared_ptr<VectorField> vector_field = brick.vectors;
+    cpp::Material streamline_material(renderer_type, "obj");
+    streamline_material.commit();
+    float streamline_radius = world_diagonal / 1000.f;
+    StreamlineGeometry streamlines(streamline_material, streamline_radius);
+    StreamlineParams streamline_params;
+    bool show_streamlines = vector_field && streamline_res > 0;
+    bool streamlines_changed = show_streamlines;
+    std::future<Streamlines> streamline_task;
+    std::chrono::steady_clock::time_point streamline_start;
+    double streamline_trace_ms = 0.0;
+    if (vector_field) {
+        streamline_params.seed_box = vector_field->bounds;
+        if (streamline_res > 0) {
+            streamline_params.seed_res = math::vec3i(streamline_res);
+        }
+    } else {
+        show_magnitude = true;
+    }
+
+    SceneLights lights;
+    lights.params = light_params;
+
+    // Start with a disabled plane on each axis through the center of the volume
+    ClippingGroup clipping;
+    for (int axis = 0; axis < 3; ++axis) {
+        ClippingPlaneState plane;
+        plane.normal = math::vec3f(0.f);
+        plane.normal[axis] = 1.f;
+        plane.position = world_center[axis];
+        clipping.planes.push_back(plane);
+    }
+
+    // The main volume's instance unless its magnitude volume is hidden, each added volume's
+    // instance, the streamlines once traced and the clipping instance while clipping is on
+    auto world_instances = [&]() {
+        std::vector<cpp::Instance> instances;
+        if (show_magnitude) {
+            instances.push_back(instance);
+        }
+        for (const auto &v : scene_volumes) {
+            instances.push_back(v->instance);
+        }
+        if (streamlines.active()) {
+            instances.push_back(streamlines.instance);
+        }
+        if (clipping.active()) {
+            instances.push_back(clipping.instance);
+        }
+        return instances;
+    };
 
     cpp::World world;
-    world.setParam("instance", cpp::CopiedData(instance));
-    world.setParam("light", cpp::CopiedData(lights));
+    world.setParam("instance", cpp::CopiedData(world_instances()));
+    world.setParam("light", lights.light_list());
     world.commit();
 
     cam_eye = arcball.eye();
@@ -540,6 +1195,8 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
 
     cpp::FrameBuffer fb(win_width, win_height, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
     fb.clear();
+    TrackedMemory fb_memory(MemoryCategory::FRAMEBUFFER,
+                            framebuffer_bytes(win_width, win_height));
 
     Shader display_render(fullscreen_quad_vs, display_texture_fs);
     display_render.uniform("img", 0);
@@ -561,6 +1218,8 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    TrackedMemory render_texture_memory(MemoryCategory::TEXTURE,
+                                        size_t(win_width) * win_height * 4);
 
     GLuint vao;
     glGenVertexArrays(1, &vao);
@@ -569,10 +1228,179 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
     glClearColor(0.0, 0.0, 0.0, 0.0);
     glDisable(GL_DEPTH_TEST);
 
+    record_memory_stage("Scene setup");
+
     // Start rendering asynchronously
-    cpp::Future future = fb.renderFrame(renderer, camera, world);
+    int stream_fd = -1;
+    std::unique_ptr<FrameSender> stream_sender;
+    FrameEncoder stream_encoder;
+    if (!stream_address.empty()) {
+        stream_fd = connect_to(stream_address);
+        stream_sender.reset(new FrameSender(stream_fd));
+        std::cout << "Streaming frames to " << stream_address << "\n";
+    }
+    // Frames accumulated since the framebuffer was last cleared, and whether the camera
+    // moved recently so the stream should send previews and auto quality should render
+    // with the interactive preset
+    int accumulated_frames = 0;
+    bool interacting = false;
+
+    // cpp::Future::duration isn't available in all OSPRay 2.x releases, so frames are
+    // timed by a thread waiting on each frame rather than by the UI loop, which only sees
+    // the frame is done at the next vsync
+    using FrameClock = std::chrono::steady_clock;
+    FrameClock::time_point frame_start;
+    std::future<FrameClock::time_point> frame_end;
+    cpp::Future future;
+    auto render_frame = [&]() {
+        frame_start = FrameClock::now();
+        future = fb.renderFrame(renderer, camera, world);
+        frame_end = std::async(std::launch::async, [frame = future]() mutable {
+            frame.wait();
+            return FrameClock::now();
+        });
+    };
+    render_frame();
+    size_t rendered_quality = active_quality;
+    bool ospray_frame_pending = true;
     std::vector<OSPObject> pending_commits;
 
+    bool clipping_changed = false;
+    if (restore_session &&
+        (!session.clipping_planes.empty() || !session.clipping_boxes.empty())) {
+        clipping.planes = session.clipping_planes;
+        clipping.boxes = session.clipping_boxes;
+        clipping_changed = true;
+    }
+
+    // Collect the current state for saving the session
+    auto current_session = [&]() {
+        SessionState s;
+        s.volume_file = volume_file;
+        if (fields.size() != 0) {
+            s.field = fields.name(active_field);
+        }
+        s.value_range = value_range;
+        s.tfn_value_range = ui_value_range;
+        s.colormap = tfn_widget.current_colormap_name();
+        s.opacity_points = tfn_widget.get_opacity_points();
+        s.tfn_2d_regions = tfn_2d_widget.get_regions();
+        for (const auto &v : scene_volumes) {
+            SceneVolumeState vs;
+            vs.volume_file = v->volume_file;
+            vs.translation = v->translation;
+            vs.value_range = v->value_range;
+            vs.tfn_value_range = v->ui_value_range;
+            vs.colormap = v->tfn_widget.current_colormap_name();
+            vs.opacity_points = v->tfn_widget.get_opacity_points();
+            s.volumes.push_back(vs);
+        }
+        s.has_camera = true;
+        const glm::vec3 eye = arcball.eye();
+        const glm::vec3 center = arcball.center();
+        const glm::vec3 up = arcball.up();
+        s.cam_eye = math::vec3f(eye.x, eye.y, eye.z);
+        s.cam_at = math::vec3f(center.x, center.y, center.z);
+        s.cam_up = math::vec3f(up.x, up.y, up.z);
+        s.lights = lights.params;
+        s.clipping_planes = clipping.planes;
+        s.clipping_boxes = clipping.boxes;
+        s.isovalues = isovalues;
+        s.isosurface_colors = isosurface_colors;
+        s.isosurface_opacity = isosurface_opacity;
+        s.renderer_type = renderer_type;
+        s.quality = quality_auto ? "auto" : quality_presets()[quality_index].name;
+        s.sampling_rate = sampling_rate;
+        s.density_scale = density_scale;
+        s.background_color = background_color;
+        return s;
+    };
+
+    // 2D transfer functions and shading with the precomputed normals are rendered with the
+    // CPU raycaster instead of OSPRay, which is created the first time they're enabled
+    std::unique_ptr<CpuRaycaster> raycaster;
+    bool use_tfn_2d = false;
+    bool tfn_2d_toggled = false;
+    bool use_shading = false;
+    bool shading_toggled = false;
+    auto make_raycaster = [&]() {
+        raycaster.reset(new CpuRaycaster(std::make_shared<VolumeBrick>(brick),
+                                         math::vec2i(win_width, win_height)));
+        raycaster->set_transfer_function(tfn_colors, tfn_opacities, 0, tfn_opacities.size());
+    };
+
+    // The slice view colors slices of the voxel data on the CPU, they're only re-rendered
+    // when the slice, transfer function or volume changes
+    SliceRenderer slice_renderer;
+    slice_renderer.set_transfer_function(tfn_colors, tfn_opacities);
+    SliceParams slice_params;
+    slice_params.index = brick.dims.z / 2;
+    // Oblique slices pass through the volume's center offset along their normal
+    float slice_offset = 0.f;
+    bool show_slice_view = false;
+    bool slice_changed = true;
+    GLuint slice_texture = 0;
+    math::vec2i slice_texture_size(0);
+    TrackedMemory slice_texture_memory(MemoryCategory::TEXTURE, 0);
+
+    // Get the uncropped volume, reloading it if it was released. The value range is known
+    // so it isn't recomputed
+    auto full_volume = [&]() {
+        if (!cropped) {
+            return brick;
+        }
+        if (!full_brick.voxel_data) {
+            std::cout << "Reloading the uncropped volume\n";
+            if (fields.size() != 0) {
+                full_brick = *fields.acquire(active_field);
+            } else {
+                json reload_config;
+                full_brick = load_volume(volume_file, reload_config, value_range);
+            }
+            if (compute_gradient) {
+                compute_brick_gradient(full_brick, quantize_gradient);
+            }
+            if (compute_normals) {
+                compute_brick_normals(full_brick);
+            }
+        }
+        return full_brick;
+    };
+
+    // Swap the rendered volume for another brick of the dataset, e.g. a cropped region
+    auto replace_volume = [&](const VolumeBrick &b) {
+        brick = b;
+        brick.model.setParam("densityScale", density_scale);
+        brick.model.setParam("transferFunction", tfn);
+        group.setParam("volume", cpp::CopiedData(brick.model));
+        if (!isovalues.empty()) {
+            extract_brick_isosurfaces();
+        }
+        pending_commits.push_back(brick.model.handle());
+        pending_commits.push_back(group.handle());
+        pending_commits.push_back(instance.handle());
+        pending_commits.push_back(world.handle());
+        if (raycaster) {
+            make_raycaster();
+            tfn_2d_toggled = true;
+        }
+        slice_changed = true;
+    };
+    bool crop_requested = false;
+    bool uncrop_requested = false;
+    // The field picked in the UI, swapped in once the current frame is done
+    int requested_field = -1;
+
+    // Swap in new streamlines, the world is only recommitted if they appeared or vanished
+    auto replace_streamlines = [&](Streamlines &&lines) {
+        std::vector<math::vec4f> colors =
+            streamline_colors(lines, tfn_colors, ui_value_range);
+        if (streamlines.set_lines(std::move(lines), std::move(colors), pending_commits)) {
+            world.setParam("instance", cpp::CopiedData(world_instances()));
+            pending_commits.push_back(world.handle());
+        }
+    };
+
     int frame_id = 0;
     ImGuiIO &io = ImGui::GetIO();
     glm::vec2 prev_mouse(-2.f);
@@ -580,8 +1408,7 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
     bool camera_changed = true;
     bool window_changed = false;
     bool take_screenshot = false;
-    bool lights_changed = false;
-    bool clipping_changed = false;
+    int add_light_type = 1;
     while (!done) {
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
@@ -602,15 +1429,12 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
                 } else if (event.key.keysym.sym == SDLK_c) {
                     take_screenshot = true;
                 } else if (event.key.keysym.sym == SDLK_l) {
-                    std::cout << "-ambient " << light_params[0].intensity << " -dir1 "
-                              << light_params[1].intensity << " "
-                              << light_params[1].direction.x << " "
-                              << light_params[1].direction.y << " "
-                              << light_params[1].direction.z << " -dir2 "
-                              << light_params[2].intensity << " "
-                              << light_params[2].direction.x << " "
-                              << light_params[2].direction.y << " "
-                              << light_params[2].direction.z << "\n";
+                    // Printed as the lights of a -session file
+                    json j = json::array();
+                    for (const auto &l : lights.params) {
+                        j.push_back(light_to_json(l));
+                    }
+                    std::cout << "\"lights\": " << j.dump() << "\n";
                 }
             }
             if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE &&
@@ -651,6 +1475,11 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
                 fb = cpp::FrameBuffer(
                     win_width, win_height, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
                 fb.clear();
+                fb_memory.resize(framebuffer_bytes(win_width, win_height));
+                if (raycaster) {
+                    raycaster->resize(math::vec2i(win_width, win_height));
+                }
+                accumulated_frames = 0;
 
                 glDeleteTextures(1, &render_texture);
                 glGenTextures(1, &render_texture);
@@ -670,6 +1499,7 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                render_texture_memory.resize(size_t(win_width) * win_height * 4);
             }
         }
 
@@ -682,6 +1512,7 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
             camera.setParam("direction", math::vec3f(cam_dir.x, cam_dir.y, cam_dir.z));
             camera.setParam("up", math::vec3f(cam_up.x, cam_up.y, cam_up.z));
             pending_commits.push_back(camera.handle());
+            interacting = true;
         }
 
         ImGui_ImplOpenGL3_NewFrame();
@@ -689,72 +1520,334 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
         ImGui::NewFrame();
 
         if (ImGui::Begin("Params")) {
+            if (ImGui::Button("Save Session")) {
+                try {
+                    save_session(session_file, current_session());
+                    std::cout << "Session saved to '" << session_file << "'\n";
+                } catch (const std::runtime_error &e) {
+                    std::cout << e.what() << "\n";
+                }
+            }
+            if (fields.size() != 0) {
+                if (ImGui::BeginCombo("Field", fields.name(active_field).c_str())) {
+                    for (size_t i = 0; i < fields.size(); ++i) {
+                        // Fields which aren't resident are loaded when selected
+                        const std::string label =
+                            fields.name(i) + (fields.resident(i) ? "" : " (not loaded)");
+                        if (ImGui::Selectable(label.c_str(), i == active_field)) {
+                            requested_field = i;
+                        }
+                    }
+                    ImGui::EndCombo();
+                }
+                ImGui::Text("Resident Fields: %.1f MB",
+                            fields.resident_bytes() / (1024.f * 1024.f));
+            }
             if (ImGui::SliderFloat("Density Scale", &density_scale, 0.0f, 10.f)) {
                 brick.model.setParam("densityScale", density_scale);
                 pending_commits.push_back(brick.model.handle());
+                for (auto &v : scene_volumes) {
+                    v->brick.model.setParam("densityScale", density_scale);
+                    pending_commits.push_back(v->brick.model.handle());
+                }
             }
             if (ImGui::SliderFloat("Sampling Rate", &sampling_rate, 0.1f, 5.f)) {
                 renderer.setParam("volumeSamplingRate", sampling_rate);
                 pending_commits.push_back(renderer.handle());
             }
+            // The quality presets, followed by auto
+            std::vector<const char *> quality_items;
+            for (const auto &preset : quality_presets()) {
+                quality_items.push_back(preset.name.c_str());
+            }
+            quality_items.push_back("auto");
+            int quality_item = quality_auto ? int(quality_presets().size()) : quality_index;
+            if (ImGui::Combo(
+                    "Quality", &quality_item, quality_items.data(), quality_items.size())) {
+                quality_auto = quality_item == int(quality_presets().size());
+                if (!quality_auto) {
+                    quality_index = quality_item;
+                }
+            }
+            for (const auto &preset : quality_presets()) {
+                auto fnd = quality_frame_times.find(preset.name);
+                if (fnd != quality_frame_times.end()) {
+                    ImGui::Text("%s: %.1fms/frame%s",
+                                preset.name.c_str(),
+                                fnd->second.mean_ms(),
+                                preset.name == quality_presets()[active_quality].name
+                                    ? " (active)"
+                                    : "");
+                }
+            }
+            if (brick.normals) {
+                shading_toggled =
+                    ImGui::Checkbox("Shade with Normals (CPU Raycaster)", &use_shading);
+            }
             if (ImGui::SliderFloat2(
                     "Value Range", &ui_value_range.x, value_range.x, value_range.y)) {
+                tfn_widget.set_value_range(ui_value_range.x, ui_value_range.y);
+                slice_changed = true;
                 tfn.setParam("valueRange", ui_value_range);
                 pending_commits.push_back(tfn.handle());
                 pending_commits.push_back(brick.model.handle());
             }
 
-            for (size_t i = 0; i < lights.size(); ++i) {
+            // Edits commit only the edited light, the world's light list is replaced when
+            // lights are added or removed
+            bool light_list_changed = false;
+            int remove_light = -1;
+            for (size_t i = 0; i < lights.params.size(); ++i) {
                 ImGui::PushID(i);
                 ImGui::Separator();
-
-                if (i == 0) {
-                    ImGui::Text("Ambient Light");
+                auto &light = lights.params[i];
+
+                ImGui::Text("Light %d (%s)", int(i), light.type.c_str());
+                bool light_changed = false;
+                if (light.type == "sphere") {
+                    // Sphere lights fall off with the squared distance, so their intensity
+                    // scales with the size of the scene
+                    light_changed |= ImGui::DragFloat("Intensity",
+                                                      &light.intensity,
+                                                      0.01f * std::max(light.intensity, 1.f),
+                                                      0.f,
+                                                      std::numeric_limits<float>::max());
                 } else {
-                    ImGui::Text("Directional Light");
+                    light_changed |=
+                        ImGui::SliderFloat("Intensity", &light.intensity, 0.f, 10.f);
                 }
-
-                if (ImGui::SliderFloat("Intensity", &light_params[i].intensity, 0.f, 10.f)) {
-                    lights[i].setParam("intensity", light_params[i].intensity);
-                    pending_commits.push_back(lights[i].handle());
-                    lights_changed = true;
+                light_changed |= ImGui::ColorEdit3("Color", &light.color.x);
+                if (light.type == "distant" || light.type == "hdri" ||
+                    light.type == "sunSky") {
+                    light_changed |=
+                        ImGui::SliderFloat3("Direction", &light.direction.x, -1.f, 1.f);
                 }
-                if (i != 0) {
-                    if (ImGui::SliderFloat3(
-                            "Direction", &light_params[i].direction.x, -1.f, 1.f)) {
-                        lights[i].setParam("direction", light_params[i].direction);
-                        pending_commits.push_back(lights[i].handle());
-                        lights_changed = true;
-                    }
+                if (light.type == "sphere") {
+                    light_changed |= ImGui::DragFloat3("Position",
+                                                       &light.position.x,
+                                                       world_diagonal / 200.f);
+                    light_changed |=
+                        ImGui::SliderFloat("Radius", &light.radius, 0.f, world_diagonal / 4.f);
+                }
+                if (light.type == "hdri") {
+                    ImGui::Text("Map: %s", get_file_basename(light.map).c_str());
+                }
+                if (light.type == "sunSky") {
+                    light_changed |=
+                        ImGui::SliderFloat("Turbidity", &light.turbidity, 1.f, 10.f);
+                    light_changed |= ImGui::SliderFloat("Albedo", &light.albedo, 0.f, 1.f);
+                }
+                if (light_changed) {
+                    light_list_changed |= lights.update(i, pending_commits);
+                }
+                if (ImGui::Button("Remove Light")) {
+                    remove_light = i;
                 }
                 ImGui::PopID();
             }
-            if (lights_changed) {
-                world.setParam("light", cpp::CopiedData(lights));
+            if (remove_light != -1) {
+                lights.params.erase(lights.params.begin() + remove_light);
+                light_list_changed = true;
+            }
+            ImGui::Separator();
+            // HDRI lights need an image file, so are only added from the command line or
+            // session file
+            const char *add_types[] = {"ambient", "distant", "sphere", "sunSky"};
+            ImGui::Combo("##add_light_type", &add_light_type, add_types, 4);
+            ImGui::SameLine();
+            if (ImGui::Button("Add Light")) {
+                LightParams light;
+                light.type = add_types[add_light_type];
+                if (light.type == "distant") {
+                    light.direction = math::vec3f(0.f, -1.f, 0.f);
+                } else if (light.type == "sphere") {
+                    light.position = world_center + math::vec3f(0.f, world_diagonal, 0.f);
+                    light.intensity = world_diagonal * world_diagonal;
+                } else if (light.type == "sunSky") {
+                    light.direction = math::vec3f(0.f, -1.f, 0.f);
+                    light.intensity = 1.f;
+                }
+                lights.params.push_back(light);
+                light_list_changed = true;
+            }
+            if (light_list_changed) {
+                world.setParam("light", lights.light_list());
                 pending_commits.push_back(world.handle());
             }
 
-            for (size_t i = 0; i < clipping_planes.size(); ++i) {
+            int remove_plane = -1;
+            for (size_t i = 0; i < clipping.planes.size(); ++i) {
                 ImGui::PushID(i);
                 ImGui::Separator();
-                auto &plane = clipping_planes[i];
+                auto &plane = clipping.planes[i];
 
-                ImGui::Text("Clipping Plane on axis %d", plane.axis);
+                ImGui::Text("Clipping Plane %d", int(i));
                 clipping_changed |= ImGui::Checkbox("Enabled", &plane.enabled);
-                if (ImGui::Checkbox("Flip", &plane.flip_plane)) {
-                    plane.flip_direction(plane.flip_plane, pending_commits);
-                    clipping_changed = true;
+                clipping_changed |= ImGui::Checkbox("Flip", &plane.flip);
+                clipping_changed |= ImGui::SliderFloat3("Normal", &plane.normal.x, -1.f, 1.f);
+                // Positions along the normal where the plane crosses the volume
+                const float len = length(plane.normal);
+                if (len > 0.f) {
+                    const math::vec3f n = plane.normal / len;
+                    const math::vec3f size = world_bounds.size();
+                    const float mid = dot(n, world_center);
+                    const float half = 0.5f * (std::abs(n.x) * size.x +
+                                               std::abs(n.y) * size.y +
+                                               std::abs(n.z) * size.z);
+                    clipping_changed |= ImGui::SliderFloat(
+                        "Position", &plane.position, mid - half, mid + half);
                 }
-                if (ImGui::SliderFloat("Position",
-                                       &plane.position[plane.axis],
-                                       world_bounds.lower[plane.axis],
-                                       world_bounds.upper[plane.axis])) {
-                    plane.set_position(plane.position[plane.axis], pending_commits);
-                    clipping_changed = true;
+                if (ImGui::Button("Remove Plane")) {
+                    remove_plane = i;
                 }
 
                 ImGui::PopID();
             }
+            int remove_box = -1;
+            for (size_t i = 0; i < clipping.boxes.size(); ++i) {
+                ImGui::PushID(clipping.planes.size() + i);
+                ImGui::Separator();
+                auto &box = clipping.boxes[i];
+
+                ImGui::Text("Clipping Box %d", int(i));
+                clipping_changed |= ImGui::Checkbox("Enabled", &box.enabled);
+                const char *axis_names[3] = {"Box X", "Box Y", "Box Z"};
+                for (int a = 0; a < 3; ++a) {
+                    const float lo = world_bounds.lower[a];
+                    const float hi = world_bounds.upper[a];
+                    clipping_changed |= ImGui::DragFloatRange2(axis_names[a],
+                                                               &box.bounds.lower[a],
+                                                               &box.bounds.upper[a],
+                                                               (hi - lo) / 200.f,
+                                                               lo,
+                                                               hi);
+                }
+                if (ImGui::Button("Remove Box")) {
+                    remove_box = i;
+                }
+
+                ImGui::PopID();
+            }
+            if (remove_plane != -1) {
+                clipping.planes.erase(clipping.planes.begin() + remove_plane);
+                clipping_changed = true;
+            }
+            if (remove_box != -1) {
+                clipping.boxes.erase(clipping.boxes.begin() + remove_box);
+                clipping_changed = true;
+            }
+            ImGui::Separator();
+            if (ImGui::Button("Add Clipping Plane")) {
+                ClippingPlaneState plane;
+                plane.enabled = true;
+                plane.position = world_center.x;
+                clipping.planes.push_back(plane);
+                clipping_changed = true;
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Add Clipping Box")) {
+                ClippingBoxState box;
+                box.enabled = true;
+                box.bounds = world_bounds;
+                clipping.boxes.push_back(box);
+                clipping_changed = true;
+            }
+
+            // Unlike the clipping planes, cropping copies the box into a smaller volume so
+            // the voxels outside it aren't sampled
+            if (brick.voxel_data) {
+                ImGui::Separator();
+                ImGui::Text("Crop Box (%d x %d x %d voxels)",
+                            crop_region.size().x,
+                            crop_region.size().y,
+                            crop_region.size().z);
+                const char *axis_names[3] = {"Crop X", "Crop Y", "Crop Z"};
+                for (int a = 0; a < 3; ++a) {
+                    ImGui::DragIntRange2(axis_names[a],
+                                         &crop_region.lower[a],
+                                         &crop_region.upper[a],
+                                         1.f,
+                                         0,
+                                         volume_dims[a]);
+                    // Keep at least one voxel in the box
+                    crop_region.lower[a] = std::min(crop_region.lower[a], volume_dims[a] - 1);
+                    crop_region.upper[a] =
+                        std::max(crop_region.upper[a], crop_region.lower[a] + 1);
+                }
+                ImGui::Checkbox("Release Uncropped Voxels", &crop_release);
+                if (ImGui::Button("Apply Crop")) {
+                    crop_requested = true;
+                }
+                if (cropped) {
+                    ImGui::SameLine();
+                    if (ImGui::Button("Reset Crop")) {
+                        uncrop_requested = true;
+                    }
+                }
+                ImGui::Separator();
+                slice_changed |= ImGui::Checkbox("Slice View", &show_slice_view);
+            }
+
+            // Changing the seeds or tracing params retraces the lines in the background
+            if (vector_field) {
+                ImGui::Separator();
+                ImGui::Text("Streamlines: %d lines, %d vertices (%.1f ms)",
+                            int(streamlines.lines.num_lines),
+                            int(streamlines.lines.positions.size()),
+                            streamline_trace_ms);
+                if (ImGui::Checkbox("Show Magnitude Volume", &show_magnitude)) {
+                    world.setParam("instance", cpp::CopiedData(world_instances()));
+                    pending_commits.push_back(world.handle());
+                }
+                streamlines_changed |= ImGui::Checkbox("Show Streamlines", &show_streamlines);
+                const char *axis_names[3] = {"Seed X", "Seed Y", "Seed Z"};
+                for (int a = 0; a < 3; ++a) {
+                    const float lo = vector_field->bounds.lower[a];
+                    const float hi = vector_field->bounds.upper[a];
+                    streamlines_changed |=
+                        ImGui::DragFloatRange2(axis_names[a],
+                                               &streamline_params.seed_box.lower[a],
+                                               &streamline_params.seed_box.upper[a],
+                                               (hi - lo) / 200.f,
+                                               lo,
+                                               hi);
+                }
+                streamlines_changed |= ImGui::SliderInt3(
+                    "Seed Grid", &streamline_params.seed_res.x, 1, 64);
+                streamlines_changed |= ImGui::SliderInt(
+                    "Random Seeds", &streamline_params.random_seeds, 0, 65536);
+                streamlines_changed |= ImGui::SliderFloat(
+                    "Step (voxels)", &streamline_params.step, 0.05f, 2.f);
+                streamlines_changed |=
+                    ImGui::SliderInt("Max Steps", &streamline_params.max_steps, 1, 4096);
+                if (ImGui::SliderFloat("Line Radius",
+                                       &streamline_radius,
+                                       world_diagonal / 10000.f,
+                                       world_diagonal / 100.f)) {
+                    streamlines.set_radius(streamline_radius, pending_commits);
+                }
+            }
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Memory")) {
+            for (size_t i = 0; i < size_t(MemoryCategory::COUNT); ++i) {
+                const MemoryCategory c = MemoryCategory(i);
+                ImGui::Text("%s: %s (peak %s)",
+                            memory_category_name(c),
+                            format_bytes(tracked_memory(c)).c_str(),
+                            format_bytes(tracked_memory_peak(c)).c_str());
+            }
+            ImGui::Separator();
+            ImGui::Text("RSS: %s (peak %s)",
+                        format_bytes(current_rss()).c_str(),
+                        format_bytes(peak_rss()).c_str());
+            for (const auto &stage : memory_stages()) {
+                ImGui::Text("%s: RSS %s (peak %s)",
+                            stage.name.c_str(),
+                            format_bytes(stage.rss).c_str(),
+                            format_bytes(stage.peak_rss).c_str());
+            }
         }
         ImGui::End();
 
@@ -773,6 +1866,70 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
         }
         ImGui::End();
 
+        // Moving a volume changes the world's bounds, so the world is recommitted
+        for (size_t i = 0; i < scene_volumes.size(); ++i) {
+            SceneVolume &v = *scene_volumes[i];
+            const std::string title = "Transfer Function: " +
+                                      get_file_basename(v.volume_file) + "##" +
+                                      std::to_string(i);
+            if (ImGui::Begin(title.c_str()) && v.draw_ui(pending_commits)) {
+                pending_commits.push_back(world.handle());
+            }
+            ImGui::End();
+        }
+
+        if (show_slice_view && brick.voxel_data) {
+            if (ImGui::Begin("Slice View", &show_slice_view)) {
+                slice_changed |= ImGui::Checkbox("Oblique", &slice_params.oblique);
+                if (!slice_params.oblique) {
+                    const char *axis_names[3] = {"X", "Y", "Z"};
+                    for (int a = 0; a < 3; ++a) {
+                        if (a > 0) {
+                            ImGui::SameLine();
+                        }
+                        slice_changed |=
+                            ImGui::RadioButton(axis_names[a], &slice_params.axis, a);
+                    }
+                    const int slice_count = brick.dims[slice_params.axis];
+                    slice_params.index = std::min(slice_params.index, slice_count - 1);
+                    slice_changed |=
+                        ImGui::SliderInt("Slice", &slice_params.index, 0, slice_count - 1);
+                } else {
+                    slice_changed |=
+                        ImGui::SliderFloat3("Normal", &slice_params.normal.x, -1.f, 1.f);
+                    if (length(slice_params.normal) < 1e-3f) {
+                        slice_params.normal = math::vec3f(0.f, 0.f, 1.f);
+                    }
+                    const float half_diagonal = 0.5f * length(brick.bounds.size());
+                    slice_changed |= ImGui::SliderFloat(
+                        "Offset", &slice_offset, -half_diagonal, half_diagonal);
+                    slice_params.center =
+                        brick.bounds.center() + slice_offset * normalize(slice_params.normal);
+                    slice_changed |=
+                        ImGui::SliderInt("Resolution", &slice_params.resolution, 64, 4096);
+                }
+                slice_changed |= ImGui::Checkbox("Use Opacity", &slice_params.use_opacity);
+                // The image is stored bottom row first, so it's flipped to show +y up
+                if (slice_texture) {
+                    const math::vec2f extent = slice_renderer.image_extent();
+                    const float width = ImGui::GetContentRegionAvail().x;
+                    ImGui::Image((void *)(intptr_t)slice_texture,
+                                 ImVec2(width, width * extent.y / extent.x),
+                                 ImVec2(0.f, 1.f),
+                                 ImVec2(1.f, 0.f));
+                }
+            }
+            ImGui::End();
+        }
+
+        if (brick.gradient && ImGui::Begin("2D Transfer Function")) {
+            tfn_2d_toggled = ImGui::Checkbox("Render with 2D Transfer Function", &use_tfn_2d);
+            tfn_2d_widget.draw_ui();
+        }
+        if (brick.gradient) {
+            ImGui::End();
+        }
+
         // Rendering
         ImGui::Render();
         glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
@@ -782,10 +1939,38 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
             done = true;
         }
 
-        if (future.isReady()) {
+        const bool use_raycaster = use_tfn_2d || use_shading;
+        bool raycast_changed = false;
+        if (tfn_2d_toggled || shading_toggled) {
+            if (use_raycaster) {
+                // Let OSPRay finish its frame, the raycaster renders synchronously in its
+                // place until the 2D transfer function and shading are disabled
+                future.wait();
+                if (!raycaster) {
+                    make_raycaster();
+                }
+            }
+            raycast_changed = true;
+        }
+
+        if (use_raycaster || future.isReady()) {
             ++frame_id;
+            ++accumulated_frames;
+            if (accumulated_frames >= 2) {
+                interacting = false;
+            }
+            if (frame_id == 1) {
+                record_memory_stage("First frame");
+            }
+            if (ospray_frame_pending) {
+                quality_frame_times[quality_presets()[rendered_quality].name].record(
+                    std::chrono::duration<double, std::milli>(frame_end.get() - frame_start)
+                        .count());
+                ospray_frame_pending = false;
+            }
             if (!window_changed) {
-                uint32_t *img = (uint32_t *)fb.map(OSP_FB_COLOR);
+                const uint32_t *img = use_raycaster ? raycaster->image_data()
+                                                    : (const uint32_t *)fb.map(OSP_FB_COLOR);
                 glTexSubImage2D(GL_TEXTURE_2D,
                                 0,
                                 0,
@@ -804,12 +1989,111 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
                               << std::endl;
                     stbi_flip_vertically_on_write(0);
                 }
-                fb.unmap(img);
+                // Skip progressive frames while the receiver is still reading the last one
+                const bool converged = accumulated_frames >= stream_accumulation;
+                EncodedFrame frame;
+                if (stream_sender && stream_sender->is_connected() &&
+                    (converged || !stream_sender->busy()) &&
+                    stream_encoder.encode(
+                        img, win_width, win_height, interacting, converged, frame)) {
+                    frame.header["accumulation"] = accumulated_frames;
+                    frame.header["converged"] = converged;
+                    stream_sender->post_frame(frame);
+                }
+                if (!use_raycaster) {
+                    fb.unmap((void *)img);
+                }
             }
             window_changed = false;
 
-            if (tfn_widget.changed()) {
-                tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+            if (crop_requested) {
+                const VolumeBrick full = full_volume();
+                VolumeBrick crop = crop_volume(full, crop_region);
+                if (compute_gradient) {
+                    compute_brick_gradient(crop, quantize_gradient);
+                }
+                if (compute_normals) {
+                    compute_brick_normals(crop);
+                }
+                full_brick = crop_release ? VolumeBrick() : full;
+                if (crop_release && fields.size() != 0) {
+                    fields.release(active_field);
+                }
+                cropped = true;
+                replace_volume(crop);
+                record_memory_stage("Volume cropped");
+            } else if (uncrop_requested) {
+                const VolumeBrick full = full_volume();
+                full_brick = VolumeBrick();
+                cropped = false;
+                replace_volume(full);
+                crop_region = math::box3i(math::vec3i(0), volume_dims);
+            }
+            crop_requested = false;
+            uncrop_requested = false;
+
+            if (requested_field != -1 && size_t(requested_field) != active_field) {
+                // Keep the current field's transfer function to restore it when it's
+                // selected again
+                FieldTransferFunction &prev_tfn = fields.transfer_functions[active_field];
+                prev_tfn.saved = true;
+                prev_tfn.colormap = tfn_widget.current_colormap_name();
+                prev_tfn.opacity_points = tfn_widget.get_opacity_points();
+                prev_tfn.value_range = ui_value_range;
+
+                active_field = requested_field;
+                const std::shared_ptr<VolumeBrick> field = fields.acquire(active_field);
+                value_range = field->value_range;
+                VolumeBrick field_brick = *field;
+                if (cropped) {
+                    field_brick = crop_volume(*field, crop_region);
+                    full_brick = crop_release ? VolumeBrick() : *field;
+                    if (crop_release) {
+                        fields.release(active_field);
+                    }
+                }
+                if (compute_gradient) {
+                    compute_brick_gradient(field_brick, quantize_gradient);
+                    const math::vec2i histogram_bins(256, 128);
+                    tfn_2d_widget.set_histogram(compute_histogram_2d(field_brick,
+                                                                     *field_brick.gradient,
+                                                                     value_range,
+                                                                     histogram_bins),
+                                                histogram_bins.x,
+                                                histogram_bins.y);
+                }
+                if (compute_normals) {
+                    compute_brick_normals(field_brick);
+                }
+                histogram = load_cached_histogram(*field, field_data_file(), 1024);
+                tfn_widget.set_histogram(
+                    histogram.counts, histogram.value_range.x, histogram.value_range.y);
+
+                const FieldTransferFunction &next_tfn =
+                    fields.transfer_functions[active_field];
+                ui_value_range = value_range;
+                if (next_tfn.saved) {
+                    tfn_widget.select_colormap(next_tfn.colormap);
+                    tfn_widget.set_opacity_points(next_tfn.opacity_points);
+                    ui_value_range = next_tfn.value_range;
+                }
+                tfn_widget.set_value_range(ui_value_range.x, ui_value_range.y);
+                tfn.setParam("valueRange", ui_value_range);
+                pending_commits.push_back(tfn.handle());
+                // The previous field may have been evicted, replacing the volume also
+                // extracts the isosurfaces from the new field so nothing references it
+                replace_volume(field_brick);
+                record_memory_stage("Field loaded");
+            }
+            requested_field = -1;
+
+            size_t tfn_begin = 0;
+            size_t tfn_end = 0;
+            // Only the span of the table changed by the edit is copied into the shared
+            // arrays, OSPRay reads them in place so there's no further copy on commit
+            if (tfn_widget.get_colormapf_changes(
+                    tfn_colors, tfn_opacities, tfn_begin, tfn_end)) {
+                tfn_memory.resize((tfn_colors.size() + tfn_opacities.size()) * sizeof(float));
                 tfn.setParam(
                     "color",
                     cpp::SharedData(reinterpret_cast<math::vec3f *>(tfn_colors.data()),
@@ -819,29 +2103,159 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
                 tfn.setParam("valueRange", ui_value_range);
                 pending_commits.push_back(tfn.handle());
                 pending_commits.push_back(brick.model.handle());
+                if (raycaster) {
+                    raycaster->set_transfer_function(
+                        tfn_colors, tfn_opacities, tfn_begin, tfn_end);
+                }
+                slice_renderer.set_transfer_function(tfn_colors, tfn_opacities);
+                slice_changed = true;
+                if (streamlines.active()) {
+                    streamlines.set_colors(
+                        streamline_colors(streamlines.lines, tfn_colors, ui_value_range),
+                        pending_commits);
+                }
             }
-
-            if (clipping_changed) {
-                std::vector<cpp::Instance> active_instances = {instance};
-                for (auto &p : clipping_planes) {
-                    if (p.enabled) {
-                        active_instances.push_back(p.instance);
-                    }
+            for (auto &v : scene_volumes) {
+                v->update_transfer_function(pending_commits);
+            }
+            if (raycaster && (tfn_2d_widget.changed() || tfn_2d_toggled)) {
+                std::vector<float> opacities;
+                size_t value_res = 0;
+                size_t gradient_res = 0;
+                // An empty table classifies by value alone when only shading is enabled
+                if (use_tfn_2d) {
+                    tfn_2d_widget.get_opacities(opacities, value_res, gradient_res);
                 }
-                world.setParam("instance", cpp::CopiedData(active_instances));
+                raycaster->set_transfer_function_2d(
+                    opacities, math::vec2i(int(value_res), int(gradient_res)));
+                raycast_changed = true;
+            }
+
+            // Moving a plane or box only recommits the clipping group, the world is only
+            // recommitted when clipping is turned on or off
+            if (clipping_changed && clipping.update(pending_commits)) {
+                world.setParam("instance", cpp::CopiedData(world_instances()));
                 pending_commits.push_back(world.handle());
             }
             clipping_changed = false;
 
-            if (!pending_commits.empty()) {
+            // Traced lines replace the current ones now that OSPRay is done with their
+            // arrays. Edits made while tracing are traced once the current trace finishes
+            if (streamline_task.valid() &&
+                streamline_task.wait_for(std::chrono::seconds(0)) ==
+                    std::future_status::ready) {
+                Streamlines lines = streamline_task.get();
+                streamline_trace_ms = std::chrono::duration<double, std::milli>(
+                                          std::chrono::steady_clock::now() - streamline_start)
+                                          .count();
+                // Lines traced before the streamlines were hidden are dropped
+                replace_streamlines(show_streamlines ? std::move(lines) : Streamlines());
+            }
+            if (streamlines_changed && !streamline_task.valid()) {
+                if (show_streamlines) {
+                    const StreamlineParams params = streamline_params;
+                    streamline_start = std::chrono::steady_clock::now();
+                    streamline_task = std::async(std::launch::async, [vector_field, params]() {
+                        return trace_streamlines(*vector_field, params);
+                    });
+                } else {
+                    replace_streamlines(Streamlines());
+                }
+                streamlines_changed = false;
+            }
+
+            const size_t want_quality =
+                quality_auto ? (interacting ? 0 : quality_presets().size() - 1)
+                             : size_t(quality_index);
+            if (want_quality != active_quality) {
+                active_quality = want_quality;
+                apply_quality_preset(
+                    renderer, renderer_type, quality_presets()[active_quality]);
+                pending_commits.push_back(renderer.handle());
+            }
+
+            if (!pending_commits.empty() || raycast_changed) {
                 fb.clear();
+                if (raycaster) {
+                    raycaster->reset_accumulation();
+                }
+                accumulated_frames = 0;
             }
             for (auto &c : pending_commits) {
                 ospCommit(c);
             }
             pending_commits.clear();
 
-            future = fb.renderFrame(renderer, camera, world);
+            if (use_raycaster) {
+                RaycastParams raycast_params;
+                raycast_params.preintegrated = !use_tfn_2d;
+                raycast_params.shade = use_shading;
+                raycast_params.sampling_rate = sampling_rate;
+                raycast_params.density_scale = density_scale;
+                raycast_params.background_color = background_color;
+                raycast_params.value_range = ui_value_range;
+                raycaster->set_params(raycast_params);
+
+                RaycastCamera raycast_camera;
+                raycast_camera.eye = math::vec3f(cam_eye.x, cam_eye.y, cam_eye.z);
+                raycast_camera.dir = math::vec3f(cam_dir.x, cam_dir.y, cam_dir.z);
+                raycast_camera.up = math::vec3f(cam_up.x, cam_up.y, cam_up.z);
+                raycast_camera.aspect = static_cast<float>(win_width) / win_height;
+                raycaster->render_frame(raycast_camera);
+            } else {
+                render_frame();
+                rendered_quality = active_quality;
+                ospray_frame_pending = true;
+            }
+        }
+        tfn_2d_toggled = false;
+        shading_toggled = false;
+
+        if (show_slice_view && brick.voxel_data && slice_changed) {
+            // A crop or field applied since the UI was drawn may have shrunk the volume
+            slice_params.axis = std::min(std::max(slice_params.axis, 0), 2);
+            slice_params.index = std::min(std::max(slice_params.index, 0),
+                                          brick.dims[slice_params.axis] - 1);
+            slice_params.value_range = ui_value_range;
+            slice_params.background_color = background_color;
+            slice_renderer.render(brick, slice_params);
+
+            const math::vec2i size = slice_renderer.image_size();
+            if (!slice_texture) {
+                glGenTextures(1, &slice_texture);
+                glBindTexture(GL_TEXTURE_2D, slice_texture);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+            glBindTexture(GL_TEXTURE_2D, slice_texture);
+            if (size != slice_texture_size) {
+                slice_texture_size = size;
+                slice_texture_memory.resize(size_t(size.x) * size.y * 4);
+                glTexImage2D(GL_TEXTURE_2D,
+                             0,
+                             GL_RGBA8,
+                             size.x,
+                             size.y,
+                             0,
+                             GL_RGBA,
+                             GL_UNSIGNED_BYTE,
+                             slice_renderer.image_data());
+            } else {
+                glTexSubImage2D(GL_TEXTURE_2D,
+                                0,
+                                0,
+                                0,
+                                size.x,
+                                size.y,
+                                GL_RGBA,
+                                GL_UNSIGNED_BYTE,
+                                slice_renderer.image_data());
+            }
+            // The render texture stays bound for the frame uploads and display
+            glBindTexture(GL_TEXTURE_2D, render_texture);
+            slice_changed = false;
         }
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -853,7 +2267,13 @@ void run_app(const std::vector<std::string> &args, SDL_Window *window)
         SDL_GL_SwapWindow(window);
 
         camera_changed = false;
-        lights_changed = false;
     }
+    if (stream_sender) {
+        stream_sender->close();
+        close_socket(stream_fd);
+    }
+    record_memory_stage("Exit");
+    std::cout << quality_frame_time_report(quality_frame_times);
+    std::cout << memory_report();
 }
 
@@ -0,0 +1,67 @@
+#include "render_quality.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+const std::vector<QualityPreset> &quality_presets()
+{
+    // name, pixel samples, AO samples, shadows, max path length
+    static const std::vector<QualityPreset> presets = {{"interactive", 1, 0, false, 4},
+                                                       {"balanced", 1, 1, true, 8},
+                                                       {"final", 4, 4, true, 20}};
+    return presets;
+}
+
+size_t find_quality_preset(const std::string &name)
+{
+    const auto &presets = quality_presets();
+    for (size_t i = 0; i < presets.size(); ++i) {
+        if (presets[i].name == name) {
+            return i;
+        }
+    }
+    throw std::runtime_error("Unrecognized quality preset " + name);
+}
+
+void apply_quality_preset(cpp::Renderer &renderer,
+                          const std::string &renderer_type,
+                          const QualityPreset &preset)
+{
+    renderer.setParam("pixelSamples", preset.pixel_samples);
+    renderer.setParam("maxPathLength", preset.max_path_length);
+    if (renderer_type == "scivis") {
+        renderer.setParam("aoSamples", preset.ao_samples);
+        renderer.setParam("shadows", preset.shadows);
+    }
+}
+
+void QualityFrameTimes::record(const double ms)
+{
+    ++frames;
+    total_ms += ms;
+    max_ms = std::max(max_ms, ms);
+}
+
+double QualityFrameTimes::mean_ms() const
+{
+    return frames > 0 ? total_ms / frames : 0.0;
+}
+
+std::string quality_frame_time_report(const std::map<std::string, QualityFrameTimes> &times)
+{
+    std::stringstream ss;
+    ss << "Frame times per quality preset:\n";
+    for (const auto &preset : quality_presets()) {
+        auto fnd = times.find(preset.name);
+        if (fnd == times.end() || fnd->second.frames == 0) {
+            continue;
+        }
+        const QualityFrameTimes &t = fnd->second;
+        ss << "  " << std::left << std::setw(12) << preset.name << std::right << t.frames
+           << " frames, mean " << std::fixed << std::setprecision(2) << t.mean_ms()
+           << "ms (" << 1000.0 / t.mean_ms() << " FPS), max " << t.max_ms << "ms\n";
+        ss.unsetf(std::ios_base::floatfield);
+    }
+    return ss.str();
+}
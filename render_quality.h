@@ -0,0 +1,44 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <ospray/ospray.h>
+#include <ospray/ospray_cpp.h>
+
+using namespace ospray;
+
+// Renderer settings trading frame time for image quality, set together so the tradeoff is
+// explicit instead of leaving some parameters at the renderer's defaults
+struct QualityPreset {
+    std::string name;
+    int pixel_samples = 1;
+    int ao_samples = 0;
+    bool shadows = false;
+    int max_path_length = 4;
+};
+
+// The interactive, balanced and final presets, from fastest to highest quality
+const std::vector<QualityPreset> &quality_presets();
+
+// Get the index of the named preset in quality_presets, throwing if there's no such preset
+size_t find_quality_preset(const std::string &name);
+
+// Set the preset's parameters on the renderer, which must be committed after. The scivis
+// renderer takes all of them, the path tracer only the pixel samples and max path length
+void apply_quality_preset(cpp::Renderer &renderer,
+                          const std::string &renderer_type,
+                          const QualityPreset &preset);
+
+struct QualityFrameTimes {
+    size_t frames = 0;
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+
+    void record(const double ms);
+
+    double mean_ms() const;
+};
+
+// Format the frame times of each preset as a table, in the order of quality_presets
+std::string quality_frame_time_report(const std::map<std::string, QualityFrameTimes> &times);
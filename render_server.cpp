@@ -0,0 +1,312 @@
+#include "render_server.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include "frame_transport.h"
+#include "json.hpp"
+#include "memory_stats.h"
+#include "render_session.h"
+#include "socket_util.h"
+#include "util.h"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// How often the accept loop checks if a session requested the server shut down
+const int ACCEPT_POLL_MS = 100;
+
+// Updates received from the client, shared between the receive thread and the render loop
+struct ClientConnection {
+    int fd = -1;
+    std::mutex mutex;
+    std::condition_variable render_cv;
+
+    std::vector<json> updates;
+    bool connected = true;
+
+    void push_update(const json &update)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        updates.push_back(update);
+        render_cv.notify_one();
+    }
+
+    void disconnect()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        connected = false;
+        render_cv.notify_all();
+    }
+};
+
+struct StreamSettings {
+    int max_accumulation;
+    int preview_passes;
+
+    StreamSettings(const RenderServerParams &params)
+        : max_accumulation(params.max_accumulation), preview_passes(params.preview_passes)
+    {
+    }
+
+    void apply_update(const json &update, FrameTransportParams &transport)
+    {
+        max_accumulation = std::max(update.value("max_accumulation", max_accumulation), 1);
+        preview_passes = update.value("preview_passes", preview_passes);
+        transport.max_fps = std::max(update.value("max_fps", transport.max_fps), 1.f);
+        transport.preview_quality = update.value("preview_quality", transport.preview_quality);
+        transport.tile_quality = update.value("tile_quality", transport.tile_quality);
+        transport.full_quality = update.value("full_quality", transport.full_quality);
+        transport.tile_threshold = update.value("tile_threshold", transport.tile_threshold);
+    }
+};
+
+// Tears a client's connection down when the session ends, including when it ends by an
+// exception, so the receive thread is never destroyed while joinable
+struct ConnectionTeardown {
+    ClientConnection &conn;
+    FrameSender &sender;
+    std::thread &receiver;
+    bool done = false;
+
+    ConnectionTeardown(ClientConnection &conn, FrameSender &sender, std::thread &receiver)
+        : conn(conn), sender(sender), receiver(receiver)
+    {
+    }
+
+    ~ConnectionTeardown()
+    {
+        run();
+    }
+
+    // Shutting the socket down first unblocks a send to a client that stopped reading,
+    // so the sender's thread can be joined
+    void run()
+    {
+        if (done) {
+            return;
+        }
+        done = true;
+        conn.disconnect();
+        shutdown_socket(conn.fd);
+        sender.close();
+        if (receiver.joinable()) {
+            receiver.join();
+        }
+        close_socket(conn.fd);
+    }
+};
+
+// Serve a client with its own render session until it disconnects, returns true if the
+// client requested the server shutdown
+bool serve_client(const std::shared_ptr<VolumeBrick> &dataset,
+                  ClientConnection &conn,
+                  const RenderServerParams &params)
+{
+    const int fd = conn.fd;
+    FrameSender sender(fd);
+    std::thread receiver;
+    ConnectionTeardown teardown(conn, sender, receiver);
+
+    // The session is setup before receiving updates, setup failures such as an unsupported
+    // renderer for the volume end the connection through the teardown
+    RenderSession session(dataset, params.session);
+    StreamSettings settings(params);
+    FrameEncoder encoder(params.transport);
+
+    receiver = std::thread([&]() {
+        Message msg;
+        while (recv_message(fd, msg)) {
+            if (msg.type != MESSAGE_JSON) {
+                continue;
+            }
+            try {
+                conn.push_update(json::parse(msg.payload.begin(), msg.payload.end()));
+            } catch (const std::exception &e) {
+                sender.post_json({{"type", "error"}, {"message", e.what()}});
+            }
+        }
+        conn.disconnect();
+    });
+    sender.post_json(session.describe());
+
+    bool shutdown_requested = false;
+    bool closing = false;
+    // Set when the camera moves, previews are sent until the image has accumulated a few
+    // passes after the camera stops
+    bool interacting = false;
+    size_t frame_id = 0;
+    size_t skipped_frames = 0;
+    while (!closing) {
+        std::vector<json> updates;
+        {
+            std::unique_lock<std::mutex> lock(conn.mutex);
+            // Once the image has converged there's nothing to do until the client changes
+            // something
+            if (session.accumulated_frames >= settings.max_accumulation) {
+                conn.render_cv.wait(
+                    lock, [&]() { return !conn.connected || !conn.updates.empty(); });
+            }
+            if (!conn.connected) {
+                break;
+            }
+            std::swap(updates, conn.updates);
+        }
+
+        // Updates received while the previous pass was rendering are applied together
+        for (const auto &u : updates) {
+            if (u.value("shutdown", false)) {
+                shutdown_requested = true;
+                closing = true;
+            }
+            if (u.value("close", false)) {
+                closing = true;
+            }
+            try {
+                settings.apply_update(u, encoder.parameters());
+                session.apply_update(u);
+                if (u.find("camera") != u.end()) {
+                    interacting = true;
+                }
+                if (u.value("describe", false)) {
+                    sender.post_json(session.describe());
+                }
+            } catch (const std::exception &e) {
+                sender.post_json({{"type", "error"}, {"message", e.what()}});
+            }
+        }
+        if (closing) {
+            break;
+        }
+
+        const auto render_start = Clock::now();
+        session.render_pass();
+        const auto render_end = Clock::now();
+        if (session.accumulated_frames >= settings.preview_passes) {
+            interacting = false;
+        }
+
+        // Skip progressive frames while the client is still reading the last one, tiles
+        // are relative to what was sent before so they can't replace a frame waiting to be
+        // sent. The converged frame is a full frame and is always sent
+        const bool converged = session.accumulated_frames >= settings.max_accumulation;
+        if (!converged && sender.busy()) {
+            ++skipped_frames;
+            continue;
+        }
+
+        EncodedFrame frame;
+        const uint32_t *img = session.map_image();
+        const bool send = encoder.encode(
+            img, session.img_size.x, session.img_size.y, interacting, converged, frame);
+        session.unmap_image(img);
+        if (!send) {
+            continue;
+        }
+
+        frame.header["frame"] = frame_id++;
+        frame.header["accumulation"] = session.accumulated_frames;
+        frame.header["converged"] = converged;
+        frame.header["render_ms"] =
+            std::chrono::duration<double, std::milli>(render_end - render_start).count();
+        frame.header["skipped_frames"] = skipped_frames;
+        frame.header["dropped_frames"] = sender.num_dropped_frames();
+        sender.post_frame(frame);
+    }
+
+    teardown.run();
+
+    std::cout << "Client disconnected, sent " << frame_id << " frames ("
+              << format_bytes(sender.num_sent_bytes()) << "), skipped " << skipped_frames
+              << "\n";
+    return shutdown_requested;
+}
+
+}
+
+void run_render_server(const std::shared_ptr<VolumeBrick> &dataset,
+                       const RenderServerParams &params)
+{
+    const int listen_fd = listen_on(params.address);
+    std::cout << "Render server listening on " << params.address << "\n";
+
+    std::atomic<bool> shutdown(false);
+    std::mutex clients_mutex;
+    std::vector<std::shared_ptr<ClientConnection>> clients;
+    std::vector<std::thread> client_threads;
+    // The sessions which have ended, their threads are joined by the accept loop
+    std::vector<std::thread::id> finished_threads;
+    while (!shutdown) {
+        {
+            std::vector<std::thread::id> finished;
+            {
+                std::lock_guard<std::mutex> lock(clients_mutex);
+                std::swap(finished, finished_threads);
+            }
+            for (const auto &id : finished) {
+                auto it = std::find_if(
+                    client_threads.begin(), client_threads.end(), [&](const std::thread &t) {
+                        return t.get_id() == id;
+                    });
+                it->join();
+                client_threads.erase(it);
+            }
+        }
+        // Poll for connections rather than blocking in accept, so a session requesting
+        // shutdown is noticed without having to wake up accept, which another thread
+        // can't portably interrupt
+        if (!wait_readable(listen_fd, ACCEPT_POLL_MS)) {
+            continue;
+        }
+        const int fd = accept_client(listen_fd);
+        if (fd < 0) {
+            if (!shutdown) {
+                std::cerr << "[error]: Failed to accept client connection\n";
+            }
+            continue;
+        }
+        std::cout << "Client connected\n";
+
+        auto conn = std::make_shared<ClientConnection>();
+        conn->fd = fd;
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            clients.push_back(conn);
+        }
+        client_threads.emplace_back([&, conn]() {
+            try {
+                if (serve_client(dataset, *conn, params)) {
+                    shutdown = true;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "[error]: Client session failed: " << e.what() << "\n";
+            }
+            std::lock_guard<std::mutex> lock(clients_mutex);
+            clients.erase(std::find(clients.begin(), clients.end(), conn));
+            finished_threads.push_back(std::this_thread::get_id());
+        });
+    }
+
+    // Disconnect any other clients still connected and wait for their sessions to finish
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        for (auto &c : clients) {
+            c->disconnect();
+        }
+    }
+    for (auto &t : client_threads) {
+        t.join();
+    }
+
+    close_socket(listen_fd);
+    if (starts_with(params.address, "unix:")) {
+        std::remove(params.address.substr(5).c_str());
+    }
+    std::cout << "Render server shutting down\n";
+}
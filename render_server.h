@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "frame_transport.h"
+#include "render_session.h"
+#include "volume_data.h"
+
+struct RenderServerParams {
+    // Either "unix:<path>" for a Unix domain socket or "[host:]port" for TCP
+    std::string address = "unix:/tmp/mini_scivis.sock";
+    // The initial parameters for each client's render session
+    RenderSessionParams session;
+    // How frames are encoded and paced for the clients
+    FrameTransportParams transport;
+    // Stop rendering once this many frames have been accumulated
+    int max_accumulation = 64;
+    // Previews are sent after the camera moves until this many frames have accumulated
+    int preview_passes = 2;
+};
+
+// Run a headless render server for the dataset. Each client gets its own render session
+// sharing the dataset, and can send JSON updates to the camera, transfer function and
+// render parameters. Frames are sent as downscaled previews while the camera moves, then
+// as the tiles which changed while the image accumulates, and in full once converged.
+// The dataset stays loaded between clients, the server exits when a client sends
+// {"shutdown": true}.
+void run_render_server(const std::shared_ptr<VolumeBrick> &dataset,
+                       const RenderServerParams &params);
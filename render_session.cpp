@@ -0,0 +1,352 @@
+#include "render_session.h"
+#include <array>
+#include "frame_transport.h"
+
+namespace {
+
+json vec3_json(const math::vec3f &v)
+{
+    return {v.x, v.y, v.z};
+}
+
+math::vec3f json_vec3(const json &j)
+{
+    return math::vec3f(j.at(0).get<float>(), j.at(1).get<float>(), j.at(2).get<float>());
+}
+
+}
+
+RenderSession::RenderSession(const std::shared_ptr<VolumeBrick> &dataset,
+                             const RenderSessionParams &params)
+    : dataset(dataset),
+      value_range(dataset->value_range),
+      group(OSPGroup(nullptr)),
+      world(OSPWorld(nullptr)),
+      world_bounds(params.distributed ? params.global_bounds : dataset->bounds),
+      image_start(params.image_start),
+      image_end(params.image_end),
+      img_size(params.img_size)
+{
+    tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+    tfn_memory = TrackedMemory(MemoryCategory::TRANSFER_FUNCTION,
+                               (tfn_colors.size() + tfn_opacities.size()) * sizeof(float));
+    lights.params = default_lights();
+
+    const math::vec3f world_center = world_bounds.center();
+    const float world_diagonal = math::length(world_bounds.size());
+    cam_eye =
+        math::vec3f(world_center.x, world_center.y, world_center.z - world_diagonal * 1.5f);
+    cam_at = world_center;
+    cam_up = math::vec3f(0.f, 1.f, 0.f);
+    fb_memory = TrackedMemory(MemoryCategory::FRAMEBUFFER,
+                              framebuffer_bytes(img_size.x, img_size.y));
+
+    // The raycaster renders the session by itself, so none of the OSPRay objects are made
+    if (params.renderer_type == "preintegrated") {
+        if (params.distributed) {
+            throw std::runtime_error(
+                "The preintegrated renderer doesn't support distributed rendering");
+        }
+        raycaster.reset(new CpuRaycaster(dataset, img_size));
+        RaycastParams raycast_params;
+        raycast_params.density_scale = params.density_scale;
+        raycast_params.background_color = params.background_color;
+        raycast_params.value_range = value_range;
+        raycaster->set_params(raycast_params);
+        update_transfer_function();
+        return;
+    }
+
+    tfn = cpp::TransferFunction("piecewiseLinear");
+    update_transfer_function();
+    tfn.commit();
+
+    renderer = cpp::Renderer(params.renderer_type);
+    renderer.setParam("volumeSamplingRate", 1.f);
+    renderer.setParam("backgroundColor", params.background_color);
+    renderer.commit();
+
+    model = cpp::VolumetricModel(dataset->brick);
+    model.setParam("densityScale", params.density_scale);
+    model.setParam("transferFunction", tfn);
+    model.commit();
+
+    group = cpp::Group();
+    group.setParam("volume", cpp::CopiedData(model));
+    group.commit();
+
+    instance = cpp::Instance(group);
+    instance.commit();
+
+    world = cpp::World();
+    world.setParam("instance", cpp::CopiedData(instance));
+    world.setParam("light", lights.light_list());
+    if (params.distributed) {
+        // Ghost voxels loaded around the partition are used for interpolation but clipped
+        // off so ranks' regions don't overlap when compositing
+        world.setParam("region", cpp::CopiedData(dataset->bounds));
+    }
+    world.commit();
+
+    camera = cpp::Camera("perspective");
+    update_camera();
+    camera.commit();
+
+    fb = cpp::FrameBuffer(img_size.x, img_size.y, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
+    fb.clear();
+}
+
+bool RenderSession::apply_update(const json &update)
+{
+    // The OSPRay objects to commit, which are only made when not using the raycaster
+    std::vector<OSPObject> pending_commits;
+    bool changed = false;
+    if (update.find("camera") != update.end()) {
+        const json &cam = update["camera"];
+        if (cam.find("eye") != cam.end()) {
+            cam_eye = json_vec3(cam["eye"]);
+        }
+        if (cam.find("at") != cam.end()) {
+            cam_at = json_vec3(cam["at"]);
+        }
+        if (cam.find("up") != cam.end()) {
+            cam_up = json_vec3(cam["up"]);
+        }
+        if (cam.find("fovy") != cam.end()) {
+            fovy = cam["fovy"].get<float>();
+        }
+        update_camera();
+        if (!raycaster) {
+            pending_commits.push_back(camera.handle());
+        }
+        changed = true;
+    }
+    if (update.find("image_size") != update.end()) {
+        const math::vec2i size(update["image_size"][0].get<int>(),
+                               update["image_size"][1].get<int>());
+        if (size.x <= 0 || size.y <= 0) {
+            throw std::runtime_error("Invalid image size");
+        }
+        if (size != img_size) {
+            img_size = size;
+            fb_memory.resize(framebuffer_bytes(img_size.x, img_size.y));
+            if (raycaster) {
+                raycaster->resize(img_size);
+            } else {
+                fb = cpp::FrameBuffer(
+                    img_size.x, img_size.y, OSP_FB_SRGBA, OSP_FB_COLOR | OSP_FB_ACCUM);
+                update_camera();
+                pending_commits.push_back(camera.handle());
+            }
+            changed = true;
+        }
+    }
+
+    bool tfn_changed = false;
+    if (update.find("colormap") != update.end()) {
+        const std::string name = update["colormap"].get<std::string>();
+        if (!tfn_widget.select_colormap(name)) {
+            throw std::runtime_error("Unknown colormap " + name);
+        }
+        tfn_changed = true;
+    }
+    if (update.find("opacity_points") != update.end()) {
+        tfn_widget.set_opacity_points(
+            update["opacity_points"].get<std::vector<std::array<float, 2>>>());
+        tfn_changed = true;
+    }
+    if (update.find("value_range") != update.end()) {
+        value_range = math::vec2f(update["value_range"][0].get<float>(),
+                                  update["value_range"][1].get<float>());
+        tfn_changed = true;
+    }
+    if (update.find("tfn_2d") != update.end()) {
+        if (!raycaster) {
+            throw std::runtime_error(
+                "2D transfer functions require the preintegrated renderer");
+        }
+        tfn_2d_widget.set_regions(update["tfn_2d"].get<std::vector<std::array<float, 5>>>());
+        std::vector<float> opacities;
+        size_t value_res = 0;
+        size_t gradient_res = 0;
+        tfn_2d_widget.get_opacities(opacities, value_res, gradient_res);
+        if (update["tfn_2d"].empty()) {
+            opacities.clear();
+        }
+        raycaster->set_transfer_function_2d(opacities,
+                                            math::vec2i(int(value_res), int(gradient_res)));
+        changed = true;
+    }
+    if (update.find("lights") != update.end()) {
+        std::vector<LightParams> params;
+        for (const auto &l : update["lights"]) {
+            params.push_back(light_from_json(l));
+        }
+        lights.params = params;
+        // The raycaster doesn't light the volume, so only the OSPRay lights are updated
+        if (!raycaster && lights.update_all(pending_commits)) {
+            world.setParam("light", lights.light_list());
+            pending_commits.push_back(world.handle());
+        }
+        changed = true;
+    }
+    if (tfn_changed) {
+        update_transfer_function();
+        if (!raycaster) {
+            pending_commits.push_back(tfn.handle());
+            pending_commits.push_back(model.handle());
+        }
+        changed = true;
+    }
+
+    RaycastParams raycast_params = raycaster ? raycaster->get_params() : RaycastParams();
+    if (update.find("density_scale") != update.end()) {
+        raycast_params.density_scale = update["density_scale"].get<float>();
+        if (!raycaster) {
+            model.setParam("densityScale", raycast_params.density_scale);
+            pending_commits.push_back(model.handle());
+        }
+        changed = true;
+    }
+    if (update.find("sampling_rate") != update.end()) {
+        raycast_params.sampling_rate = update["sampling_rate"].get<float>();
+        if (!raycaster) {
+            renderer.setParam("volumeSamplingRate", raycast_params.sampling_rate);
+            pending_commits.push_back(renderer.handle());
+        }
+        changed = true;
+    }
+    if (update.find("background_color") != update.end()) {
+        raycast_params.background_color = json_vec3(update["background_color"]);
+        if (!raycaster) {
+            renderer.setParam("backgroundColor", raycast_params.background_color);
+            pending_commits.push_back(renderer.handle());
+        }
+        changed = true;
+    }
+    if (raycaster) {
+        raycast_params.value_range = value_range;
+        raycaster->set_params(raycast_params);
+    }
+
+    if (!changed) {
+        return false;
+    }
+    for (auto &c : pending_commits) {
+        ospCommit(c);
+    }
+    reset_accumulation();
+    return true;
+}
+
+void RenderSession::reset_accumulation()
+{
+    if (raycaster) {
+        raycaster->reset_accumulation();
+    } else {
+        fb.clear();
+    }
+    accumulated_frames = 0;
+}
+
+void RenderSession::render_pass()
+{
+    if (raycaster) {
+        raycaster->render_frame(raycast_camera());
+    } else {
+        fb.renderFrame(renderer, camera, world).wait();
+    }
+    ++accumulated_frames;
+}
+
+const uint32_t *RenderSession::map_image()
+{
+    if (raycaster) {
+        return raycaster->image_data();
+    }
+    return (const uint32_t *)fb.map(OSP_FB_COLOR);
+}
+
+void RenderSession::unmap_image(const uint32_t *img)
+{
+    if (!raycaster) {
+        fb.unmap((void *)img);
+    }
+}
+
+std::vector<uint8_t> RenderSession::encode_jpeg(const int quality)
+{
+    const uint32_t *img = map_image();
+    std::vector<uint8_t> jpeg = ::encode_jpeg(
+        reinterpret_cast<const uint8_t *>(img), img_size.x, img_size.y, quality, true);
+    unmap_image(img);
+    return jpeg;
+}
+
+json RenderSession::describe() const
+{
+    json info;
+    info["type"] = "scene";
+    info["image_size"] = {img_size.x, img_size.y};
+    info["world_bounds"] = {vec3_json(world_bounds.lower), vec3_json(world_bounds.upper)};
+    info["value_range"] = {value_range.x, value_range.y};
+    info["camera"] = {{"eye", vec3_json(cam_eye)},
+                      {"at", vec3_json(cam_at)},
+                      {"up", vec3_json(cam_up)},
+                      {"fovy", fovy}};
+    info["colormap"] = tfn_widget.current_colormap_name();
+    info["colormaps"] = tfn_widget.colormap_names();
+    info["opacity_points"] = tfn_widget.get_opacity_points();
+    info["tfn_2d"] = tfn_2d_widget.get_regions();
+    info["lights"] = json::array();
+    for (const auto &l : lights.params) {
+        info["lights"].push_back(light_to_json(l));
+    }
+    info["gradient"] = dataset->gradient != nullptr;
+    return info;
+}
+
+void RenderSession::update_camera()
+{
+    if (raycaster) {
+        return;
+    }
+    const math::vec2f region_size = image_end - image_start;
+    camera.setParam("aspect", (img_size.x / region_size.x) / (img_size.y / region_size.y));
+    camera.setParam("imageStart", image_start);
+    camera.setParam("imageEnd", image_end);
+    camera.setParam("position", cam_eye);
+    camera.setParam("direction", math::normalize(cam_at - cam_eye));
+    camera.setParam("up", cam_up);
+    camera.setParam("fovy", fovy);
+}
+
+void RenderSession::update_transfer_function()
+{
+    size_t begin = 0;
+    size_t end = 0;
+    tfn_widget.get_colormapf_changes(tfn_colors, tfn_opacities, begin, end);
+    if (raycaster) {
+        raycaster->set_transfer_function(tfn_colors, tfn_opacities, begin, end);
+        return;
+    }
+    tfn.setParam("color",
+                 cpp::SharedData(reinterpret_cast<math::vec3f *>(tfn_colors.data()),
+                                 tfn_colors.size() / 3));
+    tfn.setParam("opacity", cpp::SharedData(tfn_opacities.data(), tfn_opacities.size()));
+    tfn.setParam("valueRange", value_range);
+}
+
+RaycastCamera RenderSession::raycast_camera() const
+{
+    const math::vec2f region_size = image_end - image_start;
+    RaycastCamera cam;
+    cam.eye = cam_eye;
+    cam.dir = math::normalize(cam_at - cam_eye);
+    cam.up = cam_up;
+    cam.fovy = fovy;
+    cam.aspect = (img_size.x / region_size.x) / (img_size.y / region_size.y);
+    cam.image_start = image_start;
+    cam.image_end = image_end;
+    return cam;
+}
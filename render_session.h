@@ -0,0 +1,128 @@
+#pragma once
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ospray/ospray_cpp.h>
+#include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <rkcommon/math/box.h>
+#include <rkcommon/math/vec.h>
+#include "cpu_raycaster.h"
+#include "json.hpp"
+#include "lights.h"
+#include "memory_stats.h"
+#include "transfer_function_2d_widget.h"
+#include "transfer_function_widget.h"
+#include "volume_data.h"
+
+using namespace ospray;
+using namespace rkcommon;
+using json = nlohmann::json;
+
+struct RenderSessionParams {
+    // An OSPRay renderer, or "preintegrated" to render with the CPU raycaster using a
+    // pre-integrated transfer function table
+    std::string renderer_type = "scivis";
+    math::vec3f background_color = math::vec3f(1.f);
+    float density_scale = 1.f;
+    math::vec2i img_size = math::vec2i(1280, 720);
+    // Set when the session's dataset is one rank's partition of a distributed volume. The
+    // partition's bounds are set as the region the rank owns, and the camera is placed
+    // relative to the bounds of the whole volume
+    bool distributed = false;
+    math::box3f global_bounds;
+    // The region of a larger image rendered by the session, in normalized coordinates from
+    // the lower left corner. img_size is the size of the region, the camera's aspect ratio
+    // is that of the full image
+    math::vec2f image_start = math::vec2f(0.f);
+    math::vec2f image_end = math::vec2f(1.f);
+};
+
+// Parameters for rendering a fixed number of frames without a window and saving the image
+struct BatchRenderParams {
+    RenderSessionParams session;
+    math::vec2f value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    int frames = 32;
+    // A JSON camera update (eye, at, up) to apply, the default camera is used if empty
+    json camera;
+    std::string output_image_file = "mini_scivis.jpg";
+};
+
+// The per-viewer state for rendering a dataset: its own camera, transfer function,
+// lights and framebuffer. The dataset's voxel data and OSPRay volume are shared with
+// any other sessions viewing it, each session makes its own volumetric model to apply
+// its transfer function to the shared volume
+struct RenderSession {
+    std::shared_ptr<VolumeBrick> dataset;
+
+    TransferFunctionWidget tfn_widget;
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    // The 2D value x gradient magnitude opacities, used when regions are set. Only the
+    // preintegrated renderer supports them
+    TransferFunction2DWidget tfn_2d_widget;
+    TrackedMemory tfn_memory;
+    math::vec2f value_range;
+
+    cpp::TransferFunction tfn;
+    cpp::VolumetricModel model;
+    cpp::Renderer renderer;
+    cpp::Group group;
+    cpp::Instance instance;
+    SceneLights lights;
+    cpp::World world;
+
+    math::box3f world_bounds;
+    math::vec3f cam_eye;
+    math::vec3f cam_at;
+    math::vec3f cam_up;
+    float fovy = 40.f;
+    math::vec2f image_start;
+    math::vec2f image_end;
+    cpp::Camera camera;
+
+    math::vec2i img_size;
+    cpp::FrameBuffer fb;
+    TrackedMemory fb_memory;
+    int accumulated_frames = 0;
+
+    // Set when rendering with the pre-integrated CPU raycaster instead of OSPRay
+    std::unique_ptr<CpuRaycaster> raycaster;
+
+    RenderSession(const std::shared_ptr<VolumeBrick> &dataset,
+                  const RenderSessionParams &params);
+
+    RenderSession(const RenderSession &) = delete;
+    RenderSession &operator=(const RenderSession &) = delete;
+
+    // Apply a JSON update to the camera, transfer function or render parameters, returns
+    // true if the scene changed and the accumulated image was reset. See the README for
+    // the supported parameters
+    bool apply_update(const json &update);
+
+    // Clear the framebuffer to restart accumulation
+    void reset_accumulation();
+
+    // Render and accumulate another frame, blocking until it's complete
+    void render_pass();
+
+    // Map the current accumulated image as sRGBA8 pixels, stored bottom row first. Unmap
+    // it once done reading it
+    const uint32_t *map_image();
+
+    void unmap_image(const uint32_t *img);
+
+    // Encode the current accumulated image as a JPEG
+    std::vector<uint8_t> encode_jpeg(const int quality);
+
+    // Get a JSON description of the session's current parameters and the dataset bounds
+    json describe() const;
+
+private:
+    void update_camera();
+
+    void update_transfer_function();
+
+    RaycastCamera raycast_camera() const;
+};
@@ -0,0 +1,164 @@
+#include "scene_volumes.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <rkcommon/math/AffineSpace.h>
+#include "gradient_volume.h"
+#include "imgui.h"
+#include "loader.h"
+#include "util.h"
+#include "vector_field.h"
+#include "volume_histogram.h"
+
+SceneVolume::SceneVolume(const std::string &volume_file, const math::vec3f &translation)
+    : volume_file(volume_file), translation(translation), tfn("piecewiseLinear")
+{
+}
+
+void SceneVolume::setup(const float density_scale)
+{
+    value_range = brick.value_range;
+    if (!std::isfinite(ui_value_range.x) || !std::isfinite(ui_value_range.y)) {
+        ui_value_range = value_range;
+    }
+    if (brick.voxel_data) {
+        const std::string data_file = config.find("volume") != config.end()
+                                          ? config["volume"].get<std::string>()
+                                          : volume_file;
+        const VolumeHistogram histogram = load_cached_histogram(brick, data_file, 1024);
+        tfn_widget.set_histogram(
+            histogram.counts, histogram.value_range.x, histogram.value_range.y);
+    }
+    tfn_widget.set_value_range(ui_value_range.x, ui_value_range.y);
+
+    tfn_widget.get_colormapf(tfn_colors, tfn_opacities);
+    tfn_memory = TrackedMemory(MemoryCategory::TRANSFER_FUNCTION,
+                               (tfn_colors.size() + tfn_opacities.size()) * sizeof(float));
+    tfn.setParam("color",
+                 cpp::SharedData(reinterpret_cast<math::vec3f *>(tfn_colors.data()),
+                                 tfn_colors.size() / 3));
+    tfn.setParam("opacity", cpp::SharedData(tfn_opacities.data(), tfn_opacities.size()));
+    tfn.setParam("valueRange", ui_value_range);
+    tfn.commit();
+
+    brick.model.setParam("densityScale", density_scale);
+    brick.model.setParam("transferFunction", tfn);
+    brick.model.commit();
+
+    group.setParam("volume", cpp::CopiedData(brick.model));
+    group.commit();
+
+    instance = cpp::Instance(group);
+    instance.setParam("xfm", math::affine3f::translate(translation));
+    instance.commit();
+}
+
+math::box3f SceneVolume::world_bounds() const
+{
+    return math::box3f(brick.bounds.lower + translation, brick.bounds.upper + translation);
+}
+
+void SceneVolume::update_transform(std::vector<OSPObject> &pending_commits)
+{
+    instance.setParam("xfm", math::affine3f::translate(translation));
+    pending_commits.push_back(instance.handle());
+}
+
+bool SceneVolume::update_transfer_function(std::vector<OSPObject> &pending_commits)
+{
+    size_t begin = 0;
+    size_t end = 0;
+    if (!tfn_widget.get_colormapf_changes(tfn_colors, tfn_opacities, begin, end)) {
+        return false;
+    }
+    tfn_memory.resize((tfn_colors.size() + tfn_opacities.size()) * sizeof(float));
+    tfn.setParam("color",
+                 cpp::SharedData(reinterpret_cast<math::vec3f *>(tfn_colors.data()),
+                                 tfn_colors.size() / 3));
+    tfn.setParam("opacity", cpp::SharedData(tfn_opacities.data(), tfn_opacities.size()));
+    tfn.setParam("valueRange", ui_value_range);
+    pending_commits.push_back(tfn.handle());
+    pending_commits.push_back(brick.model.handle());
+    return true;
+}
+
+bool SceneVolume::draw_ui(std::vector<OSPObject> &pending_commits)
+{
+    if (ImGui::SliderFloat2("Value Range", &ui_value_range.x, value_range.x, value_range.y)) {
+        tfn_widget.set_value_range(ui_value_range.x, ui_value_range.y);
+        tfn.setParam("valueRange", ui_value_range);
+        pending_commits.push_back(tfn.handle());
+        pending_commits.push_back(brick.model.handle());
+    }
+    const float size = length(brick.bounds.size());
+    const bool moved =
+        ImGui::DragFloat3("Translation", &translation.x, std::max(size, 1.f) / 200.f);
+    if (moved) {
+        update_transform(pending_commits);
+    }
+    tfn_widget.draw_ui();
+    return moved;
+}
+
+size_t estimate_volume_bytes(const std::string &volume_file, const std::string &field)
+{
+    if (get_file_extension(volume_file) != "json") {
+        return 0;
+    }
+    json config = load_volume_config(volume_file);
+    if (!field.empty()) {
+        const std::vector<std::string> names = volume_field_names(config);
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i] == field) {
+                config = volume_field_config(config, i);
+            }
+        }
+    }
+    const math::vec3i dims = get_vec<int, 3>(config["size"]);
+    const std::string voxel_type = config["type"].get<std::string>();
+    size_t voxel_bytes = voxel_type_size(voxel_type);
+    // vec3f volumes also hold the float32 volume of the vectors' magnitudes
+    if (voxel_type == "vec3f") {
+        voxel_bytes += sizeof(float);
+    }
+    return dims.long_product() * voxel_bytes;
+}
+
+size_t volume_brick_bytes(const VolumeBrick &brick)
+{
+    size_t bytes = brick.voxel_data ? brick.voxel_data->size() : 0;
+    if (brick.vectors && brick.vectors->data) {
+        bytes += brick.vectors->data->size();
+    }
+    if (brick.gradient && brick.gradient->data) {
+        bytes += brick.gradient->data->size();
+    }
+    if (brick.normals && brick.normals->data) {
+        bytes += brick.normals->data->size();
+    }
+    return bytes;
+}
+
+void check_volume_budget(const std::vector<std::string> &volume_files,
+                         const std::vector<size_t> &volume_bytes,
+                         const size_t budget_bytes)
+{
+    size_t total = 0;
+    for (const auto &b : volume_bytes) {
+        total += b;
+    }
+    if (budget_bytes == 0 || total <= budget_bytes) {
+        return;
+    }
+    std::stringstream ss;
+    ss << "The volumes need " << format_bytes(total) << ", over the volume budget of "
+       << format_bytes(budget_bytes) << ":\n";
+    for (size_t i = 0; i < volume_files.size(); ++i) {
+        ss << "  " << get_file_basename(volume_files[i]) << ": "
+           << format_bytes(volume_bytes[i]) << "\n";
+    }
+    std::cout << ss.str();
+    throw std::runtime_error("The volumes exceed the volume budget");
+}
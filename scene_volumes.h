@@ -0,0 +1,81 @@
+#pragma once
+
+#include <limits>
+#include <string>
+#include <vector>
+#include <ospray/ospray.h>
+#include <ospray/ospray_cpp.h>
+#include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <rkcommon/math/vec.h>
+#include "json.hpp"
+#include "memory_stats.h"
+#include "transfer_function_widget.h"
+#include "volume_data.h"
+
+using namespace ospray;
+using namespace rkcommon;
+using json = nlohmann::json;
+
+// A volume shown with the main volume, e.g. to compare a simulation and an observation side
+// by side or overlaid. It has its own transfer function and value range and is placed in
+// the world as its own instance, translated from where the volume's data places it
+struct SceneVolume {
+    std::string volume_file;
+    math::vec3f translation = math::vec3f(0.f);
+    // The full value range, computed on load if not finite, and the part of it the transfer
+    // function is applied over
+    math::vec2f value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    math::vec2f ui_value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    json config;
+    VolumeBrick brick;
+
+    TransferFunctionWidget tfn_widget;
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    TrackedMemory tfn_memory;
+    cpp::TransferFunction tfn;
+    cpp::Group group;
+    cpp::Instance instance;
+
+    SceneVolume(const std::string &volume_file, const math::vec3f &translation);
+
+    SceneVolume(const SceneVolume &) = delete;
+    SceneVolume &operator=(const SceneVolume &) = delete;
+
+    // Setup the transfer function, model and instance once the brick is loaded. The
+    // colormaps should be added to the widget beforehand
+    void setup(const float density_scale);
+
+    // The bounds of the volume in the world, after translation
+    math::box3f world_bounds() const;
+
+    // Set the instance's transform from the translation and add it to pending_commits
+    void update_transform(std::vector<OSPObject> &pending_commits);
+
+    // Copy any transfer function edits into the OSPRay transfer function and add the
+    // objects to commit to pending_commits. Returns true if there were edits
+    bool update_transfer_function(std::vector<OSPObject> &pending_commits);
+
+    // Draw the volume's transfer function, value range and translation UI into the current
+    // window, adding the objects to commit to pending_commits. Returns true if the
+    // translation changed, which changes the world's bounds
+    bool draw_ui(std::vector<OSPObject> &pending_commits);
+};
+
+// Get the bytes of voxel data a volume file will load, read from its JSON config without
+// loading the data. Returns 0 for volumes whose size isn't known until loading, e.g. IDX
+// and OFF files. For multi-field volumes the size of the named or first field is returned.
+// This agrees with volume_brick_bytes of the loaded brick, e.g. vec3f volumes count their
+// vectors and magnitudes
+size_t estimate_volume_bytes(const std::string &volume_file, const std::string &field = "");
+
+// The bytes of all the host buffers the brick holds: its voxels, and its vectors,
+// gradients and normals if it has them
+size_t volume_brick_bytes(const VolumeBrick &brick);
+
+// Check that the volumes to load, with the estimated sizes in bytes, fit in the memory
+// budget shared by all volumes in the scene, throwing with a report of the sizes if not. A
+// budget of 0 is unlimited
+void check_volume_budget(const std::vector<std::string> &volume_files,
+                         const std::vector<size_t> &volume_bytes,
+                         const size_t budget_bytes);
@@ -0,0 +1,313 @@
+#include "session_state.h"
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include "util.h"
+
+namespace {
+
+json vec2_json(const math::vec2f &v)
+{
+    return {v.x, v.y};
+}
+
+json vec3_json(const math::vec3f &v)
+{
+    return {v.x, v.y, v.z};
+}
+
+bool is_finite(const math::vec2f &v)
+{
+    return std::isfinite(v.x) && std::isfinite(v.y);
+}
+
+bool has_key(const json &j, const char *key)
+{
+    return j.find(key) != j.end();
+}
+
+}
+
+json light_to_json(const LightParams &light)
+{
+    json j = {{"type", light.type},
+              {"intensity", light.intensity},
+              {"color", vec3_json(light.color)}};
+    if (light.type == "distant" || light.type == "hdri" || light.type == "sunSky") {
+        j["direction"] = vec3_json(light.direction);
+    }
+    if (light.type == "hdri" || light.type == "sunSky") {
+        j["up"] = vec3_json(light.up);
+    }
+    if (light.type == "sphere") {
+        j["position"] = vec3_json(light.position);
+        j["radius"] = light.radius;
+    }
+    if (light.type == "hdri") {
+        j["map"] = light.map;
+    }
+    if (light.type == "sunSky") {
+        j["turbidity"] = light.turbidity;
+        j["albedo"] = light.albedo;
+    }
+    return j;
+}
+
+LightParams light_from_json(const json &j)
+{
+    LightParams light;
+    if (has_key(j, "type")) {
+        light.type = j["type"].get<std::string>();
+    }
+    if (has_key(j, "intensity")) {
+        light.intensity = j["intensity"].get<float>();
+    }
+    if (has_key(j, "color")) {
+        light.color = get_vec<float, 3>(j["color"]);
+    }
+    if (has_key(j, "direction")) {
+        light.direction = get_vec<float, 3>(j["direction"]);
+    }
+    if (has_key(j, "up")) {
+        light.up = get_vec<float, 3>(j["up"]);
+    }
+    if (has_key(j, "position")) {
+        light.position = get_vec<float, 3>(j["position"]);
+    }
+    if (has_key(j, "radius")) {
+        light.radius = j["radius"].get<float>();
+    }
+    if (has_key(j, "map")) {
+        light.map = j["map"].get<std::string>();
+    }
+    if (has_key(j, "turbidity")) {
+        light.turbidity = j["turbidity"].get<float>();
+    }
+    if (has_key(j, "albedo")) {
+        light.albedo = j["albedo"].get<float>();
+    }
+    return light;
+}
+
+json session_to_json(const SessionState &session)
+{
+    json j;
+    j["volume"] = session.volume_file;
+    if (!session.field.empty()) {
+        j["field"] = session.field;
+    }
+    // Infinite ranges mean the range is computed on load, and can't be stored in JSON
+    if (is_finite(session.value_range)) {
+        j["value_range"] = vec2_json(session.value_range);
+    }
+    if (is_finite(session.tfn_value_range)) {
+        j["tfn_value_range"] = vec2_json(session.tfn_value_range);
+    }
+    j["colormap"] = session.colormap;
+    j["opacity_points"] = session.opacity_points;
+    j["tfn_2d"] = session.tfn_2d_regions;
+    if (session.has_camera) {
+        j["camera"] = {{"eye", vec3_json(session.cam_eye)},
+                       {"at", vec3_json(session.cam_at)},
+                       {"up", vec3_json(session.cam_up)}};
+    }
+
+    j["volumes"] = json::array();
+    for (const auto &v : session.volumes) {
+        json vj = {{"volume", v.volume_file},
+                   {"translation", vec3_json(v.translation)},
+                   {"colormap", v.colormap},
+                   {"opacity_points", v.opacity_points}};
+        if (is_finite(v.value_range)) {
+            vj["value_range"] = vec2_json(v.value_range);
+        }
+        if (is_finite(v.tfn_value_range)) {
+            vj["tfn_value_range"] = vec2_json(v.tfn_value_range);
+        }
+        j["volumes"].push_back(vj);
+    }
+
+    j["lights"] = json::array();
+    for (const auto &l : session.lights) {
+        j["lights"].push_back(light_to_json(l));
+    }
+    j["clipping_planes"] = json::array();
+    for (const auto &p : session.clipping_planes) {
+        j["clipping_planes"].push_back({{"enabled", p.enabled},
+                                        {"flip", p.flip},
+                                        {"normal", vec3_json(p.normal)},
+                                        {"position", p.position}});
+    }
+    j["clipping_boxes"] = json::array();
+    for (const auto &b : session.clipping_boxes) {
+        j["clipping_boxes"].push_back({{"enabled", b.enabled},
+                                       {"lower", vec3_json(b.bounds.lower)},
+                                       {"upper", vec3_json(b.bounds.upper)}});
+    }
+
+    j["isovalues"] = session.isovalues;
+    j["isosurface_colors"] = json::array();
+    for (const auto &c : session.isosurface_colors) {
+        j["isosurface_colors"].push_back({c.x, c.y, c.z, c.w});
+    }
+    j["isosurface_opacity"] = session.isosurface_opacity;
+
+    j["renderer"] = {{"type", session.renderer_type},
+                     {"quality", session.quality},
+                     {"sampling_rate", session.sampling_rate},
+                     {"density_scale", session.density_scale},
+                     {"background_color", vec3_json(session.background_color)}};
+    return j;
+}
+
+SessionState session_from_json(const json &j)
+{
+    SessionState session;
+    if (has_key(j, "volume")) {
+        session.volume_file = j["volume"].get<std::string>();
+    }
+    if (has_key(j, "field")) {
+        session.field = j["field"].get<std::string>();
+    }
+    if (has_key(j, "value_range")) {
+        session.value_range = get_vec<float, 2>(j["value_range"]);
+    }
+    if (has_key(j, "tfn_value_range")) {
+        session.tfn_value_range = get_vec<float, 2>(j["tfn_value_range"]);
+    }
+    if (has_key(j, "colormap")) {
+        session.colormap = j["colormap"].get<std::string>();
+    }
+    if (has_key(j, "opacity_points")) {
+        session.opacity_points =
+            j["opacity_points"].get<std::vector<std::array<float, 2>>>();
+    }
+    if (has_key(j, "tfn_2d")) {
+        session.tfn_2d_regions = j["tfn_2d"].get<std::vector<std::array<float, 5>>>();
+    }
+    if (has_key(j, "camera")) {
+        const json &cam = j["camera"];
+        session.has_camera = true;
+        session.cam_eye = get_vec<float, 3>(cam.at("eye"));
+        session.cam_at = get_vec<float, 3>(cam.at("at"));
+        session.cam_up = get_vec<float, 3>(cam.at("up"));
+    }
+
+    if (has_key(j, "lights")) {
+        for (const auto &l : j["lights"]) {
+            LightParams light = light_from_json(l);
+            // Older sessions had an ambient light followed by two distant lights
+            if (!has_key(l, "type") && !session.lights.empty()) {
+                light.type = "distant";
+            }
+            session.lights.push_back(light);
+        }
+    }
+    if (has_key(j, "clipping_planes")) {
+        for (const auto &p : j["clipping_planes"]) {
+            ClippingPlaneState plane;
+            // Older sessions only had axis aligned planes
+            if (has_key(p, "normal")) {
+                plane.normal = get_vec<float, 3>(p["normal"]);
+            } else {
+                const int axis = p.at("axis").get<int>();
+                if (axis < 0 || axis > 2) {
+                    throw std::runtime_error("Invalid clipping plane axis in session");
+                }
+                plane.normal = math::vec3f(0.f);
+                plane.normal[axis] = 1.f;
+            }
+            plane.enabled = p.at("enabled").get<bool>();
+            plane.flip = p.at("flip").get<bool>();
+            plane.position = p.at("position").get<float>();
+            session.clipping_planes.push_back(plane);
+        }
+    }
+    if (has_key(j, "volumes")) {
+        for (const auto &vj : j["volumes"]) {
+            SceneVolumeState v;
+            v.volume_file = vj.at("volume").get<std::string>();
+            if (has_key(vj, "translation")) {
+                v.translation = get_vec<float, 3>(vj["translation"]);
+            }
+            if (has_key(vj, "value_range")) {
+                v.value_range = get_vec<float, 2>(vj["value_range"]);
+            }
+            if (has_key(vj, "tfn_value_range")) {
+                v.tfn_value_range = get_vec<float, 2>(vj["tfn_value_range"]);
+            }
+            if (has_key(vj, "colormap")) {
+                v.colormap = vj["colormap"].get<std::string>();
+            }
+            if (has_key(vj, "opacity_points")) {
+                v.opacity_points =
+                    vj["opacity_points"].get<std::vector<std::array<float, 2>>>();
+            }
+            session.volumes.push_back(v);
+        }
+    }
+    if (has_key(j, "clipping_boxes")) {
+        for (const auto &b : j["clipping_boxes"]) {
+            ClippingBoxState box;
+            box.enabled = b.at("enabled").get<bool>();
+            box.bounds.lower = get_vec<float, 3>(b.at("lower"));
+            box.bounds.upper = get_vec<float, 3>(b.at("upper"));
+            session.clipping_boxes.push_back(box);
+        }
+    }
+
+    if (has_key(j, "isovalues")) {
+        session.isovalues = j["isovalues"].get<std::vector<float>>();
+    }
+    if (has_key(j, "isosurface_colors")) {
+        for (const auto &c : j["isosurface_colors"]) {
+            session.isosurface_colors.push_back(get_vec<float, 4>(c));
+        }
+    }
+    if (has_key(j, "isosurface_opacity")) {
+        session.isosurface_opacity = j["isosurface_opacity"].get<float>();
+        session.has_isosurface_opacity = true;
+    }
+
+    if (has_key(j, "renderer")) {
+        const json &r = j["renderer"];
+        if (has_key(r, "type")) {
+            session.renderer_type = r["type"].get<std::string>();
+            session.has_renderer_type = true;
+        }
+        if (has_key(r, "quality")) {
+            session.quality = r["quality"].get<std::string>();
+            session.has_quality = true;
+        }
+        if (has_key(r, "sampling_rate")) {
+            session.sampling_rate = r["sampling_rate"].get<float>();
+            session.has_sampling_rate = true;
+        }
+        if (has_key(r, "density_scale")) {
+            session.density_scale = r["density_scale"].get<float>();
+            session.has_density_scale = true;
+        }
+        if (has_key(r, "background_color")) {
+            session.background_color = get_vec<float, 3>(r["background_color"]);
+            session.has_background_color = true;
+        }
+    }
+    return session;
+}
+
+void save_session(const std::string &file, const SessionState &session)
+{
+    std::ofstream fout(file.c_str());
+    if (!(fout << session_to_json(session).dump(4))) {
+        throw std::runtime_error("Failed to write session file " + file);
+    }
+}
+
+SessionState load_session(const std::string &file)
+{
+    std::ifstream fin(file.c_str());
+    if (!fin) {
+        throw std::runtime_error("Failed to open session file " + file);
+    }
+    return session_from_json(json::parse(fin));
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <limits>
+#include <string>
+#include <vector>
+#include <rkcommon/math/box.h>
+#include <rkcommon/math/vec.h>
+#include "json.hpp"
+
+using namespace rkcommon;
+using json = nlohmann::json;
+
+// A light of the scene, of one of OSPRay's types: ambient, distant, sphere (a point light
+// with a radius), hdri (an environment map) or sunSky. Each type uses the parameters
+// commented with it
+struct LightParams {
+    std::string type = "ambient";
+    float intensity = 0.5f;
+    math::vec3f color = math::vec3f(1.f);
+    // distant, hdri and sunSky
+    math::vec3f direction = math::vec3f(0.f, 0.f, 1.f);
+    // hdri and sunSky
+    math::vec3f up = math::vec3f(0.f, 1.f, 0.f);
+    // sphere
+    math::vec3f position = math::vec3f(0.f);
+    float radius = 0.f;
+    // hdri, the environment map image file
+    std::string map;
+    // sunSky
+    float turbidity = 3.f;
+    float albedo = 0.3f;
+
+    LightParams() = default;
+    LightParams(float intensity) : intensity(intensity) {}
+    LightParams(float intensity, const math::vec3f &dir)
+        : type("distant"), intensity(intensity), direction(dir)
+    {
+    }
+};
+
+// A clipping plane through the points x where dot(normal, x) = position. Flipping it
+// clips the other side of the plane
+struct ClippingPlaneState {
+    bool enabled = false;
+    bool flip = false;
+    math::vec3f normal = math::vec3f(1.f, 0.f, 0.f);
+    float position = 0.f;
+};
+
+// A clipping box, the volume outside the box is clipped
+struct ClippingBoxState {
+    bool enabled = false;
+    math::box3f bounds = math::box3f(math::vec3f(0.f), math::vec3f(1.f));
+};
+
+// A volume shown with the main volume, with its own transfer function and placement
+struct SceneVolumeState {
+    std::string volume_file;
+    math::vec3f translation = math::vec3f(0.f);
+    math::vec2f value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    math::vec2f tfn_value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    std::string colormap;
+    std::vector<std::array<float, 2>> opacity_points;
+};
+
+// The interactive app's dataset, transfer function, camera and scene settings, saved to a
+// session JSON file from the UI and restored with -session. Keys missing from a session
+// file keep their defaults, so sessions can be written by hand
+struct SessionState {
+    std::string volume_file;
+    // The selected field of a multi-field volume, the value range and transfer function are
+    // those of the field
+    std::string field;
+    // The volume's full value range, restoring it skips computing the range when loading
+    math::vec2f value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    // The part of the value range the transfer function is applied over
+    math::vec2f tfn_value_range = math::vec2f(std::numeric_limits<float>::infinity());
+    std::string colormap;
+    std::vector<std::array<float, 2>> opacity_points;
+    std::vector<std::array<float, 5>> tfn_2d_regions;
+    // Volumes shown with the main volume
+    std::vector<SceneVolumeState> volumes;
+
+    bool has_camera = false;
+    math::vec3f cam_eye = math::vec3f(0.f);
+    math::vec3f cam_at = math::vec3f(0.f, 0.f, 1.f);
+    math::vec3f cam_up = math::vec3f(0.f, 1.f, 0.f);
+
+    std::vector<LightParams> lights;
+    std::vector<ClippingPlaneState> clipping_planes;
+    std::vector<ClippingBoxState> clipping_boxes;
+
+    std::vector<float> isovalues;
+    std::vector<math::vec4f> isosurface_colors;
+    float isosurface_opacity = 1.f;
+
+    std::string renderer_type = "scivis";
+    // A quality preset name or auto
+    std::string quality = "auto";
+    float sampling_rate = 1.f;
+    float density_scale = 1.f;
+    math::vec3f background_color = math::vec3f(1.f);
+
+    // Whether the settings with defaults were in the session file, so restoring it only
+    // overrides the settings it has
+    bool has_isosurface_opacity = false;
+    bool has_renderer_type = false;
+    bool has_quality = false;
+    bool has_sampling_rate = false;
+    bool has_density_scale = false;
+    bool has_background_color = false;
+};
+
+json light_to_json(const LightParams &light);
+
+// Read a light, keys missing from the JSON keep their defaults
+LightParams light_from_json(const json &j);
+
+json session_to_json(const SessionState &session);
+
+SessionState session_from_json(const json &j);
+
+void save_session(const std::string &file, const SessionState &session);
+
+SessionState load_session(const std::string &file);
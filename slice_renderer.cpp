@@ -0,0 +1,265 @@
+#include "slice_renderer.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+#include "voxel_sampler.h"
+
+namespace {
+
+const int TILE_SIZE = 32;
+
+uint32_t pack_rgba8(const float *rgb)
+{
+    uint32_t packed = 0xff000000;
+    for (int c = 0; c < 3; ++c) {
+        packed |= uint32_t(srgb_encode(rgb[c])) << (8 * c);
+    }
+    return packed;
+}
+
+// The volume axes shown along the image's x and y for slices along the axis
+void slice_image_axes(const int axis, int &ax, int &ay)
+{
+    ax = axis == 0 ? 1 : 0;
+    ay = axis == 2 ? 1 : 2;
+}
+
+struct SliceFrame {
+    const VolumeBrick *brick = nullptr;
+    const SliceParams *params = nullptr;
+    const std::vector<uint32_t> *lut = nullptr;
+    math::vec2i img_size;
+    uint32_t *image = nullptr;
+    // Oblique slices: the voxel position of the image's lower left corner and the step in
+    // voxels per pixel along the image's x and y
+    math::vec3f origin;
+    math::vec3f du;
+    math::vec3f dv;
+    uint32_t background = 0;
+};
+
+// Color a row of n voxels spaced stride apart through the lookup table. For contiguous
+// rows the conversion and scaling auto-vectorize, leaving only the table lookup scalar
+template <typename T>
+void classify_row(const T *voxels,
+                  const size_t stride,
+                  const int n,
+                  const float value_lo,
+                  const float value_scale,
+                  const uint32_t *lut,
+                  const float max_index,
+                  uint32_t *out)
+{
+    for (int i = 0; i < n; ++i) {
+        const float x = (float(voxels[i * stride]) - value_lo) * value_scale;
+        out[i] = lut[int(std::min(std::max(0.f, x), max_index) + 0.5f)];
+    }
+}
+
+template <typename T>
+void axis_slice(const SliceFrame &f)
+{
+    const VolumeBrick &brick = *f.brick;
+    const SliceParams &params = *f.params;
+    const T *voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    const math::vec3i dims = brick.dims;
+    const float max_index = float(f.lut->size() - 1);
+    const float value_lo = params.value_range.x;
+    const float value_scale = params.value_range.y > params.value_range.x
+                                  ? max_index / (params.value_range.y - params.value_range.x)
+                                  : max_index;
+    const size_t index = size_t(params.index);
+
+    // Slices along y and z are made of whole x rows of the volume, slices along x gather a
+    // voxel from each x row
+    using range_type = tbb::blocked_range<int>;
+    tbb::parallel_for(range_type(0, f.img_size.y), [&](const range_type &r) {
+        for (int j = r.begin(); j != r.end(); ++j) {
+            uint32_t *out = f.image + size_t(j) * f.img_size.x;
+            const T *row = nullptr;
+            size_t stride = 1;
+            if (params.axis == 0) {
+                row = voxels + size_t(j) * dims.y * dims.x + index;
+                stride = dims.x;
+            } else if (params.axis == 1) {
+                row = voxels + (size_t(j) * dims.y + index) * dims.x;
+            } else {
+                row = voxels + (index * dims.y + j) * dims.x;
+            }
+            classify_row(row,
+                         stride,
+                         f.img_size.x,
+                         value_lo,
+                         value_scale,
+                         f.lut->data(),
+                         max_index,
+                         out);
+        }
+    });
+}
+
+template <typename T>
+void oblique_slice(const SliceFrame &f)
+{
+    const VolumeBrick &brick = *f.brick;
+    const SliceParams &params = *f.params;
+    VoxelSampler<T> sampler;
+    sampler.voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    sampler.dims = brick.dims;
+    sampler.value_lo = params.value_range.x;
+    sampler.value_scale = params.value_range.y > params.value_range.x
+                              ? 1.f / (params.value_range.y - params.value_range.x)
+                              : 1.f;
+    const math::vec3f upper(brick.dims);
+    const float max_index = float(f.lut->size() - 1);
+
+    using range_type = tbb::blocked_range2d<int>;
+    const range_type tiles(0, f.img_size.y, TILE_SIZE, 0, f.img_size.x, TILE_SIZE);
+    tbb::parallel_for(tiles, [&](const range_type &r) {
+        for (int j = r.rows().begin(); j != r.rows().end(); ++j) {
+            uint32_t *out = f.image + size_t(j) * f.img_size.x;
+            math::vec3f p = f.origin + (r.cols().begin() + 0.5f) * f.du + (j + 0.5f) * f.dv;
+            for (int i = r.cols().begin(); i != r.cols().end(); ++i, p += f.du) {
+                if (p.x < 0.f || p.y < 0.f || p.z < 0.f || p.x >= upper.x ||
+                    p.y >= upper.y || p.z >= upper.z) {
+                    out[i] = f.background;
+                    continue;
+                }
+                out[i] = (*f.lut)[int(sampler(p) * max_index + 0.5f)];
+            }
+        }
+    });
+}
+
+template <typename T>
+void slice_dispatch(const SliceFrame &f)
+{
+    if (f.params->oblique) {
+        oblique_slice<T>(f);
+    } else {
+        axis_slice<T>(f);
+    }
+}
+
+}
+
+void SliceRenderer::set_transfer_function(const std::vector<float> &colors,
+                                          const std::vector<float> &opacities)
+{
+    if (opacities.empty() || colors.size() != opacities.size() * 3) {
+        throw std::runtime_error("Invalid slice transfer function");
+    }
+    tfn_colors = colors;
+    tfn_opacities = opacities;
+    lut.clear();
+}
+
+void SliceRenderer::render(const VolumeBrick &brick, const SliceParams &params)
+{
+    if (!brick.voxel_data) {
+        throw std::runtime_error("Slices can only be rendered from structured voxel data");
+    }
+    if (tfn_opacities.empty()) {
+        throw std::runtime_error("The slice renderer's transfer function must be set");
+    }
+
+    // The lookup table is only rebuilt when the transfer function or blending changes
+    if (lut.empty() || lut_use_opacity != params.use_opacity ||
+        lut_background != params.background_color) {
+        lut_use_opacity = params.use_opacity;
+        lut_background = params.background_color;
+        lut.resize(tfn_opacities.size());
+        for (size_t i = 0; i < lut.size(); ++i) {
+            float rgb[3];
+            const float a = params.use_opacity ? tfn_opacities[i] : 1.f;
+            for (int c = 0; c < 3; ++c) {
+                rgb[c] = tfn_colors[i * 3 + c] * a + params.background_color[c] * (1.f - a);
+            }
+            lut[i] = pack_rgba8(rgb);
+        }
+    }
+
+    SliceFrame f;
+    f.brick = &brick;
+    f.params = &params;
+    f.lut = &lut;
+    f.background = pack_rgba8(&params.background_color.x);
+
+    const math::vec3f spacing = brick.bounds.size() / math::vec3f(brick.dims);
+    if (params.oblique) {
+        if (params.resolution < 1) {
+            throw std::runtime_error("The slice resolution must be positive");
+        }
+        const math::vec3f n = normalize(params.normal);
+        // Orient the plane like the axis aligned slice it's closest to
+        int axis = 0;
+        for (int i = 1; i < 3; ++i) {
+            if (std::abs(n[i]) > std::abs(n[axis])) {
+                axis = i;
+            }
+        }
+        int ax = 0;
+        int ay = 0;
+        slice_image_axes(axis, ax, ay);
+        math::vec3f ex(0.f);
+        math::vec3f ey(0.f);
+        ex[ax] = 1.f;
+        ey[ay] = 1.f;
+        const math::vec3f u = normalize(ex - dot(ex, n) * n);
+        const math::vec3f v = normalize(ey - dot(ey, n) * n - dot(ey, u) * u);
+
+        const float extent = length(brick.bounds.size());
+        const float pixel_size = extent / params.resolution;
+        img_size = math::vec2i(params.resolution);
+        img_extent = math::vec2f(extent);
+        const math::vec3f corner = params.center - 0.5f * extent * (u + v);
+        f.origin = (corner - brick.bounds.lower) / spacing;
+        f.du = u * pixel_size / spacing;
+        f.dv = v * pixel_size / spacing;
+    } else {
+        if (params.axis < 0 || params.axis > 2 || params.index < 0 ||
+            params.index >= brick.dims[params.axis]) {
+            throw std::runtime_error("Axis aligned slice is outside the volume");
+        }
+        int ax = 0;
+        int ay = 0;
+        slice_image_axes(params.axis, ax, ay);
+        img_size = math::vec2i(brick.dims[ax], brick.dims[ay]);
+        img_extent = math::vec2f(brick.bounds.size()[ax], brick.bounds.size()[ay]);
+    }
+    image.resize(size_t(img_size.x) * img_size.y);
+    f.img_size = img_size;
+    f.image = image.data();
+
+    const std::string &voxel_type = brick.voxel_type;
+    if (voxel_type == "uint8") {
+        slice_dispatch<uint8_t>(f);
+    } else if (voxel_type == "uint16") {
+        slice_dispatch<uint16_t>(f);
+    } else if (voxel_type == "float32") {
+        slice_dispatch<float>(f);
+    } else if (voxel_type == "float64") {
+        slice_dispatch<double>(f);
+    } else {
+        throw std::runtime_error("Unrecognized voxel type " + voxel_type);
+    }
+}
+
+const uint32_t *SliceRenderer::image_data() const
+{
+    return image.data();
+}
+
+math::vec2i SliceRenderer::image_size() const
+{
+    return img_size;
+}
+
+math::vec2f SliceRenderer::image_extent() const
+{
+    return img_extent;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <rkcommon/math/vec.h>
+#include "volume_data.h"
+
+using namespace rkcommon;
+
+struct SliceParams {
+    // Axis aligned slices read the voxels at index along the axis straight from the voxel
+    // rows, oblique slices trilinearly sample the plane through center with the normal
+    bool oblique = false;
+    int axis = 2;
+    int index = 0;
+    // The oblique plane in world space
+    math::vec3f center = math::vec3f(0.f);
+    math::vec3f normal = math::vec3f(0.f, 0.f, 1.f);
+    // Width and height of oblique slice images, which cover a square as wide as the
+    // volume's diagonal so the slice fits at any orientation
+    int resolution = 1024;
+    math::vec2f value_range = math::vec2f(0.f, 1.f);
+    // Blend the transfer function's colors over the background by their opacity, otherwise
+    // the colors are shown opaque
+    bool use_opacity = false;
+    math::vec3f background_color = math::vec3f(0.f);
+};
+
+// Renders 2D slices of the brick's structured voxel data colored by the transfer function,
+// for inspecting the data without ray marching the volume. Axis aligned slices map the
+// image's (x, y) to the volume's (y, z), (x, z) or (x, y) for slices along x, y or z
+class SliceRenderer {
+    std::vector<float> tfn_colors;
+    std::vector<float> tfn_opacities;
+    // sRGBA8 color of each transfer function entry, built for the blending params below
+    std::vector<uint32_t> lut;
+    bool lut_use_opacity = false;
+    math::vec3f lut_background = math::vec3f(0.f);
+
+    math::vec2i img_size = math::vec2i(0);
+    math::vec2f img_extent = math::vec2f(0.f);
+    std::vector<uint32_t> image;
+
+public:
+    // Set the linear RGB colors and opacities of the transfer function
+    void set_transfer_function(const std::vector<float> &colors,
+                               const std::vector<float> &opacities);
+
+    // Render the slice of the brick, which must have voxel_data
+    void render(const VolumeBrick &brick, const SliceParams &params);
+
+    // The slice as sRGBA8 pixels, stored bottom row first like the raycaster's image
+    const uint32_t *image_data() const;
+
+    math::vec2i image_size() const;
+
+    // The world space width and height covered by the image, to display it at its aspect
+    math::vec2f image_extent() const;
+};
@@ -0,0 +1,458 @@
+#include "synthetic_volume.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/partitioner.h>
+#include "loader.h"
+#include "util.h"
+
+namespace {
+
+uint32_t hash_coords(int x, int y, int z, uint32_t seed)
+{
+    uint32_t h = seed ^ 0x9e3779b9u;
+    h ^= uint32_t(x) * 0x8da6b343u;
+    h ^= uint32_t(y) * 0xd8163841u;
+    h ^= uint32_t(z) * 0xcb1ab31fu;
+    // Murmur3 finalizer to mix the bits
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+float hash_to_unit(uint32_t h)
+{
+    return static_cast<float>(h) / static_cast<float>(std::numeric_limits<uint32_t>::max());
+}
+
+float smoothstep(float t)
+{
+    return t * t * (3.f - 2.f * t);
+}
+
+float lerp(float a, float b, float t)
+{
+    return (1.f - t) * a + t * b;
+}
+
+float value_noise(const math::vec3f &p, uint32_t seed)
+{
+    const math::vec3i c(std::floor(p.x), std::floor(p.y), std::floor(p.z));
+    const math::vec3f t(smoothstep(p.x - c.x), smoothstep(p.y - c.y), smoothstep(p.z - c.z));
+    float corners[8];
+    for (int i = 0; i < 8; ++i) {
+        corners[i] = hash_to_unit(
+            hash_coords(c.x + (i & 1), c.y + ((i >> 1) & 1), c.z + ((i >> 2) & 1), seed));
+    }
+    const float x00 = lerp(corners[0], corners[1], t.x);
+    const float x10 = lerp(corners[2], corners[3], t.x);
+    const float x01 = lerp(corners[4], corners[5], t.x);
+    const float x11 = lerp(corners[6], corners[7], t.x);
+    return lerp(lerp(x00, x10, t.y), lerp(x01, x11, t.y), t.z);
+}
+
+struct Blob {
+    math::vec3f center;
+    float sigma;
+};
+
+// Evaluates the normalized [0, 1] field values for the params one z slice at a time,
+// so the generation can be split over slices and streamed
+class SyntheticFieldSampler {
+    SyntheticVolumeParams params;
+    std::vector<Blob> blobs;
+    float noise_scale;
+
+public:
+    SyntheticFieldSampler(const SyntheticVolumeParams &params) : params(params)
+    {
+        const float max_dim = reduce_max(params.dims);
+        noise_scale = 4.f / max_dim;
+        if (params.field == SyntheticField::BLOBS) {
+            std::mt19937 rng(params.seed);
+            std::uniform_real_distribution<float> unit(0.f, 1.f);
+            for (int i = 0; i < params.blob_count; ++i) {
+                Blob b;
+                b.center =
+                    math::vec3f(unit(rng), unit(rng), unit(rng)) * math::vec3f(params.dims);
+                b.sigma = lerp(0.01f, 0.04f, unit(rng)) * max_dim;
+                blobs.push_back(b);
+            }
+        }
+    }
+
+    bool brick_empty(int x, int y, int z) const
+    {
+        if (params.sparsity <= 0.f) {
+            return false;
+        }
+        const int bs = params.sparsity_brick_size;
+        const float h = hash_to_unit(hash_coords(x / bs, y / bs, z / bs, ~params.seed));
+        return h < params.sparsity;
+    }
+
+    // Fill the slice with dims.x * dims.y normalized field values
+    void sample_slice(int z, std::vector<float> &slice) const
+    {
+        slice.resize(size_t(params.dims.x) * params.dims.y);
+        switch (params.field) {
+        case SyntheticField::NOISE:
+            sample_noise(z, slice);
+            break;
+        case SyntheticField::MARSCHNER_LOBB:
+            sample_marschner_lobb(z, slice);
+            break;
+        case SyntheticField::BLOBS:
+            sample_blobs(z, slice);
+            break;
+        }
+        if (params.sparsity > 0.f) {
+            for (int y = 0; y < params.dims.y; ++y) {
+                for (int x = 0; x < params.dims.x; ++x) {
+                    if (brick_empty(x, y, z)) {
+                        slice[size_t(y) * params.dims.x + x] = 0.f;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    void sample_noise(int z, std::vector<float> &slice) const
+    {
+        for (int y = 0; y < params.dims.y; ++y) {
+            for (int x = 0; x < params.dims.x; ++x) {
+                const math::vec3f p = math::vec3f(x, y, z) * noise_scale;
+                float amplitude = 1.f;
+                float frequency = 1.f;
+                float sum = 0.f;
+                float total_amplitude = 0.f;
+                for (int o = 0; o < params.noise_octaves; ++o) {
+                    sum += amplitude * value_noise(p * frequency, params.seed + o);
+                    total_amplitude += amplitude;
+                    amplitude *= 0.5f;
+                    frequency *= 2.f;
+                }
+                slice[size_t(y) * params.dims.x + x] = sum / total_amplitude;
+            }
+        }
+    }
+
+    void sample_marschner_lobb(int z, std::vector<float> &slice) const
+    {
+        // The Marschner-Lobb test signal, evaluated over [-1, 1]^3
+        const float alpha = 0.25f;
+        const float f_m = 6.f;
+        constexpr float pi = 3.14159265f;
+        const float pz = 2.f * z / std::max(params.dims.z - 1, 1) - 1.f;
+        for (int y = 0; y < params.dims.y; ++y) {
+            const float py = 2.f * y / std::max(params.dims.y - 1, 1) - 1.f;
+            for (int x = 0; x < params.dims.x; ++x) {
+                const float px = 2.f * x / std::max(params.dims.x - 1, 1) - 1.f;
+                const float r = std::sqrt(px * px + py * py);
+                const float rho_r = std::cos(2.f * pi * f_m * std::cos(pi * r / 2.f));
+                slice[size_t(y) * params.dims.x + x] =
+                    (1.f - std::sin(pi * pz / 2.f) + alpha * (1.f + rho_r)) /
+                    (2.f * (1.f + alpha));
+            }
+        }
+    }
+
+    void sample_blobs(int z, std::vector<float> &slice) const
+    {
+        std::fill(slice.begin(), slice.end(), 0.f);
+        for (const auto &b : blobs) {
+            // Only rasterize blobs within 3 sigma of the slice
+            const float cutoff = 3.f * b.sigma;
+            const float dz = z - b.center.z;
+            if (std::abs(dz) > cutoff) {
+                continue;
+            }
+            const int y_begin = std::max(int(b.center.y - cutoff), 0);
+            const int y_end = std::min(int(b.center.y + cutoff) + 1, params.dims.y);
+            const int x_begin = std::max(int(b.center.x - cutoff), 0);
+            const int x_end = std::min(int(b.center.x + cutoff) + 1, params.dims.x);
+            const float inv_two_sigma_sq = 1.f / (2.f * b.sigma * b.sigma);
+            for (int y = y_begin; y < y_end; ++y) {
+                const float dy = y - b.center.y;
+                for (int x = x_begin; x < x_end; ++x) {
+                    const float dx = x - b.center.x;
+                    const float v =
+                        std::exp(-(dx * dx + dy * dy + dz * dz) * inv_two_sigma_sq);
+                    float &out = slice[size_t(y) * params.dims.x + x];
+                    out = std::max(out, v);
+                }
+            }
+        }
+    }
+};
+
+template <typename T>
+void convert_slice(const std::vector<float> &slice, const float scale, uint8_t *out)
+{
+    T *typed_out = reinterpret_cast<T *>(out);
+    const float rounding = std::is_integral<T>::value ? 0.5f : 0.f;
+    for (size_t i = 0; i < slice.size(); ++i) {
+        typed_out[i] = static_cast<T>(slice[i] * scale + rounding);
+    }
+}
+
+float voxel_type_scale(const std::string &voxel_type)
+{
+    if (voxel_type == "uint8") {
+        return 255.f;
+    } else if (voxel_type == "uint16") {
+        return 65535.f;
+    }
+    return 1.f;
+}
+
+// Convert the normalized slice to the voxel type, writing it to out
+void convert_slice(const std::vector<float> &slice,
+                   const std::string &voxel_type,
+                   uint8_t *out)
+{
+    const float scale = voxel_type_scale(voxel_type);
+    if (voxel_type == "uint8") {
+        convert_slice<uint8_t>(slice, scale, out);
+    } else if (voxel_type == "uint16") {
+        convert_slice<uint16_t>(slice, scale, out);
+    } else if (voxel_type == "float32") {
+        convert_slice<float>(slice, scale, out);
+    } else if (voxel_type == "float64") {
+        convert_slice<double>(slice, scale, out);
+    } else {
+        throw std::runtime_error("Unrecognized voxel type " + voxel_type);
+    }
+}
+
+void check_dims(const math::vec3i &dims)
+{
+    if (dims.x <= 0 || dims.y <= 0 || dims.z <= 0) {
+        throw std::runtime_error("Synthetic volume dims must be positive");
+    }
+}
+
+}
+
+SyntheticField parse_synthetic_field(const std::string &name)
+{
+    if (name == "noise") {
+        return SyntheticField::NOISE;
+    } else if (name == "marschner-lobb") {
+        return SyntheticField::MARSCHNER_LOBB;
+    } else if (name == "blobs") {
+        return SyntheticField::BLOBS;
+    }
+    throw std::runtime_error("Unrecognized synthetic field " + name);
+}
+
+std::string synthetic_field_name(const SyntheticField field)
+{
+    switch (field) {
+    case SyntheticField::NOISE:
+        return "noise";
+    case SyntheticField::MARSCHNER_LOBB:
+        return "marschner-lobb";
+    case SyntheticField::BLOBS:
+        return "blobs";
+    }
+    return "";
+}
+
+VolumeBrick generate_synthetic_volume(const SyntheticVolumeParams &params)
+{
+    check_dims(params.dims);
+    VolumeBrick brick;
+    brick.dims = params.dims;
+    brick.bounds = math::box3f(math::vec3f(0), math::vec3f(brick.dims));
+    brick.voxel_type = params.voxel_type;
+    brick.value_range = math::vec2f(0.f, voxel_type_scale(params.voxel_type));
+
+    const size_t voxel_size = voxel_type_size(params.voxel_type);
+    const size_t slice_bytes = size_t(params.dims.x) * params.dims.y * voxel_size;
+    brick.voxel_data =
+        make_tracked_buffer(MemoryCategory::VOLUME_HOST, slice_bytes * params.dims.z);
+
+    const SyntheticFieldSampler sampler(params);
+    tbb::parallel_for(tbb::blocked_range<int>(0, params.dims.z),
+                      [&](const tbb::blocked_range<int> &r) {
+                          std::vector<float> slice;
+                          for (int z = r.begin(); z < r.end(); ++z) {
+                              sampler.sample_slice(z, slice);
+                              convert_slice(slice,
+                                            params.voxel_type,
+                                            brick.voxel_data->data() + z * slice_bytes);
+                          }
+                      });
+
+    make_structured_volume(brick, math::vec3f(1.f));
+    return brick;
+}
+
+json write_synthetic_volume(const SyntheticVolumeParams &params, const std::string &raw_file)
+{
+    check_dims(params.dims);
+    const size_t voxel_size = voxel_type_size(params.voxel_type);
+    const size_t slice_bytes = size_t(params.dims.x) * params.dims.y * voxel_size;
+    const size_t total_bytes = slice_bytes * params.dims.z;
+
+    // Size the file up front so each slab can be written independently at its offset
+    {
+        std::ofstream fout(raw_file.c_str(), std::ios::binary | std::ios::trunc);
+        fout.seekp(total_bytes - 1);
+        fout.put(0);
+        if (!fout) {
+            throw std::runtime_error("Failed to create synthetic volume " + raw_file);
+        }
+    }
+
+    // Slabs are limited to about 16MB so each thread only holds a small part of the
+    // volume, the simple partitioner never makes chunks over the grainsize
+    const size_t max_slab_bytes = 16 * 1024 * 1024;
+    const int slab_slices = int(std::max(size_t(1), max_slab_bytes / slice_bytes));
+    const SyntheticFieldSampler sampler(params);
+    tbb::parallel_for(
+        tbb::blocked_range<int>(0, params.dims.z, slab_slices),
+        [&](const tbb::blocked_range<int> &r) {
+            std::fstream fout(raw_file.c_str(),
+                              std::ios::binary | std::ios::in | std::ios::out);
+            std::vector<float> slice;
+            std::vector<uint8_t> slab(slice_bytes * r.size(), 0);
+            for (int z = r.begin(); z < r.end(); ++z) {
+                sampler.sample_slice(z, slice);
+                convert_slice(
+                    slice, params.voxel_type, slab.data() + (z - r.begin()) * slice_bytes);
+            }
+            fout.seekp(r.begin() * slice_bytes);
+            fout.write(reinterpret_cast<const char *>(slab.data()), slab.size());
+            if (!fout) {
+                throw std::runtime_error("Failed to write synthetic volume " + raw_file);
+            }
+        },
+        tbb::simple_partitioner());
+
+    json config;
+    config["name"] = "synthetic_" + synthetic_field_name(params.field);
+    config["url"] = get_file_basename(raw_file);
+    config["volume"] = raw_file;
+    config["size"] = {params.dims.x, params.dims.y, params.dims.z};
+    config["spacing"] = {1.f, 1.f, 1.f};
+    config["type"] = params.voxel_type;
+    config["sparsity"] = params.sparsity;
+    config["seed"] = params.seed;
+    return config;
+}
+
+void write_synthetic_tet_mesh(const SyntheticVolumeParams &params, const std::string &off_file)
+{
+    const math::vec3i dims = params.dims;
+    if (dims.x < 2 || dims.y < 2 || dims.z < 2) {
+        throw std::runtime_error("A tet mesh needs at least 2 vertices along each axis");
+    }
+    const SyntheticFieldSampler sampler(params);
+
+    // Find the cells to write, skipping those in empty bricks
+    const math::vec3i cell_dims = dims - math::vec3i(1);
+    const size_t n_cells = tbb::parallel_reduce(
+        tbb::blocked_range<int>(0, cell_dims.z),
+        size_t(0),
+        [&](const tbb::blocked_range<int> &r, size_t n) {
+            for (int z = r.begin(); z < r.end(); ++z) {
+                for (int y = 0; y < cell_dims.y; ++y) {
+                    for (int x = 0; x < cell_dims.x; ++x) {
+                        n += sampler.brick_empty(x, y, z) ? 0 : 1;
+                    }
+                }
+            }
+            return n;
+        },
+        [](const size_t a, const size_t b) { return a + b; });
+
+    std::ofstream fout(off_file.c_str());
+    fout << dims.long_product() << " " << n_cells * 6 << "\n";
+
+    // Text formatting is the bottleneck for large meshes, so each slice is formatted in
+    // parallel and the results written out in order in batches
+    const int batch_size = 64;
+    std::vector<std::string> slice_text(batch_size);
+    for (int batch = 0; batch < dims.z; batch += batch_size) {
+        const int batch_end = std::min(batch + batch_size, dims.z);
+        tbb::parallel_for(batch, batch_end, [&](const int z) {
+            std::vector<float> slice;
+            sampler.sample_slice(z, slice);
+            std::string &text = slice_text[z - batch];
+            text.clear();
+            char buf[128];
+            for (int y = 0; y < dims.y; ++y) {
+                for (int x = 0; x < dims.x; ++x) {
+                    std::snprintf(buf,
+                                  sizeof(buf),
+                                  "%d %d %d %g\n",
+                                  x,
+                                  y,
+                                  z,
+                                  slice[size_t(y) * dims.x + x]);
+                    text += buf;
+                }
+            }
+        });
+        for (int z = batch; z < batch_end; ++z) {
+            fout << slice_text[z - batch];
+        }
+    }
+
+    // Split each cell into six tets around its main diagonal, one for each ordering of
+    // the axes. Corners are numbered by their x, y, z offset bits
+    const int axis_orders[6][3] = {
+        {0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+    auto vertex_id = [&](const int x, const int y, const int z, const int corner) {
+        return (size_t(z + ((corner >> 2) & 1)) * dims.y + y + ((corner >> 1) & 1)) *
+                   dims.x +
+               x + (corner & 1);
+    };
+    for (int batch = 0; batch < cell_dims.z; batch += batch_size) {
+        const int batch_end = std::min(batch + batch_size, cell_dims.z);
+        tbb::parallel_for(batch, batch_end, [&](const int z) {
+            std::string &text = slice_text[z - batch];
+            text.clear();
+            char buf[128];
+            for (int y = 0; y < cell_dims.y; ++y) {
+                for (int x = 0; x < cell_dims.x; ++x) {
+                    if (sampler.brick_empty(x, y, z)) {
+                        continue;
+                    }
+                    for (const auto &order : axis_orders) {
+                        const int c1 = 1 << order[0];
+                        const int c2 = c1 | (1 << order[1]);
+                        std::snprintf(buf,
+                                      sizeof(buf),
+                                      "%zu %zu %zu %zu\n",
+                                      vertex_id(x, y, z, 0),
+                                      vertex_id(x, y, z, c1),
+                                      vertex_id(x, y, z, c2),
+                                      vertex_id(x, y, z, 7));
+                        text += buf;
+                    }
+                }
+            }
+        });
+        for (int z = batch; z < batch_end; ++z) {
+            fout << slice_text[z - batch];
+        }
+    }
+    if (!fout) {
+        throw std::runtime_error("Failed to write synthetic tet mesh " + off_file);
+    }
+}
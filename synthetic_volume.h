@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <rkcommon/math/vec.h>
+#include "json.hpp"
+#include "volume_data.h"
+
+using namespace rkcommon;
+using json = nlohmann::json;
+
+enum class SyntheticField { NOISE, MARSCHNER_LOBB, BLOBS };
+
+struct SyntheticVolumeParams {
+    SyntheticField field = SyntheticField::MARSCHNER_LOBB;
+    math::vec3i dims = math::vec3i(128);
+    std::string voxel_type = "uint8";
+    // Fraction of the bricks in the volume which are left empty (zero), in [0, 1].
+    // This is applied on top of the field to produce empty space at a known ratio
+    float sparsity = 0.f;
+    int sparsity_brick_size = 16;
+    uint32_t seed = 0;
+    // Number of blobs placed for the BLOBS field
+    int blob_count = 64;
+    // Octaves of value noise summed for the NOISE field
+    int noise_octaves = 4;
+};
+
+SyntheticField parse_synthetic_field(const std::string &name);
+
+std::string synthetic_field_name(const SyntheticField field);
+
+// Generate the volume in memory, filling the voxels in parallel. The brick's value range
+// is set to the range of the voxel type's normalized values
+VolumeBrick generate_synthetic_volume(const SyntheticVolumeParams &params);
+
+// Stream the volume to the raw file, generating and writing slabs of it in parallel so
+// volumes larger than memory can be produced. Returns the JSON config describing the
+// volume, in the same format as the OpenScivisDatasets configs
+json write_synthetic_volume(const SyntheticVolumeParams &params, const std::string &raw_file);
+
+// Write a tetrahedral mesh in the OFF format read by load_off. The params dims are the
+// number of vertices along each axis, each cell of the vertex grid is split into six
+// tetrahedra and cells in empty bricks are skipped
+void write_synthetic_tet_mesh(const SyntheticVolumeParams &params, const std::string &off_file);
@@ -79,6 +79,12 @@ glm::vec3 ArcballCamera::up() const
     return glm::normalize(glm::vec3{inv_camera * glm::vec4{0, 1, 0, 0}});
 }
 
+glm::vec3 ArcballCamera::center() const
+{
+    // The center translation is a pure translation by -center
+    return -glm::vec3{center_translation[3]};
+}
+
 void ArcballCamera::update_camera()
 {
     camera = translation * glm::mat4_cast(rotation) * center_translation;
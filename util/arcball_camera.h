@@ -54,6 +54,9 @@ public:
     // Get the up direction of the camera in world space
     glm::vec3 up() const;
 
+    // Get the point the camera orbits around in world space
+    glm::vec3 center() const;
+
 private:
     void update_camera();
 };
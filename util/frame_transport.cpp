@@ -0,0 +1,462 @@
+#include "frame_transport.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <shared_mutex>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
+#include "socket_util.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Signatures store the average color of each block of pixels in a tile
+const int SIGNATURE_BLOCK = 8;
+
+// stb_image_write's vertical flip is a global flag, so encoders which flip need exclusive
+// access while others can run concurrently
+std::shared_timed_mutex flip_mutex;
+
+void append_bytes(void *context, void *data, int size)
+{
+    auto *out = reinterpret_cast<std::vector<uint8_t> *>(context);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    out->insert(out->end(), bytes, bytes + size);
+}
+
+double elapsed_ms(const Clock::time_point &start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+}
+
+std::vector<uint8_t> encode_jpeg(const uint8_t *rgba,
+                                 const int width,
+                                 const int height,
+                                 const int quality,
+                                 const bool flip_y)
+{
+    std::vector<uint8_t> jpeg;
+    if (flip_y) {
+        std::lock_guard<std::shared_timed_mutex> lock(flip_mutex);
+        stbi_flip_vertically_on_write(1);
+        stbi_write_jpg_to_func(append_bytes, &jpeg, width, height, 4, rgba, quality);
+        stbi_flip_vertically_on_write(0);
+    } else {
+        std::shared_lock<std::shared_timed_mutex> lock(flip_mutex);
+        stbi_write_jpg_to_func(append_bytes, &jpeg, width, height, 4, rgba, quality);
+    }
+    return jpeg;
+}
+
+FrameEncoder::FrameEncoder(const FrameTransportParams &p) : params(p)
+{
+    // Keep tiles a multiple of the signature block size
+    params.tile_size =
+        std::max(SIGNATURE_BLOCK,
+                 (params.tile_size + SIGNATURE_BLOCK - 1) / SIGNATURE_BLOCK * SIGNATURE_BLOCK);
+    params.preview_downscale = std::max(params.preview_downscale, 1);
+}
+
+bool FrameEncoder::encode(const uint32_t *img,
+                          const int w,
+                          const int h,
+                          const bool interacting,
+                          const bool converged,
+                          EncodedFrame &frame)
+{
+    const auto start = Clock::now();
+    if (converged) {
+        if (sent_converged) {
+            return false;
+        }
+        sent_converged = true;
+        frame = encode_full(img, w, h, params.full_quality);
+    } else {
+        sent_converged = false;
+        const std::chrono::duration<double> since_last = start - last_sent;
+        if (since_last.count() < 1.0 / params.max_fps) {
+            return false;
+        }
+        if (interacting) {
+            frame = encode_preview(img, w, h);
+        } else {
+            frame = encode_tiles(img, w, h);
+            if (frame.header["kind"] == "tiles" && frame.header["tiles"].empty()) {
+                return false;
+            }
+        }
+    }
+    last_sent = start;
+    frame.header["encode_ms"] = elapsed_ms(start);
+    return true;
+}
+
+EncodedFrame FrameEncoder::encode_preview(const uint32_t *img, const int w, const int h)
+{
+    const int s = params.preview_downscale;
+    const int pw = std::max(w / s, 1);
+    const int ph = std::max(h / s, 1);
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(img);
+
+    // Box filter the image down, writing the preview top row first
+    std::vector<uint8_t> preview(size_t(pw) * ph * 4, 0);
+    tbb::parallel_for(0, ph, [&](const int py) {
+        for (int px = 0; px < pw; ++px) {
+            uint32_t sum[4] = {0, 0, 0, 0};
+            int count = 0;
+            for (int y = py * s; y < std::min((py + 1) * s, h); ++y) {
+                const uint8_t *row = src + size_t(h - 1 - y) * w * 4;
+                for (int x = px * s; x < std::min((px + 1) * s, w); ++x) {
+                    for (int c = 0; c < 4; ++c) {
+                        sum[c] += row[x * 4 + c];
+                    }
+                    ++count;
+                }
+            }
+            for (int c = 0; c < 4; ++c) {
+                preview[(size_t(py) * pw + px) * 4 + c] = static_cast<uint8_t>(sum[c] / count);
+            }
+        }
+    });
+
+    // The receiver only has the upscaled preview now, so tiles can't be applied to it
+    tile_signatures.clear();
+    width = w;
+    height = h;
+
+    EncodedFrame frame;
+    frame.data = encode_jpeg(preview.data(), pw, ph, params.preview_quality, false);
+    frame.header["kind"] = "preview";
+    frame.header["width"] = w;
+    frame.header["height"] = h;
+    frame.header["preview_width"] = pw;
+    frame.header["preview_height"] = ph;
+    frame.header["quality"] = params.preview_quality;
+    return frame;
+}
+
+EncodedFrame FrameEncoder::encode_tiles(const uint32_t *img, const int w, const int h)
+{
+    if (w != width || h != height || tile_signatures.empty()) {
+        return encode_full(img, w, h, params.tile_quality);
+    }
+
+    const int tiles_x = (w + params.tile_size - 1) / params.tile_size;
+    const int tiles_y = (h + params.tile_size - 1) / params.tile_size;
+    const int num_tiles = tiles_x * tiles_y;
+    const size_t sig_size = signature_size();
+
+    std::vector<uint8_t> signatures(num_tiles * sig_size, 0);
+    std::vector<uint8_t> changed(num_tiles, 0);
+    tbb::parallel_for(0, num_tiles, [&](const int t) {
+        uint8_t *sig = signatures.data() + t * sig_size;
+        const uint8_t *prev = tile_signatures.data() + t * sig_size;
+        compute_signature(img, t, sig);
+        for (size_t i = 0; i < sig_size; ++i) {
+            if (std::abs(int(sig[i]) - int(prev[i])) > params.tile_threshold) {
+                changed[t] = 1;
+                break;
+            }
+        }
+    });
+
+    std::vector<int> changed_tiles;
+    for (int t = 0; t < num_tiles; ++t) {
+        if (changed[t]) {
+            changed_tiles.push_back(t);
+        }
+    }
+    if (changed_tiles.size() > params.max_tile_fraction * num_tiles) {
+        return encode_full(img, w, h, params.tile_quality);
+    }
+
+    // Copy each changed tile out top row first and encode them in parallel
+    std::vector<std::vector<uint8_t>> tile_jpegs(changed_tiles.size());
+    const uint32_t *src = img;
+    tbb::parallel_for(size_t(0), changed_tiles.size(), [&](const size_t i) {
+        const int t = changed_tiles[i];
+        const int x0 = (t % tiles_x) * params.tile_size;
+        const int y0 = (t / tiles_x) * params.tile_size;
+        const int tw = std::min(params.tile_size, w - x0);
+        const int th = std::min(params.tile_size, h - y0);
+        std::vector<uint32_t> tile(size_t(tw) * th);
+        for (int y = 0; y < th; ++y) {
+            std::memcpy(tile.data() + size_t(y) * tw,
+                        src + size_t(h - 1 - (y0 + y)) * w + x0,
+                        tw * sizeof(uint32_t));
+        }
+        tile_jpegs[i] = encode_jpeg(reinterpret_cast<const uint8_t *>(tile.data()),
+                                    tw,
+                                    th,
+                                    params.tile_quality,
+                                    false);
+        std::memcpy(tile_signatures.data() + t * sig_size,
+                    signatures.data() + t * sig_size,
+                    sig_size);
+    });
+
+    EncodedFrame frame;
+    frame.header["kind"] = "tiles";
+    frame.header["width"] = w;
+    frame.header["height"] = h;
+    frame.header["quality"] = params.tile_quality;
+    frame.header["total_tiles"] = num_tiles;
+    frame.header["tiles"] = json::array();
+    for (size_t i = 0; i < changed_tiles.size(); ++i) {
+        const int t = changed_tiles[i];
+        const int x0 = (t % tiles_x) * params.tile_size;
+        const int y0 = (t / tiles_x) * params.tile_size;
+        frame.header["tiles"].push_back({x0,
+                                         y0,
+                                         std::min(params.tile_size, w - x0),
+                                         std::min(params.tile_size, h - y0),
+                                         tile_jpegs[i].size()});
+        frame.data.insert(frame.data.end(), tile_jpegs[i].begin(), tile_jpegs[i].end());
+    }
+    return frame;
+}
+
+EncodedFrame FrameEncoder::encode_full(const uint32_t *img,
+                                       const int w,
+                                       const int h,
+                                       const int quality)
+{
+    width = w;
+    height = h;
+
+    EncodedFrame frame;
+    frame.data = encode_jpeg(reinterpret_cast<const uint8_t *>(img), w, h, quality, true);
+    frame.header["kind"] = "full";
+    frame.header["width"] = w;
+    frame.header["height"] = h;
+    frame.header["quality"] = quality;
+
+    const int tiles_x = (w + params.tile_size - 1) / params.tile_size;
+    const int tiles_y = (h + params.tile_size - 1) / params.tile_size;
+    const size_t sig_size = signature_size();
+    tile_signatures.resize(size_t(tiles_x) * tiles_y * sig_size);
+    tbb::parallel_for(0, tiles_x * tiles_y, [&](const int t) {
+        compute_signature(img, t, tile_signatures.data() + t * sig_size);
+    });
+    return frame;
+}
+
+void FrameEncoder::invalidate()
+{
+    tile_signatures.clear();
+    sent_converged = false;
+}
+
+FrameTransportParams &FrameEncoder::parameters()
+{
+    return params;
+}
+
+size_t FrameEncoder::signature_size() const
+{
+    const size_t blocks = params.tile_size / SIGNATURE_BLOCK;
+    return blocks * blocks * 3;
+}
+
+void FrameEncoder::compute_signature(const uint32_t *img,
+                                     const int tile,
+                                     uint8_t *signature) const
+{
+    const int tiles_x = (width + params.tile_size - 1) / params.tile_size;
+    const int x0 = (tile % tiles_x) * params.tile_size;
+    const int y0 = (tile / tiles_x) * params.tile_size;
+    const int blocks = params.tile_size / SIGNATURE_BLOCK;
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(img);
+    for (int by = 0; by < blocks; ++by) {
+        for (int bx = 0; bx < blocks; ++bx) {
+            uint32_t sum[3] = {0, 0, 0};
+            int count = 0;
+            const int y_end = std::min(y0 + (by + 1) * SIGNATURE_BLOCK, height);
+            const int x_end = std::min(x0 + (bx + 1) * SIGNATURE_BLOCK, width);
+            for (int y = y0 + by * SIGNATURE_BLOCK; y < y_end; ++y) {
+                const uint8_t *row = src + size_t(height - 1 - y) * width * 4;
+                for (int x = x0 + bx * SIGNATURE_BLOCK; x < x_end; ++x) {
+                    sum[0] += row[x * 4];
+                    sum[1] += row[x * 4 + 1];
+                    sum[2] += row[x * 4 + 2];
+                    ++count;
+                }
+            }
+            uint8_t *out = signature + (by * blocks + bx) * 3;
+            for (int c = 0; c < 3; ++c) {
+                out[c] = count > 0 ? static_cast<uint8_t>(sum[c] / count) : 0;
+            }
+        }
+    }
+}
+
+void FrameDecoder::decode(const json &header, const uint8_t *data, const size_t size)
+{
+    const int w = header["width"].get<int>();
+    const int h = header["height"].get<int>();
+    if (w <= 0 || h <= 0 || size_t(w) * h * 4 > MAX_MESSAGE_SIZE) {
+        throw std::runtime_error("Invalid frame size " + std::to_string(w) + "x" +
+                                 std::to_string(h));
+    }
+    if (w != width || h != height) {
+        width = w;
+        height = h;
+        image = std::vector<uint8_t>(size_t(width) * height * 4, 0);
+    }
+
+    const std::string kind = header["kind"].get<std::string>();
+    if (kind == "tiles") {
+        size_t offset = 0;
+        for (const auto &t : header["tiles"]) {
+            const int x0 = t[0].get<int>();
+            const int y0 = t[1].get<int>();
+            const size_t tile_size = t[4].get<size_t>();
+            if (x0 < 0 || x0 >= width || y0 < 0 || y0 >= height) {
+                throw std::runtime_error("Tile is outside the frame");
+            }
+            if (tile_size > size - offset) {
+                throw std::runtime_error("Tile data is truncated");
+            }
+            int tw, th, n;
+            uint8_t *tile =
+                stbi_load_from_memory(data + offset, int(tile_size), &tw, &th, &n, 4);
+            if (!tile) {
+                throw std::runtime_error("Failed to decode tile");
+            }
+            // Clip the decoded tile to the frame, its size isn't necessarily the one in
+            // the header
+            const int rows = std::min(th, height - y0);
+            const int row_width = std::min(tw, width - x0);
+            for (int y = 0; y < rows; ++y) {
+                std::memcpy(image.data() + (size_t(y0 + y) * width + x0) * 4,
+                            tile + size_t(y) * tw * 4,
+                            row_width * 4);
+            }
+            stbi_image_free(tile);
+            offset += tile_size;
+        }
+        return;
+    }
+
+    int iw, ih, n;
+    uint8_t *img = stbi_load_from_memory(data, int(size), &iw, &ih, &n, 4);
+    if (!img) {
+        throw std::runtime_error("Failed to decode " + kind + " frame");
+    }
+    if (iw == width && ih == height) {
+        std::memcpy(image.data(), img, image.size());
+    } else {
+        // Nearest neighbor upscale of the preview to the full image size
+        for (int y = 0; y < height; ++y) {
+            const int sy = std::min(y * ih / height, ih - 1);
+            for (int x = 0; x < width; ++x) {
+                const int sx = std::min(x * iw / width, iw - 1);
+                std::memcpy(image.data() + (size_t(y) * width + x) * 4,
+                            img + (size_t(sy) * iw + sx) * 4,
+                            4);
+            }
+        }
+    }
+    stbi_image_free(img);
+}
+
+FrameSender::FrameSender(const int fd) : fd(fd)
+{
+    thread = std::thread([this]() {
+        while (true) {
+            std::string msg;
+            std::shared_ptr<std::vector<uint8_t>> payload;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                send_cv.wait(lock,
+                             [&]() { return !connected || !messages.empty() || frame; });
+                if (!connected) {
+                    break;
+                }
+                if (!messages.empty()) {
+                    msg = messages.front();
+                    messages.pop_front();
+                } else {
+                    payload = frame;
+                    frame = nullptr;
+                }
+            }
+            const bool sent = payload ? send_message(this->fd,
+                                                     MESSAGE_FRAME,
+                                                     payload->data(),
+                                                     payload->size())
+                                      : send_message(this->fd, MESSAGE_JSON, msg);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!sent) {
+                connected = false;
+                break;
+            }
+            sent_bytes += payload ? payload->size() : msg.size();
+        }
+    });
+}
+
+FrameSender::~FrameSender()
+{
+    close();
+}
+
+bool FrameSender::busy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frame != nullptr;
+}
+
+bool FrameSender::is_connected()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return connected;
+}
+
+void FrameSender::post_frame(const EncodedFrame &encoded)
+{
+    auto payload = std::make_shared<std::vector<uint8_t>>(
+        pack_frame_message(encoded.header.dump(), encoded.data));
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frame) {
+        ++dropped_frames;
+    }
+    frame = payload;
+    send_cv.notify_one();
+}
+
+void FrameSender::post_json(const json &msg)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    messages.push_back(msg.dump());
+    send_cv.notify_one();
+}
+
+void FrameSender::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        connected = false;
+        send_cv.notify_all();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+size_t FrameSender::num_dropped_frames()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped_frames;
+}
+
+size_t FrameSender::num_sent_bytes()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return sent_bytes;
+}
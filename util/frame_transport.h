@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// Encode an RGBA8 image as a JPEG. OSPRay framebuffers are stored bottom row first, so
+// pass flip_y to write them top row first
+std::vector<uint8_t> encode_jpeg(const uint8_t *rgba,
+                                 const int width,
+                                 const int height,
+                                 const int quality,
+                                 const bool flip_y);
+
+struct FrameTransportParams {
+    // Previews are sent at 1/preview_downscale of the image resolution
+    int preview_downscale = 4;
+    int tile_size = 64;
+    // A tile is resent once the average color of any 8x8 block in it has changed by more
+    // than this amount (in 0-255 units) since it was last sent
+    float tile_threshold = 2.f;
+    // Send a full frame instead of tiles when more than this fraction of tiles changed
+    float max_tile_fraction = 0.5f;
+    int preview_quality = 50;
+    int tile_quality = 80;
+    int full_quality = 95;
+    // Maximum rate at which preview and tile frames are sent, converged frames are always
+    // sent
+    float max_fps = 30.f;
+};
+
+// An encoded frame, the header describes how to decode the data. Frames are either a
+// "preview", "full" or "tiles" frame, see FrameDecoder
+struct EncodedFrame {
+    json header;
+    std::vector<uint8_t> data;
+};
+
+// Encodes frames for sending to a remote display, choosing between downscaled previews
+// while the camera moves, tiles which changed since they were last sent while the image
+// accumulates, and a full quality frame once it has converged. Changed tiles are found
+// by comparing a small per-tile signature of block averages against the signature of what
+// was last sent, so no copy of the previous frame is kept. Frames are encoded directly
+// from the mapped framebuffer without copying it.
+class FrameEncoder {
+    FrameTransportParams params;
+    int width = 0;
+    int height = 0;
+    // The signatures of the tiles last sent, empty if the receiver doesn't have a full
+    // resolution image to apply tiles to (e.g. after a preview)
+    std::vector<uint8_t> tile_signatures;
+    bool sent_converged = false;
+    std::chrono::steady_clock::time_point last_sent;
+
+public:
+    FrameEncoder(const FrameTransportParams &params = FrameTransportParams());
+
+    // Encode the next frame to send for the bottom row first RGBA8 image, returns false if
+    // nothing needs to be sent for it. Whether the camera is moving or the image has
+    // converged selects the type of frame, and non-converged frames are paced to max_fps
+    bool encode(const uint32_t *img,
+                const int width,
+                const int height,
+                const bool interacting,
+                const bool converged,
+                EncodedFrame &frame);
+
+    EncodedFrame encode_preview(const uint32_t *img, const int width, const int height);
+
+    // Encode only the tiles which changed since they were last sent, falling back to a
+    // full frame if there's no previous full resolution frame or too many tiles changed.
+    // The frame will have no tiles if nothing changed
+    EncodedFrame encode_tiles(const uint32_t *img, const int width, const int height);
+
+    EncodedFrame encode_full(const uint32_t *img,
+                             const int width,
+                             const int height,
+                             const int quality);
+
+    // Forget what was sent, so the next tiles frame is sent as a full frame
+    void invalidate();
+
+    FrameTransportParams &parameters();
+
+private:
+    size_t signature_size() const;
+
+    void compute_signature(const uint32_t *img, const int tile, uint8_t *signature) const;
+};
+
+// Reconstructs the image on the receiving side. The image is stored top row first
+class FrameDecoder {
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> image;
+
+    // Decode the frame and apply it to the image
+    void decode(const json &header, const uint8_t *data, const size_t size);
+};
+
+// Sends frames and JSON messages on a socket from a background thread so rendering isn't
+// blocked by the network. Frames are passed through a single slot, callers can check
+// busy() to skip encoding frames while the receiver is still reading the previous one.
+// JSON messages are queued and always delivered.
+class FrameSender {
+    int fd = -1;
+    std::mutex mutex;
+    std::condition_variable send_cv;
+    std::shared_ptr<std::vector<uint8_t>> frame;
+    std::deque<std::string> messages;
+    size_t dropped_frames = 0;
+    size_t sent_bytes = 0;
+    bool connected = true;
+    std::thread thread;
+
+public:
+    FrameSender(const int fd);
+    ~FrameSender();
+
+    FrameSender(const FrameSender &) = delete;
+    FrameSender &operator=(const FrameSender &) = delete;
+
+    // Returns true if a frame is waiting to be sent
+    bool busy();
+
+    bool is_connected();
+
+    // Post a frame to be sent, replacing any frame still waiting
+    void post_frame(const EncodedFrame &encoded);
+
+    void post_json(const json &msg);
+
+    // Stop sending and wait for the send thread to exit
+    void close();
+
+    size_t num_dropped_frames();
+
+    size_t num_sent_bytes();
+};
@@ -0,0 +1,265 @@
+#include "memory_stats.h"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+std::array<std::atomic<size_t>, size_t(MemoryCategory::COUNT)> current_bytes = {};
+std::array<std::atomic<size_t>, size_t(MemoryCategory::COUNT)> peak_bytes = {};
+
+std::mutex stages_mutex;
+std::vector<MemoryStage> stages;
+
+#ifndef _WIN32
+// Read a "<field>: <value> kB" entry from /proc/self/status
+size_t read_proc_status_kb(const std::string &field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size(), field) == 0 && line[field.size()] == ':') {
+            return std::stoull(line.substr(field.size() + 1)) * 1024;
+        }
+    }
+    return 0;
+}
+#endif
+
+}
+
+const char *memory_category_name(const MemoryCategory category)
+{
+    switch (category) {
+    case MemoryCategory::VOLUME_HOST:
+        return "Volume (host)";
+    case MemoryCategory::VOLUME_OSPRAY:
+        return "Volume (OSPRay copy)";
+    case MemoryCategory::VOLUME_DERIVED:
+        return "Volume (derived)";
+    case MemoryCategory::ISOSURFACE:
+        return "Isosurfaces";
+    case MemoryCategory::FRAMEBUFFER:
+        return "Framebuffers";
+    case MemoryCategory::TRANSFER_FUNCTION:
+        return "Transfer functions";
+    case MemoryCategory::TEXTURE:
+        return "Textures (GPU)";
+    default:
+        break;
+    }
+    return "Unknown";
+}
+
+void track_memory(const MemoryCategory category, const size_t bytes)
+{
+    const size_t c = size_t(category);
+    const size_t now = current_bytes[c].fetch_add(bytes) + bytes;
+    size_t peak = peak_bytes[c].load();
+    while (now > peak && !peak_bytes[c].compare_exchange_weak(peak, now)) {
+    }
+}
+
+void untrack_memory(const MemoryCategory category, const size_t bytes)
+{
+    current_bytes[size_t(category)].fetch_sub(bytes);
+}
+
+size_t tracked_memory(const MemoryCategory category)
+{
+    return current_bytes[size_t(category)].load();
+}
+
+size_t tracked_memory_peak(const MemoryCategory category)
+{
+    return peak_bytes[size_t(category)].load();
+}
+
+TrackedMemory::TrackedMemory(const MemoryCategory category, const size_t bytes)
+    : category(category), bytes(bytes)
+{
+    track_memory(category, bytes);
+}
+
+TrackedMemory::~TrackedMemory()
+{
+    if (category != MemoryCategory::COUNT) {
+        untrack_memory(category, bytes);
+    }
+}
+
+TrackedMemory::TrackedMemory(TrackedMemory &&other)
+    : category(other.category), bytes(other.bytes)
+{
+    other.category = MemoryCategory::COUNT;
+    other.bytes = 0;
+}
+
+TrackedMemory &TrackedMemory::operator=(TrackedMemory &&other)
+{
+    if (this != &other) {
+        if (category != MemoryCategory::COUNT) {
+            untrack_memory(category, bytes);
+        }
+        category = other.category;
+        bytes = other.bytes;
+        other.category = MemoryCategory::COUNT;
+        other.bytes = 0;
+    }
+    return *this;
+}
+
+void TrackedMemory::resize(const size_t new_bytes)
+{
+    if (category == MemoryCategory::COUNT) {
+        return;
+    }
+    untrack_memory(category, bytes);
+    bytes = new_bytes;
+    track_memory(category, bytes);
+}
+
+size_t TrackedMemory::size() const
+{
+    return bytes;
+}
+
+std::shared_ptr<std::vector<uint8_t>> make_tracked_buffer(const MemoryCategory category,
+                                                          const size_t size)
+{
+    track_memory(category, size);
+    return std::shared_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(size, 0),
+                                                 [category, size](std::vector<uint8_t> *v) {
+                                                     untrack_memory(category, size);
+                                                     delete v;
+                                                 });
+}
+
+size_t framebuffer_bytes(const int width, const int height)
+{
+    return size_t(width) * height * (4 + 4 * sizeof(float));
+}
+
+size_t current_rss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.WorkingSetSize;
+#else
+    return read_proc_status_kb("VmRSS");
+#endif
+}
+
+size_t peak_rss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    const size_t hwm = read_proc_status_kb("VmHWM");
+    if (hwm != 0) {
+        return hwm;
+    }
+    // Fall back to getrusage on systems without procfs, where ru_maxrss is in kB
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return size_t(usage.ru_maxrss) * 1024;
+#endif
+}
+
+void record_memory_stage(const std::string &name)
+{
+    MemoryStage stage;
+    stage.name = name;
+    stage.rss = current_rss();
+    stage.peak_rss = peak_rss();
+    for (size_t i = 0; i < stage.tracked.size(); ++i) {
+        stage.tracked[i] = current_bytes[i].load();
+    }
+    std::lock_guard<std::mutex> lock(stages_mutex);
+    stages.push_back(stage);
+}
+
+std::vector<MemoryStage> memory_stages()
+{
+    std::lock_guard<std::mutex> lock(stages_mutex);
+    return stages;
+}
+
+std::string format_bytes(const size_t bytes)
+{
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = bytes;
+    size_t unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        ++unit;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.2f%s", value, units[unit]);
+    return buf;
+}
+
+std::string memory_report()
+{
+    std::stringstream report;
+    report << "Memory use (current / peak):\n";
+    size_t total = 0;
+    for (size_t i = 0; i < size_t(MemoryCategory::COUNT); ++i) {
+        const MemoryCategory c = MemoryCategory(i);
+        report << "  " << memory_category_name(c) << ": " << format_bytes(tracked_memory(c))
+               << " / " << format_bytes(tracked_memory_peak(c)) << "\n";
+        if (c != MemoryCategory::TEXTURE) {
+            total += tracked_memory(c);
+        }
+    }
+    report << "  Tracked host total: " << format_bytes(total) << "\n"
+           << "  RSS: " << format_bytes(current_rss()) << " / " << format_bytes(peak_rss())
+           << "\n";
+
+    const auto recorded = memory_stages();
+    if (!recorded.empty()) {
+        report << "Pipeline stages (RSS, peak RSS):\n";
+        for (const auto &s : recorded) {
+            report << "  " << s.name << ": " << format_bytes(s.rss) << ", "
+                   << format_bytes(s.peak_rss) << "\n";
+        }
+    }
+    return report.str();
+}
+
+json memory_report_json()
+{
+    json report;
+    for (size_t i = 0; i < size_t(MemoryCategory::COUNT); ++i) {
+        const MemoryCategory c = MemoryCategory(i);
+        report["tracked"][memory_category_name(c)] = {{"current", tracked_memory(c)},
+                                                      {"peak", tracked_memory_peak(c)}};
+    }
+    report["rss"] = current_rss();
+    report["peak_rss"] = peak_rss();
+    report["stages"] = json::array();
+    for (const auto &s : memory_stages()) {
+        json stage;
+        stage["name"] = s.name;
+        stage["rss"] = s.rss;
+        stage["peak_rss"] = s.peak_rss;
+        for (size_t i = 0; i < s.tracked.size(); ++i) {
+            stage["tracked"][memory_category_name(MemoryCategory(i))] = s.tracked[i];
+        }
+        report["stages"].push_back(stage);
+    }
+    return report;
+}
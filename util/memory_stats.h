@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+enum class MemoryCategory {
+    // Host voxel data owned by the app, shared with OSPRay
+    VOLUME_HOST,
+    // Volume data copied into OSPRay, e.g. the unstructured mesh arrays
+    VOLUME_OSPRAY,
+    // Derived volumes computed from the voxel data, e.g. gradient magnitudes
+    VOLUME_DERIVED,
+    ISOSURFACE,
+    FRAMEBUFFER,
+    TRANSFER_FUNCTION,
+    // OpenGL textures, these are GPU allocations and not part of the process RSS
+    TEXTURE,
+    COUNT
+};
+
+const char *memory_category_name(const MemoryCategory category);
+
+// Add or remove bytes from the process-wide count for the category
+void track_memory(const MemoryCategory category, const size_t bytes);
+
+void untrack_memory(const MemoryCategory category, const size_t bytes);
+
+size_t tracked_memory(const MemoryCategory category);
+
+size_t tracked_memory_peak(const MemoryCategory category);
+
+// Tracks an allocation owned by some other object (e.g. an OSPRay copy or framebuffer)
+// for as long as this handle lives
+class TrackedMemory {
+    MemoryCategory category = MemoryCategory::COUNT;
+    size_t bytes = 0;
+
+public:
+    TrackedMemory() = default;
+    TrackedMemory(const MemoryCategory category, const size_t bytes);
+    ~TrackedMemory();
+
+    TrackedMemory(const TrackedMemory &) = delete;
+    TrackedMemory &operator=(const TrackedMemory &) = delete;
+
+    TrackedMemory(TrackedMemory &&other);
+    TrackedMemory &operator=(TrackedMemory &&other);
+
+    // Change the size of the tracked allocation, e.g. when a framebuffer is resized
+    void resize(const size_t new_bytes);
+
+    size_t size() const;
+};
+
+// Allocate a zero-initialized byte buffer which is counted against the category until
+// the last reference to it is released
+std::shared_ptr<std::vector<uint8_t>> make_tracked_buffer(const MemoryCategory category,
+                                                          const size_t size);
+
+// Size of an OSPRay framebuffer with an SRGBA color buffer and RGBA32F accumulation buffer
+size_t framebuffer_bytes(const int width, const int height);
+
+// Get the current and peak resident set size of the process in bytes
+size_t current_rss();
+
+size_t peak_rss();
+
+struct MemoryStage {
+    std::string name;
+    size_t rss = 0;
+    size_t peak_rss = 0;
+    std::array<size_t, size_t(MemoryCategory::COUNT)> tracked;
+};
+
+// Record a snapshot of the tracked memory and RSS at a named stage of the pipeline
+void record_memory_stage(const std::string &name);
+
+std::vector<MemoryStage> memory_stages();
+
+// Get a human readable report of the current memory use and recorded stages
+std::string memory_report();
+
+json memory_report_json();
+
+std::string format_bytes(const size_t bytes);
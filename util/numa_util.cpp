@@ -0,0 +1,281 @@
+#include "numa_util.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+#include "util.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+// Memory policy modes from linux/mempolicy.h, the syscalls are used directly so libnuma
+// isn't required
+const int LINUX_MPOL_DEFAULT = 0;
+const int LINUX_MPOL_BIND = 2;
+const int LINUX_MPOL_INTERLEAVE = 3;
+
+bool set_memory_policy(const int mode, const std::vector<int> &nodes)
+{
+    if (mode == LINUX_MPOL_DEFAULT) {
+        return syscall(SYS_set_mempolicy, mode, nullptr, 0) == 0;
+    }
+    const size_t bits = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> mask;
+    for (const int n : nodes) {
+        if (n / bits >= mask.size()) {
+            mask.resize(n / bits + 1, 0);
+        }
+        mask[n / bits] |= 1ul << (n % bits);
+    }
+    return syscall(SYS_set_mempolicy, mode, mask.data(), mask.size() * bits + 1) == 0;
+}
+
+// Applies a memory policy to the calling thread for its lifetime
+class ScopedMemoryPolicy {
+    bool applied = false;
+
+public:
+    ScopedMemoryPolicy(const NumaPlacement &placement)
+    {
+        if (placement.interleave_memory) {
+            std::vector<int> ids;
+            for (const auto &n : numa_nodes()) {
+                ids.push_back(n.id);
+            }
+            applied = set_memory_policy(LINUX_MPOL_INTERLEAVE, ids);
+        } else if (placement.memory_node >= 0) {
+            applied = set_memory_policy(LINUX_MPOL_BIND, {placement.memory_node});
+        } else {
+            return;
+        }
+        if (!applied) {
+            std::cerr << "[warning]: Failed to set the NUMA memory policy\n";
+        }
+    }
+
+    ~ScopedMemoryPolicy()
+    {
+        if (applied) {
+            set_memory_policy(LINUX_MPOL_DEFAULT, {});
+        }
+    }
+};
+
+// Pins threads to the node's CPUs while they're working in the arena, restoring their
+// previous affinity when they leave it
+class PinningObserver : public tbb::task_scheduler_observer {
+    cpu_set_t cpus;
+
+public:
+    PinningObserver(tbb::task_arena &arena, const NumaNode &node)
+        : tbb::task_scheduler_observer(arena)
+    {
+        CPU_ZERO(&cpus);
+        for (const int cpu : node.cpus) {
+            CPU_SET(cpu, &cpus);
+        }
+        observe(true);
+    }
+
+    ~PinningObserver()
+    {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool) override
+    {
+        sched_getaffinity(0, sizeof(cpu_set_t), &previous_cpus());
+        sched_setaffinity(0, sizeof(cpu_set_t), &cpus);
+    }
+
+    void on_scheduler_exit(bool) override
+    {
+        sched_setaffinity(0, sizeof(cpu_set_t), &previous_cpus());
+    }
+
+private:
+    static cpu_set_t &previous_cpus()
+    {
+        static thread_local cpu_set_t previous;
+        return previous;
+    }
+};
+#endif
+
+}
+
+std::vector<NumaNode> numa_nodes()
+{
+    std::vector<NumaNode> nodes;
+#ifdef __linux__
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string online_list;
+    if (std::getline(online, online_list)) {
+        for (const int id : parse_cpu_list(online_list)) {
+            std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(id) +
+                                  "/cpulist");
+            std::string list;
+            NumaNode node;
+            node.id = id;
+            if (std::getline(cpulist, list)) {
+                node.cpus = parse_cpu_list(list);
+            }
+            // Memory-only nodes have no CPUs to run on
+            if (!node.cpus.empty()) {
+                nodes.push_back(node);
+            }
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        NumaNode node;
+        for (int i = 0; i < int(std::thread::hardware_concurrency()); ++i) {
+            node.cpus.push_back(i);
+        }
+        nodes.push_back(node);
+    }
+    return nodes;
+}
+
+std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    for (const auto &range : split_string(list, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int i = first; i <= last; ++i) {
+            cpus.push_back(i);
+        }
+    }
+    return cpus;
+}
+
+bool pin_to_numa_node(const NumaNode &node)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int cpu : node.cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+NumaNode find_numa_node(const int id)
+{
+    for (const auto &n : numa_nodes()) {
+        if (n.id == id) {
+            return n;
+        }
+    }
+    throw std::runtime_error("NUMA node " + std::to_string(id) + " not found");
+}
+
+bool apply_thread_placement(const NumaPlacement &placement)
+{
+    if (placement.thread_node < 0) {
+        return true;
+    }
+    return pin_to_numa_node(find_numa_node(placement.thread_node));
+}
+
+void run_with_numa_placement(const NumaPlacement &placement,
+                             const std::function<void()> &loader)
+{
+#ifdef __linux__
+    auto run = [&]() {
+        ScopedMemoryPolicy policy(placement);
+        loader();
+    };
+    if (placement.loader_node < 0) {
+        run();
+        return;
+    }
+    const NumaNode node = find_numa_node(placement.loader_node);
+    tbb::task_arena arena(int(node.cpus.size()));
+    arena.initialize();
+    PinningObserver observer(arena, node);
+    arena.execute(run);
+#else
+    (void)placement;
+    loader();
+#endif
+}
+
+std::string numa_placement_report(const void *data, const size_t size)
+{
+    std::stringstream ss;
+    const std::vector<NumaNode> nodes = numa_nodes();
+    ss << "NUMA nodes:";
+    for (const auto &n : nodes) {
+        ss << " " << n.id << " (" << n.cpus.size() << " CPUs)";
+    }
+    ss << "\n";
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    sched_getaffinity(0, sizeof(cpu_set_t), &cpus);
+    ss << "Threads may run on nodes:";
+    for (const auto &n : nodes) {
+        for (const int c : n.cpus) {
+            if (CPU_ISSET(c, &cpus)) {
+                ss << " " << n.id;
+                break;
+            }
+        }
+    }
+    ss << " (" << CPU_COUNT(&cpus) << " CPUs)\n";
+
+    // Sample the pages of the buffer to find which nodes they're on
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(data) / page_size * page_size;
+    const uintptr_t end = reinterpret_cast<uintptr_t>(data) + size;
+    const size_t num_pages = size == 0 ? 0 : (end - begin + page_size - 1) / page_size;
+    const size_t max_samples = 4096;
+    const size_t stride = std::max(num_pages / max_samples, size_t(1));
+    std::vector<void *> pages;
+    for (size_t i = 0; i < num_pages; i += stride) {
+        pages.push_back(reinterpret_cast<void *>(begin + i * page_size));
+    }
+    std::vector<int> status(pages.size(), -1);
+    if (!pages.empty() &&
+        syscall(SYS_move_pages, 0, pages.size(), pages.data(), nullptr, status.data(), 0) ==
+            0) {
+        std::map<int, size_t> node_pages;
+        for (const int s : status) {
+            if (s >= 0) {
+                ++node_pages[s];
+            }
+        }
+        ss << "Volume memory pages:";
+        for (const auto &n : node_pages) {
+            ss << " node " << n.first << " " << 100.0 * n.second / pages.size() << "%";
+        }
+        ss << " (" << pages.size() << " of " << num_pages << " pages sampled)\n";
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+    return ss.str();
+}
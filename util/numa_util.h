@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+// Get the NUMA nodes of the machine and their CPUs from sysfs. If the topology isn't
+// available a single node with all the CPUs is returned
+std::vector<NumaNode> numa_nodes();
+
+// Parse a sysfs CPU list, e.g. "0-15,32-47"
+std::vector<int> parse_cpu_list(const std::string &list);
+
+// Restrict the calling thread, and threads it creates afterwards, to the CPUs of the node.
+// Returns false if pinning isn't supported or failed
+bool pin_to_numa_node(const NumaNode &node);
+
+// Where to place the app's threads and volume memory on a NUMA machine. By default
+// threads float across all nodes and memory is placed on the node of the thread which
+// first touches it
+struct NumaPlacement {
+    // Node to pin the process's threads to, including the OSPRay and TBB worker threads
+    // created afterwards. -1 to leave them unpinned
+    int thread_node = -1;
+    // Node to run the loaders' TBB arena on, -1 to use the default arena
+    int loader_node = -1;
+    // Node to allocate volume memory on, -1 for the default first-touch placement
+    int memory_node = -1;
+    // Interleave the pages of volume memory across all nodes, takes precedence over
+    // memory_node
+    bool interleave_memory = false;
+};
+
+// Get the node with the id, throws if there's no such node
+NumaNode find_numa_node(const int id);
+
+// Pin the calling thread to the placement's thread node if set. Call this before OSPRay
+// is initialized so its worker threads inherit the pinning. Returns false if pinning
+// was requested but failed
+bool apply_thread_placement(const NumaPlacement &placement);
+
+// Run the loader in a TBB arena whose threads are pinned to the placement's loader node,
+// with the memory policy applied to the calling thread so memory it allocates and
+// touches is placed as requested. Without a placement this just calls the loader
+void run_with_numa_placement(const NumaPlacement &placement,
+                             const std::function<void()> &loader);
+
+// Report the NUMA nodes, the nodes the process's threads may run on and the nodes
+// holding the pages of the buffer
+std::string numa_placement_report(const void *data, const size_t size);
@@ -0,0 +1,165 @@
+#include "preintegration.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <tbb/parallel_for.h>
+
+PreintegrationTable::PreintegrationTable(const size_t resolution)
+    : resolution(resolution),
+      colors(resolution * 3, 0.f),
+      opacities(resolution, 0.f),
+      extinction_sum(resolution, 0.f),
+      color_sum(resolution * 3, 0.f),
+      table(resolution * resolution * 4, 0.f)
+{
+    if (resolution < 2) {
+        throw std::runtime_error("The pre-integration table resolution must be at least 2");
+    }
+}
+
+void PreintegrationTable::set_segment(const float step, const float density)
+{
+    if (step == step_size && density == density_scale) {
+        return;
+    }
+    step_size = step;
+    density_scale = density;
+    // The extinction sums scale with the density, so every entry changes
+    resample(std::vector<float>(), std::vector<float>(), 0, 0);
+    compute_entries(0, resolution);
+}
+
+void PreintegrationTable::update(const std::vector<float> &tfn_colors,
+                                 const std::vector<float> &tfn_opacities,
+                                 size_t begin,
+                                 size_t end)
+{
+    const size_t tfn_size = tfn_opacities.size();
+    if (tfn_size < 2 || tfn_colors.size() != tfn_size * 3) {
+        throw std::runtime_error("Invalid transfer function for pre-integration");
+    }
+    end = std::min(end, tfn_size);
+    if (begin >= end) {
+        last_update_entries = 0;
+        return;
+    }
+
+    // Find the table rows sampling the changed transfer function entries, including the
+    // rows interpolating between them and their unchanged neighbors
+    const float scale = float(resolution - 1) / float(tfn_size - 1);
+    const size_t table_begin =
+        begin == 0 ? 0 : size_t(std::max(std::floor((begin - 1) * scale), 0.f));
+    const size_t table_end =
+        std::min(size_t(std::ceil(std::min(end, tfn_size - 1) * scale)) + 1, resolution);
+
+    resample(tfn_colors, tfn_opacities, table_begin, table_end);
+    compute_entries(table_begin, table_end);
+}
+
+size_t PreintegrationTable::get_resolution() const
+{
+    return resolution;
+}
+
+const float *PreintegrationTable::lookup(const float front, const float back) const
+{
+    const float scale = float(resolution - 1);
+    const size_t f = size_t(std::min(std::max(front, 0.f), 1.f) * scale + 0.5f);
+    const size_t b = size_t(std::min(std::max(back, 0.f), 1.f) * scale + 0.5f);
+    return &table[(f * resolution + b) * 4];
+}
+
+void PreintegrationTable::resample(const std::vector<float> &tfn_colors,
+                                   const std::vector<float> &tfn_opacities,
+                                   const size_t begin,
+                                   const size_t end)
+{
+    const size_t tfn_size = tfn_opacities.size();
+    for (size_t i = begin; i < end; ++i) {
+        const float pos = float(i) / (resolution - 1) * (tfn_size - 1);
+        const size_t lo = std::min(size_t(pos), tfn_size - 1);
+        const size_t hi = std::min(lo + 1, tfn_size - 1);
+        const float t = pos - lo;
+        for (size_t c = 0; c < 3; ++c) {
+            colors[i * 3 + c] =
+                (1.f - t) * tfn_colors[lo * 3 + c] + t * tfn_colors[hi * 3 + c];
+        }
+        opacities[i] = (1.f - t) * tfn_opacities[lo] + t * tfn_opacities[hi];
+    }
+
+    // The prefix sums change from the first resampled entry onwards, integrated with the
+    // trapezoid rule in units of table entries
+    const size_t first = std::max(begin, size_t(1));
+    extinction_sum[0] = 0.f;
+    std::fill(color_sum.begin(), color_sum.begin() + 3, 0.f);
+    for (size_t i = first; i < resolution; ++i) {
+        const float tau_prev = opacities[i - 1] * density_scale;
+        const float tau = opacities[i] * density_scale;
+        extinction_sum[i] = extinction_sum[i - 1] + 0.5f * (tau_prev + tau);
+        for (size_t c = 0; c < 3; ++c) {
+            color_sum[i * 3 + c] =
+                color_sum[(i - 1) * 3 + c] +
+                0.5f * (colors[(i - 1) * 3 + c] * tau_prev + colors[i * 3 + c] * tau);
+        }
+    }
+}
+
+void PreintegrationTable::compute_entries(const size_t begin, const size_t end)
+{
+    // A segment's integral changes if it overlaps the changed rows, segments entirely
+    // before or after them only see a constant offset in the prefix sums which cancels
+    // out. So row i only needs the columns whose segment with i overlaps [begin, end)
+    auto column_range = [&](const size_t i, size_t &col_begin, size_t &col_end) {
+        if (i < begin) {
+            col_begin = begin;
+            col_end = resolution;
+        } else if (i < end) {
+            col_begin = 0;
+            col_end = resolution;
+        } else {
+            col_begin = 0;
+            col_end = end;
+        }
+    };
+
+    tbb::parallel_for(size_t(0), resolution, [&](const size_t i) {
+        size_t col_begin = 0;
+        size_t col_end = 0;
+        column_range(i, col_begin, col_end);
+        for (size_t j = col_begin; j < col_end; ++j) {
+            float *entry = &table[(i * resolution + j) * 4];
+            float alpha = 0.f;
+            float color[3] = {0.f, 0.f, 0.f};
+            if (i == j) {
+                alpha = 1.f - std::exp(-step_size * opacities[i] * density_scale);
+                for (size_t c = 0; c < 3; ++c) {
+                    color[c] = colors[i * 3 + c];
+                }
+            } else {
+                const size_t lo = std::min(i, j);
+                const size_t hi = std::max(i, j);
+                const float extinction = extinction_sum[hi] - extinction_sum[lo];
+                alpha = 1.f - std::exp(-step_size * extinction / (hi - lo));
+                // The segment's color is the extinction weighted average color over it
+                for (size_t c = 0; c < 3; ++c) {
+                    color[c] = extinction > 0.f
+                                   ? (color_sum[hi * 3 + c] - color_sum[lo * 3 + c]) /
+                                         extinction
+                                   : 0.f;
+                }
+            }
+            for (size_t c = 0; c < 3; ++c) {
+                entry[c] = color[c] * alpha;
+            }
+            entry[3] = alpha;
+        }
+    });
+
+    last_update_entries = 0;
+    for (size_t i = 0; i < resolution; ++i) {
+        size_t col_begin = 0;
+        size_t col_end = 0;
+        column_range(i, col_begin, col_end);
+        last_update_entries += col_end - col_begin;
+    }
+}
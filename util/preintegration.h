@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// A 2D pre-integrated transfer function table. Entry (front, back) holds the premultiplied
+// RGBA of a ray segment of length step_size whose scalar value varies linearly from the
+// front sample to the back sample, both normalized to [0, 1] over the transfer function's
+// value range. Looking up segments instead of point samples captures transfer function
+// features between the samples, so far fewer samples per ray give the same image quality.
+// The integrals are approximated with prefix sums of the extinction and extinction
+// weighted color along the transfer function, so each entry costs O(1) to compute
+class PreintegrationTable {
+    size_t resolution = 256;
+    float step_size = 1.f;
+    float density_scale = 1.f;
+
+    // The transfer function resampled to the table resolution
+    std::vector<float> colors;
+    std::vector<float> opacities;
+    // Prefix sums of the extinction and the extinction weighted color
+    std::vector<float> extinction_sum;
+    std::vector<float> color_sum;
+
+    // RGBA entries, indexed by [front * resolution + back]
+    std::vector<float> table;
+
+public:
+    PreintegrationTable(const size_t resolution = 256);
+
+    // Set the segment length in units where an opacity of 1 is the extinction over one unit,
+    // and the density scale applied to the opacities. Rebuilds the whole table if changed
+    void set_segment(const float step_size, const float density_scale);
+
+    // Update the table from the RGB color and opacity transfer function arrays, where the
+    // entries [begin, end) changed since the last update. Only the table entries whose
+    // segment overlaps the changed span are recomputed, in parallel. If the transfer
+    // function's size changed the whole table is rebuilt
+    void update(const std::vector<float> &tfn_colors,
+                const std::vector<float> &tfn_opacities,
+                size_t begin,
+                size_t end);
+
+    size_t get_resolution() const;
+
+    // Look up the premultiplied RGBA of the segment between the normalized values
+    const float *lookup(const float front, const float back) const;
+
+    // The number of entries recomputed by the last update, for reporting
+    size_t last_update_entries = 0;
+
+private:
+    void resample(const std::vector<float> &tfn_colors,
+                  const std::vector<float> &tfn_opacities,
+                  const size_t begin,
+                  const size_t end);
+
+    void compute_entries(const size_t begin, const size_t end);
+};
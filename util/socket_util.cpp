@@ -0,0 +1,333 @@
+#include "socket_util.h"
+#include <cstring>
+#include <stdexcept>
+#include "util.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// Winsock sockets are handles rather than fds, they're passed around as ints like the
+// POSIX fds since handle values fit in 32 bits
+#define MSG_NOSIGNAL 0
+#define SHUT_RDWR SD_BOTH
+using ssize_t = int;
+#endif
+
+namespace {
+
+const std::string UNIX_PREFIX = "unix:";
+
+// Winsock must be started before the first socket is created
+void init_sockets()
+{
+#ifdef _WIN32
+    static const bool initialized = []() {
+        WSADATA wsa_data;
+        return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+    }();
+    if (!initialized) {
+        throw std::runtime_error("Failed to initialize Winsock");
+    }
+#endif
+}
+
+int open_socket(const int family, const int type, const int protocol)
+{
+    init_sockets();
+#ifdef _WIN32
+    const SOCKET s = socket(family, type, protocol);
+    return s == INVALID_SOCKET ? -1 : int(s);
+#else
+    return socket(family, type, protocol);
+#endif
+}
+
+bool send_all(const int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n =
+            send(fd, reinterpret_cast<const char *>(data), int(size), MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool recv_all(const int fd, uint8_t *data, size_t size)
+{
+    while (size > 0) {
+        const ssize_t n = recv(fd, reinterpret_cast<char *>(data), int(size), 0);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+sockaddr_un unix_address(const std::string &address)
+{
+    const std::string path = address.substr(UNIX_PREFIX.size());
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::runtime_error("Unix socket path too long: " + path);
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+#endif
+
+void split_host_port(const std::string &address, std::string &host, std::string &port)
+{
+    const size_t fnd = address.find_last_of(':');
+    if (fnd == std::string::npos) {
+        host = "";
+        port = address;
+    } else {
+        host = address.substr(0, fnd);
+        port = address.substr(fnd + 1);
+    }
+}
+
+}
+
+int listen_on(const std::string &address)
+{
+    int fd = -1;
+    if (starts_with(address, UNIX_PREFIX)) {
+#ifdef _WIN32
+        throw std::runtime_error("Unix domain sockets aren't supported on Windows");
+#else
+        const sockaddr_un addr = unix_address(address);
+        // Remove a stale socket left by a previous server, but never some other file
+        // which happens to be at the path
+        struct stat path_stat;
+        if (lstat(addr.sun_path, &path_stat) == 0) {
+            if (!S_ISSOCK(path_stat.st_mode)) {
+                throw std::runtime_error("Unix socket path " + address +
+                                         " exists and is not a socket");
+            }
+            unlink(addr.sun_path);
+        }
+        fd = open_socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+            close_socket(fd);
+            throw std::runtime_error("Failed to bind Unix socket " + address);
+        }
+#endif
+    } else {
+        std::string host, port;
+        split_host_port(address, host, port);
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *info = nullptr;
+        const char *node = host.empty() ? nullptr : host.c_str();
+        if (getaddrinfo(node, port.c_str(), &hints, &info) != 0) {
+            throw std::runtime_error("Failed to resolve address " + address);
+        }
+        fd = open_socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        bool bound = false;
+        if (fd >= 0) {
+            const int reuse = 1;
+            setsockopt(fd,
+                       SOL_SOCKET,
+                       SO_REUSEADDR,
+                       reinterpret_cast<const char *>(&reuse),
+                       sizeof(reuse));
+            bound = bind(fd, info->ai_addr, info->ai_addrlen) == 0;
+        }
+        freeaddrinfo(info);
+        if (!bound) {
+            close_socket(fd);
+            throw std::runtime_error("Failed to bind TCP socket " + address);
+        }
+    }
+    if (listen(fd, 8) != 0) {
+        close_socket(fd);
+        throw std::runtime_error("Failed to listen on " + address);
+    }
+    return fd;
+}
+
+int connect_to(const std::string &address)
+{
+    int fd = -1;
+    if (starts_with(address, UNIX_PREFIX)) {
+#ifdef _WIN32
+        throw std::runtime_error("Unix domain sockets aren't supported on Windows");
+#else
+        const sockaddr_un addr = unix_address(address);
+        fd = open_socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 ||
+            connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+            close_socket(fd);
+            throw std::runtime_error("Failed to connect to " + address);
+        }
+#endif
+    } else {
+        std::string host, port;
+        split_host_port(address, host, port);
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *info = nullptr;
+        const char *node = host.empty() ? "localhost" : host.c_str();
+        if (getaddrinfo(node, port.c_str(), &hints, &info) != 0) {
+            throw std::runtime_error("Failed to resolve address " + address);
+        }
+        fd = open_socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        const bool connected = fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) == 0;
+        freeaddrinfo(info);
+        if (!connected) {
+            close_socket(fd);
+            throw std::runtime_error("Failed to connect to " + address);
+        }
+        // Updates are small and latency sensitive, so don't wait to batch them
+        const int no_delay = 1;
+        setsockopt(fd,
+                   IPPROTO_TCP,
+                   TCP_NODELAY,
+                   reinterpret_cast<const char *>(&no_delay),
+                   sizeof(no_delay));
+    }
+    return fd;
+}
+
+bool wait_readable(const int fd, const int timeout_ms)
+{
+#ifdef _WIN32
+    WSAPOLLFD pfd = {};
+    pfd.fd = fd;
+    pfd.events = POLLRDNORM;
+    return WSAPoll(&pfd, 1, timeout_ms) > 0;
+#else
+    pollfd pfd = {};
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, timeout_ms) > 0;
+#endif
+}
+
+int accept_client(const int listen_fd)
+{
+#ifdef _WIN32
+    const SOCKET s = accept(listen_fd, nullptr, nullptr);
+    const int fd = s == INVALID_SOCKET ? -1 : int(s);
+#else
+    const int fd = accept(listen_fd, nullptr, nullptr);
+#endif
+    if (fd >= 0) {
+        // Setting TCP_NODELAY fails harmlessly on Unix domain sockets
+        const int no_delay = 1;
+        setsockopt(fd,
+                   IPPROTO_TCP,
+                   TCP_NODELAY,
+                   reinterpret_cast<const char *>(&no_delay),
+                   sizeof(no_delay));
+    }
+    return fd;
+}
+
+void shutdown_socket(const int fd)
+{
+    if (fd >= 0) {
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+void close_socket(const int fd)
+{
+    if (fd >= 0) {
+#ifdef _WIN32
+        closesocket(fd);
+#else
+        close(fd);
+#endif
+    }
+}
+
+bool send_message(const int fd, const uint32_t type, const uint8_t *data, const size_t size)
+{
+    if (size > MAX_MESSAGE_SIZE) {
+        return false;
+    }
+    const uint32_t header[2] = {htonl(type), htonl(static_cast<uint32_t>(size))};
+    return send_all(fd, reinterpret_cast<const uint8_t *>(header), sizeof(header)) &&
+           send_all(fd, data, size);
+}
+
+bool send_message(const int fd, const uint32_t type, const std::string &str)
+{
+    return send_message(fd, type, reinterpret_cast<const uint8_t *>(str.data()), str.size());
+}
+
+bool recv_message(const int fd, Message &msg)
+{
+    uint32_t header[2];
+    if (!recv_all(fd, reinterpret_cast<uint8_t *>(header), sizeof(header))) {
+        return false;
+    }
+    msg.type = ntohl(header[0]);
+    const uint32_t size = ntohl(header[1]);
+    if (size > MAX_MESSAGE_SIZE) {
+        return false;
+    }
+    msg.payload.resize(size);
+    return recv_all(fd, msg.payload.data(), msg.payload.size());
+}
+
+std::vector<uint8_t> pack_frame_message(const std::string &header,
+                                        const std::vector<uint8_t> &image)
+{
+    std::vector<uint8_t> payload(sizeof(uint32_t) + header.size() + image.size(), 0);
+    const uint32_t header_size = htonl(static_cast<uint32_t>(header.size()));
+    std::memcpy(payload.data(), &header_size, sizeof(uint32_t));
+    std::memcpy(payload.data() + sizeof(uint32_t), header.data(), header.size());
+    std::memcpy(payload.data() + sizeof(uint32_t) + header.size(), image.data(), image.size());
+    return payload;
+}
+
+void unpack_frame_message(const Message &msg,
+                          std::string &header,
+                          const uint8_t *&image,
+                          size_t &image_size)
+{
+    uint32_t header_size = 0;
+    if (msg.payload.size() < sizeof(uint32_t)) {
+        throw std::runtime_error("Frame message is too small");
+    }
+    std::memcpy(&header_size, msg.payload.data(), sizeof(uint32_t));
+    header_size = ntohl(header_size);
+    if (msg.payload.size() < sizeof(uint32_t) + header_size) {
+        throw std::runtime_error("Frame message header is truncated");
+    }
+    header = std::string(
+        reinterpret_cast<const char *>(msg.payload.data()) + sizeof(uint32_t), header_size);
+    image = msg.payload.data() + sizeof(uint32_t) + header_size;
+    image_size = msg.payload.size() - sizeof(uint32_t) - header_size;
+}
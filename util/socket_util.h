@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Simple framed messages over TCP or Unix domain sockets. Each message is a 4 byte type
+// followed by a 4 byte payload length, both in network byte order, and the payload
+enum MessageType : uint32_t {
+    // A UTF-8 JSON document
+    MESSAGE_JSON = 1,
+    // A JSON header followed by the image data, see pack_frame_message
+    MESSAGE_FRAME = 2
+};
+
+// Messages with larger payloads are rejected, so a bad header can't make the receiver
+// allocate an arbitrary amount of memory. This fits an uncompressed 8K RGBA frame
+const uint32_t MAX_MESSAGE_SIZE = 256 * 1024 * 1024;
+
+struct Message {
+    uint32_t type = 0;
+    std::vector<uint8_t> payload;
+};
+
+// Open a listening socket on the address, which is either "unix:<path>" for a Unix
+// domain socket or "[host:]port" for TCP. Returns the socket fd, or throws on failure
+int listen_on(const std::string &address);
+
+// Connect to a socket opened with listen_on, returns the socket fd or throws on failure
+int connect_to(const std::string &address);
+
+// Wait up to timeout_ms for the socket to be readable, or for a listening socket to have a
+// pending connection. Returns false if the timeout passed first
+bool wait_readable(const int fd, const int timeout_ms);
+
+// Accept a client connection on the listening socket, returns -1 on failure
+int accept_client(const int listen_fd);
+
+// Shutdown both directions of the connection, waking any threads blocked on it
+void shutdown_socket(const int fd);
+
+void close_socket(const int fd);
+
+// Send or receive a complete message, returns false if the connection was closed or the
+// payload is over MAX_MESSAGE_SIZE
+bool send_message(const int fd, const uint32_t type, const uint8_t *data, const size_t size);
+
+bool send_message(const int fd, const uint32_t type, const std::string &str);
+
+bool recv_message(const int fd, Message &msg);
+
+// Frame messages carry a JSON header describing the image, prefixed by its length,
+// followed by the encoded image data
+std::vector<uint8_t> pack_frame_message(const std::string &header,
+                                        const std::vector<uint8_t> &image);
+
+void unpack_frame_message(const Message &msg,
+                          std::string &header,
+                          const uint8_t *&image,
+                          size_t &image_size);
@@ -0,0 +1,275 @@
+#include "transfer_function_2d_widget.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+float clamp_unit(const float x)
+{
+    return std::min(std::max(x, 0.f), 1.f);
+}
+
+TfnRegion2D make_region(const float value_a,
+                        const float value_b,
+                        const float gradient_a,
+                        const float gradient_b,
+                        const float opacity)
+{
+    TfnRegion2D r;
+    r.value_lo = std::min(value_a, value_b);
+    r.value_hi = std::max(value_a, value_b);
+    r.gradient_lo = std::min(gradient_a, gradient_b);
+    r.gradient_hi = std::max(gradient_a, gradient_b);
+    r.opacity = opacity;
+    return r;
+}
+
+}
+
+bool TfnRegion2D::contains(const float value, const float gradient) const
+{
+    return value >= value_lo && value <= value_hi && gradient >= gradient_lo &&
+           gradient <= gradient_hi;
+}
+
+TransferFunction2DWidget::TransferFunction2DWidget()
+    : table(value_resolution * gradient_resolution, 0.f)
+{
+}
+
+void TransferFunction2DWidget::set_histogram(const std::vector<uint32_t> &counts,
+                                             const size_t value_bins,
+                                             const size_t gradient_bins)
+{
+    histogram_width = value_bins;
+    histogram_height = gradient_bins;
+    histogram_img.resize(value_bins * gradient_bins * 4);
+    const uint32_t max_count =
+        counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+    const float inv_log_max = max_count > 0 ? 1.f / std::log1p(float(max_count)) : 0.f;
+    for (size_t i = 0; i < value_bins * gradient_bins; ++i) {
+        const uint8_t c = uint8_t(std::log1p(float(counts[i])) * inv_log_max * 255.f);
+        histogram_img[i * 4] = c;
+        histogram_img[i * 4 + 1] = c;
+        histogram_img[i * 4 + 2] = c;
+        histogram_img[i * 4 + 3] = 255;
+    }
+    gpu_image_stale = true;
+}
+
+void TransferFunction2DWidget::draw_ui()
+{
+    update_gpu_image();
+
+    const ImGuiIO &io = ImGui::GetIO();
+
+    ImGui::Text("2D Transfer Function");
+    ImGui::TextWrapped(
+        "Value increases to the right and gradient magnitude upwards. Left click + drag to "
+        "add a region, drag a region to move it, right click to remove it.");
+
+    const ImVec2 canvas_pos = ImGui::GetCursorScreenPos();
+    const ImVec2 canvas_size(ImGui::GetContentRegionAvail().x,
+                             ImGui::GetContentRegionAvail().x * 0.5f);
+    const ImVec2 canvas_end(canvas_pos.x + canvas_size.x, canvas_pos.y + canvas_size.y);
+
+    ImDrawList *draw_list = ImGui::GetWindowDrawList();
+    draw_list->PushClipRect(canvas_pos, canvas_end);
+    if (histogram_tex != (GLuint)-1) {
+        // Flip the image so the lowest gradient bin is at the bottom
+        size_t tmp = histogram_tex;
+        draw_list->AddImage(reinterpret_cast<void *>(tmp),
+                            canvas_pos,
+                            canvas_end,
+                            ImVec2(0.f, 1.f),
+                            ImVec2(1.f, 0.f));
+    }
+    draw_list->AddRect(canvas_pos, canvas_end, ImColor(180, 180, 180, 255));
+
+    ImGui::InvisibleButton("tfn_2d_canvas", canvas_size);
+
+    const float mouse_value = clamp_unit((io.MousePos.x - canvas_pos.x) / canvas_size.x);
+    const float mouse_gradient =
+        clamp_unit(1.f - (io.MousePos.y - canvas_pos.y) / canvas_size.y);
+    // Find the topmost region under the mouse, regions added later are drawn on top
+    size_t hovered_region = -1;
+    for (size_t i = regions.size(); i-- > 0;) {
+        if (regions[i].contains(mouse_value, mouse_gradient)) {
+            hovered_region = i;
+            break;
+        }
+    }
+
+    if (ImGui::IsItemClicked(0)) {
+        drag_start[0] = mouse_value;
+        drag_start[1] = mouse_gradient;
+        if (hovered_region != (size_t)-1) {
+            selected_region = hovered_region;
+            drag_region = regions[selected_region];
+            drag_mode = DRAG_MOVE;
+        } else {
+            regions.push_back(
+                make_region(mouse_value, mouse_value, mouse_gradient, mouse_gradient, 0.5f));
+            selected_region = regions.size() - 1;
+            drag_mode = DRAG_CREATE;
+        }
+    } else if (ImGui::IsItemClicked(1) && hovered_region != (size_t)-1) {
+        regions.erase(regions.begin() + hovered_region);
+        selected_region = -1;
+        drag_mode = DRAG_NONE;
+        table_changed = true;
+    }
+
+    if (drag_mode != DRAG_NONE && io.MouseDown[0]) {
+        TfnRegion2D &region = regions[selected_region];
+        if (drag_mode == DRAG_CREATE) {
+            region = make_region(
+                drag_start[0], mouse_value, drag_start[1], mouse_gradient, region.opacity);
+        } else {
+            // Keep the region inside the domain while moving it
+            const float dv =
+                std::min(std::max(mouse_value - drag_start[0], -drag_region.value_lo),
+                         1.f - drag_region.value_hi);
+            const float dg =
+                std::min(std::max(mouse_gradient - drag_start[1], -drag_region.gradient_lo),
+                         1.f - drag_region.gradient_hi);
+            region = drag_region;
+            region.value_lo += dv;
+            region.value_hi += dv;
+            region.gradient_lo += dg;
+            region.gradient_hi += dg;
+        }
+        table_changed = true;
+    } else if (drag_mode != DRAG_NONE) {
+        // Drop regions which were clicked but not dragged out to a usable size
+        const TfnRegion2D &region = regions[selected_region];
+        if (drag_mode == DRAG_CREATE && (region.value_hi - region.value_lo < 0.005f ||
+                                         region.gradient_hi - region.gradient_lo < 0.005f)) {
+            regions.erase(regions.begin() + selected_region);
+            selected_region = -1;
+        }
+        drag_mode = DRAG_NONE;
+    }
+
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const TfnRegion2D &r = regions[i];
+        const ImVec2 lo(canvas_pos.x + r.value_lo * canvas_size.x,
+                        canvas_pos.y + (1.f - r.gradient_hi) * canvas_size.y);
+        const ImVec2 hi(canvas_pos.x + r.value_hi * canvas_size.x,
+                        canvas_pos.y + (1.f - r.gradient_lo) * canvas_size.y);
+        draw_list->AddRectFilled(lo, hi, ImColor(255, 255, 255, int(r.opacity * 96.f)));
+        draw_list->AddRect(lo,
+                           hi,
+                           i == selected_region ? ImColor(255, 200, 0, 255)
+                                                : ImColor(255, 255, 255, 255),
+                           0.f,
+                           0,
+                           2.f);
+    }
+    draw_list->PopClipRect();
+
+    if (selected_region < regions.size()) {
+        if (ImGui::SliderFloat(
+                "Region Opacity", &regions[selected_region].opacity, 0.f, 1.f)) {
+            table_changed = true;
+        }
+    }
+}
+
+bool TransferFunction2DWidget::changed() const
+{
+    return table_changed;
+}
+
+void TransferFunction2DWidget::get_opacities(std::vector<float> &opacities,
+                                             size_t &value_res,
+                                             size_t &gradient_res)
+{
+    if (table_changed) {
+        update_table();
+        table_changed = false;
+    }
+    opacities = table;
+    value_res = value_resolution;
+    gradient_res = gradient_resolution;
+}
+
+std::vector<std::array<float, 5>> TransferFunction2DWidget::get_regions() const
+{
+    std::vector<std::array<float, 5>> r;
+    for (const auto &region : regions) {
+        r.push_back({region.value_lo,
+                     region.value_hi,
+                     region.gradient_lo,
+                     region.gradient_hi,
+                     region.opacity});
+    }
+    return r;
+}
+
+void TransferFunction2DWidget::set_regions(const std::vector<std::array<float, 5>> &r)
+{
+    regions.clear();
+    for (const auto &region : r) {
+        regions.push_back(make_region(clamp_unit(region[0]),
+                                      clamp_unit(region[1]),
+                                      clamp_unit(region[2]),
+                                      clamp_unit(region[3]),
+                                      clamp_unit(region[4])));
+    }
+    selected_region = -1;
+    drag_mode = DRAG_NONE;
+    table_changed = true;
+}
+
+void TransferFunction2DWidget::update_table()
+{
+    std::fill(table.begin(), table.end(), 0.f);
+    for (const auto &r : regions) {
+        const float ramp = 0.25f * (r.value_hi - r.value_lo);
+        const size_t g_begin = size_t(std::ceil(r.gradient_lo * (gradient_resolution - 1)));
+        const size_t g_end = size_t(r.gradient_hi * (gradient_resolution - 1)) + 1;
+        const size_t v_begin = size_t(std::ceil(r.value_lo * (value_resolution - 1)));
+        const size_t v_end = size_t(r.value_hi * (value_resolution - 1)) + 1;
+        for (size_t v = v_begin; v < v_end; ++v) {
+            const float x = float(v) / (value_resolution - 1);
+            const float edge_distance = std::min(x - r.value_lo, r.value_hi - x);
+            const float weight = ramp > 0.f ? clamp_unit(edge_distance / ramp) : 1.f;
+            const float opacity = r.opacity * weight;
+            for (size_t g = g_begin; g < g_end; ++g) {
+                float &entry = table[g * value_resolution + v];
+                entry = std::max(entry, opacity);
+            }
+        }
+    }
+}
+
+void TransferFunction2DWidget::update_gpu_image()
+{
+    if (!gpu_image_stale) {
+        return;
+    }
+    gpu_image_stale = false;
+
+    GLint prev_tex_2d = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &prev_tex_2d);
+    if (histogram_tex == (GLuint)-1) {
+        glGenTextures(1, &histogram_tex);
+        glBindTexture(GL_TEXTURE_2D, histogram_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, histogram_tex);
+    glTexImage2D(GL_TEXTURE_2D,
+                 0,
+                 GL_RGBA8,
+                 (GLsizei)histogram_width,
+                 (GLsizei)histogram_height,
+                 0,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 histogram_img.data());
+    glBindTexture(GL_TEXTURE_2D, prev_tex_2d);
+}
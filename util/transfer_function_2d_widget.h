@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "glad/glad.h"
+#include "imgui.h"
+
+// A rectangle of the value x gradient magnitude domain in normalized [0, 1] coordinates,
+// classified with the region's opacity. The opacity ramps down over the outer quarters of
+// the region's value span so neighboring materials blend smoothly
+struct TfnRegion2D {
+    float value_lo = 0.f;
+    float value_hi = 1.f;
+    float gradient_lo = 0.f;
+    float gradient_hi = 1.f;
+    float opacity = 0.5f;
+
+    bool contains(const float value, const float gradient) const;
+};
+
+// Editor for a 2D transfer function mapping value and gradient magnitude to opacity,
+// drawn over a log scaled 2D histogram of the volume. Material boundaries show up as arcs
+// in the histogram, so regions placed over them separate boundaries which overlap in
+// value alone. The colors still come from the 1D transfer function's colormap by value
+class TransferFunction2DWidget {
+    enum DragMode { DRAG_NONE, DRAG_CREATE, DRAG_MOVE };
+
+    std::vector<TfnRegion2D> regions;
+    size_t selected_region = -1;
+    DragMode drag_mode = DRAG_NONE;
+    float drag_start[2] = {0.f, 0.f};
+    TfnRegion2D drag_region;
+
+    // The opacity table, indexed by [gradient * value_resolution + value]
+    size_t value_resolution = 256;
+    size_t gradient_resolution = 128;
+    std::vector<float> table;
+    bool table_changed = true;
+
+    // RGBA8 image of the log scaled histogram, bottom row is the lowest gradient
+    std::vector<uint8_t> histogram_img;
+    size_t histogram_width = 0;
+    size_t histogram_height = 0;
+    bool gpu_image_stale = false;
+    GLuint histogram_tex = -1;
+
+public:
+    TransferFunction2DWidget();
+
+    // Set the 2D histogram of the volume, stored as [gradient_bin * value_bins + value_bin]
+    void set_histogram(const std::vector<uint32_t> &counts,
+                       const size_t value_bins,
+                       const size_t gradient_bins);
+
+    // Add the 2D transfer function UI into the currently active window
+    void draw_ui();
+
+    // Returns true if the regions changed since the opacities were last fetched
+    bool changed() const;
+
+    void get_opacities(std::vector<float> &opacities,
+                       size_t &value_res,
+                       size_t &gradient_res);
+
+    // Get or set the regions as (value_lo, value_hi, gradient_lo, gradient_hi, opacity)
+    std::vector<std::array<float, 5>> get_regions() const;
+
+    void set_regions(const std::vector<std::array<float, 5>> &regions);
+
+private:
+    void update_table();
+
+    void update_gpu_image();
+};
@@ -1,8 +1,11 @@
 #include "transfer_function_widget.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <iostream>
+#include <stdexcept>
 #include "embedded_colormaps.h"
+#include "util.h"
 
 #ifndef TFN_WIDGET_NO_STB_IMAGE_IMPL
 #define STB_IMAGE_IMPLEMENTATION
@@ -31,6 +34,93 @@ inline float srgb_to_linear(const float x)
     }
 }
 
+namespace {
+
+// Linearize the RGBA8 colormap into 16 bit fixed point, which keeps the precision of the
+// dark sRGB colors in half the size of floats
+std::vector<uint16_t> linearize_colormap(const std::vector<uint8_t> &img,
+                                         const ColorSpace color_space)
+{
+    std::vector<uint16_t> linear(img.size());
+    for (size_t i = 0; i < img.size(); ++i) {
+        float x = img[i] / 255.f;
+        if (i % 4 != 3 && color_space == SRGB) {
+            x = srgb_to_linear(x);
+        }
+        linear[i] = static_cast<uint16_t>(clamp(x, 0.f, 1.f) * 65535.f + 0.5f);
+    }
+    return linear;
+}
+
+// The opacity of the values at histogram peaks in the suggested opacity presets
+const float peak_preset_opacity = 0.75f;
+
+// Find up to max_peaks of the most prominent peaks of the log scaled histogram, smoothed so
+// noise between neighboring bins isn't mistaken for peaks. Peaks in the first and last
+// bin are skipped, these usually hold the background or values clamped to the range.
+// Returns the (lo, peak, hi) bins of each peak sorted by bin
+std::vector<std::array<size_t, 3>> find_histogram_peaks(const std::vector<uint32_t> &counts,
+                                                        const size_t max_peaks)
+{
+    const size_t n = counts.size();
+    const size_t radius = std::max(n / 128, size_t(1));
+    std::vector<float> smoothed(n, 0.f);
+    for (size_t i = 0; i < n; ++i) {
+        const size_t lo = i > radius ? i - radius : 0;
+        const size_t hi = std::min(i + radius + 1, n);
+        for (size_t j = lo; j < hi; ++j) {
+            smoothed[i] += std::log1p(float(counts[j]));
+        }
+        smoothed[i] /= hi - lo;
+    }
+    const float max_log = n > 0 ? *std::max_element(smoothed.begin(), smoothed.end()) : 0.f;
+
+    // The prominence of a peak is its height above the higher of the lowest points
+    // between it and a higher bin on each side
+    std::vector<std::pair<float, std::array<size_t, 3>>> peaks;
+    for (size_t i = 1; i + 1 < n; ++i) {
+        if (smoothed[i] <= smoothed[i - 1] || smoothed[i] < smoothed[i + 1]) {
+            continue;
+        }
+        float left_min = smoothed[i];
+        for (size_t j = i; j-- > 0 && smoothed[j] <= smoothed[i];) {
+            left_min = std::min(left_min, smoothed[j]);
+        }
+        float right_min = smoothed[i];
+        for (size_t j = i + 1; j < n && smoothed[j] <= smoothed[i]; ++j) {
+            right_min = std::min(right_min, smoothed[j]);
+        }
+        const float prominence = smoothed[i] - std::max(left_min, right_min);
+        if (prominence < 0.05f * max_log) {
+            continue;
+        }
+        const float half_height = smoothed[i] - 0.5f * prominence;
+        size_t lo = i;
+        while (lo > 0 && smoothed[lo - 1] > half_height) {
+            --lo;
+        }
+        size_t hi = i;
+        while (hi + 1 < n && smoothed[hi + 1] > half_height) {
+            ++hi;
+        }
+        peaks.push_back(std::make_pair(prominence, std::array<size_t, 3>{lo, i, hi}));
+    }
+    std::sort(peaks.begin(),
+              peaks.end(),
+              [](const std::pair<float, std::array<size_t, 3>> &a,
+                 const std::pair<float, std::array<size_t, 3>> &b) {
+                  return a.first > b.first;
+              });
+    std::vector<std::array<size_t, 3>> result;
+    for (size_t i = 0; i < std::min(peaks.size(), max_peaks); ++i) {
+        result.push_back(peaks[i].second);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
 Colormap::Colormap(const std::string &name,
                    const std::vector<uint8_t> &img,
                    const ColorSpace color_space,
@@ -103,23 +193,185 @@ TransferFunctionWidget::TransferFunctionWidget()
 
 void TransferFunctionWidget::add_colormap(const Colormap &map)
 {
-    selected_colormap = colormaps.size();
-    colormaps.push_back(map);
-    if (colormaps.back().color_space == SRGB) {
-        Colormap &cmap = colormaps.back();
-        cmap.color_space = LINEAR;
-        for (size_t i = 0; i < cmap.colormap.size() / 4; ++i) {
-            for (size_t j = 0; j < 3; ++j) {
-                const float x = srgb_to_linear(cmap.colormap[i * 4 + j] / 255.f);
-                cmap.colormap[i * 4 + j] = static_cast<uint8_t>(clamp(x * 255.f, 0.f, 255.f));
+    ColormapEntry entry;
+    entry.name = map.name;
+    entry.color_space = map.color_space;
+    entry.use_opacity = map.use_opacity;
+    entry.linear = linearize_colormap(map.colormap, map.color_space);
+    add_colormap_entry(std::move(entry));
+    selected_colormap = colormaps.size() - 1;
+    update_colormap();
+}
+
+void TransferFunctionWidget::load_colormap_directory(const std::string &dir,
+                                                     const bool use_opacity)
+{
+    auto load_colormaps = [dir, use_opacity]() {
+        std::vector<ColormapEntry> loaded;
+        for (const auto &file : list_directory(dir)) {
+            const std::string ext = get_file_extension(file);
+            if (ext != "png" && ext != "jpg") {
+                continue;
+            }
+            const std::string path = dir + "/" + file;
+            int w, h, n;
+            uint8_t *data = stbi_load(path.c_str(), &w, &h, &n, 4);
+            if (!data) {
+                std::cout << "Failed to load colormap " << path << "\n";
+                continue;
             }
+            ColormapEntry entry;
+            entry.name = file;
+            entry.color_space = LINEAR;
+            entry.use_opacity = use_opacity;
+            entry.linear =
+                linearize_colormap(std::vector<uint8_t>(data, data + w * 4), LINEAR);
+            stbi_image_free(data);
+            loaded.push_back(std::move(entry));
         }
+        return loaded;
+    };
+    pending_loads.push_back(std::async(std::launch::async, load_colormaps));
+}
+
+bool TransferFunctionWidget::poll_colormap_loads()
+{
+    bool added = false;
+    for (auto it = pending_loads.begin(); it != pending_loads.end();) {
+        if (it->wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
+        try {
+            for (auto &entry : it->get()) {
+                add_colormap_entry(std::move(entry));
+                added = true;
+            }
+        } catch (const std::runtime_error &e) {
+            std::cout << "Failed to load colormaps: " << e.what() << "\n";
+        }
+        it = pending_loads.erase(it);
+    }
+    return added;
+}
+
+void TransferFunctionWidget::wait_colormap_loads()
+{
+    for (auto &load : pending_loads) {
+        load.wait();
     }
+    poll_colormap_loads();
+}
+
+void TransferFunctionWidget::set_resolution(const size_t res)
+{
+    if (res < 2) {
+        throw std::runtime_error("The transfer function resolution must be at least 2");
+    }
+    resolution = res;
     update_colormap();
 }
 
+void TransferFunctionWidget::set_histogram(const std::vector<uint32_t> &counts,
+                                           const float value_lo,
+                                           const float value_hi)
+{
+    histogram = counts;
+    histogram_range[0] = value_lo;
+    histogram_range[1] = value_hi;
+
+    histogram_peaks.clear();
+    const float bin_size = (value_hi - value_lo) / std::max(counts.size(), size_t(1));
+    for (const auto &p : find_histogram_peaks(counts, 4)) {
+        HistogramPeak peak;
+        peak.value_lo = value_lo + p[0] * bin_size;
+        peak.value = value_lo + (p[1] + 0.5f) * bin_size;
+        peak.value_hi = value_lo + (p[2] + 1) * bin_size;
+        histogram_peaks.push_back(peak);
+    }
+}
+
+void TransferFunctionWidget::set_value_range(const float value_lo, const float value_hi)
+{
+    value_range[0] = value_lo;
+    value_range[1] = value_hi;
+}
+
+std::vector<std::array<float, 2>> TransferFunctionWidget::peak_opacity_points(
+    const size_t peak) const
+{
+    const HistogramPeak &p = histogram_peaks.at(peak);
+    const float scale =
+        value_range[1] > value_range[0] ? 1.f / (value_range[1] - value_range[0]) : 0.f;
+    const float x_lo = (p.value_lo - value_range[0]) * scale;
+    const float x = (p.value - value_range[0]) * scale;
+    const float x_hi = (p.value_hi - value_range[0]) * scale;
+
+    // A tent over the peak, keeping the points inside the widget's range
+    std::vector<std::array<float, 2>> pts = {{0.f, 0.f}};
+    if (x_lo > 0.f && x_lo < 1.f) {
+        pts.push_back({x_lo, 0.f});
+    }
+    if (x > 0.f && x < 1.f) {
+        pts.push_back({x, peak_preset_opacity});
+    }
+    if (x_hi > 0.f && x_hi < 1.f) {
+        pts.push_back({x_hi, 0.f});
+    }
+    pts.push_back({1.f, 0.f});
+    return pts;
+}
+
+std::vector<std::array<float, 2>> TransferFunctionWidget::all_peaks_opacity_points() const
+{
+    // Take the max of the peaks' tents at each of their points
+    std::vector<std::vector<std::array<float, 2>>> tents;
+    std::vector<float> xs;
+    for (size_t i = 0; i < histogram_peaks.size(); ++i) {
+        tents.push_back(peak_opacity_points(i));
+        for (const auto &p : tents.back()) {
+            xs.push_back(p[0]);
+        }
+    }
+    std::sort(xs.begin(), xs.end());
+    xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+
+    auto eval_tent = [](const std::vector<std::array<float, 2>> &tent, const float x) {
+        for (size_t i = 1; i < tent.size(); ++i) {
+            if (x <= tent[i][0]) {
+                const float t = (x - tent[i - 1][0]) / (tent[i][0] - tent[i - 1][0]);
+                return (1.f - t) * tent[i - 1][1] + t * tent[i][1];
+            }
+        }
+        return tent.back()[1];
+    };
+    std::vector<std::array<float, 2>> pts;
+    for (const float x : xs) {
+        float opacity = 0.f;
+        for (const auto &tent : tents) {
+            opacity = std::max(opacity, eval_tent(tent, x));
+        }
+        pts.push_back({x, opacity});
+    }
+    if (pts.size() < 2) {
+        pts = {{0.f, 0.f}, {1.f, 0.f}};
+    }
+    return pts;
+}
+
+size_t TransferFunctionWidget::num_histogram_peaks() const
+{
+    return histogram_peaks.size();
+}
+
+size_t TransferFunctionWidget::get_resolution() const
+{
+    return resolution;
+}
+
 void TransferFunctionWidget::draw_ui()
 {
+    poll_colormap_loads();
     update_gpu_image();
 
     const ImGuiIO &io = ImGui::GetIO();
@@ -130,7 +382,21 @@ void TransferFunctionWidget::draw_ui()
         "Left click + drag to move points.");
 
     if (ImGui::BeginCombo("Colormap", colormaps[selected_colormap].name.c_str())) {
+        const ImVec2 thumbnail_size(3.f * ImGui::GetTextLineHeight(),
+                                    ImGui::GetTextLineHeight());
         for (size_t i = 0; i < colormaps.size(); ++i) {
+            if (!colormaps[i].linear.empty() && thumbnail_img != (GLuint)-1) {
+                // Sample along the middle of the colormap's row of thumbnails
+                const float v = (i + 0.5f) / colormaps.size();
+                size_t tex = thumbnail_img;
+                ImGui::Image(reinterpret_cast<void *>(tex),
+                             thumbnail_size,
+                             ImVec2(0.f, v),
+                             ImVec2(1.f, v));
+            } else {
+                ImGui::Dummy(thumbnail_size);
+            }
+            ImGui::SameLine();
             if (ImGui::Selectable(colormaps[i].name.c_str(), selected_colormap == i)) {
                 selected_colormap = i;
                 update_colormap();
@@ -139,6 +405,26 @@ void TransferFunctionWidget::draw_ui()
         ImGui::EndCombo();
     }
 
+    if (!histogram_peaks.empty()) {
+        ImGui::Text("Opacity Presets");
+        for (size_t i = 0; i < histogram_peaks.size(); ++i) {
+            const std::string label = "Peak " + std::to_string(i + 1);
+            ImGui::SameLine();
+            if (ImGui::Button(label.c_str())) {
+                set_opacity_points(peak_opacity_points(i));
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Values %g to %g",
+                                  histogram_peaks[i].value_lo,
+                                  histogram_peaks[i].value_hi);
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("All Peaks")) {
+            set_opacity_points(all_peaks_opacity_points());
+        }
+    }
+
     vec2f canvas_size = ImGui::GetContentRegionAvail();
     // Note: If you're not using OpenGL for rendering your UI, the setup for
     // displaying the colormap texture in the UI will need to be updated.
@@ -155,6 +441,9 @@ void TransferFunctionWidget::draw_ui()
     const vec2f view_scale(canvas_size.x, -canvas_size.y);
     const vec2f view_offset(canvas_pos.x, canvas_pos.y + canvas_size.y);
 
+    if (!histogram.empty() && histogram_range[1] > histogram_range[0]) {
+        draw_histogram(draw_list, canvas_pos, canvas_size);
+    }
     draw_list->AddRect(canvas_pos, canvas_pos + canvas_size, ImColor(180, 180, 180, 255));
 
     ImGui::InvisibleButton("tfn_canvas", canvas_size);
@@ -173,6 +462,7 @@ void TransferFunctionWidget::draw_ui()
                                       std::min(std::max(io.MousePos.y, bbmin.y), bbmax.y));
 
     if (clicked_on_item) {
+        const std::vector<vec2f> prev_control_pts = alpha_control_pts;
         vec2f mouse_pos = (vec2f(clipped_mouse_pos) - view_offset) / view_scale;
         mouse_pos.x = clamp(mouse_pos.x, 0.f, 1.f);
         mouse_pos.y = clamp(mouse_pos.y, 0.f, 1.f);
@@ -214,7 +504,7 @@ void TransferFunctionWidget::draw_ui()
                     });
                 selected_point = std::distance(alpha_control_pts.begin(), fnd);
             }
-            update_colormap();
+            update_opacity_points(prev_control_pts);
         } else if (ImGui::IsMouseClicked(1)) {
             selected_point = -1;
             // Find and remove the point
@@ -229,7 +519,7 @@ void TransferFunctionWidget::draw_ui()
                 fnd != alpha_control_pts.end() - 1) {
                 alpha_control_pts.erase(fnd);
             }
-            update_colormap();
+            update_opacity_points(prev_control_pts);
         } else {
             selected_point = -1;
         }
@@ -252,21 +542,32 @@ void TransferFunctionWidget::draw_ui()
 
 bool TransferFunctionWidget::changed() const
 {
-    return colormap_changed;
+    return dirty_end > dirty_begin;
 }
 
 std::vector<uint8_t> TransferFunctionWidget::get_colormap()
 {
-    colormap_changed = false;
-    return current_colormap;
+    std::vector<uint8_t> colormap(resolution * 4, 0);
+    for (size_t i = 0; i < resolution; ++i) {
+        for (size_t j = 0; j < 3; ++j) {
+            colormap[i * 4 + j] =
+                static_cast<uint8_t>(clamp(table_colors[i * 3 + j] * 255.f, 0.f, 255.f));
+        }
+        colormap[i * 4 + 3] =
+            static_cast<uint8_t>(clamp(table_opacities[i] * 255.f, 0.f, 255.f));
+    }
+    return colormap;
 }
 
 std::vector<float> TransferFunctionWidget::get_colormapf()
 {
-    colormap_changed = false;
-    std::vector<float> colormapf(current_colormap.size(), 0.f);
-    for (size_t i = 0; i < current_colormap.size(); ++i) {
-        colormapf[i] = current_colormap[i] / 255.f;
+    dirty_begin = dirty_end = 0;
+    std::vector<float> colormapf(resolution * 4, 0.f);
+    for (size_t i = 0; i < resolution; ++i) {
+        colormapf[i * 4] = table_colors[i * 3];
+        colormapf[i * 4 + 1] = table_colors[i * 3 + 1];
+        colormapf[i * 4 + 2] = table_colors[i * 3 + 2];
+        colormapf[i * 4 + 3] = table_opacities[i];
     }
     return colormapf;
 }
@@ -274,14 +575,123 @@ std::vector<float> TransferFunctionWidget::get_colormapf()
 void TransferFunctionWidget::get_colormapf(std::vector<float> &color,
                                            std::vector<float> &opacity)
 {
-    colormap_changed = false;
-    color.resize((current_colormap.size() / 4) * 3);
-    opacity.resize(current_colormap.size() / 4);
-    for (size_t i = 0; i < current_colormap.size() / 4; ++i) {
-        color[i * 3] = current_colormap[i * 4] / 255.f;
-        color[i * 3 + 1] = current_colormap[i * 4 + 1] / 255.f;
-        color[i * 3 + 2] = current_colormap[i * 4 + 2] / 255.f;
-        opacity[i] = current_colormap[i * 4 + 3] / 255.f;
+    dirty_begin = dirty_end = 0;
+    color = table_colors;
+    opacity = table_opacities;
+}
+
+bool TransferFunctionWidget::get_colormapf_changes(std::vector<float> &color,
+                                                   std::vector<float> &opacity,
+                                                   size_t &begin,
+                                                   size_t &end)
+{
+    if (color.size() != table_colors.size() || opacity.size() != table_opacities.size()) {
+        get_colormapf(color, opacity);
+        begin = 0;
+        end = resolution;
+        return true;
+    }
+    if (!changed()) {
+        return false;
+    }
+    begin = dirty_begin;
+    end = dirty_end;
+    std::copy(table_colors.begin() + begin * 3,
+              table_colors.begin() + end * 3,
+              color.begin() + begin * 3);
+    std::copy(table_opacities.begin() + begin,
+              table_opacities.begin() + end,
+              opacity.begin() + begin);
+    dirty_begin = dirty_end = 0;
+    return true;
+}
+
+std::vector<std::string> TransferFunctionWidget::colormap_names() const
+{
+    std::vector<std::string> names;
+    for (const auto &c : colormaps) {
+        names.push_back(c.name);
+    }
+    return names;
+}
+
+const std::string &TransferFunctionWidget::current_colormap_name() const
+{
+    return colormaps[selected_colormap].name;
+}
+
+bool TransferFunctionWidget::select_colormap(const std::string &name)
+{
+    for (size_t i = 0; i < colormaps.size(); ++i) {
+        if (colormaps[i].name == name) {
+            selected_colormap = i;
+            update_colormap();
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<std::array<float, 2>> TransferFunctionWidget::get_opacity_points() const
+{
+    std::vector<std::array<float, 2>> pts;
+    for (const auto &p : alpha_control_pts) {
+        pts.push_back({p.x, p.y});
+    }
+    return pts;
+}
+
+void TransferFunctionWidget::set_opacity_points(const std::vector<std::array<float, 2>> &pts)
+{
+    if (pts.size() < 2) {
+        throw std::runtime_error("At least two opacity control points are required");
+    }
+    const std::vector<vec2f> prev_control_pts = alpha_control_pts;
+    alpha_control_pts.clear();
+    for (const auto &p : pts) {
+        alpha_control_pts.emplace_back(clamp(p[0], 0.f, 1.f), clamp(p[1], 0.f, 1.f));
+    }
+    std::sort(alpha_control_pts.begin(),
+              alpha_control_pts.end(),
+              [](const vec2f &a, const vec2f &b) { return a.x < b.x; });
+    alpha_control_pts.front().x = 0.f;
+    alpha_control_pts.back().x = 1.f;
+    selected_point = -1;
+    update_opacity_points(prev_control_pts);
+}
+
+void TransferFunctionWidget::draw_histogram(ImDrawList *draw_list,
+                                            const ImVec2 &canvas_pos,
+                                            const ImVec2 &canvas_size) const
+{
+    const uint32_t max_count = *std::max_element(histogram.begin(), histogram.end());
+    const float max_log = std::log1p(float(max_count));
+    if (max_log <= 0.f) {
+        return;
+    }
+    // Draw a bar for each pixel column with the largest count of the bins it covers
+    const int columns = std::max(int(canvas_size.x), 1);
+    const float bins_per_value = histogram.size() / (histogram_range[1] - histogram_range[0]);
+    const float column_values = (value_range[1] - value_range[0]) / columns;
+    const ImU32 color = ImColor(140, 140, 140, 160);
+    for (int c = 0; c < columns; ++c) {
+        const float v0 = value_range[0] + c * column_values;
+        const float b0 = (v0 - histogram_range[0]) * bins_per_value;
+        const float b1 = b0 + column_values * bins_per_value;
+        if (b1 < 0.f || b0 >= histogram.size()) {
+            continue;
+        }
+        const size_t begin = size_t(std::max(b0, 0.f));
+        const size_t end =
+            std::min(std::max(size_t(std::ceil(b1)), begin + 1), histogram.size());
+        const uint32_t count =
+            *std::max_element(histogram.begin() + begin, histogram.begin() + end);
+        const float height = std::log1p(float(count)) / max_log * canvas_size.y;
+        const float x = canvas_pos.x + c * canvas_size.x / columns;
+        draw_list->AddRectFilled(
+            ImVec2(x, canvas_pos.y + canvas_size.y - height),
+            ImVec2(x + canvas_size.x / columns, canvas_pos.y + canvas_size.y),
+            color);
     }
 }
 
@@ -298,62 +708,202 @@ void TransferFunctionWidget::update_gpu_image()
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     }
+    if (thumbnails_stale) {
+        thumbnails_stale = false;
+        if (thumbnail_img == (GLuint)-1) {
+            glGenTextures(1, &thumbnail_img);
+            glBindTexture(GL_TEXTURE_2D, thumbnail_img);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, thumbnail_img);
+        glTexImage2D(GL_TEXTURE_2D,
+                     0,
+                     GL_RGB8,
+                     (GLsizei)thumbnail_width,
+                     (GLsizei)colormaps.size(),
+                     0,
+                     GL_RGBA,
+                     GL_UNSIGNED_BYTE,
+                     thumbnails.data());
+    }
     if (gpu_image_stale) {
         gpu_image_stale = false;
         glBindTexture(GL_TEXTURE_2D, colormap_img);
         glTexImage2D(GL_TEXTURE_2D,
                      0,
                      GL_RGB8,
-                     (GLsizei)(current_colormap.size() / 4),
+                     (GLsizei)(preview_colormap.size() / 4),
                      1,
                      0,
                      GL_RGBA,
                      GL_UNSIGNED_BYTE,
-                     current_colormap.data());
+                     preview_colormap.data());
     }
     glBindTexture(GL_TEXTURE_2D, prev_tex_2d);
 }
 
 void TransferFunctionWidget::update_colormap()
 {
-    colormap_changed = true;
     gpu_image_stale = true;
-    current_colormap = colormaps[selected_colormap].colormap;
-    // We only change opacities for now, so go through and update the opacity
-    // by blending between the neighboring control points
-    if (!colormaps[selected_colormap].use_opacity) {
-        auto a_it = alpha_control_pts.begin();
-        const size_t npixels = current_colormap.size() / 4;
-        for (size_t i = 0; i < npixels; ++i) {
-            float x = static_cast<float>(i) / npixels;
-            auto high = a_it + 1;
-            if (x > high->x) {
-                ++a_it;
-                ++high;
-            }
-            float t = (x - a_it->x) / (high->x - a_it->x);
-            float alpha = (1.f - t) * a_it->y + t * high->y;
-            current_colormap[i * 4 + 3] =
-                static_cast<uint8_t>(clamp(alpha * 255.f, 0.f, 255.f));
+    decode_colormap(selected_colormap);
+    const ColormapEntry &cmap = colormaps[selected_colormap];
+    const size_t cmap_size = cmap.linear.size() / 4;
+    table_colors.resize(resolution * 3);
+    table_opacities.resize(resolution);
+    preview_colormap.resize(cmap.linear.size());
+    std::vector<float> cmap_colors(cmap.linear.size());
+    for (size_t i = 0; i < cmap.linear.size(); ++i) {
+        cmap_colors[i] = cmap.linear[i] / 65535.f;
+        preview_colormap[i] = static_cast<uint8_t>(cmap_colors[i] * 255.f);
+    }
+
+    for (size_t i = 0; i < resolution; ++i) {
+        const float pos = static_cast<float>(i) / (resolution - 1) * (cmap_size - 1);
+        const size_t lo = std::min(static_cast<size_t>(pos), cmap_size - 1);
+        const size_t hi = std::min(lo + 1, cmap_size - 1);
+        const float t = pos - lo;
+        for (size_t j = 0; j < 3; ++j) {
+            table_colors[i * 3 + j] =
+                (1.f - t) * cmap_colors[lo * 4 + j] + t * cmap_colors[hi * 4 + j];
+        }
+        if (cmap.use_opacity) {
+            table_opacities[i] =
+                (1.f - t) * cmap_colors[lo * 4 + 3] + t * cmap_colors[hi * 4 + 3];
         }
     }
+    mark_dirty(0, resolution);
+    if (!cmap.use_opacity) {
+        update_opacity_span(0.f, 1.f);
+    }
+}
+
+void TransferFunctionWidget::update_opacity_span(const float x_begin, const float x_end)
+{
+    // Opacities read from the colormap don't depend on the control points
+    if (colormaps[selected_colormap].use_opacity) {
+        return;
+    }
+    const float scale = static_cast<float>(resolution - 1);
+    const size_t begin = static_cast<size_t>(std::ceil(clamp(x_begin, 0.f, 1.f) * scale));
+    const size_t end = static_cast<size_t>(std::floor(clamp(x_end, 0.f, 1.f) * scale)) + 1;
+    for (size_t i = begin; i < end; ++i) {
+        table_opacities[i] = sample_opacity(i / scale);
+    }
+    mark_dirty(begin, end);
+}
+
+void TransferFunctionWidget::update_opacity_points(const std::vector<vec2f> &old_pts)
+{
+    auto same = [](const vec2f &a, const vec2f &b) { return a.x == b.x && a.y == b.y; };
+    const std::vector<vec2f> &new_pts = alpha_control_pts;
+
+    // Find the run of points which changed, trimming the unchanged points at each end
+    size_t first = 0;
+    while (first < old_pts.size() && first < new_pts.size() &&
+           same(old_pts[first], new_pts[first])) {
+        ++first;
+    }
+    if (first == old_pts.size() && first == new_pts.size()) {
+        return;
+    }
+    size_t old_last = old_pts.size();
+    size_t new_last = new_pts.size();
+    while (old_last > first && new_last > first &&
+           same(old_pts[old_last - 1], new_pts[new_last - 1])) {
+        --old_last;
+        --new_last;
+    }
+
+    // Only the segments between the unchanged neighbors of the run are affected
+    const float x_begin = first > 0 ? new_pts[first - 1].x : 0.f;
+    const float x_end = new_last < new_pts.size() ? new_pts[new_last].x : 1.f;
+    update_opacity_span(x_begin, x_end);
+}
+
+float TransferFunctionWidget::sample_opacity(const float x) const
+{
+    auto high = std::upper_bound(alpha_control_pts.begin(),
+                                 alpha_control_pts.end(),
+                                 x,
+                                 [](const float v, const vec2f &p) { return v < p.x; });
+    if (high == alpha_control_pts.begin()) {
+        return high->y;
+    }
+    if (high == alpha_control_pts.end()) {
+        return alpha_control_pts.back().y;
+    }
+    auto low = high - 1;
+    const float t = (x - low->x) / (high->x - low->x);
+    return (1.f - t) * low->y + t * high->y;
+}
+
+void TransferFunctionWidget::mark_dirty(const size_t begin, const size_t end)
+{
+    if (begin >= end) {
+        return;
+    }
+    if (dirty_end <= dirty_begin) {
+        dirty_begin = begin;
+        dirty_end = end;
+    } else {
+        dirty_begin = std::min(dirty_begin, begin);
+        dirty_end = std::max(dirty_end, end);
+    }
 }
 
 void TransferFunctionWidget::load_embedded_preset(const uint8_t *buf,
                                                   size_t size,
                                                   const std::string &name)
 {
+    ColormapEntry entry;
+    entry.name = name;
+    entry.embedded = buf;
+    entry.embedded_size = size;
+    add_colormap_entry(std::move(entry));
+}
+
+void TransferFunctionWidget::decode_colormap(const size_t i)
+{
+    ColormapEntry &cmap = colormaps[i];
+    if (!cmap.linear.empty()) {
+        return;
+    }
     int w, h, n;
-    uint8_t *img_data = stbi_load_from_memory(buf, (int)size, &w, &h, &n, 4);
-    auto img = std::vector<uint8_t>(img_data, img_data + w * 1 * 4);
+    uint8_t *img_data =
+        stbi_load_from_memory(cmap.embedded, (int)cmap.embedded_size, &w, &h, &n, 4);
+    if (!img_data) {
+        throw std::runtime_error("Failed to decode colormap " + cmap.name);
+    }
+    cmap.linear = linearize_colormap(std::vector<uint8_t>(img_data, img_data + w * 4),
+                                     cmap.color_space);
     stbi_image_free(img_data);
-    colormaps.emplace_back(name, img, SRGB, false);
-    Colormap &cmap = colormaps.back();
-    for (size_t i = 0; i < cmap.colormap.size() / 4; ++i) {
-        for (size_t j = 0; j < 3; ++j) {
-            const float x = srgb_to_linear(cmap.colormap[i * 4 + j] / 255.f);
-            cmap.colormap[i * 4 + j] = static_cast<uint8_t>(clamp(x * 255.f, 0.f, 255.f));
-        }
+    update_thumbnail(i);
+}
+
+void TransferFunctionWidget::add_colormap_entry(ColormapEntry &&entry)
+{
+    colormaps.push_back(std::move(entry));
+    thumbnails.resize(colormaps.size() * thumbnail_width * 4, 0);
+    thumbnails_stale = true;
+    if (!colormaps.back().linear.empty()) {
+        update_thumbnail(colormaps.size() - 1);
     }
 }
 
+void TransferFunctionWidget::update_thumbnail(const size_t i)
+{
+    const std::vector<uint16_t> &linear = colormaps[i].linear;
+    const size_t cmap_size = linear.size() / 4;
+    uint8_t *row = &thumbnails[i * thumbnail_width * 4];
+    for (size_t x = 0; x < thumbnail_width; ++x) {
+        const size_t j = x * (cmap_size - 1) / (thumbnail_width - 1);
+        for (size_t c = 0; c < 3; ++c) {
+            row[x * 4 + c] = static_cast<uint8_t>(linear[j * 4 + c] >> 8);
+        }
+        row[x * 4 + 3] = 255;
+    }
+    thumbnails_stale = true;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <future>
 #include <string>
 #include <vector>
 #include "glad/glad.h"
@@ -10,7 +12,8 @@ enum ColorSpace { LINEAR, SRGB };
 
 struct Colormap {
     std::string name;
-    // An RGBA8 1D image
+    // An RGBA8 1D image in the color space, it's linearized when sampled into the
+    // transfer function
     std::vector<uint8_t> colormap;
     ColorSpace color_space;
     bool use_opacity;
@@ -38,16 +41,64 @@ class TransferFunctionWidget {
         operator ImVec2() const;
     };
 
-    std::vector<Colormap> colormaps;
+    // A colormap which can be selected, embedded colormaps are decoded and linearized the
+    // first time they're selected so startup doesn't pay for colormaps never used
+    struct ColormapEntry {
+        std::string name;
+        ColorSpace color_space = SRGB;
+        bool use_opacity = false;
+        // The encoded embedded image, if the colormap is decoded on selection
+        const uint8_t *embedded = nullptr;
+        size_t embedded_size = 0;
+        // Linear RGBA colors and opacities in 16 bit fixed point, empty until decoded
+        std::vector<uint16_t> linear;
+    };
+
+    std::vector<ColormapEntry> colormaps;
     size_t selected_colormap = 0;
-    std::vector<uint8_t> current_colormap;
+
+    // Colormaps being loaded from directories in the background
+    std::vector<std::future<std::vector<ColormapEntry>>> pending_loads;
+
+    // A row of thumbnail_width RGBA8 pixels for each colormap, shown in the colormap list.
+    // The rows of colormaps which haven't been decoded yet are left blank
+    static const size_t thumbnail_width = 64;
+    std::vector<uint8_t> thumbnails;
+    bool thumbnails_stale = false;
+    GLuint thumbnail_img = -1;
+
+    // The transfer function table, linear RGB colors and opacities sampled from the
+    // colormap and opacity control points at the table resolution
+    size_t resolution = 1024;
+    std::vector<float> table_colors;
+    std::vector<float> table_opacities;
+    // The span of table entries [dirty_begin, dirty_end) changed since the table was last
+    // fetched. Moving a control point only recomputes and marks the entries between its
+    // neighbors
+    size_t dirty_begin = 0;
+    size_t dirty_end = 0;
+
+    // RGBA8 preview of the colormap's colors shown in the UI
+    std::vector<uint8_t> preview_colormap;
 
     std::vector<vec2f> alpha_control_pts = {vec2f(0.f), vec2f(1.f)};
     size_t selected_point = -1;
 
+    // A peak of the value histogram, spanning the values around it where the smoothed log
+    // count is above half the peak's prominence
+    struct HistogramPeak {
+        float value_lo, value, value_hi;
+    };
+
+    // The volume's value histogram drawn behind the opacity curve, its bins span
+    // histogram_range and the widget's x axis spans value_range
+    std::vector<uint32_t> histogram;
+    float histogram_range[2] = {0.f, 1.f};
+    float value_range[2] = {0.f, 1.f};
+    std::vector<HistogramPeak> histogram_peaks;
+
     bool clicked_on_item = false;
     bool gpu_image_stale = true;
-    bool colormap_changed = true;
     GLuint colormap_img = -1;
 
 public:
@@ -57,6 +108,40 @@ public:
     // is provided in sRGBA colorspace it will be linearized
     void add_colormap(const Colormap &map);
 
+    // Load the PNG and JPG colormaps in the directory in a background thread, they're added
+    // to the colormaps when draw_ui or poll_colormap_loads sees the load finished. Like
+    // -tfn images the colormaps are taken as linear RGBA
+    void load_colormap_directory(const std::string &dir, const bool use_opacity);
+
+    // Add the colormaps of any finished directory loads, returns true if some were added
+    bool poll_colormap_loads();
+
+    // Wait for the directory loads to finish and add their colormaps
+    void wait_colormap_loads();
+
+    // Set the number of entries in the transfer function table
+    void set_resolution(const size_t resolution);
+
+    size_t get_resolution() const;
+
+    // Set the histogram of the volume's values over [value_lo, value_hi] to draw log scaled
+    // behind the opacity curve, and find its peaks to offer as opacity presets
+    void set_histogram(const std::vector<uint32_t> &counts,
+                       const float value_lo,
+                       const float value_hi);
+
+    // Set the value range the transfer function is applied over, to line the histogram
+    // up with the opacity curve
+    void set_value_range(const float value_lo, const float value_hi);
+
+    // Get opacity control points making the values around the histogram peak opaque
+    std::vector<std::array<float, 2>> peak_opacity_points(const size_t peak) const;
+
+    // Get opacity control points making the values around all histogram peaks opaque
+    std::vector<std::array<float, 2>> all_peaks_opacity_points() const;
+
+    size_t num_histogram_peaks() const;
+
     // Add the transfer function UI into the currently active window
     void draw_ui();
 
@@ -74,11 +159,57 @@ public:
     // as separate color and opacity vectors
     void get_colormapf(std::vector<float> &color, std::vector<float> &opacity);
 
+    // Copy only the entries changed since the table was last fetched into the color and
+    // opacity vectors, which are resized and filled completely if their size doesn't match
+    // the table. Returns false if nothing changed, otherwise the updated entries are
+    // [begin, end)
+    bool get_colormapf_changes(std::vector<float> &color,
+                               std::vector<float> &opacity,
+                               size_t &begin,
+                               size_t &end);
+
+    // Get the names of the available colormaps
+    std::vector<std::string> colormap_names() const;
+
+    const std::string &current_colormap_name() const;
+
+    // Select a colormap by name, returns false if there's no colormap with the name
+    bool select_colormap(const std::string &name);
+
+    // Get or set the opacity control points as (x, opacity) pairs in [0, 1]. When setting
+    // the points they're sorted and the end points are moved to span [0, 1]
+    std::vector<std::array<float, 2>> get_opacity_points() const;
+
+    void set_opacity_points(const std::vector<std::array<float, 2>> &pts);
+
 private:
     void update_gpu_image();
 
+    // Draw the log scaled histogram as bars behind the opacity curve
+    void draw_histogram(ImDrawList *draw_list,
+                        const ImVec2 &canvas_pos,
+                        const ImVec2 &canvas_size) const;
+
+    // Resample the whole table from the colormap and control points
     void update_colormap();
 
+    // Recompute the opacities of the table entries in [x_begin, x_end]
+    void update_opacity_span(const float x_begin, const float x_end);
+
+    // Recompute the opacities between the control points which changed from old_pts
+    void update_opacity_points(const std::vector<vec2f> &old_pts);
+
+    float sample_opacity(const float x) const;
+
+    void mark_dirty(const size_t begin, const size_t end);
+
     void load_embedded_preset(const uint8_t *buf, size_t size, const std::string &name);
+
+    // Decode and linearize the colormap if it hasn't been yet
+    void decode_colormap(const size_t i);
+
+    void add_colormap_entry(ColormapEntry &&entry);
+
+    void update_thumbnail(const size_t i);
 };
 
@@ -4,6 +4,13 @@
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -47,8 +54,54 @@ std::string get_file_basepath(const std::string &path)
     return path.substr(0, end);
 }
 
+std::vector<std::string> list_directory(const std::string &dir)
+{
+    std::vector<std::string> files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA find_data;
+    HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &find_data);
+    if (find == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open directory " + dir);
+    }
+    do {
+        if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+            files.push_back(find_data.cFileName);
+        }
+    } while (FindNextFileA(find, &find_data));
+    FindClose(find);
+#else
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        throw std::runtime_error("Failed to open directory " + dir);
+    }
+    while (dirent *entry = readdir(d)) {
+        const std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            files.push_back(name);
+        }
+    }
+    closedir(d);
+#endif
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
 bool starts_with(const std::string &str, const std::string &prefix)
 {
     return std::strncmp(str.c_str(), prefix.c_str(), prefix.size()) == 0;
 }
 
+
+std::vector<std::string> split_string(const std::string &str, const char delim)
+{
+    std::vector<std::string> parts;
+    size_t start = 0;
+    size_t end = str.find(delim);
+    while (end != std::string::npos) {
+        parts.push_back(str.substr(start, end - start));
+        start = end + 1;
+        end = str.find(delim, start);
+    }
+    parts.push_back(str.substr(start));
+    return parts;
+}
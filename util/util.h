@@ -19,8 +19,14 @@ std::string get_file_basename(const std::string &path);
 
 std::string get_file_basepath(const std::string &path);
 
+// List the names of the files in the directory, sorted by name
+std::vector<std::string> list_directory(const std::string &dir);
+
 bool starts_with(const std::string &str, const std::string &prefix);
 
+// Split the string on the delimiter, e.g. for comma separated lists of arguments
+std::vector<std::string> split_string(const std::string &str, const char delim);
+
 template <typename T, size_t N>
 inline math::vec_t<T, N> get_vec(const json &j)
 {
@@ -0,0 +1,295 @@
+#include "vector_field.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include "loader.h"
+
+namespace {
+
+// Trilinearly interpolate the vectors at a position in voxel coordinates, which must be
+// within [0, dims - 1]
+math::vec3f sample_vector(const math::vec3f *vectors,
+                          const math::vec3i &dims,
+                          const math::vec3f &p)
+{
+    int i0[3];
+    int i1[3];
+    float t[3];
+    for (int i = 0; i < 3; ++i) {
+        i0[i] = std::min(int(p[i]), dims[i] - 1);
+        i1[i] = std::min(i0[i] + 1, dims[i] - 1);
+        t[i] = p[i] - i0[i];
+    }
+    auto voxel = [&](const int x, const int y, const int z) {
+        return vectors[(size_t(z) * dims.y + y) * dims.x + x];
+    };
+    const math::vec3f v00 =
+        (1.f - t[0]) * voxel(i0[0], i0[1], i0[2]) + t[0] * voxel(i1[0], i0[1], i0[2]);
+    const math::vec3f v10 =
+        (1.f - t[0]) * voxel(i0[0], i1[1], i0[2]) + t[0] * voxel(i1[0], i1[1], i0[2]);
+    const math::vec3f v01 =
+        (1.f - t[0]) * voxel(i0[0], i0[1], i1[2]) + t[0] * voxel(i1[0], i0[1], i1[2]);
+    const math::vec3f v11 =
+        (1.f - t[0]) * voxel(i0[0], i1[1], i1[2]) + t[0] * voxel(i1[0], i1[1], i1[2]);
+    const math::vec3f v0 = (1.f - t[1]) * v00 + t[1] * v10;
+    const math::vec3f v1 = (1.f - t[1]) * v01 + t[1] * v11;
+    return (1.f - t[2]) * v0 + t[2] * v1;
+}
+
+struct Tracer {
+    const math::vec3f *vectors = nullptr;
+    math::vec3i dims;
+    // Converts the field's world space vectors to voxels per unit time
+    math::vec3f inv_spacing;
+    math::vec3f upper;
+    const StreamlineParams *params = nullptr;
+
+    bool inside(const math::vec3f &p) const
+    {
+        return p.x >= 0.f && p.y >= 0.f && p.z >= 0.f && p.x <= upper.x && p.y <= upper.y &&
+               p.z <= upper.z;
+    }
+
+    // The unit direction of the field at p in voxel coordinates, false if p is outside the
+    // field or the field is too slow there to have a direction
+    bool direction(const math::vec3f &p, math::vec3f &dir, float &speed) const
+    {
+        if (!inside(p)) {
+            return false;
+        }
+        const math::vec3f v = sample_vector(vectors, dims, p);
+        speed = length(v);
+        if (speed < params->min_speed) {
+            return false;
+        }
+        dir = normalize(v * inv_spacing);
+        return true;
+    }
+
+    // Trace from the seed with RK4 steps of h voxels along the normalized field, so the
+    // steps have a fixed length in voxels whatever the field's speed. The seed isn't
+    // added to the line
+    void trace(const math::vec3f &seed,
+               const float h,
+               std::vector<math::vec3f> &line,
+               std::vector<float> &speeds) const
+    {
+        math::vec3f p = seed;
+        math::vec3f k1, k2, k3, k4;
+        float speed = 0.f;
+        float unused = 0.f;
+        if (!direction(p, k1, speed)) {
+            return;
+        }
+        for (int i = 0; i < params->max_steps; ++i) {
+            if (!direction(p + 0.5f * h * k1, k2, unused) ||
+                !direction(p + 0.5f * h * k2, k3, unused) ||
+                !direction(p + h * k3, k4, unused)) {
+                return;
+            }
+            p = p + h / 6.f * (k1 + 2.f * k2 + 2.f * k3 + k4);
+            // The direction at the new vertex is the first stage of the next step
+            if (!direction(p, k1, speed)) {
+                return;
+            }
+            line.push_back(p);
+            speeds.push_back(speed);
+        }
+    }
+};
+
+std::vector<math::vec3f> streamline_seeds(const StreamlineParams &params)
+{
+    std::vector<math::vec3f> seeds;
+    const math::box3f &box = params.seed_box;
+    if (params.random_seeds > 0) {
+        // A fixed seed so the same params always trace the same lines
+        std::minstd_rand rng(0);
+        std::uniform_real_distribution<float> dist(0.f, 1.f);
+        for (int i = 0; i < params.random_seeds; ++i) {
+            const math::vec3f t(dist(rng), dist(rng), dist(rng));
+            seeds.push_back(box.lower + t * box.size());
+        }
+        return seeds;
+    }
+    const math::vec3i res = max(params.seed_res, math::vec3i(1));
+    for (int z = 0; z < res.z; ++z) {
+        for (int y = 0; y < res.y; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                const math::vec3f t =
+                    (math::vec3f(x, y, z) + math::vec3f(0.5f)) / math::vec3f(res);
+                seeds.push_back(box.lower + t * box.size());
+            }
+        }
+    }
+    return seeds;
+}
+
+}
+
+const math::vec3f *VectorField::vectors() const
+{
+    return reinterpret_cast<const math::vec3f *>(data->data());
+}
+
+math::vec3f VectorField::spacing() const
+{
+    return bounds.size() / math::vec3f(dims);
+}
+
+VolumeBrick compute_magnitude_volume(const VectorField &field)
+{
+    VolumeBrick brick;
+    brick.dims = field.dims;
+    brick.bounds = field.bounds;
+    brick.voxel_type = "float32";
+    const size_t n_voxels = brick.dims.long_product();
+    brick.voxel_data =
+        make_tracked_buffer(MemoryCategory::VOLUME_HOST, n_voxels * sizeof(float));
+
+    const math::vec3f *vectors = field.vectors();
+    float *magnitudes = reinterpret_cast<float *>(brick.voxel_data->data());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n_voxels),
+                      [&](const tbb::blocked_range<size_t> &r) {
+                          for (size_t i = r.begin(); i != r.end(); ++i) {
+                              magnitudes[i] = length(vectors[i]);
+                          }
+                      });
+
+    make_structured_volume(brick, field.spacing(), field.bounds.lower);
+    return brick;
+}
+
+Streamlines trace_streamlines(const VectorField &field, const StreamlineParams &params)
+{
+    const math::vec3f spacing = field.spacing();
+    Tracer tracer;
+    tracer.vectors = field.vectors();
+    tracer.dims = field.dims;
+    tracer.inv_spacing = 1.f / spacing;
+    tracer.upper = math::vec3f(field.dims - 1);
+    tracer.params = &params;
+
+    // Each seed's line is traced into its own vertices, which are then packed together
+    const std::vector<math::vec3f> seeds = streamline_seeds(params);
+    std::vector<std::vector<math::vec3f>> lines(seeds.size());
+    std::vector<std::vector<float>> line_speeds(seeds.size());
+    tbb::parallel_for(size_t(0), seeds.size(), [&](const size_t i) {
+        const math::vec3f seed = (seeds[i] - field.bounds.lower) / spacing;
+        math::vec3f dir;
+        float speed = 0.f;
+        if (!tracer.direction(seed, dir, speed)) {
+            return;
+        }
+        std::vector<math::vec3f> &line = lines[i];
+        std::vector<float> &speeds = line_speeds[i];
+        if (params.both_directions) {
+            tracer.trace(seed, -params.step, line, speeds);
+            std::reverse(line.begin(), line.end());
+            std::reverse(speeds.begin(), speeds.end());
+        }
+        line.push_back(seed);
+        speeds.push_back(speed);
+        tracer.trace(seed, params.step, line, speeds);
+        for (auto &p : line) {
+            p = field.bounds.lower + p * spacing;
+        }
+    });
+
+    Streamlines streamlines;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].size() < 2) {
+            continue;
+        }
+        const uint32_t first = streamlines.positions.size();
+        for (uint32_t j = 0; j + 1 < lines[i].size(); ++j) {
+            streamlines.indices.push_back(first + j);
+        }
+        streamlines.positions.insert(
+            streamlines.positions.end(), lines[i].begin(), lines[i].end());
+        streamlines.speeds.insert(
+            streamlines.speeds.end(), line_speeds[i].begin(), line_speeds[i].end());
+        ++streamlines.num_lines;
+    }
+    return streamlines;
+}
+
+std::vector<math::vec4f> streamline_colors(const Streamlines &lines,
+                                           const std::vector<float> &colors,
+                                           const math::vec2f &value_range)
+{
+    const size_t n = colors.size() / 3;
+    const float scale =
+        value_range.y > value_range.x ? (n - 1) / (value_range.y - value_range.x) : 0.f;
+    std::vector<math::vec4f> vertex_colors(lines.speeds.size());
+    tbb::parallel_for(size_t(0), lines.speeds.size(), [&](const size_t i) {
+        const float x = (lines.speeds[i] - value_range.x) * scale;
+        const size_t c = size_t(std::min(std::max(x, 0.f), float(n - 1)) + 0.5f);
+        vertex_colors[i] =
+            math::vec4f(colors[c * 3], colors[c * 3 + 1], colors[c * 3 + 2], 1.f);
+    });
+    return vertex_colors;
+}
+
+StreamlineGeometry::StreamlineGeometry(const cpp::Material &material, const float radius)
+    : geometry("curve")
+{
+    geometry.setParam("type", int(OSP_ROUND));
+    geometry.setParam("basis", int(OSP_LINEAR));
+    geometry.setParam("radius", radius);
+    model = cpp::GeometricModel(geometry);
+    model.setParam("material", material);
+    // The model and group are committed once the geometry has lines
+    group.setParam("geometry", cpp::CopiedData(model));
+    instance = cpp::Instance(group);
+}
+
+bool StreamlineGeometry::set_lines(Streamlines &&new_lines,
+                                   std::vector<math::vec4f> &&new_colors,
+                                   std::vector<OSPObject> &pending_commits)
+{
+    const bool was_active = active();
+    lines = std::move(new_lines);
+    colors = std::move(new_colors);
+    if (active()) {
+        geometry.setParam("vertex.position", cpp::SharedData(lines.positions));
+        geometry.setParam("vertex.color", cpp::SharedData(colors));
+        geometry.setParam("index", cpp::SharedData(lines.indices));
+        commit_lines(pending_commits);
+    }
+    return active() != was_active;
+}
+
+void StreamlineGeometry::set_colors(std::vector<math::vec4f> &&new_colors,
+                                    std::vector<OSPObject> &pending_commits)
+{
+    colors = std::move(new_colors);
+    if (active()) {
+        geometry.setParam("vertex.color", cpp::SharedData(colors));
+        commit_lines(pending_commits);
+    }
+}
+
+void StreamlineGeometry::set_radius(const float radius,
+                                    std::vector<OSPObject> &pending_commits)
+{
+    geometry.setParam("radius", radius);
+    if (active()) {
+        commit_lines(pending_commits);
+    }
+}
+
+bool StreamlineGeometry::active() const
+{
+    return !lines.indices.empty();
+}
+
+void StreamlineGeometry::commit_lines(std::vector<OSPObject> &pending_commits)
+{
+    pending_commits.push_back(geometry.handle());
+    pending_commits.push_back(model.handle());
+    pending_commits.push_back(group.handle());
+    pending_commits.push_back(instance.handle());
+}
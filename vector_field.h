@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <ospray/ospray.h>
+#include <ospray/ospray_cpp.h>
+#include <ospray/ospray_cpp/ext/rkcommon.h>
+#include <rkcommon/math/box.h>
+#include <rkcommon/math/vec.h>
+#include "volume_data.h"
+
+using namespace ospray;
+using namespace rkcommon;
+
+// A 3-component vector field on a regular grid, e.g. a velocity volume, loaded from raw
+// volumes with the "vec3f" voxel type (three float32 components per voxel)
+struct VectorField {
+    math::vec3i dims;
+    math::box3f bounds;
+    // The vectors of the voxels in x, y, z order, shared with the loader's voxel buffer
+    std::shared_ptr<std::vector<uint8_t>> data;
+
+    const math::vec3f *vectors() const;
+
+    // The grid spacing in world units per voxel
+    math::vec3f spacing() const;
+};
+
+// Compute the float32 volume of the field's vector magnitudes in parallel, with its own
+// structuredRegular volume over the field's bounds so it can be rendered and classified
+// like any scalar volume
+VolumeBrick compute_magnitude_volume(const VectorField &field);
+
+struct StreamlineParams {
+    // Seeds are placed on a grid of seed_res points spanning the seed box in world space,
+    // or at random_seeds random points in the box if it's non-zero
+    math::box3f seed_box;
+    math::vec3i seed_res = math::vec3i(8);
+    int random_seeds = 0;
+    // The RK4 step length in voxels, and the maximum steps traced in each direction
+    float step = 0.5f;
+    int max_steps = 512;
+    // Lines stop where the field's speed drops below min_speed
+    float min_speed = 1e-6f;
+    // Trace both downstream and upstream of each seed
+    bool both_directions = true;
+};
+
+// Streamlines as the vertices of linear curves: each line's vertices are contiguous in
+// positions and speeds, and indices holds the first vertex of each of the lines' segments
+struct Streamlines {
+    std::vector<math::vec3f> positions;
+    std::vector<float> speeds;
+    std::vector<uint32_t> indices;
+    size_t num_lines = 0;
+};
+
+// Trace a streamline from each seed with 4th order Runge-Kutta integration, tracing the
+// seeds in parallel. Seeds outside the field or in places where it's still are skipped
+Streamlines trace_streamlines(const VectorField &field, const StreamlineParams &params);
+
+// Color each vertex by its speed through the transfer function's linear RGB colors applied
+// over value_range, e.g. the transfer function of the magnitude volume
+std::vector<math::vec4f> streamline_colors(const Streamlines &lines,
+                                           const std::vector<float> &colors,
+                                           const math::vec2f &value_range);
+
+// The streamlines as round linear curves in their own group and instance. The vertex
+// arrays are shared with OSPRay, so they're kept here while the geometry uses them
+struct StreamlineGeometry {
+    Streamlines lines;
+    std::vector<math::vec4f> colors;
+
+    cpp::Instance instance;
+
+    StreamlineGeometry(const cpp::Material &material, const float radius);
+
+    // Replace the lines and their colors, adding the objects to commit to pending_commits.
+    // Returns true if the lines became empty or non-empty, in which case the instance must
+    // be removed from or added to the world
+    bool set_lines(Streamlines &&new_lines,
+                   std::vector<math::vec4f> &&new_colors,
+                   std::vector<OSPObject> &pending_commits);
+
+    // Recolor the lines, e.g. after the transfer function changed
+    void set_colors(std::vector<math::vec4f> &&new_colors,
+                    std::vector<OSPObject> &pending_commits);
+
+    void set_radius(const float radius, std::vector<OSPObject> &pending_commits);
+
+    // Whether there are lines, i.e. the instance should be in the world
+    bool active() const;
+
+private:
+    cpp::Geometry geometry;
+    cpp::GeometricModel model;
+    cpp::Group group;
+
+    // Add the geometry and everything referencing it to pending_commits
+    void commit_lines(std::vector<OSPObject> &pending_commits);
+};
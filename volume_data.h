@@ -1,22 +1,40 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
 #include <ospray/ospray.h>
 #include <ospray/ospray_cpp.h>
 #include <ospray/ospray_cpp/ext/rkcommon.h>
 #include <rkcommon/math/box.h>
 #include <rkcommon/math/vec.h>
+#include "memory_stats.h"
 
 using namespace ospray;
 using namespace rkcommon;
 
+struct GradientVolume;
+struct NormalVolume;
+struct VectorField;
+
 struct VolumeBrick {
     cpp::Volume brick;
     cpp::VolumetricModel model;
     math::box3f bounds;
     math::vec3i dims;
     std::shared_ptr<std::vector<uint8_t>> voxel_data;
+    // The voxel type name from the config (uint8, uint16, float32, float64), empty for
+    // unstructured volumes which don't have voxel_data
+    std::string voxel_type;
+    // Accounts for data copied into OSPRay for the volume, e.g. unstructured mesh arrays,
+    // for as long as the brick is referenced
+    std::shared_ptr<TrackedMemory> ospray_memory;
+    // The gradient magnitude volume, if computed for 2D transfer functions
+    std::shared_ptr<GradientVolume> gradient;
+    // The quantized gradient directions, if computed for shading
+    std::shared_ptr<NormalVolume> normals;
+    // The vector field of vec3f volumes, which are rendered as the volume of its magnitudes
+    std::shared_ptr<VectorField> vectors;
 
     math::vec2f value_range;
 };
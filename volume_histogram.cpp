@@ -0,0 +1,141 @@
+#include "volume_histogram.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <tbb/blocked_range.h>
+#include <tbb/combinable.h>
+#include <tbb/parallel_for.h>
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+template <typename T>
+std::vector<uint32_t> histogram_1d(const VolumeBrick &brick,
+                                   const math::vec2f &value_range,
+                                   const int bins)
+{
+    const T *voxels = reinterpret_cast<const T *>(brick.voxel_data->data());
+    const size_t num_voxels = size_t(brick.dims.x) * brick.dims.y * brick.dims.z;
+    const float value_scale =
+        value_range.y > value_range.x ? bins / (value_range.y - value_range.x) : 0.f;
+
+    tbb::combinable<std::vector<uint32_t>> local_counts(
+        [&]() { return std::vector<uint32_t>(bins, 0); });
+    auto count_voxels = [&](const tbb::blocked_range<size_t> &r) {
+        std::vector<uint32_t> &counts = local_counts.local();
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+            const int v = std::min(
+                std::max(int((voxels[i] - value_range.x) * value_scale), 0), bins - 1);
+            ++counts[v];
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, num_voxels), count_voxels);
+
+    std::vector<uint32_t> counts(bins, 0);
+    local_counts.combine_each([&](const std::vector<uint32_t> &local) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += local[i];
+        }
+    });
+    return counts;
+}
+
+// Describe the data file and histogram parameters the cache is valid for
+json histogram_cache_key(const std::string &data_file,
+                         const VolumeBrick &brick,
+                         const size_t bins)
+{
+    struct stat file_stat;
+    if (stat(data_file.c_str(), &file_stat) != 0) {
+        return json();
+    }
+    json key;
+    key["file_size"] = uint64_t(file_stat.st_size);
+    key["modified"] = int64_t(file_stat.st_mtime);
+    key["voxel_type"] = brick.voxel_type;
+    key["dims"] = {brick.dims.x, brick.dims.y, brick.dims.z};
+    key["value_range"] = {brick.value_range.x, brick.value_range.y};
+    key["bins"] = bins;
+    return key;
+}
+
+}
+
+VolumeHistogram compute_histogram(const VolumeBrick &brick,
+                                  const math::vec2f &value_range,
+                                  const size_t bins)
+{
+    if (!brick.voxel_data) {
+        throw std::runtime_error("Histograms can only be computed for structured volumes");
+    }
+    if (bins == 0) {
+        throw std::runtime_error("Invalid number of histogram bins");
+    }
+    VolumeHistogram histogram;
+    histogram.value_range = value_range;
+    if (brick.voxel_type == "uint8") {
+        histogram.counts = histogram_1d<uint8_t>(brick, value_range, bins);
+    } else if (brick.voxel_type == "uint16") {
+        histogram.counts = histogram_1d<uint16_t>(brick, value_range, bins);
+    } else if (brick.voxel_type == "float32") {
+        histogram.counts = histogram_1d<float>(brick, value_range, bins);
+    } else if (brick.voxel_type == "float64") {
+        histogram.counts = histogram_1d<double>(brick, value_range, bins);
+    } else {
+        throw std::runtime_error("Unrecognized voxel type " + brick.voxel_type);
+    }
+    return histogram;
+}
+
+VolumeHistogram load_cached_histogram(const VolumeBrick &brick,
+                                      const std::string &data_file,
+                                      const size_t bins)
+{
+    const std::string cache_file = data_file + ".histogram.json";
+    const json key = histogram_cache_key(data_file, brick, bins);
+    if (!key.is_null()) {
+        std::ifstream fin(cache_file.c_str());
+        if (fin) {
+            try {
+                const json cache = json::parse(fin);
+                if (cache["key"] == key) {
+                    VolumeHistogram histogram;
+                    histogram.value_range = brick.value_range;
+                    histogram.counts = cache["counts"].get<std::vector<uint32_t>>();
+                    if (histogram.counts.size() == bins) {
+                        std::cout << "Loaded cached histogram " << cache_file << "\n";
+                        return histogram;
+                    }
+                }
+            } catch (const std::exception &e) {
+                std::cout << "Ignoring invalid histogram cache " << cache_file << ": "
+                          << e.what() << "\n";
+            }
+        }
+    }
+
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+    VolumeHistogram histogram = compute_histogram(brick, brick.value_range, bins);
+    const auto end = steady_clock::now();
+    std::cout << "Histogram computed in " << duration_cast<milliseconds>(end - start).count()
+              << "ms\n";
+
+    if (!key.is_null()) {
+        json cache;
+        cache["key"] = key;
+        cache["counts"] = histogram.counts;
+        std::ofstream fout(cache_file.c_str());
+        if (fout << cache.dump()) {
+            std::cout << "Saved histogram cache " << cache_file << "\n";
+        } else {
+            std::cout << "Failed to write histogram cache " << cache_file << "\n";
+        }
+    }
+    return histogram;
+}
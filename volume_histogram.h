@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <rkcommon/math/vec.h>
+#include "volume_data.h"
+
+using namespace rkcommon;
+
+// A histogram of a brick's voxel values, with the bins spanning the value range evenly
+struct VolumeHistogram {
+    math::vec2f value_range;
+    std::vector<uint32_t> counts;
+};
+
+// Compute the histogram of the brick's voxel values over the value range in parallel,
+// values outside the range are counted in the first or last bin
+VolumeHistogram compute_histogram(const VolumeBrick &brick,
+                                  const math::vec2f &value_range,
+                                  const size_t bins);
+
+// Load the histogram over the brick's value range from the cache file next to the volume
+// data file, <data_file>.histogram.json. If there's no cache file or it was made for a
+// different file size, modification time, value range or number of bins the histogram
+// is computed and the cache file written for next time
+VolumeHistogram load_cached_histogram(const VolumeBrick &brick,
+                                      const std::string &data_file,
+                                      const size_t bins);
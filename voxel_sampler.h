@@ -0,0 +1,53 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <rkcommon/math/vec.h>
+
+using namespace rkcommon;
+
+inline uint8_t srgb_encode(const float x)
+{
+    const float c = std::min(std::max(x, 0.f), 1.f);
+    const float s = c <= 0.0031308f ? 12.92f * c : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+    return uint8_t(s * 255.f + 0.5f);
+}
+
+// Trilinearly interpolate the voxels at a position in voxel coordinates, returning the
+// value normalized to [0, 1] over the value range
+template <typename T>
+struct VoxelSampler {
+    const T *voxels = nullptr;
+    math::vec3i dims;
+    float value_lo = 0.f;
+    float value_scale = 1.f;
+
+    float operator()(const math::vec3f &p) const
+    {
+        int i0[3];
+        int i1[3];
+        float t[3];
+        for (int i = 0; i < 3; ++i) {
+            const float x = std::min(std::max(p[i], 0.f), float(dims[i] - 1));
+            i0[i] = int(x);
+            i1[i] = std::min(i0[i] + 1, dims[i] - 1);
+            t[i] = x - i0[i];
+        }
+        auto voxel = [&](const int x, const int y, const int z) {
+            return float(voxels[(size_t(z) * dims.y + y) * dims.x + x]);
+        };
+        const float v00 = (1.f - t[0]) * voxel(i0[0], i0[1], i0[2]) +
+                          t[0] * voxel(i1[0], i0[1], i0[2]);
+        const float v10 = (1.f - t[0]) * voxel(i0[0], i1[1], i0[2]) +
+                          t[0] * voxel(i1[0], i1[1], i0[2]);
+        const float v01 = (1.f - t[0]) * voxel(i0[0], i0[1], i1[2]) +
+                          t[0] * voxel(i1[0], i0[1], i1[2]);
+        const float v11 = (1.f - t[0]) * voxel(i0[0], i1[1], i1[2]) +
+                          t[0] * voxel(i1[0], i1[1], i1[2]);
+        const float v0 = (1.f - t[1]) * v00 + t[1] * v10;
+        const float v1 = (1.f - t[1]) * v01 + t[1] * v11;
+        const float v = (1.f - t[2]) * v0 + t[2] * v1;
+        return std::min(std::max((v - value_lo) * value_scale, 0.f), 1.f);
+    }
+};